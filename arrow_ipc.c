@@ -0,0 +1,856 @@
+/*
+ * Arrow IPC files (also known as Feather v2) of Persons.
+ *
+ * >>> mymodule.write_arrow_file("people.arrow", persons)
+ * >>> cols = mymodule.read_arrow_file("people.arrow")   # PersonColumns, zero-copy
+ * >>> pyarrow.feather.read_table("people.arrow")
+ *
+ * The schema is (first_name: utf8, last_name: utf8, number: int32), without
+ * nulls.  Each partition of a PersonColumns is written as one record batch;
+ * since person_chunk already has Arrow's layout, its arrays are written as
+ * they are.
+ *
+ * read_arrow_file() maps the file and returns a PersonColumns whose arrays
+ * point into the mapping: nothing is copied and the open time does not depend
+ * on the size of the names.  The offsets are checked when the file is opened,
+ * so a corrupt file is rejected rather than read out of bounds.  As with any
+ * mapping, truncating the file while it is in use crashes the process.
+ *
+ * File layout (see the Arrow columnar format specification)
+ *
+ *      "ARROW1" + 2 padding bytes
+ *      message: Schema
+ *      message: RecordBatch + body, for each batch
+ *      Footer flatbuffer | int32 footer size | "ARROW1"
+ *
+ * message: uint32 0xFFFFFFFF | int32 metadata size | Message flatbuffer, padded to 8
+ *
+ * The flatbuffers are written and read by hand below; only the tables and
+ * fields used by this schema are supported.
+ */
+#include <Python.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "person.h"
+#include "person_columns.h"
+#include "probes.h"
+#include "latency.h"
+#include "encoding.h"
+#include "tracked_alloc.h"
+
+#define ARROW_MAGIC "ARROW1"
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+#define ARROW_METADATA_V5 4
+
+// MessageHeader and Type unions
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_UTF8 5
+
+#define ARROW_COLUMNS 3
+#define ARROW_BUFFERS 8         // validity + offsets + data, twice, validity + values
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+/*
+ * FLATBUFFER BUILDER
+ *
+ * Objects are appended in order.  A reference (uoffset) must point forward,
+ * so a table reserves the slots of its references and the referenced objects
+ * are appended later and patched in with fb_patch().  Each table is preceded
+ * by its vtable.  Positions are kept instead of pointers because the buffer
+ * moves as it grows.
+ */
+
+struct fb {
+    char *buf;
+    size_t size;
+    size_t capacity;
+    int failed;
+};
+
+static size_t fb_reserve(struct fb *b, size_t n)
+{
+    if(b->size + n > b->capacity){
+        size_t capacity = b->capacity ? b->capacity : 1024;
+        while(capacity < b->size + n){
+            capacity *= 2;
+        }
+        char *buf = tracked_realloc(b->buf, capacity);
+        if(buf == NULL){
+            b->failed = 1;
+            return 0;
+        }
+        b->buf = buf;
+        b->capacity = capacity;
+    }
+    size_t pos = b->size;
+    memset(b->buf + pos, 0, n);
+    b->size += n;
+    return pos;
+}
+
+static void fb_align(struct fb *b, size_t alignment)
+{
+    if(b->size % alignment != 0){
+        fb_reserve(b, alignment - b->size % alignment);
+    }
+}
+
+static void fb_patch(struct fb *b, size_t slot, size_t target)
+{
+    if(!b->failed){
+        put_u32(b->buf + slot, (uint32_t)(target - slot));
+    }
+}
+
+/*
+ * Append a table whose field i has size sizes[i] (0 if absent), and store the
+ * position of each field in pos[i].
+ */
+static size_t fb_table(struct fb *b, int n, const int *sizes, size_t *pos)
+{
+    size_t offsets[8];
+    size_t inline_size = 4;         // soffset to the vtable
+    for(int i = 0; i < n; i++){
+        offsets[i] = 0;
+        if(sizes[i] > 0){
+            inline_size = (inline_size + (size_t)sizes[i] - 1) / (size_t)sizes[i] * (size_t)sizes[i];
+            offsets[i] = inline_size;
+            inline_size += (size_t)sizes[i];
+        }
+    }
+
+    fb_align(b, 2);
+    size_t vtable = fb_reserve(b, 4 + 2 * (size_t)n);
+    fb_align(b, 8);
+    size_t table = fb_reserve(b, inline_size);
+    if(b->failed){
+        return 0;
+    }
+    put_u16(b->buf + vtable, (uint16_t)(4 + 2 * n));
+    put_u16(b->buf + vtable + 2, (uint16_t)inline_size);
+    for(int i = 0; i < n; i++){
+        put_u16(b->buf + vtable + 4 + 2 * i, (uint16_t)offsets[i]);
+        pos[i] = table + offsets[i];
+    }
+    put_u32(b->buf + table, (uint32_t)(table - vtable));
+    return table;
+}
+
+static size_t fb_string(struct fb *b, const char *s)
+{
+    size_t len = strlen(s);
+    fb_align(b, 4);
+    size_t pos = fb_reserve(b, 4 + len + 1);
+    if(!b->failed){
+        put_u32(b->buf + pos, (uint32_t)len);
+        memcpy(b->buf + pos + 4, s, len);
+    }
+    return pos;
+}
+
+// Append a vector of n elements aligned to `alignment`; returns the position
+// of its length, the elements follow.
+static size_t fb_vector(struct fb *b, size_t n, size_t elem_size, size_t alignment)
+{
+    fb_align(b, 4);
+    while((b->size + 4) % alignment != 0){
+        fb_reserve(b, 4);
+    }
+    size_t pos = fb_reserve(b, 4 + n * elem_size);
+    if(!b->failed){
+        put_u32(b->buf + pos, (uint32_t)n);
+    }
+    return pos;
+}
+
+static void fb_empty_table(struct fb *b, size_t slot)
+{
+    size_t pos[1];
+    fb_patch(b, slot, fb_table(b, 0, NULL, pos));
+}
+
+static void fb_field(struct fb *b, size_t slot, const char *name, int type)
+{
+    // name, nullable, type_type, type, dictionary, children
+    static const int sizes[] = {4, 1, 1, 4, 0, 4};
+    size_t pos[6];
+    size_t table = fb_table(b, 6, sizes, pos);
+    if(b->failed){
+        return;
+    }
+    fb_patch(b, slot, table);
+    b->buf[pos[1]] = 0;
+    b->buf[pos[2]] = (char)type;
+    fb_patch(b, pos[0], fb_string(b, name));
+    if(type == ARROW_TYPE_INT){
+        // bitWidth, is_signed
+        static const int int_sizes[] = {4, 1};
+        size_t int_pos[2];
+        size_t int_table = fb_table(b, 2, int_sizes, int_pos);
+        if(!b->failed){
+            put_u32(b->buf + int_pos[0], 32);
+            b->buf[int_pos[1]] = 1;
+        }
+        fb_patch(b, pos[3], int_table);
+    } else {
+        fb_empty_table(b, pos[3]);
+    }
+    fb_patch(b, pos[5], fb_vector(b, 0, 4, 4));
+}
+
+static void fb_schema(struct fb *b, size_t slot)
+{
+    // endianness (Little, the default), fields
+    static const int sizes[] = {0, 4};
+    size_t pos[2];
+    size_t table = fb_table(b, 2, sizes, pos);
+    if(b->failed){
+        return;
+    }
+    fb_patch(b, slot, table);
+    size_t fields = fb_vector(b, ARROW_COLUMNS, 4, 4);
+    fb_patch(b, pos[1], fields);
+    fb_field(b, fields + 4, "first_name", ARROW_TYPE_UTF8);
+    fb_field(b, fields + 8, "last_name", ARROW_TYPE_UTF8);
+    fb_field(b, fields + 12, "number", ARROW_TYPE_INT);
+}
+
+// Message { version, header_type, header, bodyLength }, returns the header slot.
+static size_t fb_message(struct fb *b, int header_type, uint64_t body_length)
+{
+    static const int sizes[] = {2, 1, 4, 8};
+    size_t pos[4];
+    size_t root = fb_reserve(b, 4);
+    size_t table = fb_table(b, 4, sizes, pos);
+    if(b->failed){
+        return 0;
+    }
+    fb_patch(b, root, table);
+    put_u16(b->buf + pos[0], ARROW_METADATA_V5);
+    b->buf[pos[1]] = (char)header_type;
+    put_u64(b->buf + pos[3], body_length);
+    return pos[2];
+}
+
+/*
+ * WRITER
+ */
+
+struct arrow_block {
+    uint64_t offset;
+    uint32_t metadata_length;
+    uint64_t body_length;
+};
+
+struct arrow_buffer {
+    const void *data;
+    uint64_t offset;            // in the body
+    uint64_t length;
+};
+
+static int write_padded(FILE *f, const void *data, size_t size)
+{
+    static const char zeros[8] = {0};
+    size_t pad = align8(size) - size;
+    return (size == 0 || fwrite(data, size, 1, f) == 1) && (pad == 0 || fwrite(zeros, pad, 1, f) == 1) ? 0 : -1;
+}
+
+// Write an encapsulated message, return its metadata length or 0 on error.
+static uint32_t write_message(FILE *f, struct fb *b)
+{
+    if(b->failed){
+        errno = ENOMEM;
+        return 0;
+    }
+    char prefix[8];
+    put_u32(prefix, ARROW_CONTINUATION);
+    put_u32(prefix + 4, (uint32_t)align8(b->size));
+    if(fwrite(prefix, sizeof(prefix), 1, f) != 1 || write_padded(f, b->buf, b->size) < 0){
+        return 0;
+    }
+    return (uint32_t)(sizeof(prefix) + align8(b->size));
+}
+
+static void chunk_buffers(const struct person_chunk *c, struct arrow_buffer *buffers, uint64_t *body_length)
+{
+    Py_ssize_t n = c->n;
+    const struct arrow_buffer layout[ARROW_BUFFERS] = {
+        {NULL, 0, 0},
+        {c->first_offsets, 0, (uint64_t)(n + 1) * 4},
+        {c->first_data, 0, (uint64_t)c->first_offsets[n]},
+        {NULL, 0, 0},
+        {c->last_offsets, 0, (uint64_t)(n + 1) * 4},
+        {c->last_data, 0, (uint64_t)c->last_offsets[n]},
+        {NULL, 0, 0},
+        {c->number, 0, (uint64_t)n * 4},
+    };
+    uint64_t offset = 0;
+    for(int i = 0; i < ARROW_BUFFERS; i++){
+        buffers[i] = layout[i];
+        buffers[i].offset = offset;
+        offset += align8(buffers[i].length);
+    }
+    *body_length = offset;
+}
+
+static int write_record_batch(FILE *f, const struct person_chunk *c, struct arrow_block *block)
+{
+    struct arrow_buffer buffers[ARROW_BUFFERS];
+    uint64_t body_length;
+    chunk_buffers(c, buffers, &body_length);
+
+    struct fb b = {0};
+    size_t header = fb_message(&b, ARROW_HEADER_RECORD_BATCH, body_length);
+    // length, nodes, buffers
+    static const int sizes[] = {8, 4, 4};
+    size_t pos[3];
+    size_t table = fb_table(&b, 3, sizes, pos);
+    size_t nodes = fb_vector(&b, ARROW_COLUMNS, 16, 8);
+    size_t bufs = fb_vector(&b, ARROW_BUFFERS, 16, 8);
+    if(!b.failed){
+        fb_patch(&b, header, table);
+        put_u64(b.buf + pos[0], (uint64_t)c->n);
+        fb_patch(&b, pos[1], nodes);
+        fb_patch(&b, pos[2], bufs);
+        for(int i = 0; i < ARROW_COLUMNS; i++){
+            put_u64(b.buf + nodes + 4 + 16 * i, (uint64_t)c->n);      // length
+            put_u64(b.buf + nodes + 4 + 16 * i + 8, 0);               // null_count
+        }
+        for(int i = 0; i < ARROW_BUFFERS; i++){
+            put_u64(b.buf + bufs + 4 + 16 * i, buffers[i].offset);
+            put_u64(b.buf + bufs + 4 + 16 * i + 8, buffers[i].length);
+        }
+    }
+
+    block->metadata_length = write_message(f, &b);
+    tracked_free(b.buf);
+    if(block->metadata_length == 0){
+        return -1;
+    }
+    block->body_length = body_length;
+    for(int i = 0; i < ARROW_BUFFERS; i++){
+        if(write_padded(f, buffers[i].data, (size_t)buffers[i].length) < 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int write_footer(FILE *f, const struct arrow_block *blocks, int n_blocks)
+{
+    struct fb b = {0};
+    // version, schema, dictionaries, recordBatches
+    static const int sizes[] = {2, 4, 4, 4};
+    size_t pos[4];
+    size_t root = fb_reserve(&b, 4);
+    size_t table = fb_table(&b, 4, sizes, pos);
+    if(!b.failed){
+        fb_patch(&b, root, table);
+        put_u16(b.buf + pos[0], ARROW_METADATA_V5);
+        fb_schema(&b, pos[1]);
+        fb_patch(&b, pos[2], fb_vector(&b, 0, 24, 8));
+        size_t batches = fb_vector(&b, (size_t)n_blocks, 24, 8);
+        fb_patch(&b, pos[3], batches);
+        for(int i = 0; !b.failed && i < n_blocks; i++){
+            char *e = b.buf + batches + 4 + 24 * (size_t)i;
+            put_u64(e, blocks[i].offset);
+            put_u32(e + 8, blocks[i].metadata_length);
+            put_u64(e + 16, blocks[i].body_length);
+        }
+    }
+    if(b.failed){
+        tracked_free(b.buf);
+        errno = ENOMEM;
+        return -1;
+    }
+    char trailer[10];
+    put_u32(trailer, (uint32_t)b.size);
+    memcpy(trailer + 4, ARROW_MAGIC, 6);
+    int rc = fwrite(b.buf, b.size, 1, f) == 1 && fwrite(trailer, sizeof(trailer), 1, f) == 1 ? 0 : -1;
+    tracked_free(b.buf);
+    return rc;
+}
+
+// Does not touch Python state.
+static int write_arrow(const char *path, const struct PersonColumns *columns)
+{
+    struct arrow_block *blocks = tracked_malloc(((size_t)columns->n_chunks + 1) * sizeof(struct arrow_block));
+    if(blocks == NULL){
+        errno = ENOMEM;
+        return -1;
+    }
+    FILE *f = fopen(path, "wb");
+    if(f == NULL){
+        tracked_free(blocks);
+        return -1;
+    }
+
+    char header[8] = ARROW_MAGIC;
+    struct fb schema = {0};
+    fb_schema(&schema, fb_message(&schema, ARROW_HEADER_SCHEMA, 0));
+    uint32_t schema_length = fwrite(header, sizeof(header), 1, f) == 1 ? write_message(f, &schema) : 0;
+    tracked_free(schema.buf);
+    int rc = schema_length == 0 ? -1 : 0;
+
+    uint64_t offset = sizeof(header) + schema_length;
+    for(int i = 0; rc == 0 && i < columns->n_chunks; i++){
+        blocks[i].offset = offset;
+        rc = write_record_batch(f, &columns->chunks[i], &blocks[i]);
+        offset += blocks[i].metadata_length + blocks[i].body_length;
+    }
+    if(rc == 0){
+        rc = write_footer(f, blocks, columns->n_chunks);
+    }
+    int saved = errno;
+    if(fclose(f) != 0 && rc == 0){
+        saved = errno;
+        rc = -1;
+    }
+    tracked_free(blocks);
+    errno = saved;
+    return rc;
+}
+
+static PyObject *write_arrow_file(PyObject *module, PyObject *args)
+{
+    PyObject *path, *persons;
+    if(!PyArg_ParseTuple(args, "O&O:write_arrow_file", PyUnicode_FSConverter, &path, &persons)){
+        return NULL;
+    }
+    PROBE3(bulk_entry, "write_arrow_file", persons,
+           PersonColumns_Check(persons) ? (long)((struct PersonColumns *)persons)->n : -1L);
+    uint64_t started = latency_start();
+    PyObject *columns;
+    if(PersonColumns_Check(persons)){
+        Py_INCREF(persons);
+        columns = persons;
+    } else {
+        columns = PyObject_CallFunction((PyObject *)&PersonColumnsType, "Oi", persons, 1);
+        if(columns == NULL){
+            Py_DECREF(path);
+            PROBE3(bulk_return, "write_arrow_file", persons, -1L);
+            LATENCY_END(LAT_WRITE_ARROW_FILE, started);
+            return NULL;
+        }
+    }
+
+    int rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = write_arrow(PyBytes_AS_STRING(path), (struct PersonColumns *)columns);
+    Py_END_ALLOW_THREADS
+    Py_ssize_t n = ((struct PersonColumns *)columns)->n;
+    Py_DECREF(columns);
+    PROBE3(bulk_return, "write_arrow_file", persons, rc < 0 ? -1L : (long)n);
+    LATENCY_END(LAT_WRITE_ARROW_FILE, started);
+    if(rc < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        unlink(PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+    return PyLong_FromSsize_t(n);
+}
+
+/*
+ * FLATBUFFER READER
+ *
+ * Every access is bounds checked against the flatbuffer.  Functions return -1
+ * on malformed input.
+ */
+
+struct fbr {
+    const char *buf;
+    size_t size;
+};
+
+static int fbr_deref(const struct fbr *r, size_t slot, size_t *target)
+{
+    if(slot + 4 > r->size){
+        return -1;
+    }
+    uint64_t t = (uint64_t)slot + get_u32(r->buf + slot);
+    if(t >= r->size){
+        return -1;
+    }
+    *target = (size_t)t;
+    return 0;
+}
+
+// Position of field `id` of `table` in *pos, or 0 if the field is absent.
+static int fbr_field(const struct fbr *r, size_t table, int id, size_t field_size, size_t *pos)
+{
+    if(table + 4 > r->size){
+        return -1;
+    }
+    int64_t vtable = (int64_t)table - (int32_t)get_u32(r->buf + table);
+    if(vtable < 0 || (uint64_t)vtable + 4 > r->size){
+        return -1;
+    }
+    uint16_t vtable_size = get_u16(r->buf + vtable);
+    uint16_t table_size = get_u16(r->buf + vtable + 2);
+    if((uint64_t)vtable + vtable_size > r->size || table + table_size > r->size){
+        return -1;
+    }
+    *pos = 0;
+    if(4 + 2 * (size_t)id + 2 > vtable_size){
+        return 0;
+    }
+    uint16_t offset = get_u16(r->buf + vtable + 4 + 2 * id);
+    if(offset == 0){
+        return 0;
+    }
+    if(offset + field_size > table_size){
+        return -1;
+    }
+    *pos = table + offset;
+    return 0;
+}
+
+static int fbr_u8(const struct fbr *r, size_t table, int id, unsigned *value, unsigned def)
+{
+    size_t pos;
+    if(fbr_field(r, table, id, 1, &pos) < 0){
+        return -1;
+    }
+    *value = pos ? (unsigned char)r->buf[pos] : def;
+    return 0;
+}
+
+static int fbr_u32(const struct fbr *r, size_t table, int id, uint32_t *value, uint32_t def)
+{
+    size_t pos;
+    if(fbr_field(r, table, id, 4, &pos) < 0){
+        return -1;
+    }
+    *value = pos ? get_u32(r->buf + pos) : def;
+    return 0;
+}
+
+static int fbr_u64(const struct fbr *r, size_t table, int id, uint64_t *value, uint64_t def)
+{
+    size_t pos;
+    if(fbr_field(r, table, id, 8, &pos) < 0){
+        return -1;
+    }
+    *value = pos ? get_u64(r->buf + pos) : def;
+    return 0;
+}
+
+// Referenced table or vector of field `id`, 0 if absent.
+static int fbr_ref(const struct fbr *r, size_t table, int id, size_t *target)
+{
+    size_t pos;
+    if(fbr_field(r, table, id, 4, &pos) < 0){
+        return -1;
+    }
+    *target = 0;
+    return pos ? fbr_deref(r, pos, target) : 0;
+}
+
+// Number of elements of a vector and position of the first one.
+static int fbr_vector(const struct fbr *r, size_t vector, size_t elem_size, size_t *n, size_t *first)
+{
+    if(vector == 0 || vector + 4 > r->size){
+        return -1;
+    }
+    *n = get_u32(r->buf + vector);
+    *first = vector + 4;
+    return *n <= (r->size - *first) / elem_size ? 0 : -1;
+}
+
+/*
+ * READER
+ */
+
+static int check_schema(const struct fbr *r, size_t schema)
+{
+    static const int types[ARROW_COLUMNS] = {ARROW_TYPE_UTF8, ARROW_TYPE_UTF8, ARROW_TYPE_INT};
+    size_t fields, n, first;
+    if(fbr_ref(r, schema, 1, &fields) < 0 || fbr_vector(r, fields, 4, &n, &first) < 0 || n != ARROW_COLUMNS){
+        return -1;
+    }
+    for(size_t i = 0; i < n; i++){
+        size_t field, type, dictionary;
+        unsigned type_type;
+        if(fbr_deref(r, first + 4 * i, &field) < 0 || fbr_u8(r, field, 2, &type_type, 0) < 0
+                || fbr_ref(r, field, 3, &type) < 0 || fbr_ref(r, field, 4, &dictionary) < 0
+                || type_type != (unsigned)types[i] || dictionary != 0){
+            return -1;
+        }
+        if(type_type == ARROW_TYPE_INT){
+            uint32_t bit_width;
+            unsigned is_signed;
+            if(type == 0 || fbr_u32(r, type, 0, &bit_width, 0) < 0 || fbr_u8(r, type, 1, &is_signed, 0) < 0
+                    || bit_width != 32 || !is_signed){
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Point a buffer of a record batch into the mapping.
+static int batch_buffer(const char *body, uint64_t body_length, const char *bufs, int i,
+                        uint64_t min_length, size_t alignment, const char **data, uint64_t *length)
+{
+    uint64_t offset = get_u64(bufs + 16 * (size_t)i);
+    *length = get_u64(bufs + 16 * (size_t)i + 8);
+    if(offset > body_length || *length > body_length - offset || *length < min_length
+            || (uintptr_t)(body + offset) % alignment != 0){
+        return -1;
+    }
+    *data = body + offset;
+    return 0;
+}
+
+static const int32_t empty_offsets[1] = {0};
+
+// Check the offsets of a utf8 column and set up the chunk's arrays.
+static int batch_utf8(const char *body, uint64_t body_length, const char *bufs, int first_buffer,
+                      Py_ssize_t n, const int32_t **offsets_out, const char **data_out)
+{
+    const char *offsets, *data;
+    uint64_t offsets_length, data_length;
+    if(batch_buffer(body, body_length, bufs, first_buffer + 1, n > 0 ? (uint64_t)(n + 1) * 4 : 0, 4,
+                    &offsets, &offsets_length) < 0
+            || batch_buffer(body, body_length, bufs, first_buffer + 2, 0, 1, &data, &data_length) < 0){
+        return -1;
+    }
+    if(n == 0){
+        // An empty array may have no offsets at all.
+        *offsets_out = empty_offsets;
+        *data_out = data;
+        return 0;
+    }
+    const int32_t *o = (const int32_t *)offsets;
+    if(o[0] < 0){
+        return -1;
+    }
+    for(Py_ssize_t i = 0; i < n; i++){
+        if(o[i + 1] < o[i]){
+            return -1;
+        }
+    }
+    if((uint64_t)o[n] > data_length){
+        return -1;
+    }
+    *offsets_out = o;
+    *data_out = data;
+    return 0;
+}
+
+static int read_record_batch(const char *map, size_t size, uint64_t offset, uint32_t metadata_length,
+                             uint64_t body_length, struct person_chunk *chunk)
+{
+    if(offset > size || metadata_length < 8 || metadata_length > size - offset
+            || body_length > size - offset - metadata_length){
+        return -1;
+    }
+    const char *m = map + offset;
+    size_t fb_start = 8, fb_size = get_u32(m + 4);
+    if(get_u32(m) != ARROW_CONTINUATION){
+        // Files written before the continuation marker existed
+        fb_start = 4;
+        fb_size = get_u32(m);
+    }
+    if(fb_size > metadata_length - fb_start){
+        return -1;
+    }
+    struct fbr r = {m + fb_start, fb_size};
+
+    size_t message, header, compression, nodes, bufs, n_nodes, n_bufs, first_node, first_buf;
+    unsigned header_type;
+    uint64_t length;
+    if(fbr_deref(&r, 0, &message) < 0 || fbr_u8(&r, message, 1, &header_type, 0) < 0
+            || header_type != ARROW_HEADER_RECORD_BATCH || fbr_ref(&r, message, 2, &header) < 0 || header == 0
+            || fbr_u64(&r, header, 0, &length, 0) < 0 || length > INT32_MAX
+            || fbr_ref(&r, header, 3, &compression) < 0 || compression != 0
+            || fbr_ref(&r, header, 1, &nodes) < 0 || fbr_vector(&r, nodes, 16, &n_nodes, &first_node) < 0
+            || fbr_ref(&r, header, 2, &bufs) < 0 || fbr_vector(&r, bufs, 16, &n_bufs, &first_buf) < 0
+            || n_nodes != ARROW_COLUMNS || n_bufs != ARROW_BUFFERS){
+        return -1;
+    }
+    for(int i = 0; i < ARROW_COLUMNS; i++){
+        const char *node = r.buf + first_node + 16 * i;
+        if(get_u64(node) != length || get_u64(node + 8) != 0){
+            return -1;      // nulls are not supported
+        }
+    }
+
+    Py_ssize_t n = (Py_ssize_t)length;
+    const char *body = m + metadata_length;
+    const char *b = r.buf + first_buf;
+    const int32_t *first_offsets, *last_offsets;
+    const char *first_data, *last_data, *number;
+    uint64_t number_length;
+    if(batch_utf8(body, body_length, b, 0, n, &first_offsets, &first_data) < 0
+            || batch_utf8(body, body_length, b, 3, n, &last_offsets, &last_data) < 0
+            || batch_buffer(body, body_length, b, 7, (uint64_t)n * 4, 4, &number, &number_length) < 0){
+        return -1;
+    }
+
+    // Borrowed: the casts are safe because borrowed arrays are never written.
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->n = n;
+    chunk->number = (int32_t *)number;
+    chunk->first_offsets = (int32_t *)first_offsets;
+    chunk->first_data = (char *)first_data;
+    chunk->last_offsets = (int32_t *)last_offsets;
+    chunk->last_data = (char *)last_data;
+    return 0;
+}
+
+struct arrow_mapping {
+    void *map;
+    size_t size;
+};
+
+static void arrow_mapping_destructor(PyObject *capsule)
+{
+    struct arrow_mapping *m = PyCapsule_GetPointer(capsule, "mymodule.arrow_mapping");
+    if(m != NULL){
+        munmap(m->map, m->size);
+        tracked_free(m);
+    }
+}
+
+static PyObject *read_arrow_file_impl(PyObject *module, PyObject *args)
+{
+    PyObject *path;
+    if(!PyArg_ParseTuple(args, "O&:read_arrow_file", PyUnicode_FSConverter, &path)){
+        return NULL;
+    }
+
+    int fd = open(PyBytes_AS_STRING(path), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        if(fd >= 0){
+            close(fd);
+        }
+        Py_DECREF(path);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    if(size < 8 + 10){
+        close(fd);
+        PyErr_Format(PyExc_ValueError, "%s is not an Arrow IPC file", PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        return NULL;
+    }
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    // The capsule owns the mapping from now on.
+    struct arrow_mapping *mapping = tracked_malloc(sizeof(*mapping));
+    PyObject *owner = mapping ? PyCapsule_New(mapping, "mymodule.arrow_mapping", arrow_mapping_destructor) : NULL;
+    if(owner == NULL){
+        tracked_free(mapping);
+        munmap(map, size);
+        Py_DECREF(path);
+        return PyErr_Occurred() ? NULL : PyErr_NoMemory();
+    }
+    mapping->map = map;
+    mapping->size = size;
+
+    PyObject *result = NULL;
+    struct person_chunk *chunks = NULL;
+    uint32_t footer_size = get_u32(map + size - 10);
+    if(memcmp(map, ARROW_MAGIC, 6) != 0 || memcmp(map + size - 6, ARROW_MAGIC, 6) != 0
+            || footer_size > size - 8 - 10){
+        goto corrupt;
+    }
+    struct fbr r = {map + size - 10 - footer_size, footer_size};
+    size_t footer, schema, batches, n_batches, first_batch;
+    if(fbr_deref(&r, 0, &footer) < 0 || fbr_ref(&r, footer, 1, &schema) < 0 || schema == 0
+            || check_schema(&r, schema) < 0
+            || fbr_ref(&r, footer, 3, &batches) < 0 || fbr_vector(&r, batches, 24, &n_batches, &first_batch) < 0
+            || n_batches > INT_MAX){
+        goto corrupt;
+    }
+
+    int n_chunks = n_batches > 0 ? (int)n_batches : 1;
+    chunks = tracked_calloc((size_t)n_chunks, sizeof(struct person_chunk));
+    if(chunks == NULL){
+        PyErr_NoMemory();
+        goto done;
+    }
+    int rc = 0;
+    Py_BEGIN_ALLOW_THREADS
+    for(size_t i = 0; rc == 0 && i < n_batches; i++){
+        const char *e = r.buf + first_batch + 24 * i;
+        rc = read_record_batch(map, size, get_u64(e), get_u32(e + 8), get_u64(e + 16), &chunks[i]);
+    }
+    Py_END_ALLOW_THREADS
+    if(rc < 0){
+        goto corrupt;
+    }
+    if(n_batches == 0){
+        chunks[0].first_offsets = chunks[0].last_offsets = (int32_t *)empty_offsets;
+    }
+    result = PersonColumns_FromBorrowedChunks(chunks, n_chunks, owner);
+    chunks = NULL;
+    goto done;
+
+corrupt:
+    PyErr_Format(PyExc_ValueError, "%s is not an Arrow IPC file of Persons "
+                 "(utf8, utf8, int32 columns without nulls or compression)", PyBytes_AS_STRING(path));
+done:
+    tracked_free(chunks);
+    Py_DECREF(owner);
+    Py_DECREF(path);
+    return result;
+}
+
+static PyObject *read_arrow_file(PyObject *module, PyObject *args)
+{
+    PROBE3(bulk_entry, "read_arrow_file", args, -1L);
+    uint64_t started = latency_start();
+    PyObject *result = read_arrow_file_impl(module, args);
+    PROBE3(bulk_return, "read_arrow_file", args,
+           result == NULL ? -1L : (long)((struct PersonColumns *)result)->n);
+    LATENCY_END(LAT_READ_ARROW_FILE, started);
+    return result;
+}
+
+static PyMethodDef arrow_ipc_functions[] = {
+    {
+        .ml_name = "write_arrow_file",
+        .ml_meth = (PyCFunction)write_arrow_file,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "write_arrow_file(path, persons)\n\n"
+                  "Write a PersonColumns, or an iterable of Persons, as an Arrow IPC (Feather v2) file "
+                  "with one record batch per partition. Return the number of rows.",
+    },
+    {
+        .ml_name = "read_arrow_file",
+        .ml_meth = (PyCFunction)read_arrow_file,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "read_arrow_file(path)\n\n"
+                  "Map an Arrow IPC file of Persons and return a PersonColumns that reads it in place.",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int arrow_ipc_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, arrow_ipc_functions);
+}
@@ -0,0 +1,444 @@
+/*
+ * C benchmarks of Person, without the Python interpreter loop.
+ *
+ *      ./bench_embed [iterations per sample] [samples]
+ *
+ * The executable embeds CPython with mymodule linked in (registered with
+ * PyImport_AppendInittab() before Py_Initialize()), and times Person
+ * operations through the C API in tight loops.  Each operation is run for a
+ * warmup sample and then `samples` samples of `iterations` calls, each timed
+ * with clock_gettime(CLOCK_MONOTONIC).  The report gives ns/op as the mean
+ * over the samples with its 95% confidence interval, the median and the
+ * minimum.
+ *
+ * tp_new, tp_init and tp_str are also called directly so that the cost of
+ * Person_new, Person_init and Person_str can be told apart from the generic
+ * type call machinery: "vectorcall" is roughly "new + dealloc" plus "init"
+ * plus that machinery.
+ *
+ * On Linux, hardware counters are read with perf_event_open() over the timed
+ * samples of each operation and reported per call in a second table: cycles,
+ * instructions, L1d, LLC and dTLB read misses and branch misses, counted in
+ * user space only.  A counter that cannot be opened (perf_event_paranoid > 2,
+ * containers, virtual machines without a PMU) is shown as "-", and the table
+ * is omitted when none can.  Counters multiplexed by the kernel are scaled by
+ * their enabled/running time.
+ */
+#include <Python.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+PyMODINIT_FUNC PyInit_mymodule(void);
+
+struct bench {
+    PyTypeObject *type;
+    PyObject *person;               // Person("Ada", "Lovelace", 1815)
+    PyObject *args[3];              // "Ada", "Lovelace", 1815
+    PyObject *args_tuple;
+    PyObject *empty_tuple;
+    PyObject *kwnames;              // ("first_name", "last_name", "number")
+    PyObject *name_str;             // "name"
+    PyObject *number_str;           // "number"
+};
+
+typedef int (*bench_func)(struct bench *b, long iterations);
+
+static int bench_new(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        PyObject *p = b->type->tp_new(b->type, b->empty_tuple, NULL);
+        if(p == NULL){
+            return -1;
+        }
+        Py_DECREF(p);
+    }
+    return 0;
+}
+
+static int bench_init(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        if(b->type->tp_init(b->person, b->args_tuple, NULL) < 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int bench_vectorcall(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        PyObject *p = PyObject_Vectorcall((PyObject *)b->type, b->args, 3, NULL);
+        if(p == NULL){
+            return -1;
+        }
+        Py_DECREF(p);
+    }
+    return 0;
+}
+
+static int bench_vectorcall_keywords(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        PyObject *p = PyObject_Vectorcall((PyObject *)b->type, b->args, 0, b->kwnames);
+        if(p == NULL){
+            return -1;
+        }
+        Py_DECREF(p);
+    }
+    return 0;
+}
+
+static int bench_tp_str(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        PyObject *s = b->type->tp_str(b->person);
+        if(s == NULL){
+            return -1;
+        }
+        Py_DECREF(s);
+    }
+    return 0;
+}
+
+static int bench_str(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        PyObject *s = PyObject_Str(b->person);
+        if(s == NULL){
+            return -1;
+        }
+        Py_DECREF(s);
+    }
+    return 0;
+}
+
+static int bench_name(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        PyObject *s = PyObject_VectorcallMethod(b->name_str, &b->person, 1 | PY_VECTORCALL_ARGUMENTS_OFFSET, NULL);
+        if(s == NULL){
+            return -1;
+        }
+        Py_DECREF(s);
+    }
+    return 0;
+}
+
+static int bench_getattr(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        PyObject *n = PyObject_GetAttr(b->person, b->number_str);
+        if(n == NULL){
+            return -1;
+        }
+        Py_DECREF(n);
+    }
+    return 0;
+}
+
+static int bench_setattr(struct bench *b, long iterations)
+{
+    for(long i = 0; i < iterations; i++){
+        if(PyObject_SetAttr(b->person, b->number_str, b->args[2]) < 0){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    bench_func fn;
+} benchmarks[] = {
+    {"new + dealloc (tp_new)", bench_new},
+    {"init (tp_init)", bench_init},
+    {"vectorcall positional", bench_vectorcall},
+    {"vectorcall keywords", bench_vectorcall_keywords},
+    {"str (tp_str)", bench_tp_str},
+    {"PyObject_Str", bench_str},
+    {"name() (VectorcallMethod)", bench_name},
+    {"getattr number", bench_getattr},
+    {"setattr number", bench_setattr},
+};
+
+/*
+ * HARDWARE COUNTERS
+ */
+
+#define HW_CACHE(cache, result) \
+    ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 | (result) << 16)
+
+static struct counter {
+    const char *name;
+    unsigned type;
+    unsigned long long config;
+    int fd;
+} counters[] = {
+#ifdef __linux__
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+    {"instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+    {"L1d-miss", PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+    {"LLC-miss", PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+    {"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1},
+    {"dTLB-miss", PERF_TYPE_HW_CACHE, HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+#endif
+};
+
+#define N_COUNTERS ((int)(sizeof(counters) / sizeof(counters[0])))
+
+// Open the counters of the calling thread.  Returns how many could be opened
+// and sets `error` to the errno of the last failure.
+static int counters_open(int *error)
+{
+    int opened = 0;
+    *error = 0;
+#ifdef __linux__
+    for(int i = 0; i < N_COUNTERS; i++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counters[i].type;
+        attr.config = counters[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters[i].fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if(counters[i].fd < 0){
+            *error = errno;
+        } else {
+            opened++;
+        }
+    }
+#endif
+    return opened;
+}
+
+static void counters_close(void)
+{
+#ifdef __linux__
+    for(int i = 0; i < N_COUNTERS; i++){
+        if(counters[i].fd >= 0){
+            close(counters[i].fd);
+        }
+    }
+#endif
+}
+
+static void counters_start(void)
+{
+#ifdef __linux__
+    for(int i = 0; i < N_COUNTERS; i++){
+        if(counters[i].fd >= 0){
+            ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+// Stop the counters and store their values divided by `calls`, NAN for the
+// counters that are not available or did not run.
+static void counters_stop(double *values, double calls)
+{
+    for(int i = 0; i < N_COUNTERS; i++){
+        values[i] = NAN;
+#ifdef __linux__
+        unsigned long long data[3];     // value, time enabled, time running
+        if(counters[i].fd >= 0){
+            ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+            if(read(counters[i].fd, data, sizeof(data)) == sizeof(data) && data[2] > 0){
+                values[i] = (double)data[0] * ((double)data[1] / (double)data[2]) / calls;
+            }
+        }
+#endif
+    }
+}
+
+static void print_counters(const char *name, const double *values)
+{
+    printf("%-28s", name);
+    for(int i = 0; i < N_COUNTERS; i++){
+        if(isnan(values[i])){
+            printf(" %9s", "-");
+        } else {
+            printf(" %9.2f", values[i]);
+        }
+    }
+    // Instructions per cycle.
+    if(N_COUNTERS >= 2 && !isnan(values[0]) && !isnan(values[1]) && values[0] > 0){
+        printf(" %9.2f", values[1] / values[0]);
+    } else {
+        printf(" %9s", "-");
+    }
+    printf("\n");
+}
+
+/*
+ * STATISTICS
+ */
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Two-sided 97.5% quantile of Student's t distribution.
+static double t_quantile(int df)
+{
+    static const double table[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if(df < (int)(sizeof(table) / sizeof(table[0]))){
+        return table[df];
+    }
+    return df < 60 ? 2.000 : df < 120 ? 1.980 : 1.960;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run(const char *name, bench_func fn, struct bench *b, long iterations, int samples, double *ns,
+               double *hw)
+{
+    // Warmup: caches, allocator free lists, method cache.
+    if(fn(b, iterations) < 0){
+        return -1;
+    }
+    counters_start();
+    for(int s = 0; s < samples; s++){
+        double t0 = now_ns();
+        if(fn(b, iterations) < 0){
+            counters_stop(hw, 1);
+            return -1;
+        }
+        ns[s] = (now_ns() - t0) / (double)iterations;
+    }
+    counters_stop(hw, (double)iterations * samples);
+
+    double mean = 0, var = 0;
+    for(int s = 0; s < samples; s++){
+        mean += ns[s];
+    }
+    mean /= samples;
+    for(int s = 0; s < samples; s++){
+        var += (ns[s] - mean) * (ns[s] - mean);
+    }
+    double ci = samples > 1 ? t_quantile(samples - 1) * sqrt(var / (samples - 1)) / sqrt(samples) : 0;
+    qsort(ns, (size_t)samples, sizeof(double), compare_double);
+    double median = samples % 2 ? ns[samples / 2] : (ns[samples / 2 - 1] + ns[samples / 2]) / 2;
+    printf("%-28s %9.2f ± %6.2f %9.2f %9.2f\n", name, mean, ci, median, ns[0]);
+    return 0;
+}
+
+static int setup(struct bench *b)
+{
+    PyObject *module = PyImport_ImportModule("mymodule");
+    if(module == NULL){
+        return -1;
+    }
+    b->type = (PyTypeObject *)PyObject_GetAttrString(module, "Person");
+    Py_DECREF(module);
+    if(b->type == NULL){
+        return -1;
+    }
+    b->args[0] = PyUnicode_FromString("Ada");
+    b->args[1] = PyUnicode_FromString("Lovelace");
+    b->args[2] = PyLong_FromLong(1815);
+    b->args_tuple = PyTuple_Pack(3, b->args[0], b->args[1], b->args[2]);
+    b->empty_tuple = PyTuple_New(0);
+    b->kwnames = Py_BuildValue("(sss)", "first_name", "last_name", "number");
+    b->name_str = PyUnicode_InternFromString("name");
+    b->number_str = PyUnicode_InternFromString("number");
+    if(b->args[0] == NULL || b->args[1] == NULL || b->args[2] == NULL || b->args_tuple == NULL
+            || b->empty_tuple == NULL || b->kwnames == NULL || b->name_str == NULL || b->number_str == NULL){
+        return -1;
+    }
+    b->person = PyObject_Call((PyObject *)b->type, b->args_tuple, NULL);
+    return b->person == NULL ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    int samples = argc > 2 ? atoi(argv[2]) : 20;
+    if(iterations < 1 || samples < 1){
+        fprintf(stderr, "usage: %s [iterations per sample] [samples]\n", argv[0]);
+        return 2;
+    }
+
+    if(PyImport_AppendInittab("mymodule", PyInit_mymodule) < 0){
+        fprintf(stderr, "cannot register mymodule\n");
+        return 1;
+    }
+    Py_Initialize();
+
+    struct bench b = {0};
+    size_t n_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    double *ns = malloc((size_t)samples * sizeof(double));
+    double *hw = malloc((n_benchmarks * N_COUNTERS + 1) * sizeof(double));
+    int perf_error;
+    int n_counters = counters_open(&perf_error);
+    int rc = ns == NULL || hw == NULL || setup(&b) < 0 ? -1 : 0;
+    if(rc == 0){
+        printf("%s\n%ld iterations x %d samples\n\n", Py_GetVersion(), iterations, samples);
+        printf("%-28s %9s   %6s %9s %9s\n", "ns/op", "mean", "ci95", "median", "min");
+    }
+    for(size_t i = 0; rc == 0 && i < n_benchmarks; i++){
+        rc = run(benchmarks[i].name, benchmarks[i].fn, &b, iterations, samples, ns, hw + i * N_COUNTERS);
+    }
+    if(rc == 0 && n_counters > 0){
+        printf("\n%-28s", "per op (user space)");
+        for(int i = 0; i < N_COUNTERS; i++){
+            printf(" %9s", counters[i].name);
+        }
+        printf(" %9s\n", "IPC");
+        for(size_t i = 0; i < n_benchmarks; i++){
+            print_counters(benchmarks[i].name, hw + i * N_COUNTERS);
+        }
+    }
+    if(rc == 0 && n_counters < N_COUNTERS){
+        printf("\n%d of %d hardware counters unavailable (%s)%s\n", N_COUNTERS - n_counters, N_COUNTERS,
+               strerror(perf_error), perf_error == EACCES || perf_error == EPERM
+               ? "; see /proc/sys/kernel/perf_event_paranoid" : "");
+    }
+    if(rc < 0 && PyErr_Occurred()){
+        PyErr_Print();
+    }
+
+    counters_close();
+    free(ns);
+    free(hw);
+    Py_XDECREF(b.person);
+    for(int i = 0; i < 3; i++){
+        Py_XDECREF(b.args[i]);
+    }
+    Py_XDECREF(b.args_tuple);
+    Py_XDECREF(b.empty_tuple);
+    Py_XDECREF(b.kwnames);
+    Py_XDECREF(b.name_str);
+    Py_XDECREF(b.number_str);
+    Py_XDECREF(b.type);
+    if(Py_FinalizeEx() < 0){
+        rc = -1;
+    }
+    return rc < 0 ? 1 : 0;
+}
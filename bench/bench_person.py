@@ -0,0 +1,185 @@
+"""
+Benchmarks of mymodule.Person, with a slotted dataclass and a namedtuple as
+baselines.
+
+    cmake --build build --target bench          # writes build/bench.json
+
+or directly, with the build directory on PYTHONPATH:
+
+    python3 bench/bench_person.py -o before.json
+    python3 bench/bench_person.py -o after.json
+    python3 -m pyperf compare_to before.json after.json --table
+
+Micro benchmarks are named <scenario>/<implementation>; bulk benchmarks
+<scenario>/<implementation>/<size>.  Select some of them with -b, a
+comma-separated list of prefixes:
+
+    python3 bench/bench_person.py -b construct,bulk_construct/person --sizes 1000,10000000
+"""
+import collections
+import dataclasses
+import gc
+
+import pyperf
+
+import mymodule
+
+
+@dataclasses.dataclass(slots=True)
+class SlotsPerson:
+    first_name: str = ""
+    last_name: str = ""
+    number: int = 0
+
+    def name(self):
+        return f"{self.first_name} {self.last_name}"
+
+    def __str__(self):
+        return f"Person(first_name={self.first_name}, last_name={self.last_name}, number={self.number})"
+
+
+class TuplePerson(collections.namedtuple("TuplePerson", ["first_name", "last_name", "number"],
+                                         defaults=("", "", 0))):
+    __slots__ = ()
+
+    def name(self):
+        return f"{self.first_name} {self.last_name}"
+
+    def __str__(self):
+        return f"Person(first_name={self.first_name}, last_name={self.last_name}, number={self.number})"
+
+
+IMPLEMENTATIONS = {
+    "person": mymodule.Person,
+    "dataclass": SlotsPerson,
+    "namedtuple": TuplePerson,
+}
+
+DEFAULT_SIZES = "1000,10000,100000,1000000,10000000"
+SEED = 42          # of mymodule.synth(), fixed so that results stay comparable
+
+FIRST = "Ada"
+LAST = "Lovelace"
+
+
+def micro_benchmarks():
+    """(name, statement, setup) of the per-object benchmarks"""
+    for impl in IMPLEMENTATIONS:
+        setup = f"from __main__ import IMPLEMENTATIONS; P = IMPLEMENTATIONS[{impl!r}]; p = P({FIRST!r}, {LAST!r}, 1815)"
+        yield f"construct_positional/{impl}", f"P({FIRST!r}, {LAST!r}, 1815)", setup
+        yield f"construct_keyword/{impl}", f"P(first_name={FIRST!r}, last_name={LAST!r}, number=1815)", setup
+        yield f"construct_mixed/{impl}", f"P({FIRST!r}, last_name={LAST!r}, number=1815)", setup
+        yield f"get_first_name/{impl}", "p.first_name", setup
+        yield f"get_number/{impl}", "p.number", setup
+        if impl != "namedtuple":
+            yield f"set_first_name/{impl}", "p.first_name = 'Grace'", setup
+            yield f"set_number/{impl}", "p.number = 1906", setup
+        yield f"name/{impl}", "p.name()", setup
+        yield f"str/{impl}", "str(p)", setup
+
+
+def make_fields(n):
+    # The same data on every machine: Zipf-distributed last names, some
+    # non-ASCII, and distinct name objects, as when Persons come from a file.
+    return [(p.first_name, p.last_name, p.number) for p in mymodule.synth(n, SEED, output="list")]
+
+
+def make_people(cls, n):
+    return [cls(f, l, i) for f, l, i in make_fields(n)]
+
+
+def time_construct(loops, cls, n):
+    names = make_fields(n)
+    total = 0.0
+    for _ in range(loops):
+        t0 = pyperf.perf_counter()
+        people = [cls(f, l, i) for f, l, i in names]
+        total += pyperf.perf_counter() - t0
+        del people
+    return total
+
+
+def time_dealloc(loops, cls, n):
+    total = 0.0
+    for _ in range(loops):
+        people = make_people(cls, n)
+        t0 = pyperf.perf_counter()
+        del people
+        total += pyperf.perf_counter() - t0
+    return total
+
+
+def time_sum_number(loops, cls, n):
+    people = make_people(cls, n)
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        sum(p.number for p in people)
+    return pyperf.perf_counter() - t0
+
+
+def time_update_number(loops, cls, n):
+    people = make_people(cls, n)
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for p in people:
+            p.number += 1
+    return pyperf.perf_counter() - t0
+
+
+def time_str(loops, cls, n):
+    people = make_people(cls, n)
+    t0 = pyperf.perf_counter()
+    for _ in range(loops):
+        for p in people:
+            str(p)
+    return pyperf.perf_counter() - t0
+
+
+BULK = {
+    "bulk_construct": time_construct,
+    "bulk_dealloc": time_dealloc,
+    "bulk_sum_number": time_sum_number,
+    "bulk_update_number": time_update_number,
+    "bulk_str": time_str,
+}
+
+
+def selected(name, prefixes):
+    return not prefixes or any(name.startswith(p) for p in prefixes)
+
+
+def add_cmdline_args(cmd, args):
+    cmd.extend(("--sizes", args.sizes))
+    if args.benchmarks:
+        cmd.extend(("-b", args.benchmarks))
+
+
+def main():
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    runner.argparser.add_argument("--sizes", default=DEFAULT_SIZES,
+                                  help=f"comma-separated sizes of the bulk benchmarks (default: {DEFAULT_SIZES})")
+    runner.argparser.add_argument("-b", "--benchmarks", default="",
+                                  help="comma-separated prefixes of the benchmarks to run (default: all)")
+    args = runner.parse_args()
+    prefixes = [p for p in args.benchmarks.split(",") if p]
+    sizes = [int(s) for s in args.sizes.split(",") if s]
+
+    runner.metadata["mymodule_file"] = mymodule.__file__
+    for name, stmt, setup in micro_benchmarks():
+        if selected(name, prefixes):
+            runner.timeit(name, stmt=stmt, setup=setup)
+
+    for scenario, func in BULK.items():
+        for impl, cls in IMPLEMENTATIONS.items():
+            if scenario == "bulk_update_number" and impl == "namedtuple":
+                continue
+            for n in sizes:
+                name = f"{scenario}/{impl}/{n}"
+                if selected(name, prefixes):
+                    # inner_loops=n: the results are per object, comparable across sizes.
+                    runner.bench_time_func(name, func, cls, n, inner_loops=n)
+                    gc.collect()
+
+
+if __name__ == "__main__":
+    main()
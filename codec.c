@@ -0,0 +1,246 @@
+#include <string.h>
+#include "codec.h"
+
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 65535
+// The last bytes of a block are always literals, a match never ends there.
+#define LZ_LAST_LITERALS 12
+
+size_t lz_compress_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+static inline uint32_t read32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static char *write_length(char *op, char *oend, size_t len)
+{
+    while(len >= 255){
+        if(op >= oend){
+            return NULL;
+        }
+        *op++ = (char)255;
+        len -= 255;
+    }
+    if(op >= oend){
+        return NULL;
+    }
+    *op++ = (char)len;
+    return op;
+}
+
+static char *write_sequence(char *op, char *oend, const char *literals, size_t literal_len,
+                            size_t offset, size_t match_len, int last)
+{
+    if(op >= oend){
+        return NULL;
+    }
+    char *token = op++;
+    size_t ml = last ? 0 : match_len - LZ_MIN_MATCH;
+    *token = (char)((literal_len >= 15 ? 15 : literal_len) << 4 | (ml >= 15 ? 15 : ml));
+    if(literal_len >= 15 && (op = write_length(op, oend, literal_len - 15)) == NULL){
+        return NULL;
+    }
+    if((size_t)(oend - op) < literal_len){
+        return NULL;
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if(last){
+        return op;
+    }
+    if(oend - op < 2){
+        return NULL;
+    }
+    op[0] = (char)offset;
+    op[1] = (char)(offset >> 8);
+    op += 2;
+    if(ml >= 15 && (op = write_length(op, oend, ml - 15)) == NULL){
+        return NULL;
+    }
+    return op;
+}
+
+size_t lz_compress(const char *src, size_t size, char *dst, size_t capacity)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const char *ip = src;
+    const char *anchor = src;
+    const char *iend = src + size;
+    const char *mflimit = size > LZ_LAST_LITERALS ? iend - LZ_LAST_LITERALS : src;
+    char *op = dst;
+    char *oend = dst + capacity;
+
+    // Positions are stored plus one so that 0 means "empty".  The search
+    // steps further after each run of misses, so incompressible data goes
+    // through quickly.
+    size_t misses = 0;
+    while(ip < mflimit){
+        uint32_t seq = read32(ip);
+        uint32_t h = lz_hash(seq);
+        const char *ref = table[h] ? src + table[h] - 1 : NULL;
+        table[h] = (uint32_t)(ip - src) + 1;
+        if(ref == NULL || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq){
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+
+        // Extend the match forward, and backward over pending literals.
+        const char *match_end = ip + LZ_MIN_MATCH;
+        const char *ref_end = ref + LZ_MIN_MATCH;
+        while(match_end < mflimit && *match_end == *ref_end){
+            match_end++;
+            ref_end++;
+        }
+        while(ip > anchor && ref > src && ip[-1] == ref[-1]){
+            ip--;
+            ref--;
+        }
+
+        op = write_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref),
+                            (size_t)(match_end - ip), 0);
+        if(op == NULL){
+            return 0;
+        }
+        // Index a position inside the match to find the next one sooner.
+        if(match_end - 2 > src){
+            table[lz_hash(read32(match_end - 2))] = (uint32_t)(match_end - 2 - src) + 1;
+        }
+        ip = anchor = match_end;
+    }
+
+    op = write_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0, 1);
+    return op == NULL ? 0 : (size_t)(op - dst);
+}
+
+static inline int read_length(const unsigned char **ip, const unsigned char *iend, size_t *len)
+{
+    unsigned char b;
+    do {
+        if(*ip >= iend){
+            return -1;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while(b == 255);
+    return 0;
+}
+
+int lz_decompress(const char *src, size_t src_size, char *dst, size_t size)
+{
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *iend = ip + src_size;
+    char *op = dst;
+    char *oend = dst + size;
+
+    while(ip < iend){
+        unsigned token = *ip++;
+        size_t literal_len = token >> 4;
+
+        // Fast path: short literals are copied with one fixed size copy that
+        // may write past them.  Output is produced in order, so the excess is
+        // overwritten before anything reads it.
+        if(literal_len < 15 && iend - ip >= 16 && oend - op >= 16){
+            memcpy(op, ip, 16);
+        } else {
+            if(literal_len == 15 && read_length(&ip, iend, &literal_len) < 0){
+                return -1;
+            }
+            if((size_t)(iend - ip) < literal_len || (size_t)(oend - op) < literal_len){
+                return -1;
+            }
+            memcpy(op, ip, literal_len);
+        }
+        op += literal_len;
+        ip += literal_len;
+        if(ip == iend){
+            break;          // last sequence
+        }
+
+        if(iend - ip < 2){
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if(match_len == 15 && read_length(&ip, iend, &match_len) < 0){
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if(offset == 0 || offset > (size_t)(op - dst) || (size_t)(oend - op) < match_len){
+            return -1;
+        }
+
+        const char *ref = op - offset;
+        if(offset >= 8 && (size_t)(oend - op) >= match_len + 8){
+            // 8 byte chunks never overlap their source when offset >= 8.  The
+            // last chunk may write up to 7 bytes past the match, which the
+            // next sequence overwrites.
+            char *end = op + match_len;
+            do {
+                memcpy(op, ref, 8);
+                op += 8;
+                ref += 8;
+            } while(op < end);
+            op = end;
+        } else {
+            for(size_t i = 0; i < match_len; i++){
+                op[i] = ref[i];
+            }
+            op += match_len;
+        }
+    }
+    return op == oend ? 0 : -1;
+}
+
+void delta_encode_i32(int32_t *values, size_t n)
+{
+    uint32_t prev = 0;
+    for(size_t i = 0; i < n; i++){
+        uint32_t v = (uint32_t)values[i];
+        values[i] = (int32_t)(v - prev);
+        prev = v;
+    }
+}
+
+void delta_decode_i32(int32_t *values, size_t n)
+{
+    uint32_t acc = 0;
+    for(size_t i = 0; i < n; i++){
+        acc += (uint32_t)values[i];
+        values[i] = (int32_t)acc;
+    }
+}
+
+void shuffle_i32(const char *src, char *dst, size_t n)
+{
+    for(size_t i = 0; i < n; i++){
+        dst[i] = src[4 * i];
+        dst[n + i] = src[4 * i + 1];
+        dst[2 * n + i] = src[4 * i + 2];
+        dst[3 * n + i] = src[4 * i + 3];
+    }
+}
+
+void unshuffle_i32(const char *src, char *dst, size_t n)
+{
+    for(size_t i = 0; i < n; i++){
+        dst[4 * i] = src[i];
+        dst[4 * i + 1] = src[n + i];
+        dst[4 * i + 2] = src[2 * n + i];
+        dst[4 * i + 3] = src[3 * n + i];
+    }
+}
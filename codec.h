@@ -0,0 +1,43 @@
+/*
+ * Block compression and filters of the module's file formats.
+ *
+ * The codec is a byte oriented LZ77 in the style of LZ4: a block is a list of
+ * sequences, each made of a run of literals and a back reference
+ *
+ *      token | [literal length bytes] | literals | offset (uint16) | [match length bytes]
+ *
+ * The high nibble of the token is the literal length and the low nibble the
+ * match length minus LZ_MIN_MATCH.  A nibble of 15 is followed by bytes that
+ * are added to it until one is not 255.  The last sequence only has literals.
+ *
+ * Filters rewrite arrays of int32 in place so that they compress better:
+ * delta replaces each value by its difference with the previous one and
+ * shuffle groups the bytes of the same significance together.
+ *
+ * None of these functions touch Python state.
+ */
+#ifndef MYMODULE_CODEC_H
+#define MYMODULE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ_MIN_MATCH 4
+
+// Worst case compressed size of `size` bytes.
+size_t lz_compress_bound(size_t size);
+
+// Returns the compressed size, or 0 if the output does not fit in `capacity`.
+size_t lz_compress(const char *src, size_t size, char *dst, size_t capacity);
+
+// Returns 0 if `src` decompresses to exactly `size` bytes, -1 if it is corrupt.
+int lz_decompress(const char *src, size_t src_size, char *dst, size_t size);
+
+void delta_encode_i32(int32_t *values, size_t n);
+void delta_decode_i32(int32_t *values, size_t n);
+
+// `src` and `dst` hold n * 4 bytes and must not overlap.
+void shuffle_i32(const char *src, char *dst, size_t n);
+void unshuffle_i32(const char *src, char *dst, size_t n);
+
+#endif
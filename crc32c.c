@@ -0,0 +1,111 @@
+/*
+ * CRC32C with the CPU's crc32 instruction when there is one (SSE4.2 on x86-64,
+ * the CRC extension on AArch64), otherwise table driven, eight bytes at a time
+ * ("slicing-by-8").
+ *
+ * On x86-64 the instruction is compiled with a target attribute and selected
+ * at run time, so the module still loads on CPUs without SSE4.2.
+ */
+#include <pthread.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u  // reflected Castagnoli polynomial
+
+typedef uint32_t (*crc32c_func)(uint32_t crc, const unsigned char *p, size_t size);
+
+static uint32_t crc32c_table[8][256];
+static crc32c_func crc32c_impl;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t size)
+{
+    while(size >= 8){
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff]
+            ^ crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24]
+            ^ crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]]
+            ^ crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+        p += 8;
+        size -= 8;
+    }
+    while(size-- > 0){
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t size)
+{
+    uint64_t crc64 = crc;
+    while(size >= 8){
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while(size-- > 0){
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#elif defined(CRC32C_ARM)
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t size)
+{
+    while(size >= 8){
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        size -= 8;
+    }
+    while(size-- > 0){
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc32c_init(void)
+{
+    for(uint32_t i = 0; i < 256; i++){
+        uint32_t crc = i;
+        for(int k = 0; k < 8; k++){
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for(uint32_t i = 0; i < 256; i++){
+        for(int t = 1; t < 8; t++){
+            uint32_t prev = crc32c_table[t - 1][i];
+            crc32c_table[t][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xff];
+        }
+    }
+
+    crc32c_impl = crc32c_sw;
+#if defined(CRC32C_X86)
+    if(__builtin_cpu_supports("sse4.2")){
+        crc32c_impl = crc32c_hw;
+    }
+#elif defined(CRC32C_ARM)
+    crc32c_impl = crc32c_hw;
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_impl(~crc, data, size);
+}
@@ -0,0 +1,16 @@
+/*
+ * CRC32C (Castagnoli) checksums of the module's binary formats.
+ */
+#ifndef MYMODULE_CRC32C_H
+#define MYMODULE_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Extend `crc` with `size` bytes.  Start with crc = 0.  Does not touch Python
+ * state and can be called without the GIL.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+#endif
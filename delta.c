@@ -0,0 +1,664 @@
+/*
+ * Delta snapshots of Person datasets.
+ *
+ * >>> mymodule.write_delta(old, new, "hour-13.delta")
+ * {'inserts': 120, 'deletes': 4, 'updates': 3031}
+ * >>> mymodule.apply_delta(replica, "hour-13.delta")   # replica == old
+ *
+ * A dataset is a sequence of Persons whose keys (first_name, last_name) are
+ * unique.  write_delta() records what turns `old` into `new`: the Persons of
+ * `new` whose key is not in `old` (inserts), the keys of `old` that are not in
+ * `new` (deletes), and the keys whose number changed (updates).  The number is
+ * the only field that is not part of the key.
+ *
+ * apply_delta() edits a list in place: updated Persons get their new number
+ * (plain Persons are modified, other types such as FrozenPerson are replaced),
+ * deleted Persons are removed without changing the order of the others, and
+ * inserted Persons are appended.  The result has the same Persons as `new`,
+ * not necessarily in the same order.  The delta is checked against the list
+ * before anything is modified, so a delta that does not belong to it is
+ * rejected and leaves it untouched.
+ *
+ * File format
+ *
+ *      char     magic[4] "MYDL"
+ *      uint32   version
+ *      uint32   crc32c of everything after this field
+ *      uint32   codec                  PERSON_FILE_CODEC_NONE or _LZ
+ *      uint64   base_count             len(old)
+ *      uint64   result_count           len(new)
+ *      uint64   n_inserts
+ *      uint64   n_deletes
+ *      uint64   n_updates
+ *      uint64   raw_size
+ *      uint64   stored_size
+ *      data[stored_size]               records, compressed as one block
+ *
+ * record:  uint8 type | uint32 first_len | uint32 last_len | int32 number | first | last
+ */
+#include <Python.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "person.h"
+#include "person_file.h"
+#include "probes.h"
+#include "latency.h"
+#include "codec.h"
+#include "crc32c.h"
+#include "encoding.h"
+#include "name_hash.h"
+#include "tracked_alloc.h"
+
+#define DELTA_MAGIC "MYDL"
+#define DELTA_VERSION 1
+#define DELTA_HEADER_SIZE 72
+#define DELTA_RECORD_HEADER_SIZE 13
+
+enum delta_type {
+    DELTA_INSERT = 1,
+    DELTA_DELETE = 2,
+    DELTA_UPDATE = 3,
+};
+
+struct key_ref {
+    const char *first;
+    const char *last;
+    Py_ssize_t first_len;
+    Py_ssize_t last_len;
+    int number;
+};
+
+/*
+ * Open addressing table of indexes into an array of key_ref.  Slots hold
+ * index + 1, 0 is empty.
+ */
+struct key_table {
+    const struct key_ref *keys;
+    Py_ssize_t *slots;
+    size_t mask;
+};
+
+static int key_equal(const struct key_ref *k, const char *first, Py_ssize_t first_len,
+                     const char *last, Py_ssize_t last_len)
+{
+    return k->first_len == first_len && k->last_len == last_len
+        && memcmp(k->first, first, (size_t)first_len) == 0
+        && memcmp(k->last, last, (size_t)last_len) == 0;
+}
+
+static Py_ssize_t key_table_find(const struct key_table *t, const char *first, Py_ssize_t first_len,
+                                 const char *last, Py_ssize_t last_len)
+{
+    size_t i = name_hash(first, (size_t)first_len, last, (size_t)last_len) & t->mask;
+    for(; t->slots[i] != 0; i = (i + 1) & t->mask){
+        const struct key_ref *k = &t->keys[t->slots[i] - 1];
+        if(key_equal(k, first, first_len, last, last_len)){
+            return t->slots[i] - 1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Index `n` keys.  Returns 0, or -1 with an exception set if memory runs out
+ * or two keys are equal.
+ */
+static int key_table_build(struct key_table *t, const struct key_ref *keys, Py_ssize_t n, const char *what)
+{
+    size_t size = 16;
+    while(size < (size_t)n * 2){
+        size *= 2;
+    }
+    t->keys = keys;
+    t->mask = size - 1;
+    t->slots = tracked_calloc(size, sizeof(Py_ssize_t));
+    if(t->slots == NULL){
+        PyErr_NoMemory();
+        return -1;
+    }
+    for(Py_ssize_t j = 0; j < n; j++){
+        const struct key_ref *k = &keys[j];
+        size_t i = name_hash(k->first, (size_t)k->first_len, k->last, (size_t)k->last_len) & t->mask;
+        for(; t->slots[i] != 0; i = (i + 1) & t->mask){
+            if(key_equal(&keys[t->slots[i] - 1], k->first, k->first_len, k->last, k->last_len)){
+                PyErr_Format(PyExc_ValueError, "duplicate key in %s at index %zd", what, j);
+                return -1;
+            }
+        }
+        t->slots[i] = j + 1;
+    }
+    return 0;
+}
+
+// Borrow the keys of a sequence of Persons (see Person_AsUTF8()).
+static struct key_ref *load_keys(PyObject *seq)
+{
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    struct key_ref *keys = tracked_malloc((n > 0 ? (size_t)n : 1) * sizeof(struct key_ref));
+    if(keys == NULL){
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for(Py_ssize_t i = 0; i < n; i++){
+        struct key_ref *k = &keys[i];
+        if(Person_AsUTF8(items[i], &k->first, &k->first_len, &k->last, &k->last_len, &k->number) < 0){
+            tracked_free(keys);
+            return NULL;
+        }
+    }
+    return keys;
+}
+
+struct buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static int buffer_put_record(struct buffer *b, int type, const struct key_ref *k, int number)
+{
+    size_t need = b->size + DELTA_RECORD_HEADER_SIZE + (size_t)k->first_len + (size_t)k->last_len;
+    if(need > b->capacity){
+        size_t capacity = b->capacity ? b->capacity : 65536;
+        while(capacity < need){
+            capacity *= 2;
+        }
+        char *data = tracked_realloc(b->data, capacity);
+        if(data == NULL){
+            PyErr_NoMemory();
+            return -1;
+        }
+        b->data = data;
+        b->capacity = capacity;
+    }
+    char *p = b->data + b->size;
+    p[0] = (char)type;
+    put_u32(p + 1, (uint32_t)k->first_len);
+    put_u32(p + 5, (uint32_t)k->last_len);
+    put_u32(p + 9, (uint32_t)number);
+    memcpy(p + DELTA_RECORD_HEADER_SIZE, k->first, (size_t)k->first_len);
+    memcpy(p + DELTA_RECORD_HEADER_SIZE + k->first_len, k->last, (size_t)k->last_len);
+    b->size = need;
+    return 0;
+}
+
+static PyObject *delta_counts(uint64_t inserts, uint64_t deletes, uint64_t updates)
+{
+    return Py_BuildValue("{s:K,s:K,s:K}",
+                         "inserts", (unsigned long long)inserts,
+                         "deletes", (unsigned long long)deletes,
+                         "updates", (unsigned long long)updates);
+}
+
+#ifdef HAVE_SYS_SDT_H
+// Number of operations of a delta_counts() dict, or -1 for NULL; for probes.
+static long delta_ops(PyObject *counts)
+{
+    if(counts == NULL){
+        return -1;
+    }
+    long ops = 0;
+    PyObject *value;
+    Py_ssize_t pos = 0;
+    while(PyDict_Next(counts, &pos, NULL, &value)){
+        ops += PyLong_AsLong(value);
+    }
+    return ops;
+}
+#endif
+
+/*
+ * WRITING
+ */
+
+static int write_delta_file(const char *path, const char *header, const char *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if(f == NULL){
+        return -1;
+    }
+    if(fwrite(header, DELTA_HEADER_SIZE, 1, f) != 1 || (size > 0 && fwrite(data, size, 1, f) != 1)){
+        int saved = errno;
+        fclose(f);
+        errno = saved;
+        return -1;
+    }
+    return fclose(f);
+}
+
+static PyObject *write_delta_impl(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *old_obj, *new_obj;
+    PyObject *path = NULL;
+    const char *compression = "lz";
+    static char *kwlist[] = {"old", "new", "path", "compression", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "OOO&|z:write_delta", kwlist,
+                &old_obj, &new_obj, PyUnicode_FSConverter, &path, &compression)){
+        return NULL;
+    }
+    int codec;
+    if(compression == NULL){
+        codec = PERSON_FILE_CODEC_NONE;
+    } else if(strcmp(compression, "lz") == 0){
+        codec = PERSON_FILE_CODEC_LZ;
+    } else {
+        Py_DECREF(path);
+        PyErr_Format(PyExc_ValueError, "unknown compression '%s', expected 'lz' or None", compression);
+        return NULL;
+    }
+
+    PyObject *old_seq = NULL, *new_seq = NULL, *result = NULL;
+    struct key_ref *old_keys = NULL, *new_keys = NULL;
+    struct key_table table = {0};
+    char *seen = NULL;
+    struct buffer records = {0};
+    char *stored = NULL;
+    uint64_t inserts = 0, deletes = 0, updates = 0;
+
+    old_seq = PySequence_Fast(old_obj, "old must be a sequence of Person");
+    new_seq = old_seq ? PySequence_Fast(new_obj, "new must be a sequence of Person") : NULL;
+    if(new_seq == NULL){
+        goto done;
+    }
+    Py_ssize_t n_old = PySequence_Fast_GET_SIZE(old_seq);
+    Py_ssize_t n_new = PySequence_Fast_GET_SIZE(new_seq);
+    if((old_keys = load_keys(old_seq)) == NULL || (new_keys = load_keys(new_seq)) == NULL
+            || key_table_build(&table, old_keys, n_old, "old") < 0){
+        goto done;
+    }
+    seen = tracked_calloc(n_old > 0 ? (size_t)n_old : 1, 1);
+    if(seen == NULL){
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    // Inserts and updates in the order of `new`, then deletes.
+    for(Py_ssize_t i = 0; i < n_new; i++){
+        const struct key_ref *k = &new_keys[i];
+        Py_ssize_t j = key_table_find(&table, k->first, k->first_len, k->last, k->last_len);
+        if(j < 0){
+            if(buffer_put_record(&records, DELTA_INSERT, k, k->number) < 0){
+                goto done;
+            }
+            inserts++;
+        } else if(seen[j]){
+            PyErr_Format(PyExc_ValueError, "duplicate key in new at index %zd", i);
+            goto done;
+        } else {
+            seen[j] = 1;
+            if(old_keys[j].number != k->number){
+                if(buffer_put_record(&records, DELTA_UPDATE, k, k->number) < 0){
+                    goto done;
+                }
+                updates++;
+            }
+        }
+    }
+    for(Py_ssize_t j = 0; j < n_old; j++){
+        if(!seen[j]){
+            if(buffer_put_record(&records, DELTA_DELETE, &old_keys[j], old_keys[j].number) < 0){
+                goto done;
+            }
+            deletes++;
+        }
+    }
+
+    size_t stored_size = 0;
+    const char *data = records.data;
+    if(codec == PERSON_FILE_CODEC_LZ && records.size > 0){
+        stored = tracked_malloc(records.size);
+        if(stored == NULL){
+            PyErr_NoMemory();
+            goto done;
+        }
+        Py_BEGIN_ALLOW_THREADS
+        stored_size = lz_compress(records.data, records.size, stored, records.size - 1);
+        Py_END_ALLOW_THREADS
+        data = stored;
+    }
+    if(stored_size == 0){
+        codec = PERSON_FILE_CODEC_NONE;
+        stored_size = records.size;
+        data = records.data;
+    }
+
+    char header[DELTA_HEADER_SIZE];
+    memcpy(header, DELTA_MAGIC, 4);
+    put_u32(header + 4, DELTA_VERSION);
+    put_u32(header + 12, (uint32_t)codec);
+    put_u64(header + 16, (uint64_t)n_old);
+    put_u64(header + 24, (uint64_t)n_new);
+    put_u64(header + 32, inserts);
+    put_u64(header + 40, deletes);
+    put_u64(header + 48, updates);
+    put_u64(header + 56, records.size);
+    put_u64(header + 64, stored_size);
+
+    int rc;
+    const char *path_str = PyBytes_AS_STRING(path);
+    Py_BEGIN_ALLOW_THREADS
+    uint32_t crc = crc32c(0, header + 12, DELTA_HEADER_SIZE - 12);
+    put_u32(header + 8, crc32c(crc, data, stored_size));
+    rc = write_delta_file(path_str, header, data, stored_size);
+    Py_END_ALLOW_THREADS
+    if(rc < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        unlink(path_str);
+        goto done;
+    }
+    result = delta_counts(inserts, deletes, updates);
+
+done:
+    tracked_free(stored);
+    tracked_free(records.data);
+    tracked_free(seen);
+    tracked_free(table.slots);
+    tracked_free(old_keys);
+    tracked_free(new_keys);
+    Py_XDECREF(old_seq);
+    Py_XDECREF(new_seq);
+    Py_DECREF(path);
+    return result;
+}
+
+static PyObject *write_delta(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PROBE3(bulk_entry, "write_delta", args, -1L);
+    uint64_t started = latency_start();
+    PyObject *result = write_delta_impl(module, args, kwds);
+    PROBE3(bulk_return, "write_delta", args, delta_ops(result));
+    LATENCY_END(LAT_WRITE_DELTA, started);
+    return result;
+}
+
+/*
+ * APPLYING
+ */
+
+// Read and check a delta file, return its decompressed records.
+static char *read_delta_file(PyObject *path, char *header, size_t *size)
+{
+    const char *path_str = PyBytes_AS_STRING(path);
+    FILE *f = fopen(path_str, "rb");
+    if(f == NULL){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        return NULL;
+    }
+    char *stored = NULL, *records = NULL;
+    if(fread(header, DELTA_HEADER_SIZE, 1, f) != 1 || memcmp(header, DELTA_MAGIC, 4) != 0
+            || get_u32(header + 4) != DELTA_VERSION){
+        goto corrupt;
+    }
+    uint32_t codec = get_u32(header + 12);
+    uint64_t raw_size = get_u64(header + 56);
+    uint64_t stored_size = get_u64(header + 64);
+    if(raw_size > PY_SSIZE_T_MAX || stored_size > raw_size
+            || (codec == PERSON_FILE_CODEC_NONE && stored_size != raw_size)
+            || (codec != PERSON_FILE_CODEC_NONE && codec != PERSON_FILE_CODEC_LZ)){
+        goto corrupt;
+    }
+
+    stored = tracked_malloc(stored_size > 0 ? (size_t)stored_size : 1);
+    if(stored == NULL){
+        fclose(f);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    int ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = (stored_size == 0 || fread(stored, (size_t)stored_size, 1, f) == 1)
+        && crc32c(crc32c(0, header + 12, DELTA_HEADER_SIZE - 12), stored, (size_t)stored_size) == get_u32(header + 8);
+    Py_END_ALLOW_THREADS
+    if(!ok){
+        goto corrupt;
+    }
+    fclose(f);
+    f = NULL;
+
+    if(codec == PERSON_FILE_CODEC_NONE){
+        *size = (size_t)raw_size;
+        return stored;
+    }
+    records = tracked_malloc(raw_size > 0 ? (size_t)raw_size : 1);
+    if(records == NULL){
+        tracked_free(stored);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    ok = lz_decompress(stored, (size_t)stored_size, records, (size_t)raw_size) == 0;
+    Py_END_ALLOW_THREADS
+    tracked_free(stored);
+    if(!ok){
+        tracked_free(records);
+        PyErr_Format(PyExc_ValueError, "%s is not a valid delta file", path_str);
+        return NULL;
+    }
+    *size = (size_t)raw_size;
+    return records;
+
+corrupt:
+    if(f != NULL){
+        fclose(f);
+    }
+    tracked_free(stored);
+    PyErr_Format(PyExc_ValueError, "%s is not a valid delta file", path_str);
+    return NULL;
+}
+
+struct delta_op {
+    int type;
+    struct key_ref key;         // points into the records
+    Py_ssize_t index;           // in base, for deletes and updates
+};
+
+static PyObject *apply_delta_impl(PyObject *module, PyObject *args)
+{
+    PyObject *base;
+    PyObject *path = NULL;
+
+    if(!PyArg_ParseTuple(args, "O!O&:apply_delta", &PyList_Type, &base, PyUnicode_FSConverter, &path)){
+        return NULL;
+    }
+
+    char header[DELTA_HEADER_SIZE];
+    size_t size = 0;
+    char *records = read_delta_file(path, header, &size);
+    if(records == NULL){
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    struct key_ref *keys = NULL;
+    struct key_table table = {0};
+    struct delta_op *ops = NULL;
+    char *deleted = NULL;
+    uint64_t n_ops = get_u64(header + 32) + get_u64(header + 40) + get_u64(header + 48);
+    Py_ssize_t n_base = PyList_GET_SIZE(base);
+
+    if(get_u64(header + 16) != (uint64_t)n_base){
+        PyErr_Format(PyExc_ValueError, "the delta applies to %llu Persons, base has %zd",
+                     (unsigned long long)get_u64(header + 16), n_base);
+        goto done;
+    }
+    if(n_ops > size / DELTA_RECORD_HEADER_SIZE){
+        goto corrupt;
+    }
+    ops = tracked_malloc((n_ops > 0 ? (size_t)n_ops : 1) * sizeof(struct delta_op));
+    deleted = tracked_calloc(n_base > 0 ? (size_t)n_base : 1, 1);
+    if(ops == NULL || deleted == NULL){
+        PyErr_NoMemory();
+        goto done;
+    }
+    if((keys = load_keys(base)) == NULL || key_table_build(&table, keys, n_base, "base") < 0){
+        goto done;
+    }
+
+    // Resolve every record before modifying the list: the keys borrow the
+    // names of the Persons that updates may replace.
+    uint64_t counts[4] = {0};
+    size_t pos = 0;
+    for(uint64_t i = 0; i < n_ops; i++){
+        struct delta_op *op = &ops[i];
+        if(size - pos < DELTA_RECORD_HEADER_SIZE){
+            goto corrupt;
+        }
+        const char *p = records + pos;
+        op->type = (unsigned char)p[0];
+        op->key.first_len = get_u32(p + 1);
+        op->key.last_len = get_u32(p + 5);
+        op->key.number = (int32_t)get_u32(p + 9);
+        op->key.first = p + DELTA_RECORD_HEADER_SIZE;
+        op->key.last = op->key.first + op->key.first_len;
+        pos += DELTA_RECORD_HEADER_SIZE;
+        if((size_t)op->key.first_len + (size_t)op->key.last_len > size - pos
+                || op->type < DELTA_INSERT || op->type > DELTA_UPDATE){
+            goto corrupt;
+        }
+        pos += (size_t)op->key.first_len + (size_t)op->key.last_len;
+        counts[op->type]++;
+
+        op->index = key_table_find(&table, op->key.first, op->key.first_len, op->key.last, op->key.last_len);
+        if((op->type == DELTA_INSERT) != (op->index < 0)){
+            PyErr_SetString(PyExc_ValueError, op->type == DELTA_INSERT
+                    ? "the delta does not match base: an inserted key is already present"
+                    : "the delta does not match base: a deleted or updated key is missing");
+            goto done;
+        }
+        if(op->type == DELTA_DELETE){
+            if(deleted[op->index]){
+                goto corrupt;
+            }
+            deleted[op->index] = 1;
+        }
+    }
+    if(pos != size || counts[DELTA_INSERT] != get_u64(header + 32)
+            || counts[DELTA_DELETE] != get_u64(header + 40) || counts[DELTA_UPDATE] != get_u64(header + 48)
+            || (uint64_t)n_base + counts[DELTA_INSERT] - counts[DELTA_DELETE] != get_u64(header + 24)){
+        goto corrupt;
+    }
+
+    // Create the new Persons first so that an error leaves the list
+    // untouched: the inserted ones and the replacements of updated Persons
+    // that are not plain Persons.
+    PyObject *inserted = PyList_New((Py_ssize_t)counts[DELTA_INSERT]);
+    PyObject *replacements = PyList_New(0);
+    if(inserted == NULL || replacements == NULL){
+        Py_XDECREF(inserted);
+        Py_XDECREF(replacements);
+        goto done;
+    }
+    Py_ssize_t n_inserted = 0;
+    for(uint64_t i = 0; i < n_ops; i++){
+        const struct delta_op *op = &ops[i];
+        if(op->type == DELTA_DELETE
+                || (op->type == DELTA_UPDATE && Py_TYPE(PyList_GET_ITEM(base, op->index)) == &PersonType)){
+            continue;
+        }
+        PyObject *p = Person_FromUTF8(op->key.first, op->key.first_len, op->key.last, op->key.last_len, op->key.number);
+        if(p == NULL){
+            Py_DECREF(inserted);
+            Py_DECREF(replacements);
+            goto done;
+        }
+        if(op->type == DELTA_INSERT){
+            PyList_SET_ITEM(inserted, n_inserted++, p);
+        } else if(PyList_Append(replacements, p) < 0){
+            Py_DECREF(p);
+            Py_DECREF(inserted);
+            Py_DECREF(replacements);
+            goto done;
+        } else {
+            Py_DECREF(p);
+        }
+    }
+
+    Py_ssize_t n_replaced = 0;
+    for(uint64_t i = 0; i < n_ops; i++){
+        const struct delta_op *op = &ops[i];
+        if(op->type != DELTA_UPDATE){
+            continue;
+        }
+        PyObject *item = PyList_GET_ITEM(base, op->index);
+        if(Py_TYPE(item) == &PersonType){
+            ((struct Person *)item)->number = op->key.number;
+        } else {
+            PyObject *p = PyList_GET_ITEM(replacements, n_replaced++);
+            Py_INCREF(p);
+            PyList_SetItem(base, op->index, p);
+        }
+    }
+    Py_DECREF(replacements);
+
+    // Remove deleted Persons in place, keeping the order of the others.
+    Py_ssize_t kept = 0;
+    for(Py_ssize_t i = 0; i < n_base; i++){
+        if(deleted[i]){
+            continue;
+        }
+        if(kept != i){
+            PyObject *item = PyList_GET_ITEM(base, i);
+            Py_INCREF(item);
+            PyList_SetItem(base, kept, item);
+        }
+        kept++;
+    }
+    int rc = PyList_SetSlice(base, kept, n_base, inserted);
+    Py_DECREF(inserted);
+    if(rc < 0){
+        goto done;
+    }
+    result = delta_counts(counts[DELTA_INSERT], counts[DELTA_DELETE], counts[DELTA_UPDATE]);
+    goto done;
+
+corrupt:
+    PyErr_Format(PyExc_ValueError, "%s is not a valid delta file", PyBytes_AS_STRING(path));
+done:
+    tracked_free(records);
+    tracked_free(keys);
+    tracked_free(table.slots);
+    tracked_free(ops);
+    tracked_free(deleted);
+    Py_DECREF(path);
+    return result;
+}
+
+static PyObject *apply_delta(PyObject *module, PyObject *args)
+{
+    PROBE3(bulk_entry, "apply_delta", args, -1L);
+    uint64_t started = latency_start();
+    PyObject *result = apply_delta_impl(module, args);
+    PROBE3(bulk_return, "apply_delta", args, delta_ops(result));
+    LATENCY_END(LAT_APPLY_DELTA, started);
+    return result;
+}
+
+static PyMethodDef delta_functions[] = {
+    {
+        .ml_name = "write_delta",
+        .ml_meth = (PyCFunction)(void(*)(void))write_delta,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "write_delta(old, new, path, compression='lz')\n\n"
+                  "Write the inserts, deletes and number updates that turn the Persons of old into "
+                  "those of new, keyed by (first_name, last_name). Return the counts as a dict.",
+    },
+    {
+        .ml_name = "apply_delta",
+        .ml_meth = (PyCFunction)apply_delta,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "apply_delta(base, path)\n\n"
+                  "Apply a delta written by write_delta() to the list base in place. Return the counts as a dict.",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int delta_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, delta_functions);
+}
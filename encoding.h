@@ -0,0 +1,17 @@
+/*
+ * Little endian encoding helpers shared by the binary formats of the module.
+ * The on-disk formats do not depend on the byte order of the host.
+ */
+#ifndef MYMODULE_ENCODING_H
+#define MYMODULE_ENCODING_H
+
+#include <stdint.h>
+
+static inline uint16_t get_u16(const char *p){ const unsigned char *u = (const unsigned char *)p; return (uint16_t)(u[0] | u[1] << 8); }
+static inline uint32_t get_u32(const char *p){ const unsigned char *u = (const unsigned char *)p; return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24; }
+static inline uint64_t get_u64(const char *p){ return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32; }
+static inline void put_u16(char *p, uint16_t v){ p[0] = (char)v; p[1] = (char)(v >> 8); }
+static inline void put_u32(char *p, uint32_t v){ put_u16(p, (uint16_t)v); put_u16(p + 2, (uint16_t)(v >> 16)); }
+static inline void put_u64(char *p, uint64_t v){ put_u32(p, (uint32_t)v); put_u32(p + 4, (uint32_t)(v >> 32)); }
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * FrozenPerson: an immutable, hash-consed Person.
+ *
+ * >>> a = mymodule.FrozenPerson.intern("Ada", "Lovelace", 1815)
+ * >>> b = mymodule.FrozenPerson.intern("Ada", "Lovelace", 1815)
+ * >>> a is b
+ * True
+ * >>> a.number = 3
+ * AttributeError: readonly attribute
+ *
+ * FrozenPerson is a subclass of Person, so anything that accepts a Person
+ * accepts it too.  Its fields are read-only and its names must be str, so a
+ * FrozenPerson never changes after tp_new() and can be shared between threads
+ * without locking.  The hash is computed once at creation.  Person.__init__()
+ * and the setters of Person's own descriptors refuse FrozenPersons, so the
+ * fields cannot be changed through the base type either.
+ *
+ * intern() returns the canonical instance for a (first_name, last_name,
+ * number) triple.  The intern table maps the triple to a weak reference so
+ * that it does not keep records alive: when the canonical instance dies,
+ * its dealloc removes the entry.  Two interned instances are equal only if
+ * they are the same object, so their comparison is a pointer compare.
+ * Instances created by calling FrozenPerson() directly are not interned and
+ * compare by value.
+ */
+#include <Python.h>
+#include <stddef.h>
+#include <structmember.h>
+#include "person.h"
+#include "stats.h"
+
+struct FrozenPerson {
+    struct Person base;
+    Py_hash_t hash;
+    PyObject *weakreflist;
+    int interned;
+};
+
+// (first_name, last_name, number) -> weakref to the canonical FrozenPerson
+static PyObject *intern_table = NULL;
+
+static PyObject *FrozenPerson_key(struct FrozenPerson *self)
+{
+    return Py_BuildValue("(OOi)", self->base.first_name, self->base.last_name, self->base.number);
+}
+
+static PyObject *FrozenPerson_create(PyTypeObject *type, PyObject *first_name, PyObject *last_name, int number)
+{
+    if(!PyUnicode_Check(first_name) || !PyUnicode_Check(last_name)){
+        PyErr_SetString(PyExc_TypeError, "FrozenPerson names must be str");
+        return NULL;
+    }
+
+    struct FrozenPerson *self = (struct FrozenPerson *) type->tp_alloc(type, 0);
+    if(self == NULL){
+        return NULL;
+    }
+    // Person_dealloc() counts the deallocation.
+    STAT_PERSON_CREATED();
+    Py_INCREF(first_name);
+    self->base.first_name = first_name;
+    Py_INCREF(last_name);
+    self->base.last_name = last_name;
+    self->base.number = number;
+
+    PyObject *key = FrozenPerson_key(self);
+    if(key == NULL){
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->hash = PyObject_Hash(key);
+    Py_DECREF(key);
+    if(self->hash == -1){
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+static int parse_fields(PyObject *args, PyObject *kwds, const char *format,
+                        PyObject **first_name, PyObject **last_name, int *number)
+{
+    static char *kwlist[] = {"first_name", "last_name", "number", NULL};
+    return PyArg_ParseTupleAndKeywords(args, kwds, format, kwlist, first_name, last_name, number);
+}
+
+static PyObject *FrozenPerson_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    PyObject *first_name = NULL;
+    PyObject *last_name = NULL;
+    int number = 42;
+    if(!parse_fields(args, kwds, "|UUi:FrozenPerson", &first_name, &last_name, &number)){
+        return NULL;
+    }
+
+    // Same defaults as Person_new()
+    PyObject *john = NULL, *doe = NULL;
+    if(first_name == NULL){
+        first_name = john = PyUnicode_FromString("John");
+    }
+    if(last_name == NULL){
+        last_name = doe = PyUnicode_FromString("Doe");
+    }
+    PyObject *result = NULL;
+    if(first_name != NULL && last_name != NULL){
+        result = FrozenPerson_create(type, first_name, last_name, number);
+    }
+    Py_XDECREF(john);
+    Py_XDECREF(doe);
+    return result;
+}
+
+// Fields are set once by tp_new, Person_init() must not run again.
+static int FrozenPerson_init(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    return 0;
+}
+
+static void FrozenPerson_dealloc(struct FrozenPerson *self)
+{
+    if(self->weakreflist != NULL){
+        PyObject_ClearWeakRefs((PyObject *)self);
+    }
+
+    if(self->interned && intern_table != NULL){
+        PyObject *exc_type, *exc_value, *exc_tb;
+        PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+        PyObject *key = FrozenPerson_key(self);
+        if(key != NULL){
+            // Our weak reference is dead now, the entry can only be ours.
+            PyObject *ref = PyDict_GetItemWithError(intern_table, key);
+            if(ref != NULL && PyWeakref_GetObject(ref) == Py_None){
+                PyDict_DelItem(intern_table, key);
+            }
+            Py_DECREF(key);
+        }
+        PyErr_Clear();
+        PyErr_Restore(exc_type, exc_value, exc_tb);
+    }
+
+    PersonType.tp_dealloc((PyObject *)self);
+}
+
+static PyObject *FrozenPerson_intern(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    PyObject *first_name;
+    PyObject *last_name;
+    int number;
+    if(!parse_fields(args, kwds, "UUi:intern", &first_name, &last_name, &number)){
+        return NULL;
+    }
+
+    PyObject *key = Py_BuildValue("(OOi)", first_name, last_name, number);
+    if(key == NULL){
+        return NULL;
+    }
+
+    PyObject *ref = PyDict_GetItemWithError(intern_table, key);
+    if(ref != NULL){
+        PyObject *canonical = PyWeakref_GetObject(ref);
+        if(canonical != Py_None){
+            Py_DECREF(key);
+            Py_INCREF(canonical);
+            return canonical;
+        }
+    } else if(PyErr_Occurred()){
+        Py_DECREF(key);
+        return NULL;
+    }
+
+    PyObject *self = FrozenPerson_create(&FrozenPersonType, first_name, last_name, number);
+    if(self == NULL){
+        Py_DECREF(key);
+        return NULL;
+    }
+    ref = PyWeakref_NewRef(self, NULL);
+    if(ref == NULL || PyDict_SetItem(intern_table, key, ref) < 0){
+        Py_XDECREF(ref);
+        Py_DECREF(key);
+        Py_DECREF(self);
+        return NULL;
+    }
+    ((struct FrozenPerson *)self)->interned = 1;
+    Py_DECREF(ref);
+    Py_DECREF(key);
+    return self;
+}
+
+static Py_hash_t FrozenPerson_hash(struct FrozenPerson *self)
+{
+    return self->hash;
+}
+
+// The fields are set by tp_new and can never be deleted.
+static PyObject *FrozenPerson_str(struct FrozenPerson *self)
+{
+    return PyUnicode_FromFormat("FrozenPerson(first_name=%S, last_name=%S, number=%d)",
+                                self->base.first_name, self->base.last_name, self->base.number);
+}
+
+static PyObject *FrozenPerson_richcompare(PyObject *a, PyObject *b, int op)
+{
+    if((op != Py_EQ && op != Py_NE) || !PyObject_TypeCheck(b, &FrozenPersonType)){
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+
+    struct FrozenPerson *x = (struct FrozenPerson *)a;
+    struct FrozenPerson *y = (struct FrozenPerson *)b;
+    int equal;
+    if(a == b){
+        equal = 1;
+    } else if((x->interned && y->interned) || x->hash != y->hash || x->base.number != y->base.number){
+        equal = 0;
+    } else {
+        equal = PyUnicode_Compare(x->base.first_name, y->base.first_name) == 0
+             && PyUnicode_Compare(x->base.last_name, y->base.last_name) == 0;
+    }
+    if(op == Py_NE){
+        equal = !equal;
+    }
+    return PyBool_FromLong(equal);
+}
+
+static PyObject *FrozenPerson_get_interned(struct FrozenPerson *self, void *Py_UNUSED(closure))
+{
+    return PyBool_FromLong(self->interned);
+}
+
+static PyObject *FrozenPerson_intern_table_size(PyTypeObject *type, PyObject *Py_UNUSED(ignored))
+{
+    return PyLong_FromSsize_t(PyDict_GET_SIZE(intern_table));
+}
+
+/*
+ * Same fields as Person_getset but READONLY.  These descriptors come first
+ * in the MRO and shadow the writable ones of Person.
+ */
+static PyMemberDef FrozenPerson_members[] = {
+    {
+        .name = "first_name",
+        .type = T_OBJECT_EX,
+        .offset = offsetof(struct Person, first_name),
+        .flags = READONLY,
+        .doc = "First name of the person"
+    },
+    {
+        .name = "last_name",
+        .type = T_OBJECT_EX,
+        .offset = offsetof(struct Person, last_name),
+        .flags = READONLY,
+        .doc = "Last name of the person"
+    },
+    {
+        .name = "number",
+        .type = T_INT,
+        .offset = offsetof(struct Person, number),
+        .flags = READONLY,
+        .doc = "Number of the person"
+    },
+    {NULL}
+};
+
+static PyGetSetDef FrozenPerson_getset[] = {
+    {"interned", (getter)FrozenPerson_get_interned, NULL, "True for the canonical instance returned by intern()", NULL},
+    {NULL}
+};
+
+static PyMethodDef FrozenPerson_methods[] = {
+    {
+        .ml_name = "intern",
+        .ml_meth = (PyCFunction)(void(*)(void))FrozenPerson_intern,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+        .ml_doc = "intern(first_name, last_name, number): return the canonical FrozenPerson for these fields",
+    },
+    {
+        .ml_name = "intern_table_size",
+        .ml_meth = (PyCFunction)FrozenPerson_intern_table_size,
+        .ml_flags = METH_NOARGS | METH_CLASS,
+        .ml_doc = "Return the number of entries of the intern table",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+PyTypeObject FrozenPersonType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.FrozenPerson",
+    .tp_doc = "FrozenPerson(first_name='John', last_name='Doe', number=42)\n\nImmutable, hashable Person",
+    .tp_basicsize = sizeof(struct FrozenPerson),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_base = &PersonType,
+    .tp_new = FrozenPerson_new,
+    .tp_init = FrozenPerson_init,
+    .tp_dealloc = (destructor) FrozenPerson_dealloc,
+    .tp_hash = (hashfunc) FrozenPerson_hash,
+    .tp_str = (reprfunc) FrozenPerson_str,
+    .tp_richcompare = FrozenPerson_richcompare,
+    .tp_weaklistoffset = offsetof(struct FrozenPerson, weakreflist),
+    .tp_members = FrozenPerson_members,
+    .tp_getset = FrozenPerson_getset,
+    .tp_methods = FrozenPerson_methods,
+};
+
+int frozen_person_module_init(PyObject *m)
+{
+    if(PyType_Ready(&FrozenPersonType) < 0){
+        return -1;
+    }
+
+    intern_table = PyDict_New();
+    if(intern_table == NULL){
+        return -1;
+    }
+
+    Py_INCREF(&FrozenPersonType);
+    if(PyModule_AddObject(m, "FrozenPerson", (PyObject *)&FrozenPersonType) < 0){
+        Py_DECREF(&FrozenPersonType);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,492 @@
+/*
+ * Latency histograms, see latency.h.
+ *
+ * Export format (little endian)
+ *
+ *      char magic[4] "MYLH" | uint32 version | uint32 LATENCY_SUB_BITS
+ *      uint32 LATENCY_MAX_BITS | uint32 n_ops
+ *      op[n_ops]:  uint32 name_len | name | uint64 count | uint64 min
+ *                  uint64 max | uint64 sum | uint32 n_buckets
+ *                  bucket[n_buckets]: uint32 index | uint64 count
+ *      uint32 crc32c of everything before
+ *
+ * Only operations and buckets with a non-zero count are written, and
+ * operations are identified by name, so that a histogram exported by another
+ * build of the module can still be merged as long as its resolution matches.
+ */
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+#include "person.h"
+#include "latency.h"
+#include "trace.h"
+#include "crc32c.h"
+#include "encoding.h"
+
+#define LH_MAGIC "MYLH"
+#define LH_VERSION 1
+#define LH_HEADER_SIZE 20
+#define LH_OP_SIZE 40           // without the name and the buckets
+#define LH_BUCKET_SIZE 12
+
+#ifdef MYMODULE_STATS
+
+static const char *op_names[LAT_COUNT] = {
+    [LAT_PERSON_NEW] = "Person.__new__",
+    [LAT_PERSON_INIT] = "Person.__init__",
+    [LAT_PERSON_STR] = "Person.__str__",
+    [LAT_PERSON_NAME] = "Person.name",
+    [LAT_PERSON_COLUMNS] = "PersonColumns",
+    [LAT_SUM_NUMBER] = "PersonColumns.sum_number",
+    [LAT_COUNT_RANGE] = "PersonColumns.count_range",
+    [LAT_SELECT_RANGE] = "PersonColumns.select_range",
+    [LAT_TO_COLUMNS] = "PersonFile.to_columns",
+    [LAT_SCAN] = "PersonFile.scan",
+    [LAT_WRITE_PERSON_FILE] = "write_person_file",
+    [LAT_WRITE_ARROW_FILE] = "write_arrow_file",
+    [LAT_READ_ARROW_FILE] = "read_arrow_file",
+    [LAT_WRITE_NAME_INDEX] = "write_name_index",
+    [LAT_PARTITION] = "partition",
+    [LAT_WRITE_DELTA] = "write_delta",
+    [LAT_APPLY_DELTA] = "apply_delta",
+    [LAT_WRITE_PERSONS] = "write_persons",
+    [LAT_SYNTH] = "synth",
+};
+
+struct histogram {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+
+int latency_flags;
+static struct histogram histograms[LAT_COUNT];
+
+static int bucket_of(uint64_t value)
+{
+    if(value >= (uint64_t)1 << LATENCY_MAX_BITS){
+        value = ((uint64_t)1 << LATENCY_MAX_BITS) - 1;
+    }
+    if(value < (1 << LATENCY_SUB_BITS)){
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - (LATENCY_SUB_BITS - 1);
+    return (1 << LATENCY_SUB_BITS) + (msb - LATENCY_SUB_BITS) * (1 << (LATENCY_SUB_BITS - 1))
+           + (int)((value >> shift) - (1 << (LATENCY_SUB_BITS - 1)));
+}
+
+// Largest value counted in bucket `i`.
+static uint64_t bucket_high(int i)
+{
+    if(i < (1 << LATENCY_SUB_BITS)){
+        return (uint64_t)i;
+    }
+    int k = (i - (1 << LATENCY_SUB_BITS)) >> (LATENCY_SUB_BITS - 1);
+    int j = (i - (1 << LATENCY_SUB_BITS)) & ((1 << (LATENCY_SUB_BITS - 1)) - 1);
+    int shift = k + 1;
+    return ((uint64_t)((1 << (LATENCY_SUB_BITS - 1)) + j + 1) << shift) - 1;
+}
+
+/*
+ * The histograms are only written with the GIL held, but the metrics exporter
+ * thread reads them without it: writes are relaxed atomic stores, which cost
+ * the same as plain ones, rather than read-modify-write operations.
+ */
+#define STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static void histogram_add(struct histogram *h, uint64_t count, uint64_t min, uint64_t max, uint64_t sum)
+{
+    if(h->count == 0 || min < h->min){
+        STORE(h->min, min);
+    }
+    if(max > h->max){
+        STORE(h->max, max);
+    }
+    STORE(h->sum, h->sum + sum);
+    STORE(h->count, h->count + count);
+}
+
+void latency_record(enum latency_op op, uint64_t started)
+{
+    uint64_t now = latency_now();
+    int flags = __atomic_load_n(&latency_flags, __ATOMIC_RELAXED);
+    if((flags & LATENCY_TRACE) && op >= LAT_PERSON_COLUMNS){
+        trace_span(op_names[op], started, now, -1);
+    }
+    if(!(flags & LATENCY_HISTOGRAMS)){
+        return;
+    }
+    uint64_t ns = now > started ? now - started : 0;
+    struct histogram *h = &histograms[op];
+    int b = bucket_of(ns);
+    STORE(h->buckets[b], h->buckets[b] + 1);
+    histogram_add(h, 1, ns, ns, ns);
+}
+
+// Smallest recorded value such that `q` percent of the values are lower or
+// equal, to the resolution of the buckets.
+static uint64_t histogram_percentile(const struct histogram *h, double q)
+{
+    double r = q / 100.0 * (double)h->count;
+    uint64_t rank = (uint64_t)r;
+    if((double)rank < r){
+        rank++;
+    }
+    if(rank < 1){
+        return h->min;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; i++){
+        seen += h->buckets[i];
+        if(seen >= rank){
+            uint64_t value = bucket_high(i);
+            return value > h->max ? h->max : value < h->min ? h->min : value;
+        }
+    }
+    return h->max;
+}
+
+const char *latency_op_name(enum latency_op op)
+{
+    return op_names[op];
+}
+
+const double latency_summary_quantiles[LATENCY_SUMMARY_QUANTILES] = {50.0, 90.0, 99.0, 99.9};
+
+int latency_summarize(enum latency_op op, struct latency_summary *summary)
+{
+    struct histogram h;     // a copy, so that the quantiles agree with each other
+    const struct histogram *from = &histograms[op];
+    h.count = LOAD(from->count);
+    if(h.count == 0){
+        return 0;
+    }
+    h.min = LOAD(from->min);
+    h.max = LOAD(from->max);
+    h.sum = LOAD(from->sum);
+    uint64_t total = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; i++){
+        h.buckets[i] = LOAD(from->buckets[i]);
+        total += h.buckets[i];
+    }
+    h.count = total;    // records that landed while copying
+    summary->count = h.count;
+    summary->sum = h.sum;
+    for(int i = 0; i < LATENCY_SUMMARY_QUANTILES; i++){
+        summary->quantiles[i] = histogram_percentile(&h, latency_summary_quantiles[i]);
+    }
+    return 1;
+}
+
+static PyObject *enable_latency_tracking(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    __atomic_or_fetch(&latency_flags, LATENCY_HISTOGRAMS, __ATOMIC_RELAXED);
+    Py_RETURN_NONE;
+}
+
+static PyObject *disable_latency_tracking(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    __atomic_and_fetch(&latency_flags, ~LATENCY_HISTOGRAMS, __ATOMIC_RELAXED);
+    Py_RETURN_NONE;
+}
+
+static PyObject *reset_latency(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    memset(histograms, 0, sizeof(histograms));
+    Py_RETURN_NONE;
+}
+
+static PyObject *percentiles(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *qs_obj = NULL;
+    static char *kwlist[] = {"percentiles", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|O:percentiles", kwlist, &qs_obj)){
+        return NULL;
+    }
+    PyObject *qs = qs_obj == NULL ? Py_BuildValue("(ddddd)", 50.0, 90.0, 99.0, 99.9, 99.99)
+                                  : PySequence_Fast(qs_obj, "percentiles must be a sequence of numbers");
+    if(qs == NULL){
+        return NULL;
+    }
+    Py_ssize_t n_qs = PySequence_Fast_GET_SIZE(qs);
+    for(Py_ssize_t i = 0; i < n_qs; i++){
+        double q = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(qs, i));
+        if(q == -1.0 && PyErr_Occurred()){
+            Py_DECREF(qs);
+            return NULL;
+        }
+        if(!(q >= 0.0 && q <= 100.0)){
+            Py_DECREF(qs);
+            PyErr_SetString(PyExc_ValueError, "percentiles must be between 0 and 100");
+            return NULL;
+        }
+    }
+
+    PyObject *result = PyDict_New();
+    for(int op = 0; result != NULL && op < LAT_COUNT; op++){
+        const struct histogram *h = &histograms[op];
+        if(h->count == 0){
+            continue;
+        }
+        PyObject *values = PyDict_New();
+        for(Py_ssize_t i = 0; values != NULL && i < n_qs; i++){
+            PyObject *q = PyNumber_Float(PySequence_Fast_GET_ITEM(qs, i));
+            PyObject *value = q ? PyLong_FromUnsignedLongLong(histogram_percentile(h, PyFloat_AS_DOUBLE(q))) : NULL;
+            if(value == NULL || PyDict_SetItem(values, q, value) < 0){
+                Py_CLEAR(values);
+            }
+            Py_XDECREF(q);
+            Py_XDECREF(value);
+        }
+        PyObject *stats = values == NULL ? NULL : Py_BuildValue(
+            "{s:K,s:K,s:d,s:K,s:N}", "count", (unsigned long long)h->count, "min", (unsigned long long)h->min,
+            "mean", (double)h->sum / (double)h->count, "max", (unsigned long long)h->max, "percentiles", values);
+        if(stats == NULL || PyDict_SetItemString(result, op_names[op], stats) < 0){
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(stats);
+    }
+    Py_DECREF(qs);
+    return result;
+}
+
+static PyObject *export_latency(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    size_t size = LH_HEADER_SIZE + 4;
+    uint32_t n_ops = 0;
+    for(int op = 0; op < LAT_COUNT; op++){
+        if(histograms[op].count == 0){
+            continue;
+        }
+        n_ops++;
+        size += LH_OP_SIZE + strlen(op_names[op]);
+        for(int i = 0; i < LATENCY_BUCKETS; i++){
+            size += histograms[op].buckets[i] ? LH_BUCKET_SIZE : 0;
+        }
+    }
+
+    PyObject *result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)size);
+    if(result == NULL){
+        return NULL;
+    }
+    char *p = PyBytes_AS_STRING(result);
+    memcpy(p, LH_MAGIC, 4);
+    put_u32(p + 4, LH_VERSION);
+    put_u32(p + 8, LATENCY_SUB_BITS);
+    put_u32(p + 12, LATENCY_MAX_BITS);
+    put_u32(p + 16, n_ops);
+    p += LH_HEADER_SIZE;
+    for(int op = 0; op < LAT_COUNT; op++){
+        const struct histogram *h = &histograms[op];
+        if(h->count == 0){
+            continue;
+        }
+        uint32_t name_len = (uint32_t)strlen(op_names[op]);
+        put_u32(p, name_len);
+        memcpy(p + 4, op_names[op], name_len);
+        p += 4 + name_len;
+        put_u64(p, h->count);
+        put_u64(p + 8, h->min);
+        put_u64(p + 16, h->max);
+        put_u64(p + 24, h->sum);
+        char *n_buckets = p + 32;
+        p += 36;
+        uint32_t n = 0;
+        for(int i = 0; i < LATENCY_BUCKETS; i++){
+            if(h->buckets[i]){
+                put_u32(p, (uint32_t)i);
+                put_u64(p + 4, h->buckets[i]);
+                p += LH_BUCKET_SIZE;
+                n++;
+            }
+        }
+        put_u32(n_buckets, n);
+    }
+    put_u32(p, crc32c(0, PyBytes_AS_STRING(result), size - 4));
+    return result;
+}
+
+static int op_by_name(const char *name, uint32_t len)
+{
+    for(int op = 0; op < LAT_COUNT; op++){
+        if(strlen(op_names[op]) == len && memcmp(op_names[op], name, len) == 0){
+            return op;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Walk an export, checking it, and add it to the histograms if `apply`.
+ * Returns -1 with ValueError set if it is not a valid export.
+ */
+static int merge_export(const char *data, size_t size, int apply)
+{
+    if(size < LH_HEADER_SIZE + 4 || memcmp(data, LH_MAGIC, 4) != 0 || get_u32(data + 4) != LH_VERSION
+            || get_u32(data + size - 4) != crc32c(0, data, size - 4)){
+        PyErr_SetString(PyExc_ValueError, "not a latency histogram export");
+        return -1;
+    }
+    if(get_u32(data + 8) != LATENCY_SUB_BITS || get_u32(data + 12) != LATENCY_MAX_BITS){
+        PyErr_SetString(PyExc_ValueError, "latency histograms of a different resolution");
+        return -1;
+    }
+    uint32_t n_ops = get_u32(data + 16);
+    const char *p = data + LH_HEADER_SIZE, *end = data + size - 4;
+    for(uint32_t k = 0; k < n_ops; k++){
+        if(end - p < 4){
+            goto corrupt;
+        }
+        uint32_t name_len = get_u32(p);
+        if((size_t)(end - p - 4) < (size_t)name_len + 36){
+            goto corrupt;
+        }
+        int op = op_by_name(p + 4, name_len);
+        if(op < 0){
+            PyErr_Format(PyExc_ValueError, "unknown operation '%.*s' in latency histograms", (int)name_len, p + 4);
+            return -1;
+        }
+        p += 4 + name_len;
+        uint64_t count = get_u64(p), min = get_u64(p + 8), max = get_u64(p + 16), sum = get_u64(p + 24);
+        uint32_t n_buckets = get_u32(p + 32);
+        p += 36;
+        if((size_t)(end - p) / LH_BUCKET_SIZE < n_buckets){
+            goto corrupt;
+        }
+        uint64_t total = 0;
+        for(uint32_t b = 0; b < n_buckets; b++){
+            uint32_t index = get_u32(p + (size_t)b * LH_BUCKET_SIZE);
+            if(index >= LATENCY_BUCKETS){
+                goto corrupt;
+            }
+            total += get_u64(p + (size_t)b * LH_BUCKET_SIZE + 4);
+            if(apply){
+                uint64_t *bucket = &histograms[op].buckets[index];
+                STORE(*bucket, *bucket + get_u64(p + (size_t)b * LH_BUCKET_SIZE + 4));
+            }
+        }
+        if(total != count || min > max){
+            goto corrupt;
+        }
+        if(apply){
+            histogram_add(&histograms[op], count, min, max, sum);
+        }
+        p += (size_t)n_buckets * LH_BUCKET_SIZE;
+    }
+    if(p != end){
+        goto corrupt;
+    }
+    return 0;
+
+corrupt:
+    PyErr_SetString(PyExc_ValueError, "corrupt latency histogram export");
+    return -1;
+}
+
+static PyObject *merge_latency(PyObject *module, PyObject *arg)
+{
+    Py_buffer view;
+    if(PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) < 0){
+        return NULL;
+    }
+    // Checked completely before anything is added.
+    int rc = merge_export(view.buf, (size_t)view.len, 0) < 0 ? -1 : merge_export(view.buf, (size_t)view.len, 1);
+    PyBuffer_Release(&view);
+    if(rc < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+#else
+
+static PyObject *not_built(void)
+{
+    PyErr_SetString(PyExc_RuntimeError, "mymodule was built without MYMODULE_STATS");
+    return NULL;
+}
+
+static PyObject *enable_latency_tracking(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    return not_built();
+}
+
+static PyObject *disable_latency_tracking(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    Py_RETURN_NONE;
+}
+
+static PyObject *reset_latency(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    Py_RETURN_NONE;
+}
+
+static PyObject *percentiles(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    return PyDict_New();
+}
+
+static PyObject *export_latency(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    return not_built();
+}
+
+static PyObject *merge_latency(PyObject *module, PyObject *arg)
+{
+    return not_built();
+}
+
+#endif
+
+static PyMethodDef latency_functions[] = {
+    {
+        .ml_name = "enable_latency_tracking",
+        .ml_meth = (PyCFunction)enable_latency_tracking,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Start recording the latency of Person operations and bulk calls in histograms",
+    },
+    {
+        .ml_name = "disable_latency_tracking",
+        .ml_meth = (PyCFunction)disable_latency_tracking,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Stop recording latencies; the histograms are kept",
+    },
+    {
+        .ml_name = "reset_latency",
+        .ml_meth = (PyCFunction)reset_latency,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Empty the latency histograms",
+    },
+    {
+        .ml_name = "percentiles",
+        .ml_meth = (PyCFunction)(void(*)(void))percentiles,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "percentiles(percentiles=(50, 90, 99, 99.9, 99.99))\n\n"
+                  "Return {operation: {'count', 'min', 'mean', 'max', 'percentiles': {q: ns}}} for every "
+                  "operation recorded since the last reset_latency(), in nanoseconds.",
+    },
+    {
+        .ml_name = "export_latency",
+        .ml_meth = (PyCFunction)export_latency,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return the latency histograms as bytes, for merge_latency() in another process",
+    },
+    {
+        .ml_name = "merge_latency",
+        .ml_meth = (PyCFunction)merge_latency,
+        .ml_flags = METH_O,
+        .ml_doc = "merge_latency(data)\n\n"
+                  "Add the histograms of an export_latency() result to the latency histograms",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int latency_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, latency_functions);
+}
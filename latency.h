@@ -0,0 +1,120 @@
+/*
+ * Latency histograms of Person operations and bulk calls.
+ *
+ * >>> mymodule.enable_latency_tracking()
+ * >>> ...
+ * >>> mymodule.percentiles()["Person.__init__"]
+ * {'count': 120000, 'min': 61, 'mean': 88.4, 'max': 25311,
+ *  'percentiles': {50.0: 83, 90.0: 97, 99.0: 171, 99.9: 1023, 99.99: 6015}}
+ *
+ * Each operation has an HDR (high dynamic range) histogram of its latencies
+ * in nanoseconds, measured with clock_gettime(CLOCK_MONOTONIC): values below
+ * 2^LATENCY_SUB_BITS are counted exactly and larger ones in buckets whose
+ * width is below 1/2^(LATENCY_SUB_BITS - 1) of their value, up to
+ * 2^LATENCY_MAX_BITS ns (about 18 minutes).  export_latency() returns the
+ * histograms as bytes that merge_latency() adds to those of another process,
+ * so that the tail of a pool of workers can be computed from all of them.
+ *
+ *      uint64_t started = latency_start();
+ *      ...
+ *      LATENCY_END(LAT_SUM_NUMBER, started);
+ *
+ * Tracking is off until enable_latency_tracking(); latency_start() is then a
+ * relaxed load and returns 0, and LATENCY_END() records nothing.  The same
+ * calls record a span of the operation while trace_to() is tracing.  Recording
+ * is only done with the GIL held, which serializes the updates of the
+ * histograms.  When the module is built without MYMODULE_STATS the macros
+ * expand to nothing and enable_latency_tracking() raises RuntimeError.
+ */
+#ifndef MYMODULE_LATENCY_H
+#define MYMODULE_LATENCY_H
+
+#include <stdint.h>
+#include <time.h>
+
+enum latency_op {
+    LAT_PERSON_NEW,                 // Person operations, not traced
+    LAT_PERSON_INIT,
+    LAT_PERSON_STR,
+    LAT_PERSON_NAME,
+    LAT_PERSON_COLUMNS,             // bulk calls, traced
+    LAT_SUM_NUMBER,
+    LAT_COUNT_RANGE,
+    LAT_SELECT_RANGE,
+    LAT_TO_COLUMNS,
+    LAT_SCAN,
+    LAT_WRITE_PERSON_FILE,
+    LAT_WRITE_ARROW_FILE,
+    LAT_READ_ARROW_FILE,
+    LAT_WRITE_NAME_INDEX,
+    LAT_PARTITION,
+    LAT_WRITE_DELTA,
+    LAT_APPLY_DELTA,
+    LAT_WRITE_PERSONS,
+    LAT_SYNTH,
+    LAT_COUNT
+};
+
+#define LATENCY_SUB_BITS 7
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKETS ((1 << LATENCY_SUB_BITS) \
+                         + (LATENCY_MAX_BITS - LATENCY_SUB_BITS) * (1 << (LATENCY_SUB_BITS - 1)))
+
+#ifdef MYMODULE_STATS
+
+#define LATENCY_HISTOGRAMS 1     // enable_latency_tracking()
+#define LATENCY_TRACE 2          // trace_to(), see trace.h
+
+extern int latency_flags;
+
+static inline uint64_t latency_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t latency_start_if(int flags)
+{
+    return __atomic_load_n(&latency_flags, __ATOMIC_RELAXED) & flags ? latency_now() : 0;
+}
+
+// Person operations are too frequent to trace and only use the histograms.
+#define latency_start() latency_start_if(LATENCY_HISTOGRAMS | LATENCY_TRACE)
+#define latency_start_person() latency_start_if(LATENCY_HISTOGRAMS)
+
+// Record the time since `started`, a non-zero latency_start().  GIL held.
+void latency_record(enum latency_op op, uint64_t started);
+
+#define LATENCY_SUMMARY_QUANTILES 4
+extern const double latency_summary_quantiles[LATENCY_SUMMARY_QUANTILES];     // 50, 90, 99, 99.9
+
+struct latency_summary {
+    uint64_t count;
+    uint64_t sum;                                   // ns
+    uint64_t quantiles[LATENCY_SUMMARY_QUANTILES];  // ns
+};
+
+/*
+ * Summarize the histogram of `op` without the GIL, for the metrics exporter.
+ * Returns 0 if nothing was recorded.  Records made meanwhile may be partially
+ * counted.
+ */
+int latency_summarize(enum latency_op op, struct latency_summary *summary);
+const char *latency_op_name(enum latency_op op);
+
+#define LATENCY_END(op, started) do { \
+        if(started){ \
+            latency_record(op, started); \
+        } \
+    } while(0)
+
+#else
+
+#define latency_start() ((uint64_t)0)
+#define latency_start_person() ((uint64_t)0)
+#define LATENCY_END(op, started) ((void)(started))
+
+#endif
+
+#endif
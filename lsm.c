@@ -0,0 +1,1470 @@
+/*
+ * LSMStore: a log-structured merge store of Persons keyed by name.
+ *
+ * >>> db = mymodule.LSMStore("people.lsm")
+ * >>> db.put(mymodule.Person("Ada", "Lovelace", 1815))     # upsert
+ * >>> db.get("Ada", "Lovelace")
+ * >>> db.scan(("A", ""), ("B", ""))                         # sorted by name
+ *
+ * The key of a Person is (first_name, last_name), compared as UTF-8 bytes.
+ * Writes go to a sorted in-memory memtable.  When it holds `memtable_size`
+ * entries it is written out as an immutable sorted run file.  Reads look at
+ * the memtable and then at the runs from newest to oldest; the first match
+ * wins.
+ *
+ * A full memtable is flushed without the GIL.  It is first detached as the
+ * immutable memtable and replaced by an empty one, so that put() goes on
+ * while the run is written and get() and scan() still see the detached
+ * entries until the run is published.  Flushes are serialized: a put() that
+ * finds the memtable full while a flush is in progress waits for it.
+ *
+ * When there are `compaction_trigger` runs, a worker thread merges all of them
+ * into one run, keeping only the newest version of each key.  It does so
+ * without the GIL: runs are memory mapped and reference counted, and only the
+ * list of runs is protected by a mutex.
+ *
+ * Run file format (run-<seq>.lsm, a higher seq is newer)
+ *
+ *      char     magic[4] "MYLR"
+ *      uint32   version
+ *      record*                 sorted by key
+ *      uint64   index[]        offset of every LSM_INDEX_INTERVAL-th record
+ *      uint32   block_crc[]    crc32c of the records from index[i] to the next block
+ *      uint8    bloom[]        Bloom filter over the keys
+ *      footer
+ *
+ * record:  uint32 first_len | uint32 last_len | int32 number | first | last
+ *
+ * footer:  uint64 n_records | uint64 index_offset | uint64 n_index
+ *          uint64 bloom_offset | uint64 bloom_bits | uint32 bloom_k
+ *          uint32 crc32c of everything from index_offset to here | char magic[4]
+ *
+ * The index, the Bloom filter and the footer are checked when the run is
+ * opened.  A block of records is checked the first time a lookup, scan or
+ * compaction reads it; a run remembers which blocks passed.
+ *
+ * A compaction writes its output under the name of its newest input and
+ * removes the other inputs afterwards.  A crash in between leaves older runs
+ * whose contents are shadowed by the newer one, which is harmless.
+ */
+#include <Python.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "person.h"
+#include "crc32c.h"
+#include "encoding.h"
+#include "tracked_alloc.h"
+
+#define LSM_MAGIC "MYLR"
+#define LSM_VERSION 2
+#define LSM_HEADER_SIZE 8
+#define LSM_RECORD_HEADER_SIZE 12
+#define LSM_FOOTER_SIZE 52
+#define LSM_INDEX_INTERVAL 16
+#define LSM_BLOOM_BITS_PER_KEY 10
+#define LSM_BLOOM_K 7
+
+/*
+ * A key/value pair.  The name buffers either belong to a memtable entry or
+ * point into a mapped run.
+ */
+struct lsm_entry {
+    const char *first;
+    const char *last;
+    uint32_t first_len;
+    uint32_t last_len;
+    int32_t number;
+};
+
+static int bytes_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if(c != 0){
+        return c;
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static int key_cmp(const struct lsm_entry *a, const struct lsm_entry *b)
+{
+    int c = bytes_cmp(a->first, a->first_len, b->first, b->first_len);
+    return c != 0 ? c : bytes_cmp(a->last, a->last_len, b->last, b->last_len);
+}
+
+static uint64_t key_hash(const struct lsm_entry *e)
+{
+    // FNV-1a with a separator between the two names
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(uint32_t i = 0; i < e->first_len; i++){
+        h = (h ^ (unsigned char)e->first[i]) * 0x100000001b3ull;
+    }
+    h = (h ^ 0xff) * 0x100000001b3ull;
+    for(uint32_t i = 0; i < e->last_len; i++){
+        h = (h ^ (unsigned char)e->last[i]) * 0x100000001b3ull;
+    }
+    return h ^ (h >> 29);
+}
+
+/*
+ * RUNS
+ */
+
+struct lsm_run {
+    uint64_t seq;
+    char *path;
+    char *data;
+    size_t size;
+    uint64_t n;
+    size_t records_end;
+    const char *index;
+    uint64_t n_index;
+    const char *block_crcs;
+    unsigned char *verified;    // per block, set once its crc matched
+    const unsigned char *bloom;
+    uint64_t bloom_bits;
+    uint32_t bloom_k;
+    int refs;               // accessed atomically
+    int obsolete;           // unlink the file when the last reference goes
+};
+
+static void run_decref(struct lsm_run *run)
+{
+    if(__atomic_sub_fetch(&run->refs, 1, __ATOMIC_ACQ_REL) != 0){
+        return;
+    }
+    munmap(run->data, run->size);
+    if(run->obsolete){
+        unlink(run->path);
+    }
+    tracked_free(run->verified);
+    tracked_free(run->path);
+    tracked_free(run);
+}
+
+static void run_incref(struct lsm_run *run)
+{
+    __atomic_add_fetch(&run->refs, 1, __ATOMIC_RELAXED);
+}
+
+// Decode the record at `offset`, returns the offset of the next one.
+static size_t run_record(const struct lsm_run *run, size_t offset, struct lsm_entry *e)
+{
+    const char *p = run->data + offset;
+    e->first_len = get_u32(p);
+    e->last_len = get_u32(p + 4);
+    e->number = (int32_t)get_u32(p + 8);
+    e->first = p + LSM_RECORD_HEADER_SIZE;
+    e->last = e->first + e->first_len;
+    return offset + LSM_RECORD_HEADER_SIZE + e->first_len + e->last_len;
+}
+
+/*
+ * Check the crc of `block` unless it already passed, and set *block_end to the
+ * offset just past its records.  Returns -1 if the block is corrupt.  Does not
+ * need the GIL: concurrent checks of the same block store the same flag.
+ */
+static int run_check_block(const struct lsm_run *run, uint64_t block, size_t *block_end)
+{
+    if(block >= run->n_index){
+        return -1;
+    }
+    uint64_t start = get_u64(run->index + block * 8);
+    uint64_t end = block + 1 < run->n_index ? get_u64(run->index + (block + 1) * 8) : run->records_end;
+    if(start < LSM_HEADER_SIZE || start >= end || end > run->records_end){
+        return -1;
+    }
+    if(!__atomic_load_n(&run->verified[block], __ATOMIC_ACQUIRE)){
+        if(crc32c(0, run->data + start, (size_t)(end - start)) != get_u32(run->block_crcs + block * 4)){
+            return -1;
+        }
+        __atomic_store_n(&run->verified[block], 1, __ATOMIC_RELEASE);
+    }
+    *block_end = (size_t)end;
+    return 0;
+}
+
+static int bloom_may_contain(const struct lsm_run *run, uint64_t hash)
+{
+    uint64_t h1 = hash, h2 = (hash >> 32) | 1;
+    for(uint32_t i = 0; i < run->bloom_k; i++){
+        uint64_t bit = (h1 + i * h2) & (run->bloom_bits - 1);
+        if(!(run->bloom[bit >> 3] & (1u << (bit & 7)))){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Map a run file and validate its footer.  Sets errno and returns NULL on
+ * failure.  Does not need the GIL.
+ */
+static struct lsm_run *run_open(const char *path, uint64_t seq)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0){
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    if(size < LSM_HEADER_SIZE + LSM_FOOTER_SIZE){
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    char *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        return NULL;
+    }
+
+    struct lsm_run *run = tracked_calloc(1, sizeof(struct lsm_run));
+    char *path_copy = tracked_malloc(strlen(path) + 1);
+    if(run == NULL || path_copy == NULL){
+        tracked_free(run);
+        tracked_free(path_copy);
+        munmap(data, size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    strcpy(path_copy, path);
+
+    const char *footer = data + size - LSM_FOOTER_SIZE;
+    run->seq = seq;
+    run->path = path_copy;
+    run->data = data;
+    run->size = size;
+    run->refs = 1;
+    run->n = get_u64(footer);
+    run->records_end = (size_t)get_u64(footer + 8);
+    run->index = data + run->records_end;
+    run->n_index = get_u64(footer + 16);
+    uint64_t bloom_offset = get_u64(footer + 24);
+    run->bloom = (const unsigned char *)data + bloom_offset;
+    run->bloom_bits = get_u64(footer + 32);
+    run->bloom_k = get_u32(footer + 40);
+    run->block_crcs = run->index + run->n_index * 8;
+
+    if(memcmp(data, LSM_MAGIC, 4) != 0 || get_u32(data + 4) != LSM_VERSION
+            || memcmp(footer + 48, LSM_MAGIC, 4) != 0
+            || run->records_end < LSM_HEADER_SIZE || run->records_end > size - LSM_FOOTER_SIZE
+            || run->n_index > (size - LSM_FOOTER_SIZE - run->records_end) / 12
+            || bloom_offset != run->records_end + run->n_index * 12
+            || run->bloom_bits / 8 != size - LSM_FOOTER_SIZE - bloom_offset
+            || run->bloom_bits == 0 || (run->bloom_bits & (run->bloom_bits - 1)) != 0
+            || (run->n == 0) != (run->n_index == 0)
+            || crc32c(0, run->index, size - 8 - run->records_end) != get_u32(footer + 44)){
+        run_decref(run);
+        errno = EBADMSG;
+        return NULL;
+    }
+    run->verified = tracked_calloc((size_t)(run->n_index ? run->n_index : 1), 1);
+    if(run->verified == NULL){
+        run_decref(run);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return run;
+}
+
+/*
+ * Point lookup: Bloom filter, binary search of the sparse index, then a scan
+ * of at most LSM_INDEX_INTERVAL records.  Returns 1 if found, 0 if not and -1
+ * if a block on the way is corrupt.
+ */
+static int run_get(const struct lsm_run *run, const struct lsm_entry *key, uint64_t hash, struct lsm_entry *out)
+{
+    if(run->n == 0 || !bloom_may_contain(run, hash)){
+        return 0;
+    }
+    uint64_t lo = 0, hi = run->n_index - 1;
+    size_t block_end;
+    while(lo < hi){
+        uint64_t mid = lo + (hi - lo + 1) / 2;
+        struct lsm_entry e;
+        if(run_check_block(run, mid, &block_end) < 0){
+            return -1;
+        }
+        run_record(run, (size_t)get_u64(run->index + mid * 8), &e);
+        if(key_cmp(&e, key) <= 0){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if(run_check_block(run, lo, &block_end) < 0){
+        return -1;
+    }
+    size_t offset = (size_t)get_u64(run->index + lo * 8);
+    while(offset < block_end){
+        struct lsm_entry e;
+        offset = run_record(run, offset, &e);
+        int c = key_cmp(&e, key);
+        if(c == 0){
+            *out = e;
+            return 1;
+        }
+        if(c > 0){
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Offset of the first record whose key is >= key, and in *block the block
+ * holding it.  Returns -1 if a block on the way is corrupt.
+ */
+static int run_lower_bound(const struct lsm_run *run, const struct lsm_entry *key, size_t *offset, uint64_t *block)
+{
+    *offset = run->records_end;
+    *block = 0;
+    if(run->n == 0){
+        return 0;
+    }
+    uint64_t lo = 0, hi = run->n_index - 1;
+    size_t block_end;
+    while(lo < hi){
+        uint64_t mid = lo + (hi - lo + 1) / 2;
+        struct lsm_entry e;
+        if(run_check_block(run, mid, &block_end) < 0){
+            return -1;
+        }
+        run_record(run, (size_t)get_u64(run->index + mid * 8), &e);
+        if(key_cmp(&e, key) < 0){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if(run_check_block(run, lo, &block_end) < 0){
+        return -1;
+    }
+    size_t pos = (size_t)get_u64(run->index + lo * 8);
+    while(pos < block_end){
+        struct lsm_entry e;
+        size_t next = run_record(run, pos, &e);
+        if(key_cmp(&e, key) >= 0){
+            break;
+        }
+        pos = next;
+    }
+    // Past the last key of the block: the next block starts there.
+    *offset = pos;
+    *block = pos < block_end ? lo : lo + 1;
+    return 0;
+}
+
+static int fwrite_u32(FILE *f, uint32_t v){ char b[4]; put_u32(b, v); return fwrite(b, 4, 1, f) == 1 ? 0 : -1; }
+
+/*
+ * Write sorted, deduplicated entries to `path` through a temporary file and
+ * an atomic rename.  Sets errno and returns -1 on failure.  Does not need the
+ * GIL.
+ */
+static int run_write(const char *path, const struct lsm_entry *entries, size_t n)
+{
+    size_t path_len = strlen(path);
+    char *tmp = tracked_malloc(path_len + 5);
+    uint64_t n_index = n == 0 ? 0 : (n - 1) / LSM_INDEX_INTERVAL + 1;
+    uint64_t *index = tracked_malloc((size_t)(n_index ? n_index : 1) * sizeof(uint64_t));
+    uint32_t *block_crcs = tracked_malloc((size_t)(n_index ? n_index : 1) * sizeof(uint32_t));
+    uint64_t bloom_bits = 64;
+    while(bloom_bits < (uint64_t)n * LSM_BLOOM_BITS_PER_KEY){
+        bloom_bits <<= 1;
+    }
+    unsigned char *bloom = tracked_calloc((size_t)(bloom_bits / 8), 1);
+    FILE *f = NULL;
+    int rc = -1;
+    if(tmp == NULL || index == NULL || block_crcs == NULL || bloom == NULL){
+        errno = ENOMEM;
+        goto done;
+    }
+    memcpy(tmp, path, path_len);
+    memcpy(tmp + path_len, ".tmp", 5);
+
+    f = fopen(tmp, "wb");
+    if(f == NULL){
+        goto done;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    uint64_t offset = LSM_HEADER_SIZE;
+    if(fwrite(LSM_MAGIC, 4, 1, f) != 1 || fwrite_u32(f, LSM_VERSION) < 0){
+        goto done;
+    }
+    uint32_t crc = 0;
+    for(size_t i = 0; i < n; i++){
+        const struct lsm_entry *e = &entries[i];
+        if(i % LSM_INDEX_INTERVAL == 0){
+            if(i > 0){
+                block_crcs[i / LSM_INDEX_INTERVAL - 1] = crc;
+            }
+            index[i / LSM_INDEX_INTERVAL] = offset;
+            crc = 0;
+        }
+        uint64_t hash = key_hash(e), h2 = (hash >> 32) | 1;
+        for(uint32_t k = 0; k < LSM_BLOOM_K; k++){
+            uint64_t bit = (hash + k * h2) & (bloom_bits - 1);
+            bloom[bit >> 3] |= (unsigned char)(1u << (bit & 7));
+        }
+        char header[LSM_RECORD_HEADER_SIZE];
+        put_u32(header, e->first_len);
+        put_u32(header + 4, e->last_len);
+        put_u32(header + 8, (uint32_t)e->number);
+        crc = crc32c(crc, header, sizeof(header));
+        crc = crc32c(crc, e->first, e->first_len);
+        crc = crc32c(crc, e->last, e->last_len);
+        if(fwrite(header, sizeof(header), 1, f) != 1
+                || fwrite(e->first, 1, e->first_len, f) != e->first_len
+                || fwrite(e->last, 1, e->last_len, f) != e->last_len){
+            goto done;
+        }
+        offset += LSM_RECORD_HEADER_SIZE + e->first_len + e->last_len;
+    }
+    if(n_index > 0){
+        block_crcs[n_index - 1] = crc;
+    }
+
+    // Everything after the records goes through one crc.
+    uint64_t index_offset = offset;
+    crc = 0;
+    for(uint64_t i = 0; i < n_index; i++){
+        char b[8];
+        put_u64(b, index[i]);
+        crc = crc32c(crc, b, sizeof(b));
+        if(fwrite(b, sizeof(b), 1, f) != 1){
+            goto done;
+        }
+    }
+    for(uint64_t i = 0; i < n_index; i++){
+        char b[4];
+        put_u32(b, block_crcs[i]);
+        crc = crc32c(crc, b, sizeof(b));
+        if(fwrite(b, sizeof(b), 1, f) != 1){
+            goto done;
+        }
+    }
+    uint64_t bloom_offset = index_offset + n_index * 12;
+    char footer[LSM_FOOTER_SIZE];
+    put_u64(footer, n);
+    put_u64(footer + 8, index_offset);
+    put_u64(footer + 16, n_index);
+    put_u64(footer + 24, bloom_offset);
+    put_u64(footer + 32, bloom_bits);
+    put_u32(footer + 40, LSM_BLOOM_K);
+    crc = crc32c(crc, bloom, (size_t)(bloom_bits / 8));
+    put_u32(footer + 44, crc32c(crc, footer, 44));
+    memcpy(footer + 48, LSM_MAGIC, 4);
+    if(fwrite(bloom, 1, (size_t)(bloom_bits / 8), f) != bloom_bits / 8
+            || fwrite(footer, sizeof(footer), 1, f) != 1){
+        goto done;
+    }
+    if(fflush(f) != 0 || fsync(fileno(f)) < 0){
+        goto done;
+    }
+    if(fclose(f) != 0){
+        f = NULL;
+        goto done;
+    }
+    f = NULL;
+    if(rename(tmp, path) < 0){
+        goto done;
+    }
+    rc = 0;
+
+done:
+    if(f != NULL){
+        int err = errno;
+        fclose(f);
+        errno = err;
+    }
+    if(rc < 0 && tmp != NULL){
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+    }
+    tracked_free(tmp);
+    tracked_free(index);
+    tracked_free(block_crcs);
+    tracked_free(bloom);
+    return rc;
+}
+
+/*
+ * STORE
+ */
+
+struct memtable_entry {
+    struct lsm_entry e;
+    char *names;            // owns e.first and e.last
+};
+
+struct LSMStore {
+    PyObject_HEAD
+    char *dir;
+    Py_ssize_t memtable_size;
+    int compaction_trigger;
+
+    struct memtable_entry *memtable;    // sorted, only touched with the GIL
+    Py_ssize_t memtable_len;
+    struct memtable_entry *immutable;   // being flushed, or left by a failed flush
+    Py_ssize_t immutable_len;
+    struct memtable_entry *spare;       // empty array that replaces a detached memtable
+    int closing;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    // Protected by mutex.  runs[0] is the newest run.
+    struct lsm_run **runs;
+    int n_runs;
+    int runs_cap;
+    uint64_t next_seq;
+    int compacting;
+    int flushing;           // a thread owns the immutable memtable
+    int stop;
+    int error;              // errno of the last failed compaction
+    unsigned long long compactions;
+
+    pthread_t worker;
+    int worker_started;
+};
+
+static PyTypeObject LSMStoreType;
+
+static char *run_path(struct LSMStore *self, uint64_t seq)
+{
+    size_t size = strlen(self->dir) + 32;
+    char *path = tracked_malloc(size);
+    if(path != NULL){
+        snprintf(path, size, "%s/run-%016llu.lsm", self->dir, (unsigned long long)seq);
+    }
+    return path;
+}
+
+// Take a reference to every run, newest first.  Called without the mutex.
+static struct lsm_run **LSMStore_snapshot(struct LSMStore *self, int *n_runs)
+{
+    pthread_mutex_lock(&self->mutex);
+    struct lsm_run **runs = tracked_malloc((size_t)(self->n_runs ? self->n_runs : 1) * sizeof(struct lsm_run *));
+    if(runs != NULL){
+        for(int i = 0; i < self->n_runs; i++){
+            runs[i] = self->runs[i];
+            run_incref(runs[i]);
+        }
+        *n_runs = self->n_runs;
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return runs;
+}
+
+static void release_snapshot(struct lsm_run **runs, int n_runs)
+{
+    for(int i = 0; i < n_runs; i++){
+        run_decref(runs[i]);
+    }
+    tracked_free(runs);
+}
+
+/*
+ * K-way merge of sorted sources, newest first, keeping the newest version of
+ * each key.
+ */
+struct merge_cursor {
+    const struct lsm_run *run;          // NULL for the memtable
+    const struct memtable_entry *mem;
+    size_t pos;                         // offset in the run or index in the memtable
+    size_t end;
+    uint64_t block;                     // run block holding pos
+    size_t block_end;                   // end of that block once checked, else 0
+    struct lsm_entry current;
+    int valid;
+    int corrupt;                        // stopped at a block that failed its crc
+};
+
+static void cursor_load(struct merge_cursor *c)
+{
+    if(c->pos >= c->end){
+        c->valid = 0;
+        return;
+    }
+    c->valid = 1;
+    if(c->run != NULL){
+        if(c->pos >= c->block_end){
+            if(c->block_end != 0){
+                c->block++;
+            }
+            if(run_check_block(c->run, c->block, &c->block_end) < 0){
+                c->valid = 0;
+                c->corrupt = 1;
+                return;
+            }
+        }
+        run_record(c->run, c->pos, &c->current);
+    } else {
+        c->current = c->mem[c->pos].e;
+    }
+}
+
+static void cursor_advance(struct merge_cursor *c)
+{
+    if(c->run != NULL){
+        struct lsm_entry e;
+        c->pos = run_record(c->run, c->pos, &e);
+    } else {
+        c->pos++;
+    }
+    cursor_load(c);
+}
+
+// Returns the index of the cursor holding the smallest key (the newest one on
+// ties) and advances every other cursor positioned on that key.
+static int merge_next(struct merge_cursor *cursors, int n)
+{
+    int best = -1;
+    for(int i = 0; i < n; i++){
+        if(!cursors[i].valid){
+            continue;
+        }
+        if(best < 0){
+            best = i;
+            continue;
+        }
+        int c = key_cmp(&cursors[i].current, &cursors[best].current);
+        if(c < 0){
+            best = i;
+        }
+    }
+    if(best < 0){
+        return -1;
+    }
+    for(int i = 0; i < n; i++){
+        if(i != best && cursors[i].valid && key_cmp(&cursors[i].current, &cursors[best].current) == 0){
+            cursor_advance(&cursors[i]);
+        }
+    }
+    return best;
+}
+
+/*
+ * Merge `runs` (newest first) into one run.  Runs in the worker thread
+ * without the GIL.
+ */
+static int LSMStore_compact(struct LSMStore *self, struct lsm_run **runs, int n_runs)
+{
+    uint64_t total = 0;
+    for(int i = 0; i < n_runs; i++){
+        total += runs[i]->n;
+    }
+    struct merge_cursor *cursors = tracked_calloc((size_t)n_runs, sizeof(struct merge_cursor));
+    struct lsm_entry *merged = tracked_malloc((size_t)(total ? total : 1) * sizeof(struct lsm_entry));
+    if(cursors == NULL || merged == NULL){
+        tracked_free(cursors);
+        tracked_free(merged);
+        return ENOMEM;
+    }
+    for(int i = 0; i < n_runs; i++){
+        cursors[i].run = runs[i];
+        cursors[i].pos = LSM_HEADER_SIZE;
+        cursors[i].end = runs[i]->records_end;
+        cursor_load(&cursors[i]);
+    }
+    size_t n = 0;
+    int best;
+    while((best = merge_next(cursors, n_runs)) >= 0){
+        merged[n++] = cursors[best].current;
+        cursor_advance(&cursors[best]);
+    }
+    int err = 0;
+    for(int i = 0; i < n_runs; i++){
+        if(cursors[i].corrupt){
+            err = EBADMSG;
+        }
+    }
+
+    // The output replaces the newest input.
+    const char *path = runs[0]->path;
+    if(err == 0 && run_write(path, merged, n) < 0){
+        err = errno;
+    }
+    tracked_free(cursors);
+    tracked_free(merged);
+    if(err != 0){
+        return err;
+    }
+
+    struct lsm_run *output = run_open(path, runs[0]->seq);
+    if(output == NULL){
+        return errno;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    // Runs flushed since the snapshot are newer and stay in front.
+    int kept = self->n_runs - n_runs;
+    for(int i = 0; i < n_runs; i++){
+        struct lsm_run *old = self->runs[kept + i];
+        if(i > 0){
+            old->obsolete = 1;
+        }
+        run_decref(old);
+    }
+    self->runs[kept] = output;
+    self->n_runs = kept + 1;
+    self->compactions++;
+    pthread_mutex_unlock(&self->mutex);
+    return 0;
+}
+
+static void *lsm_worker_main(void *p)
+{
+    struct LSMStore *self = p;
+    pthread_mutex_lock(&self->mutex);
+    for(;;){
+        while(!self->stop && self->n_runs < self->compaction_trigger){
+            pthread_cond_wait(&self->cond, &self->mutex);
+        }
+        if(self->stop){
+            break;
+        }
+        self->compacting = 1;
+        pthread_mutex_unlock(&self->mutex);
+
+        int n_runs = 0;
+        struct lsm_run **runs = LSMStore_snapshot(self, &n_runs);
+        int err = runs == NULL ? ENOMEM : LSMStore_compact(self, runs, n_runs);
+        if(runs != NULL){
+            release_snapshot(runs, n_runs);
+        }
+
+        pthread_mutex_lock(&self->mutex);
+        self->compacting = 0;
+        if(err != 0){
+            self->error = err;
+            // Do not spin on a persistent error, wait for the next flush.
+            pthread_cond_broadcast(&self->cond);
+            pthread_cond_wait(&self->cond, &self->mutex);
+        } else {
+            pthread_cond_broadcast(&self->cond);
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+}
+
+static int LSMStore_check_open(struct LSMStore *self)
+{
+    if(self->dir == NULL || self->closing){
+        PyErr_SetString(PyExc_ValueError, "LSMStore is closed");
+        return -1;
+    }
+    return 0;
+}
+
+static void memtable_clear(struct memtable_entry *memtable, Py_ssize_t *len)
+{
+    for(Py_ssize_t i = 0; i < *len; i++){
+        tracked_free(memtable[i].names);
+    }
+    *len = 0;
+}
+
+/*
+ * Become the only thread flushing.  The GIL is released while waiting and the
+ * mutex is never held while taking the GIL back.
+ */
+static void LSMStore_begin_flush(struct LSMStore *self)
+{
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    while(self->flushing){
+        pthread_cond_wait(&self->cond, &self->mutex);
+    }
+    self->flushing = 1;
+    pthread_mutex_unlock(&self->mutex);
+    Py_END_ALLOW_THREADS
+}
+
+static void LSMStore_end_flush(struct LSMStore *self)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->flushing = 0;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+/*
+ * Write the immutable memtable as the newest run.  If there is none, detach
+ * the memtable first.  Called by the thread that owns the flush.
+ */
+static int LSMStore_flush_once(struct LSMStore *self)
+{
+    if(self->immutable == NULL){
+        if(self->memtable_len == 0){
+            return 0;
+        }
+        self->immutable = self->memtable;
+        self->immutable_len = self->memtable_len;
+        self->memtable = self->spare;
+        self->memtable_len = 0;
+        self->spare = NULL;
+    }
+
+    struct lsm_entry *entries = tracked_malloc((size_t)self->immutable_len * sizeof(struct lsm_entry));
+    if(entries == NULL){
+        PyErr_NoMemory();
+        return -1;
+    }
+    for(Py_ssize_t i = 0; i < self->immutable_len; i++){
+        entries[i] = self->immutable[i].e;
+    }
+
+    pthread_mutex_lock(&self->mutex);
+    uint64_t seq = self->next_seq++;
+    pthread_mutex_unlock(&self->mutex);
+
+    char *path = run_path(self, seq);
+    if(path == NULL){
+        tracked_free(entries);
+        PyErr_NoMemory();
+        return -1;
+    }
+    int rc;
+    struct lsm_run *run = NULL;
+    Py_BEGIN_ALLOW_THREADS
+    rc = run_write(path, entries, (size_t)self->immutable_len);
+    if(rc == 0){
+        run = run_open(path, seq);
+    }
+    Py_END_ALLOW_THREADS
+    tracked_free(entries);
+    if(rc < 0 || run == NULL){
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        tracked_free(path);
+        return -1;
+    }
+    tracked_free(path);
+
+    pthread_mutex_lock(&self->mutex);
+    if(self->n_runs == self->runs_cap){
+        int cap = self->runs_cap ? self->runs_cap * 2 : 8;
+        struct lsm_run **runs = tracked_realloc(self->runs, (size_t)cap * sizeof(struct lsm_run *));
+        if(runs == NULL){
+            pthread_mutex_unlock(&self->mutex);
+            run_decref(run);
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->runs = runs;
+        self->runs_cap = cap;
+    }
+    memmove(self->runs + 1, self->runs, (size_t)self->n_runs * sizeof(struct lsm_run *));
+    self->runs[0] = run;
+    self->n_runs++;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+
+    memtable_clear(self->immutable, &self->immutable_len);
+    self->spare = self->immutable;
+    self->immutable = NULL;
+    return 0;
+}
+
+// Write the immutable memtable, then the memtable.
+static int LSMStore_flush_all(struct LSMStore *self)
+{
+    if(self->immutable != NULL && LSMStore_flush_once(self) < 0){
+        return -1;
+    }
+    return LSMStore_flush_once(self);
+}
+
+/*
+ * With full_only, flush until put() has room in the memtable, which another
+ * thread may already have made; otherwise flush everything put so far.
+ */
+static int LSMStore_flush_memtable(struct LSMStore *self, int full_only)
+{
+    LSMStore_begin_flush(self);
+    int rc = LSMStore_check_open(self);
+    if(rc == 0 && !full_only){
+        rc = LSMStore_flush_all(self);
+    }
+    while(rc == 0 && full_only && self->memtable_len == self->memtable_size){
+        rc = LSMStore_flush_once(self);
+    }
+    LSMStore_end_flush(self);
+    return rc;
+}
+
+static int compare_seq_desc(const void *a, const void *b)
+{
+    uint64_t x = (*(struct lsm_run *const *)a)->seq;
+    uint64_t y = (*(struct lsm_run *const *)b)->seq;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int LSMStore_load_runs(struct LSMStore *self)
+{
+    DIR *dir = opendir(self->dir);
+    if(dir == NULL){
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, self->dir);
+        return -1;
+    }
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL){
+        unsigned long long seq;
+        char suffix[8];
+        if(sscanf(entry->d_name, "run-%16llu.%7s", &seq, suffix) != 2 || strcmp(suffix, "lsm") != 0){
+            continue;
+        }
+        char *path = run_path(self, seq);
+        if(path == NULL){
+            closedir(dir);
+            PyErr_NoMemory();
+            return -1;
+        }
+        struct lsm_run *run = run_open(path, seq);
+        if(run == NULL){
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+            tracked_free(path);
+            closedir(dir);
+            return -1;
+        }
+        tracked_free(path);
+        if(self->n_runs == self->runs_cap){
+            int cap = self->runs_cap ? self->runs_cap * 2 : 8;
+            struct lsm_run **runs = tracked_realloc(self->runs, (size_t)cap * sizeof(struct lsm_run *));
+            if(runs == NULL){
+                run_decref(run);
+                closedir(dir);
+                PyErr_NoMemory();
+                return -1;
+            }
+            self->runs = runs;
+            self->runs_cap = cap;
+        }
+        self->runs[self->n_runs++] = run;
+        if(seq >= self->next_seq){
+            self->next_seq = seq + 1;
+        }
+    }
+    closedir(dir);
+    qsort(self->runs, (size_t)self->n_runs, sizeof(struct lsm_run *), compare_seq_desc);
+    return 0;
+}
+
+static PyObject *LSMStore_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    struct LSMStore *self = (struct LSMStore *) type->tp_alloc(type, 0);
+    if(self == NULL){
+        return NULL;
+    }
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    self->next_seq = 1;
+    return (PyObject *)self;
+}
+
+static int LSMStore_init(struct LSMStore *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *path = NULL;
+    Py_ssize_t memtable_size = 4096;
+    int compaction_trigger = 4;
+    static char *kwlist[] = {"directory", "memtable_size", "compaction_trigger", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&|ni", kwlist,
+                PyUnicode_FSConverter, &path, &memtable_size, &compaction_trigger)){
+        return -1;
+    }
+    if(self->dir != NULL){
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_RuntimeError, "LSMStore is already open");
+        return -1;
+    }
+    if(memtable_size < 1 || compaction_trigger < 2){
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_ValueError, "memtable_size must be positive and compaction_trigger at least 2");
+        return -1;
+    }
+    if(mkdir(PyBytes_AS_STRING(path), 0777) < 0 && errno != EEXIST){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return -1;
+    }
+
+    self->dir = tracked_malloc((size_t)PyBytes_GET_SIZE(path) + 1);
+    self->memtable = tracked_malloc((size_t)memtable_size * sizeof(struct memtable_entry));
+    self->spare = tracked_malloc((size_t)memtable_size * sizeof(struct memtable_entry));
+    if(self->dir == NULL || self->memtable == NULL || self->spare == NULL){
+        Py_DECREF(path);
+        PyErr_NoMemory();
+        return -1;
+    }
+    strcpy(self->dir, PyBytes_AS_STRING(path));
+    Py_DECREF(path);
+    self->memtable_size = memtable_size;
+    self->compaction_trigger = compaction_trigger;
+
+    if(LSMStore_load_runs(self) < 0){
+        return -1;
+    }
+    if(pthread_create(&self->worker, NULL, lsm_worker_main, self) != 0){
+        PyErr_SetString(PyExc_RuntimeError, "cannot start the LSMStore compaction thread");
+        return -1;
+    }
+    self->worker_started = 1;
+    return 0;
+}
+
+static void LSMStore_stop_worker(struct LSMStore *self)
+{
+    if(!self->worker_started){
+        return;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    self->stop = 1;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+    pthread_join(self->worker, NULL);
+    Py_END_ALLOW_THREADS
+    self->worker_started = 0;
+}
+
+static void LSMStore_release(struct LSMStore *self)
+{
+    LSMStore_stop_worker(self);
+    for(int i = 0; i < self->n_runs; i++){
+        run_decref(self->runs[i]);
+    }
+    tracked_free(self->runs);
+    self->runs = NULL;
+    self->n_runs = self->runs_cap = 0;
+    if(self->memtable != NULL){
+        memtable_clear(self->memtable, &self->memtable_len);
+    }
+    if(self->immutable != NULL){
+        memtable_clear(self->immutable, &self->immutable_len);
+    }
+    tracked_free(self->memtable);
+    tracked_free(self->immutable);
+    tracked_free(self->spare);
+    self->memtable = self->immutable = self->spare = NULL;
+    tracked_free(self->dir);
+    self->dir = NULL;
+}
+
+static void LSMStore_dealloc(struct LSMStore *self)
+{
+    if(self->dir != NULL && (self->memtable_len > 0 || self->immutable != NULL)){
+        PyObject *exc_type, *exc_value, *exc_tb;
+        PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+        if(LSMStore_flush_all(self) < 0){
+            PyErr_WriteUnraisable((PyObject *)self);
+        }
+        PyErr_Restore(exc_type, exc_value, exc_tb);
+    }
+    LSMStore_release(self);
+    pthread_mutex_destroy(&self->mutex);
+    pthread_cond_destroy(&self->cond);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// Index of the first memtable entry whose key is >= key.
+static Py_ssize_t memtable_lower_bound(const struct memtable_entry *memtable, Py_ssize_t len,
+                                       const struct lsm_entry *key)
+{
+    Py_ssize_t lo = 0, hi = len;
+    while(lo < hi){
+        Py_ssize_t mid = lo + (hi - lo) / 2;
+        if(key_cmp(&memtable[mid].e, key) < 0){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static PyObject *LSMStore_put(struct LSMStore *self, PyObject *person)
+{
+    if(LSMStore_check_open(self) < 0){
+        return NULL;
+    }
+    const char *first, *last;
+    Py_ssize_t first_len, last_len;
+    int number;
+    if(Person_AsUTF8(person, &first, &first_len, &last, &last_len, &number) < 0){
+        return NULL;
+    }
+    if(first_len > UINT32_MAX || last_len > UINT32_MAX){
+        PyErr_SetString(PyExc_OverflowError, "name is too long");
+        return NULL;
+    }
+
+    struct lsm_entry key = {first, last, (uint32_t)first_len, (uint32_t)last_len, number};
+    Py_ssize_t i;
+    for(;;){
+        i = memtable_lower_bound(self->memtable, self->memtable_len, &key);
+        if(i < self->memtable_len && key_cmp(&self->memtable[i].e, &key) == 0){
+            self->memtable[i].e.number = number;
+            Py_RETURN_NONE;
+        }
+        if(self->memtable_len < self->memtable_size){
+            break;
+        }
+        // Filled by other threads while a flush was in progress.
+        if(LSMStore_flush_memtable(self, 1) < 0){
+            return NULL;
+        }
+    }
+
+    char *names = tracked_malloc((size_t)(first_len + last_len) + 1);
+    if(names == NULL){
+        return PyErr_NoMemory();
+    }
+    memcpy(names, first, (size_t)first_len);
+    memcpy(names + first_len, last, (size_t)last_len);
+    memmove(&self->memtable[i + 1], &self->memtable[i], (size_t)(self->memtable_len - i) * sizeof(struct memtable_entry));
+    self->memtable[i].names = names;
+    self->memtable[i].e.first = names;
+    self->memtable[i].e.last = names + first_len;
+    self->memtable[i].e.first_len = (uint32_t)first_len;
+    self->memtable[i].e.last_len = (uint32_t)last_len;
+    self->memtable[i].e.number = number;
+    self->memtable_len++;
+
+    if(self->memtable_len == self->memtable_size && LSMStore_flush_memtable(self, 1) < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static int parse_key(PyObject *first_obj, PyObject *last_obj, struct lsm_entry *key)
+{
+    Py_ssize_t first_len, last_len;
+    if(!PyUnicode_Check(first_obj) || !PyUnicode_Check(last_obj)){
+        PyErr_SetString(PyExc_TypeError, "names must be str");
+        return -1;
+    }
+    key->first = PyUnicode_AsUTF8AndSize(first_obj, &first_len);
+    key->last = key->first == NULL ? NULL : PyUnicode_AsUTF8AndSize(last_obj, &last_len);
+    if(key->last == NULL){
+        return -1;
+    }
+    key->first_len = (uint32_t)first_len;
+    key->last_len = (uint32_t)last_len;
+    return 0;
+}
+
+static PyObject *entry_to_person(const struct lsm_entry *e)
+{
+    return Person_FromUTF8(e->first, e->first_len, e->last, e->last_len, e->number);
+}
+
+static PyObject *run_corrupt(const struct lsm_run *run)
+{
+    PyErr_Format(PyExc_ValueError, "LSM run %s is corrupt (bad checksum)", run->path);
+    return NULL;
+}
+
+static PyObject *LSMStore_get(struct LSMStore *self, PyObject *args)
+{
+    PyObject *first_obj, *last_obj;
+    struct lsm_entry key;
+    if(!PyArg_ParseTuple(args, "OO:get", &first_obj, &last_obj) || LSMStore_check_open(self) < 0
+            || parse_key(first_obj, last_obj, &key) < 0){
+        return NULL;
+    }
+
+    Py_ssize_t i = memtable_lower_bound(self->memtable, self->memtable_len, &key);
+    if(i < self->memtable_len && key_cmp(&self->memtable[i].e, &key) == 0){
+        return entry_to_person(&self->memtable[i].e);
+    }
+    i = memtable_lower_bound(self->immutable, self->immutable_len, &key);
+    if(i < self->immutable_len && key_cmp(&self->immutable[i].e, &key) == 0){
+        return entry_to_person(&self->immutable[i].e);
+    }
+
+    int n_runs = 0;
+    struct lsm_run **runs = LSMStore_snapshot(self, &n_runs);
+    if(runs == NULL){
+        return PyErr_NoMemory();
+    }
+    uint64_t hash = key_hash(&key);
+    PyObject *result = NULL;
+    for(int r = 0; r < n_runs; r++){
+        struct lsm_entry found;
+        int rc = run_get(runs[r], &key, hash, &found);
+        if(rc != 0){
+            result = rc > 0 ? entry_to_person(&found) : run_corrupt(runs[r]);
+            release_snapshot(runs, n_runs);
+            return result;
+        }
+    }
+    release_snapshot(runs, n_runs);
+    Py_RETURN_NONE;
+}
+
+/*
+ * scan(start=None, end=None): Persons with start <= (first_name, last_name) < end
+ * in key order.
+ */
+static PyObject *LSMStore_scan(struct LSMStore *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *start = Py_None, *end = Py_None;
+    static char *kwlist[] = {"start", "end", NULL};
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|OO:scan", kwlist, &start, &end)
+            || LSMStore_check_open(self) < 0){
+        return NULL;
+    }
+    struct lsm_entry start_key = {"", "", 0, 0, 0}, end_key = {0};
+    PyObject *first_obj, *last_obj;
+    if(start != Py_None && (!PyArg_ParseTuple(start, "OO;start must be a (first_name, last_name) tuple",
+                                              &first_obj, &last_obj)
+                            || parse_key(first_obj, last_obj, &start_key) < 0)){
+        return NULL;
+    }
+    if(end != Py_None && (!PyArg_ParseTuple(end, "OO;end must be a (first_name, last_name) tuple",
+                                            &first_obj, &last_obj)
+                          || parse_key(first_obj, last_obj, &end_key) < 0)){
+        return NULL;
+    }
+
+    int n_runs = 0;
+    struct lsm_run **runs = LSMStore_snapshot(self, &n_runs);
+    struct merge_cursor *cursors = tracked_calloc((size_t)n_runs + 2, sizeof(struct merge_cursor));
+    PyObject *result = PyList_New(0);
+    if(runs == NULL || cursors == NULL || result == NULL){
+        if(runs != NULL){
+            release_snapshot(runs, n_runs);
+        }
+        tracked_free(cursors);
+        Py_XDECREF(result);
+        return result == NULL ? NULL : PyErr_NoMemory();
+    }
+
+    // The memtable is the newest source, then the immutable memtable.
+    cursors[0].mem = self->memtable;
+    cursors[0].pos = (size_t)memtable_lower_bound(self->memtable, self->memtable_len, &start_key);
+    cursors[0].end = (size_t)self->memtable_len;
+    cursor_load(&cursors[0]);
+    cursors[1].mem = self->immutable;
+    cursors[1].pos = (size_t)memtable_lower_bound(self->immutable, self->immutable_len, &start_key);
+    cursors[1].end = (size_t)self->immutable_len;
+    cursor_load(&cursors[1]);
+    for(int r = 0; r < n_runs; r++){
+        cursors[r + 2].run = runs[r];
+        cursors[r + 2].end = runs[r]->records_end;
+        if(run_lower_bound(runs[r], &start_key, &cursors[r + 2].pos, &cursors[r + 2].block) < 0){
+            cursors[r + 2].corrupt = 1;
+            continue;
+        }
+        cursor_load(&cursors[r + 2]);
+    }
+
+    int best;
+    while((best = merge_next(cursors, n_runs + 2)) >= 0){
+        struct lsm_entry *e = &cursors[best].current;
+        if(end != Py_None && key_cmp(e, &end_key) >= 0){
+            break;
+        }
+        PyObject *person = entry_to_person(e);
+        if(person == NULL || PyList_Append(result, person) < 0){
+            Py_XDECREF(person);
+            Py_CLEAR(result);
+            break;
+        }
+        Py_DECREF(person);
+        cursor_advance(&cursors[best]);
+    }
+    for(int r = 0; result != NULL && r < n_runs; r++){
+        if(cursors[r + 2].corrupt){
+            Py_CLEAR(result);
+            run_corrupt(runs[r]);
+        }
+    }
+
+    tracked_free(cursors);
+    release_snapshot(runs, n_runs);
+    return result;
+}
+
+static PyObject *LSMStore_flush(struct LSMStore *self, PyObject *Py_UNUSED(ignored))
+{
+    if(LSMStore_check_open(self) < 0 || LSMStore_flush_memtable(self, 0) < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// Wait until the worker has nothing left to compact.
+static PyObject *LSMStore_wait_compaction(struct LSMStore *self, PyObject *Py_UNUSED(ignored))
+{
+    if(LSMStore_check_open(self) < 0){
+        return NULL;
+    }
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    while(self->error == 0 && (self->compacting || self->n_runs >= self->compaction_trigger)){
+        pthread_cond_wait(&self->cond, &self->mutex);
+    }
+    err = self->error;
+    self->error = 0;
+    pthread_mutex_unlock(&self->mutex);
+    Py_END_ALLOW_THREADS
+    if(err != 0){
+        errno = err;
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, self->dir);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *LSMStore_close(struct LSMStore *self, PyObject *Py_UNUSED(ignored))
+{
+    if(self->dir == NULL || self->closing){
+        Py_RETURN_NONE;
+    }
+    // Other threads see the store as closed from now on, and a flush in
+    // progress finishes before the memtables are written and freed.
+    self->closing = 1;
+    LSMStore_begin_flush(self);
+    int rc = LSMStore_flush_all(self);
+    LSMStore_release(self);
+    self->closing = 0;
+    LSMStore_end_flush(self);
+    if(rc < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *LSMStore_stats(struct LSMStore *self, PyObject *Py_UNUSED(ignored))
+{
+    pthread_mutex_lock(&self->mutex);
+    int n_runs = self->n_runs;
+    unsigned long long compactions = self->compactions;
+    unsigned long long records = 0;
+    for(int i = 0; i < self->n_runs; i++){
+        records += self->runs[i]->n;
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return Py_BuildValue("{s:n,s:i,s:K,s:K}",
+            "memtable", self->memtable_len + self->immutable_len,
+            "runs", n_runs,
+            "run_records", records,
+            "compactions", compactions);
+}
+
+static PyObject *LSMStore_enter(struct LSMStore *self, PyObject *Py_UNUSED(ignored))
+{
+    if(LSMStore_check_open(self) < 0){
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *LSMStore_exit(struct LSMStore *self, PyObject *Py_UNUSED(args))
+{
+    return LSMStore_close(self, NULL);
+}
+
+static PyMethodDef LSMStore_methods[] = {
+    {
+        .ml_name = "put",
+        .ml_meth = (PyCFunction)LSMStore_put,
+        .ml_flags = METH_O,
+        .ml_doc = "put(person): insert or replace the Person with the same first and last names",
+    },
+    {
+        .ml_name = "get",
+        .ml_meth = (PyCFunction)LSMStore_get,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "get(first_name, last_name): return the Person with these names or None",
+    },
+    {
+        .ml_name = "scan",
+        .ml_meth = (PyCFunction)(void(*)(void))LSMStore_scan,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "scan(start=None, end=None): list of the Persons whose (first_name, last_name) "
+                  "is in [start, end), sorted by name",
+    },
+    {
+        .ml_name = "flush",
+        .ml_meth = (PyCFunction)LSMStore_flush,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Write the memtable as a new run",
+    },
+    {
+        .ml_name = "wait_compaction",
+        .ml_meth = (PyCFunction)LSMStore_wait_compaction,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Block until the background compaction has caught up",
+    },
+    {
+        .ml_name = "close",
+        .ml_meth = (PyCFunction)LSMStore_close,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Flush the memtable and stop the compaction thread",
+    },
+    {
+        .ml_name = "stats",
+        .ml_meth = (PyCFunction)LSMStore_stats,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return a dict with the sizes of the memtable and runs",
+    },
+    {
+        .ml_name = "__enter__",
+        .ml_meth = (PyCFunction)LSMStore_enter,
+        .ml_flags = METH_NOARGS,
+    },
+    {
+        .ml_name = "__exit__",
+        .ml_meth = (PyCFunction)LSMStore_exit,
+        .ml_flags = METH_VARARGS,
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+static PyTypeObject LSMStoreType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.LSMStore",
+    .tp_doc = "LSMStore(directory, memtable_size=4096, compaction_trigger=4)\n\n"
+              "Log-structured merge store of Persons keyed by (first_name, last_name)",
+    .tp_basicsize = sizeof(struct LSMStore),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = LSMStore_new,
+    .tp_init = (initproc) LSMStore_init,
+    .tp_dealloc = (destructor) LSMStore_dealloc,
+    .tp_methods = LSMStore_methods,
+};
+
+int lsm_module_init(PyObject *m)
+{
+    if(PyType_Ready(&LSMStoreType) < 0){
+        return -1;
+    }
+
+    Py_INCREF(&LSMStoreType);
+    if(PyModule_AddObject(m, "LSMStore", (PyObject *)&LSMStoreType) < 0){
+        Py_DECREF(&LSMStoreType);
+        return -1;
+    }
+    return 0;
+}
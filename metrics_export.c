@@ -0,0 +1,260 @@
+/*
+ * Prometheus textfile exporter of the module's metrics.
+ *
+ * >>> mymodule.start_metrics_export("/var/lib/node_exporter/textfile/mymodule.prom", 15)
+ * >>> ...
+ * >>> mymodule.stop_metrics_export()
+ *
+ * A native thread writes the counters of stats.h, the number of Persons alive
+ * and a summary of each latency histogram (latency.h) every `interval`
+ * seconds, in the Prometheus text exposition format, for node_exporter's
+ * textfile collector.  Each file is written under a temporary name and
+ * renamed over `path`, so the collector never reads a partial file.
+ * Allocation and cache hit rates are left to PromQL: rate() of the _total
+ * counters.  reset_stats() shows up as a counter reset, which rate() handles.
+ *
+ * The thread never takes the GIL and never calls into Python: it only reads
+ * the counters and histograms, which are updated with relaxed atomics.  A
+ * file that cannot be written is skipped and retried at the next interval.
+ */
+#include <Python.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "person.h"
+#include "stats.h"
+#include "latency.h"
+#include "tracked_alloc.h"
+
+#ifdef MYMODULE_STATS
+
+static const struct {
+    enum mymodule_stat stat;
+    const char *name;
+    const char *labels;
+    const char *help;
+} counters[] = {
+    {STAT_PERSON_ALLOC, "mymodule_person_allocations_total", "", "Persons allocated"},
+    {STAT_PERSON_DEALLOC, "mymodule_person_deallocations_total", "", "Persons deallocated"},
+    {STAT_PERSON_INIT, "mymodule_person_init_total", "", "Person.__init__ calls"},
+    {STAT_PERSON_INIT_POSITIONAL, "mymodule_person_init_positional_total", "",
+     "Person.__init__ calls with positional arguments"},
+    {STAT_PERSON_INIT_KEYWORDS, "mymodule_person_init_keywords_total", "",
+     "Person.__init__ calls with keyword arguments"},
+    {STAT_PERSON_NAME, "mymodule_person_name_total", "", "Person.name calls"},
+    {STAT_PERSON_STR, "mymodule_person_str_total", "", "str(Person) calls"},
+    {STAT_POOL_HITS, "mymodule_cache_hits_total", "cache=\"person_pool\"", "Cache hits"},
+    {STAT_PAGE_HITS, "mymodule_cache_hits_total", "cache=\"paged_table\"", NULL},
+    {STAT_BLOCK_CACHE_HITS, "mymodule_cache_hits_total", "cache=\"person_file_block\"", NULL},
+    {STAT_POOL_MISSES, "mymodule_cache_misses_total", "cache=\"person_pool\"", "Cache misses"},
+    {STAT_PAGE_MISSES, "mymodule_cache_misses_total", "cache=\"paged_table\"", NULL},
+    {STAT_BLOCK_CACHE_MISSES, "mymodule_cache_misses_total", "cache=\"person_file_block\"", NULL},
+};
+
+struct exporter {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop;
+    char *path;
+    char *tmp;
+    double interval;
+};
+
+static struct exporter *exporter;   // the running exporter, protected by the GIL
+
+static int write_metrics(FILE *f)
+{
+    fprintf(f, "# HELP mymodule_persons_alive Persons currently alive\n"
+               "# TYPE mymodule_persons_alive gauge\n"
+               "mymodule_persons_alive %lld\n",
+            (long long)__atomic_load_n(&mymodule_live_persons, __ATOMIC_RELAXED));
+
+    for(size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++){
+        if(counters[i].help != NULL){
+            fprintf(f, "# HELP %s %s\n# TYPE %s counter\n", counters[i].name, counters[i].help, counters[i].name);
+        }
+        fprintf(f, "%s%s%s%s %llu\n", counters[i].name, *counters[i].labels ? "{" : "", counters[i].labels,
+                *counters[i].labels ? "}" : "",
+                (unsigned long long)__atomic_load_n(&mymodule_stats[counters[i].stat].value, __ATOMIC_RELAXED));
+    }
+
+    fprintf(f, "# HELP mymodule_latency_seconds Latency of Person operations and bulk calls, "
+               "while latency tracking is enabled\n"
+               "# TYPE mymodule_latency_seconds summary\n");
+    for(int op = 0; op < LAT_COUNT; op++){
+        struct latency_summary s;
+        if(!latency_summarize(op, &s)){
+            continue;
+        }
+        const char *name = latency_op_name(op);
+        for(int q = 0; q < LATENCY_SUMMARY_QUANTILES; q++){
+            fprintf(f, "mymodule_latency_seconds{op=\"%s\",quantile=\"%g\"} %.9f\n",
+                    name, latency_summary_quantiles[q] / 100.0, (double)s.quantiles[q] / 1e9);
+        }
+        fprintf(f, "mymodule_latency_seconds_sum{op=\"%s\"} %.9f\n", name, (double)s.sum / 1e9);
+        fprintf(f, "mymodule_latency_seconds_count{op=\"%s\"} %llu\n", name, (unsigned long long)s.count);
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+static void export_once(const struct exporter *e)
+{
+    FILE *f = fopen(e->tmp, "w");
+    if(f == NULL){
+        return;
+    }
+    int rc = write_metrics(f);
+    if(fclose(f) != 0 || rc < 0 || rename(e->tmp, e->path) < 0){
+        unlink(e->tmp);
+    }
+}
+
+static void *exporter_main(void *arg)
+{
+    struct exporter *e = arg;
+    int stop = 0;
+    while(!stop){
+        export_once(e);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        double seconds = (double)deadline.tv_sec + (double)deadline.tv_nsec / 1e9 + e->interval;
+        deadline.tv_sec = (time_t)seconds;
+        deadline.tv_nsec = (long)((seconds - (double)deadline.tv_sec) * 1e9);
+        pthread_mutex_lock(&e->mutex);
+        int rc = 0;
+        while(!e->stop && rc != ETIMEDOUT){
+            rc = pthread_cond_timedwait(&e->cond, &e->mutex, &deadline);
+        }
+        stop = e->stop;
+        pthread_mutex_unlock(&e->mutex);
+    }
+    return NULL;
+}
+
+static void exporter_free(struct exporter *e)
+{
+    pthread_mutex_destroy(&e->mutex);
+    pthread_cond_destroy(&e->cond);
+    tracked_free(e->path);
+    tracked_free(e->tmp);
+    tracked_free(e);
+}
+
+static void exporter_stop(void)
+{
+    struct exporter *e = exporter;
+    if(e == NULL){
+        return;
+    }
+    exporter = NULL;
+    pthread_mutex_lock(&e->mutex);
+    e->stop = 1;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->mutex);
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(e->thread, NULL);
+    Py_END_ALLOW_THREADS
+    exporter_free(e);
+}
+
+static PyObject *start_metrics_export(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *path;
+    double interval = 15.0;
+    static char *kwlist[] = {"path", "interval", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&|d:start_metrics_export", kwlist,
+                PyUnicode_FSConverter, &path, &interval)){
+        return NULL;
+    }
+    if(!(interval > 0.0)){
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_ValueError, "interval must be positive");
+        return NULL;
+    }
+
+    struct exporter *e = tracked_calloc(1, sizeof(*e));
+    size_t len = (size_t)PyBytes_GET_SIZE(path);
+    if(e == NULL || (e->path = tracked_malloc(len + 1)) == NULL || (e->tmp = tracked_malloc(len + 5)) == NULL){
+        if(e != NULL){
+            tracked_free(e->path);
+            tracked_free(e);
+        }
+        Py_DECREF(path);
+        return PyErr_NoMemory();
+    }
+    memcpy(e->path, PyBytes_AS_STRING(path), len + 1);
+    // node_exporter only reads *.prom files.
+    snprintf(e->tmp, len + 5, "%s.tmp", e->path);
+    Py_DECREF(path);
+    e->interval = interval;
+    pthread_mutex_init(&e->mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&e->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // exporter_stop() releases the GIL to join, and another start may install
+    // its exporter meanwhile; stop that one too so that no thread is lost.
+    while(exporter != NULL){
+        exporter_stop();
+    }
+    int rc = pthread_create(&e->thread, NULL, exporter_main, e);
+    if(rc != 0){
+        exporter_free(e);
+        errno = rc;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    exporter = e;
+    Py_RETURN_NONE;
+}
+
+static PyObject *stop_metrics_export(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    exporter_stop();
+    Py_RETURN_NONE;
+}
+
+#else
+
+static PyObject *start_metrics_export(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyErr_SetString(PyExc_RuntimeError, "mymodule was built without MYMODULE_STATS");
+    return NULL;
+}
+
+static PyObject *stop_metrics_export(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    Py_RETURN_NONE;
+}
+
+#endif
+
+static PyMethodDef metrics_export_functions[] = {
+    {
+        .ml_name = "start_metrics_export",
+        .ml_meth = (PyCFunction)(void(*)(void))start_metrics_export,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "start_metrics_export(path, interval=15.0)\n\n"
+                  "Write the module's metrics to `path` in Prometheus text format now and then every "
+                  "`interval` seconds, from a native thread, replacing any running export.",
+    },
+    {
+        .ml_name = "stop_metrics_export",
+        .ml_meth = (PyCFunction)stop_metrics_export,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Stop the thread started by start_metrics_export(); the last file is left in place",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int metrics_export_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, metrics_export_functions);
+}
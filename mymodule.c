@@ -6,11 +6,12 @@
  */
 #include <Python.h>
 #include <stdio.h>
+#include <limits.h>
 #include <stddef.h> // for offsetof()
-#include <structmember.h> // for PyMemberDef (COMPAT: Not required in future versions
-                          // however, it in later versions, it does provide the
-                          // T_OBJECT_EX, that are used below for maximum
-                          // compatibility)
+#include "person.h"
+#include "stats.h"
+#include "probes.h"
+#include "latency.h"
 /*
  * WHAT IS A PYTHON C EXTENSION MODULE
  *
@@ -134,16 +135,17 @@
  * package to be made up of C extension modules and Python modules.
  */
 
-struct Person {
-    PyObject_HEAD
-    PyObject *first_name;
-    PyObject *last_name;
-    int number;
-    char * x;
-};
+#ifdef HAVE_SYS_SDT_H
+// The semaphores of the probes.h probes, counted up by attached tracers.
+#define PROBE_SEMAPHORE_DEFINE(name) \
+    unsigned short mymodule_##name##_semaphore __attribute__((section(".probes")));
+MYMODULE_PROBES(PROBE_SEMAPHORE_DEFINE)
+#endif
 
 static void Person_dealloc(struct Person *self)
 {
+    STAT_PERSON_DESTROYED();
+    PROBE1(person_dealloc, self);
     Py_XDECREF(self->first_name);
     Py_XDECREF(self->last_name);
     Py_TYPE(self)->tp_free((PyObject *)self);
@@ -151,11 +153,14 @@ static void Person_dealloc(struct Person *self)
 
 static PyObject *Person_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
+    uint64_t started = latency_start_person();
     struct Person *self;
     self = (struct Person *) type->tp_alloc(type, 0);
     if(self == NULL){
         return NULL;
     }
+    STAT_PERSON_CREATED();
+    PROBE1(person_new, self);
 
     self->first_name = PyUnicode_FromString("John");
     if(self->first_name == NULL){
@@ -171,6 +176,7 @@ static PyObject *Person_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 
     self->number = 42;
 
+    LATENCY_END(LAT_PERSON_NEW, started);
     return (PyObject *)self;
 }
 
@@ -182,7 +188,23 @@ static int Person_init(struct Person *self, PyObject *args, PyObject *kwds)
     PyObject *last_name = NULL;
     static char *kwlist[] = {"first_name", "last_name", "number", NULL};
 
+    if(FrozenPerson_Check(self)){
+        PyErr_SetString(PyExc_TypeError, "FrozenPerson is immutable");
+        return -1;
+    }
+
+    STAT_INC(STAT_PERSON_INIT);
+    if(PyTuple_GET_SIZE(args) > 0){
+        STAT_INC(STAT_PERSON_INIT_POSITIONAL);
+    }
+    if(kwds != NULL && PyDict_GET_SIZE(kwds) > 0){
+        STAT_INC(STAT_PERSON_INIT_KEYWORDS);
+    }
+    PROBE3(person_init_entry, self, (long)PyTuple_GET_SIZE(args), (long)(kwds ? PyDict_GET_SIZE(kwds) : 0));
+    uint64_t started = latency_start_person();
     if(!PyArg_ParseTupleAndKeywords(args, kwds, "|OOi", kwlist, &first_name, &last_name, &self->number)){
+        LATENCY_END(LAT_PERSON_INIT, started);
+        PROBE2(person_init_return, self, -1);
         return -1;
     }
 
@@ -206,48 +228,119 @@ static int Person_init(struct Person *self, PyObject *args, PyObject *kwds)
         Py_XDECREF(tmp);
     }
 
+    LATENCY_END(LAT_PERSON_INIT, started);
+    PROBE2(person_init_return, self, 0);
     return 0;
 }
 
 static PyObject *Person_str(struct Person *self, PyObject *Py_UNUSED(ignored))
 {
-    return PyUnicode_FromFormat("Person(first_name=%S, last_name=%S, number=%d)", self->first_name, self->last_name, self->number);
+    STAT_INC(STAT_PERSON_STR);
+    // The names can be NULL after `del p.first_name` or after the Person was
+    // released to a PersonPool.
+    if(self->first_name == NULL){
+        PyErr_SetString(PyExc_AttributeError, "first_name");
+        return NULL;
+    }
+
+    if(self->last_name == NULL){
+        PyErr_SetString(PyExc_AttributeError, "last_name");
+        return NULL;
+    }
+
+    PROBE1(person_str_entry, self);
+    uint64_t started = latency_start_person();
+    PyObject *result = PyUnicode_FromFormat("Person(first_name=%S, last_name=%S, number=%d)", self->first_name, self->last_name, self->number);
+    LATENCY_END(LAT_PERSON_STR, started);
+    PROBE2(person_str_return, self, (long)(result ? PyUnicode_GET_LENGTH(result) : -1));
+    return result;
 }
 
 /*
- * Compat: The T_OBJECT_EX macros are replaced by Py_T_OBJECT_EX in later
- * versions of Python.  The later versions do have, for backward compatibility
- * `#define T_OBJECT_EX Py_T_OBJECT_EX` so I think using the T_OBJECT_EX
- * allows this code to compile for any relevant version.
+ * The fields are exposed with getters and setters rather than a PyMemberDef
+ * table: member descriptors can be called on a FrozenPerson through the base
+ * type (`Person.number.__set__(frozen, 1)`), so the setters must be able to
+ * refuse it.  The behaviour is otherwise that of T_OBJECT_EX and T_INT
+ * members: a deleted name raises AttributeError until it is set again.
  */
-static PyMemberDef Person_members[] = {
-    {
-        .name = "first_name",
-        .type = T_OBJECT_EX,
-        .offset = offsetof(struct Person, first_name),
-        .flags = 0,
-        .doc = "First name of the person"
-    },
-    {
-        .name = "last_name",
-        .type = T_OBJECT_EX,
-        .offset = offsetof(struct Person, last_name),
-        .flags = 0,
-        .doc = "Last name of the person"
-    },
-    {
-        .name = "number",
-        .type = T_INT,
-        .offset = offsetof(struct Person, number),
-        .flags = 0,
-        .doc = "First name of the person"
-    },
-	{NULL}
+static int Person_check_mutable(struct Person *self)
+{
+    if(FrozenPerson_Check(self)){
+        PyErr_SetString(PyExc_AttributeError, "FrozenPerson is immutable");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *Person_get_name_field(struct Person *self, void *closure)
+{
+    PyObject *value = *(PyObject **)((char *)self + (Py_ssize_t)closure);
+    if(value == NULL){
+        PyErr_SetString(PyExc_AttributeError,
+                (Py_ssize_t)closure == offsetof(struct Person, first_name) ? "first_name" : "last_name");
+        return NULL;
+    }
+    Py_INCREF(value);
+    return value;
+}
+
+static int Person_set_name_field(struct Person *self, PyObject *value, void *closure)
+{
+    if(Person_check_mutable(self) < 0){
+        return -1;
+    }
+    PyObject **field = (PyObject **)((char *)self + (Py_ssize_t)closure);
+    if(value == NULL && *field == NULL){
+        PyErr_SetString(PyExc_AttributeError,
+                (Py_ssize_t)closure == offsetof(struct Person, first_name) ? "first_name" : "last_name");
+        return -1;
+    }
+    PyObject *tmp = *field;
+    Py_XINCREF(value);
+    *field = value;
+    Py_XDECREF(tmp);
+    return 0;
+}
+
+static PyObject *Person_get_number(struct Person *self, void *Py_UNUSED(closure))
+{
+    return PyLong_FromLong(self->number);
+}
+
+static int Person_set_number(struct Person *self, PyObject *value, void *Py_UNUSED(closure))
+{
+    if(Person_check_mutable(self) < 0){
+        return -1;
+    }
+    if(value == NULL){
+        PyErr_SetString(PyExc_TypeError, "can't delete numeric/char attribute");
+        return -1;
+    }
+    long number = PyLong_AsLong(value);
+    if(number == -1 && PyErr_Occurred()){
+        return -1;
+    }
+    if(number < INT_MIN || number > INT_MAX){
+        PyErr_SetString(PyExc_OverflowError, "Python int too large to convert to C int");
+        return -1;
+    }
+    self->number = (int)number;
+    return 0;
+}
+
+static PyGetSetDef Person_getset[] = {
+    {"first_name", (getter)Person_get_name_field, (setter)Person_set_name_field,
+     "First name of the person", (void *)offsetof(struct Person, first_name)},
+    {"last_name", (getter)Person_get_name_field, (setter)Person_set_name_field,
+     "Last name of the person", (void *)offsetof(struct Person, last_name)},
+    {"number", (getter)Person_get_number, (setter)Person_set_number, "Number of the person", NULL},
+    {NULL}
 };
 
 
 static PyObject *Person_name(struct Person *self, PyObject *Py_UNUSED(args))
 {
+    STAT_INC(STAT_PERSON_NAME);
     if(self->first_name == NULL){
         PyErr_SetString(PyExc_AttributeError, "first_name");
         return NULL;
@@ -259,7 +352,12 @@ static PyObject *Person_name(struct Person *self, PyObject *Py_UNUSED(args))
         return NULL;
     }
 
-    return PyUnicode_FromFormat("%S %S", self->first_name, self->last_name);
+    PROBE1(person_name_entry, self);
+    uint64_t started = latency_start_person();
+    PyObject *result = PyUnicode_FromFormat("%S %S", self->first_name, self->last_name);
+    LATENCY_END(LAT_PERSON_NAME, started);
+    PROBE2(person_name_return, self, (long)(result ? PyUnicode_GET_LENGTH(result) : -1));
+    return result;
 }
 
 static PyMethodDef Person_methods[] = {
@@ -275,7 +373,7 @@ static PyMethodDef Person_methods[] = {
 // In the limited API, PyTypeObject is an opaque type.  Therefore, we would
 // create it by defining a PyTypeSpec instead and pass that to PyType_FromSpec()
 // which returns a PyObject* (which really is a PyTypeObject*).
-static PyTypeObject PersonType = {
+PyTypeObject PersonType = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "mymodule.Person",
     .tp_doc = "Person object",
@@ -285,11 +383,75 @@ static PyTypeObject PersonType = {
     .tp_new = Person_new,
     .tp_init = (initproc) Person_init,
     .tp_dealloc = (destructor) Person_dealloc,
-    .tp_members = Person_members,
+    .tp_getset = Person_getset,
     .tp_str = (reprfunc) Person_str,
     .tp_methods = Person_methods,
 };
 
+PyObject *Person_FromUTF8(const char *first_name, Py_ssize_t first_len,
+                          const char *last_name, Py_ssize_t last_len,
+                          int number)
+{
+    struct Person *self = (struct Person *) PersonType.tp_alloc(&PersonType, 0);
+    if(self == NULL){
+        return NULL;
+    }
+    STAT_PERSON_CREATED();
+    PROBE1(person_new, self);
+
+    self->first_name = PyUnicode_DecodeUTF8(first_name, first_len, NULL);
+    if(self->first_name == NULL){
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    self->last_name = PyUnicode_DecodeUTF8(last_name, last_len, NULL);
+    if(self->last_name == NULL){
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    self->number = number;
+
+    return (PyObject *)self;
+}
+
+int Person_AsUTF8(PyObject *person,
+                  const char **first_name, Py_ssize_t *first_len,
+                  const char **last_name, Py_ssize_t *last_len,
+                  int *number)
+{
+    if(!Person_Check(person)){
+        PyErr_Format(PyExc_TypeError, "expected a Person, got %.200s", Py_TYPE(person)->tp_name);
+        return -1;
+    }
+
+    struct Person *p = (struct Person *)person;
+    if(p->first_name == NULL || !PyUnicode_Check(p->first_name)
+            || p->last_name == NULL || !PyUnicode_Check(p->last_name)){
+        PyErr_SetString(PyExc_TypeError, "Person names must be str to be stored");
+        return -1;
+    }
+
+    *first_name = PyUnicode_AsUTF8AndSize(p->first_name, first_len);
+    if(*first_name == NULL){
+        return -1;
+    }
+    *last_name = PyUnicode_AsUTF8AndSize(p->last_name, last_len);
+    if(*last_name == NULL){
+        return -1;
+    }
+    *number = p->number;
+    return 0;
+}
+
+void Person_Reset(struct Person *self)
+{
+    Py_CLEAR(self->first_name);
+    Py_CLEAR(self->last_name);
+    self->number = 0;
+}
+
 // Passed to PyModule_Create() to create the actual module
 // The class will be added to the module subsequently using
 // PyModule_AddObject()
@@ -355,6 +517,29 @@ PyMODINIT_FUNC PyInit_mymodule(void)
         return NULL;
     }
 
+    if(paged_table_module_init(m) < 0
+            || person_columns_module_init(m) < 0
+            || shared_store_module_init(m) < 0
+            || person_pool_module_init(m) < 0
+            || frozen_person_module_init(m) < 0
+            || wal_module_init(m) < 0
+            || lsm_module_init(m) < 0
+            || person_file_module_init(m) < 0
+            || delta_module_init(m) < 0
+            || render_module_init(m) < 0
+            || arrow_ipc_module_init(m) < 0
+            || name_index_module_init(m) < 0
+            || partition_module_init(m) < 0
+            || stats_module_init(m) < 0
+            || tracked_alloc_module_init(m) < 0
+            || latency_module_init(m) < 0
+            || metrics_export_module_init(m) < 0
+            || trace_module_init(m) < 0
+            || synth_module_init(m) < 0){
+        Py_DECREF(m);
+        return NULL;
+    }
+
     printf("PY_VERSION_HEX = %x\n", PY_VERSION_HEX);
 
     return m;
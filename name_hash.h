@@ -0,0 +1,44 @@
+/*
+ * 64-bit hash of a Person name key (first_name, last_name), computed over the
+ * UTF-8 bytes.  The result does not depend on the host, so it can be stored in
+ * files.
+ */
+#ifndef MYMODULE_NAME_HASH_H
+#define MYMODULE_NAME_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "encoding.h"
+
+#define NAME_HASH_MUL 0x9E3779B97F4A7C15ull
+
+static inline uint64_t name_hash_bytes(uint64_t h, const char *p, size_t n)
+{
+    size_t len = n;
+    while(n >= 8){
+        h = (h ^ get_u64(p)) * NAME_HASH_MUL;
+        h ^= h >> 32;
+        p += 8;
+        n -= 8;
+    }
+    uint64_t tail = 0;
+    for(size_t i = 0; i < n; i++){
+        tail |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    }
+    // Mixing in the length keys ("ab", "c") and ("a", "bc") apart.
+    h = (h ^ tail ^ (uint64_t)len << 56) * NAME_HASH_MUL;
+    return h ^ (h >> 29);
+}
+
+static inline uint64_t name_hash(const char *first, size_t first_len, const char *last, size_t last_len)
+{
+    uint64_t h = name_hash_bytes(0x243F6A8885A308D3ull, first, first_len);
+    h = name_hash_bytes(h, last, last_len);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+#endif
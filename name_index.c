@@ -0,0 +1,521 @@
+/*
+ * Persistent hash index from Person names to row numbers.
+ *
+ * >>> mymodule.write_name_index("people.nx", persons)     # once
+ * >>> index = mymodule.NameIndex("people.nx")             # in every worker
+ * >>> index.lookup("Ada", "Lovelace")
+ * [1815]
+ *
+ * The row number of a Person is its position in `persons`.  The index is an
+ * open addressing hash table with linear probing, stored so that it can be
+ * used in place from a read-only mapping: opening it only checks the header,
+ * whatever the number of rows, and processes that map the same file share its
+ * pages in the page cache.
+ *
+ * File format (little endian)
+ *
+ *      header (64 bytes):
+ *          char magic[4] "MYNX" | uint32 version | uint64 n_rows
+ *          uint64 n_slots (a power of two) | uint64 slots_offset
+ *          uint64 keys_offset | uint64 keys_size | uint32 hash function
+ *          char reserved[8] | uint32 crc32c of the first 60 bytes
+ *      slot[n_slots]:  uint64 hash | uint64 key (offset of the key record in
+ *                      the key area plus one, 0 for an empty slot)
+ *      key record*:    uint64 row | uint32 first_len | uint32 last_len
+ *                      first_name | last_name
+ *
+ * All offsets in the table are relative to the key area, so the file can be
+ * mapped at any address.  The load factor is at most 1/2.  Names that occur
+ * several times have one slot per row, in row order along the probe sequence.
+ */
+#include <Python.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "person.h"
+#include "person_columns.h"
+#include "probes.h"
+#include "latency.h"
+#include "crc32c.h"
+#include "encoding.h"
+#include "name_hash.h"
+#include "tracked_alloc.h"
+
+#define NX_MAGIC "MYNX"
+#define NX_VERSION 1
+#define NX_HASH_NAME_HASH 1     // name_hash() of name_hash.h
+#define NX_HEADER_SIZE 64
+#define NX_SLOT_SIZE 16
+#define NX_RECORD_HEADER_SIZE 16
+
+/*
+ * WRITER
+ */
+
+static uint64_t nx_slots_for(uint64_t n_rows)
+{
+    uint64_t n_slots = 16;
+    while(n_slots < 2 * n_rows){
+        n_slots *= 2;
+    }
+    return n_slots;
+}
+
+// Does not touch Python state.
+static int write_index(FILE *f, const struct PersonColumns *columns)
+{
+    uint64_t n_slots = nx_slots_for((uint64_t)columns->n);
+    char *slots = tracked_calloc((size_t)n_slots, NX_SLOT_SIZE);
+    if(slots == NULL){
+        errno = ENOMEM;
+        return -1;
+    }
+    uint64_t keys_offset = NX_HEADER_SIZE + n_slots * NX_SLOT_SIZE;
+    if(fseeko(f, (off_t)keys_offset, SEEK_SET) < 0){
+        tracked_free(slots);
+        return -1;
+    }
+
+    // Stream the key records and insert each row in the table.
+    uint64_t key = 0, row = 0;
+    for(int c = 0; c < columns->n_chunks; c++){
+        const struct person_chunk *chunk = &columns->chunks[c];
+        for(Py_ssize_t i = 0; i < chunk->n; i++, row++){
+            const char *first = chunk->first_data + chunk->first_offsets[i];
+            const char *last = chunk->last_data + chunk->last_offsets[i];
+            uint32_t first_len = (uint32_t)(chunk->first_offsets[i + 1] - chunk->first_offsets[i]);
+            uint32_t last_len = (uint32_t)(chunk->last_offsets[i + 1] - chunk->last_offsets[i]);
+
+            char record[NX_RECORD_HEADER_SIZE];
+            put_u64(record, row);
+            put_u32(record + 8, first_len);
+            put_u32(record + 12, last_len);
+            if(fwrite(record, sizeof(record), 1, f) != 1
+                    || (first_len > 0 && fwrite(first, first_len, 1, f) != 1)
+                    || (last_len > 0 && fwrite(last, last_len, 1, f) != 1)){
+                tracked_free(slots);
+                return -1;
+            }
+
+            uint64_t h = name_hash(first, first_len, last, last_len);
+            uint64_t s = h & (n_slots - 1);
+            while(get_u64(slots + s * NX_SLOT_SIZE + 8) != 0){
+                s = (s + 1) & (n_slots - 1);
+            }
+            put_u64(slots + s * NX_SLOT_SIZE, h);
+            put_u64(slots + s * NX_SLOT_SIZE + 8, key + 1);
+            key += NX_RECORD_HEADER_SIZE + first_len + last_len;
+        }
+    }
+
+    char header[NX_HEADER_SIZE] = NX_MAGIC;
+    put_u32(header + 4, NX_VERSION);
+    put_u64(header + 8, row);
+    put_u64(header + 16, n_slots);
+    put_u64(header + 24, NX_HEADER_SIZE);
+    put_u64(header + 32, keys_offset);
+    put_u64(header + 40, key);
+    put_u32(header + 48, NX_HASH_NAME_HASH);
+    put_u32(header + 60, crc32c(0, header, 60));
+    int rc = fseeko(f, 0, SEEK_SET) == 0 && fwrite(header, sizeof(header), 1, f) == 1
+             && fwrite(slots, NX_SLOT_SIZE, (size_t)n_slots, f) == (size_t)n_slots ? 0 : -1;
+    tracked_free(slots);
+    return rc;
+}
+
+static PyObject *write_name_index(PyObject *module, PyObject *args)
+{
+    PyObject *path, *persons;
+    if(!PyArg_ParseTuple(args, "O&O:write_name_index", PyUnicode_FSConverter, &path, &persons)){
+        return NULL;
+    }
+    PROBE3(bulk_entry, "write_name_index", persons,
+           PersonColumns_Check(persons) ? (long)((struct PersonColumns *)persons)->n : -1L);
+    uint64_t started = latency_start();
+    PyObject *columns;
+    if(PersonColumns_Check(persons)){
+        Py_INCREF(persons);
+        columns = persons;
+    } else {
+        columns = PyObject_CallFunction((PyObject *)&PersonColumnsType, "Oi", persons, 1);
+        if(columns == NULL){
+            Py_DECREF(path);
+            PROBE3(bulk_return, "write_name_index", persons, -1L);
+            LATENCY_END(LAT_WRITE_NAME_INDEX, started);
+            return NULL;
+        }
+    }
+
+    // Written under a temporary name and renamed, so that readers never see
+    // a partial index.
+    PyObject *tmp = PyBytes_FromFormat("%s.tmp", PyBytes_AS_STRING(path));
+    if(tmp == NULL){
+        Py_DECREF(columns);
+        Py_DECREF(path);
+        PROBE3(bulk_return, "write_name_index", persons, -1L);
+        LATENCY_END(LAT_WRITE_NAME_INDEX, started);
+        return NULL;
+    }
+    int rc = -1;
+    Py_BEGIN_ALLOW_THREADS
+    FILE *f = fopen(PyBytes_AS_STRING(tmp), "wb");
+    if(f != NULL){
+        rc = write_index(f, (struct PersonColumns *)columns);
+        if(fclose(f) != 0){
+            rc = -1;
+        }
+        if(rc == 0 && rename(PyBytes_AS_STRING(tmp), PyBytes_AS_STRING(path)) < 0){
+            rc = -1;
+        }
+        if(rc < 0){
+            int saved = errno;
+            unlink(PyBytes_AS_STRING(tmp));
+            errno = saved;
+        }
+    }
+    Py_END_ALLOW_THREADS
+    Py_ssize_t n = ((struct PersonColumns *)columns)->n;
+    Py_DECREF(columns);
+    Py_DECREF(tmp);
+    PROBE3(bulk_return, "write_name_index", persons, rc < 0 ? -1L : (long)n);
+    LATENCY_END(LAT_WRITE_NAME_INDEX, started);
+    if(rc < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+    return PyLong_FromSsize_t(n);
+}
+
+/*
+ * READER
+ */
+
+struct NameIndex {
+    PyObject_HEAD
+    char *map;
+    size_t size;
+    uint64_t n_rows;
+    uint64_t n_slots;
+    const char *slots;
+    const char *keys;
+    uint64_t keys_size;
+};
+
+static PyTypeObject NameIndexType;
+
+static void NameIndex_release(struct NameIndex *self)
+{
+    if(self->map != NULL){
+        munmap(self->map, self->size);
+        self->map = NULL;
+    }
+}
+
+static void NameIndex_dealloc(struct NameIndex *self)
+{
+    NameIndex_release(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int NameIndex_init(struct NameIndex *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *path_obj = NULL;
+    static char *kwlist[] = {"path", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist, PyUnicode_FSConverter, &path_obj)){
+        return -1;
+    }
+    if(self->map != NULL){
+        Py_DECREF(path_obj);
+        PyErr_SetString(PyExc_RuntimeError, "NameIndex is already open");
+        return -1;
+    }
+
+    int fd = open(PyBytes_AS_STRING(path_obj), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        if(fd >= 0){
+            close(fd);
+        }
+        Py_DECREF(path_obj);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    char *map = size >= NX_HEADER_SIZE ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+    close(fd);
+    if(map == MAP_FAILED){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        Py_DECREF(path_obj);
+        return -1;
+    }
+
+    // Only the header is read: the table is checked as it is probed.
+    uint64_t n_slots = map ? get_u64(map + 16) : 0;
+    uint64_t slots_offset = map ? get_u64(map + 24) : 0;
+    uint64_t keys_offset = map ? get_u64(map + 32) : 0;
+    uint64_t keys_size = map ? get_u64(map + 40) : 0;
+    if(map == NULL || memcmp(map, NX_MAGIC, 4) != 0 || get_u32(map + 4) != NX_VERSION
+            || crc32c(0, map, 60) != get_u32(map + 60) || get_u32(map + 48) != NX_HASH_NAME_HASH
+            || n_slots == 0 || (n_slots & (n_slots - 1)) != 0 || slots_offset < NX_HEADER_SIZE
+            || slots_offset > size
+            || n_slots > (size - slots_offset) / NX_SLOT_SIZE
+            || keys_offset < slots_offset + n_slots * NX_SLOT_SIZE
+            || keys_offset > size || keys_size != size - keys_offset){
+        if(map != NULL){
+            munmap(map, size);
+        }
+        PyErr_Format(PyExc_ValueError, "%s is not a valid name index", PyBytes_AS_STRING(path_obj));
+        Py_DECREF(path_obj);
+        return -1;
+    }
+    Py_DECREF(path_obj);
+
+    // Probes land anywhere in the table, read-ahead would only waste memory.
+    madvise(map, size, MADV_RANDOM);
+    self->map = map;
+    self->size = size;
+    self->n_rows = get_u64(map + 8);
+    self->n_slots = n_slots;
+    self->slots = map + slots_offset;
+    self->keys = map + keys_offset;
+    self->keys_size = keys_size;
+    return 0;
+}
+
+static int NameIndex_check_open(struct NameIndex *self)
+{
+    if(self->map == NULL){
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed NameIndex");
+        return -1;
+    }
+    return 0;
+}
+
+static int NameIndex_corrupt(void)
+{
+    PyErr_SetString(PyExc_ValueError, "the name index is corrupt");
+    return -1;
+}
+
+/*
+ * Call fn(row, arg) for every row named (first, last), stopping early if fn
+ * returns non-zero.  Returns -1 with an exception set if the table is corrupt.
+ */
+static int NameIndex_probe(struct NameIndex *self, const char *first, Py_ssize_t first_len,
+                           const char *last, Py_ssize_t last_len,
+                           int (*fn)(uint64_t row, void *arg), void *arg)
+{
+    uint64_t h = name_hash(first, (size_t)first_len, last, (size_t)last_len);
+    uint64_t mask = self->n_slots - 1;
+    uint64_t s = h & mask;
+    for(uint64_t probes = 0; probes < self->n_slots; probes++, s = (s + 1) & mask){
+        const char *slot = self->slots + s * NX_SLOT_SIZE;
+        uint64_t key = get_u64(slot + 8);
+        if(key == 0){
+            return 0;
+        }
+        if(get_u64(slot) != h){
+            continue;
+        }
+        key--;
+        if(key > self->keys_size || self->keys_size - key < NX_RECORD_HEADER_SIZE){
+            return NameIndex_corrupt();
+        }
+        const char *record = self->keys + key;
+        uint64_t flen = get_u32(record + 8), llen = get_u32(record + 12);
+        if(flen + llen > self->keys_size - key - NX_RECORD_HEADER_SIZE){
+            return NameIndex_corrupt();
+        }
+        const char *name = record + NX_RECORD_HEADER_SIZE;
+        if(flen == (uint64_t)first_len && llen == (uint64_t)last_len
+                && memcmp(name, first, flen) == 0 && memcmp(name + flen, last, llen) == 0){
+            int rc = fn(get_u64(record), arg);
+            if(rc != 0){
+                return rc < 0 ? -1 : 0;
+            }
+        }
+    }
+    return 0;
+}
+
+static int NameIndex_parse(struct NameIndex *self, PyObject *args, const char *format, PyObject **extra,
+                           const char **first, Py_ssize_t *first_len, const char **last, Py_ssize_t *last_len)
+{
+    PyObject *first_obj, *last_obj;
+    if(NameIndex_check_open(self) < 0
+            || !PyArg_ParseTuple(args, format, &PyUnicode_Type, &first_obj, &PyUnicode_Type, &last_obj, extra)){
+        return -1;
+    }
+    *first = PyUnicode_AsUTF8AndSize(first_obj, first_len);
+    *last = *first ? PyUnicode_AsUTF8AndSize(last_obj, last_len) : NULL;
+    return *last ? 0 : -1;
+}
+
+static int append_row(uint64_t row, void *list)
+{
+    PyObject *n = PyLong_FromUnsignedLongLong(row);
+    int rc = n ? PyList_Append(list, n) : -1;
+    Py_XDECREF(n);
+    return rc;
+}
+
+static PyObject *NameIndex_lookup(struct NameIndex *self, PyObject *args)
+{
+    const char *first, *last;
+    Py_ssize_t first_len, last_len;
+    if(NameIndex_parse(self, args, "O!O!:lookup", NULL, &first, &first_len, &last, &last_len) < 0){
+        return NULL;
+    }
+    PyObject *rows = PyList_New(0);
+    if(rows == NULL || NameIndex_probe(self, first, first_len, last, last_len, append_row, rows) < 0){
+        Py_XDECREF(rows);
+        return NULL;
+    }
+    return rows;
+}
+
+static int first_row(uint64_t row, void *arg)
+{
+    *(uint64_t *)arg = row;
+    return 1;
+}
+
+static PyObject *NameIndex_get(struct NameIndex *self, PyObject *args)
+{
+    const char *first, *last;
+    Py_ssize_t first_len, last_len;
+    PyObject *def = Py_None;
+    if(NameIndex_parse(self, args, "O!O!|O:get", &def, &first, &first_len, &last, &last_len) < 0){
+        return NULL;
+    }
+    uint64_t row = UINT64_MAX;
+    if(NameIndex_probe(self, first, first_len, last, last_len, first_row, &row) < 0){
+        return NULL;
+    }
+    if(row == UINT64_MAX){
+        Py_INCREF(def);
+        return def;
+    }
+    return PyLong_FromUnsignedLongLong(row);
+}
+
+static Py_ssize_t NameIndex_length(struct NameIndex *self)
+{
+    return (Py_ssize_t)self->n_rows;
+}
+
+static PyObject *NameIndex_close(struct NameIndex *self, PyObject *Py_UNUSED(ignored))
+{
+    NameIndex_release(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *NameIndex_enter(struct NameIndex *self, PyObject *Py_UNUSED(ignored))
+{
+    if(NameIndex_check_open(self) < 0){
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *NameIndex_exit(struct NameIndex *self, PyObject *Py_UNUSED(args))
+{
+    NameIndex_release(self);
+    Py_RETURN_FALSE;
+}
+
+static PyObject *NameIndex_get_n_slots(struct NameIndex *self, void *Py_UNUSED(closure))
+{
+    return PyLong_FromUnsignedLongLong(self->n_slots);
+}
+
+static PySequenceMethods NameIndex_as_sequence = {
+    .sq_length = (lenfunc)NameIndex_length,
+};
+
+static PyGetSetDef NameIndex_getset[] = {
+    {"n_slots", (getter)NameIndex_get_n_slots, NULL, "Number of slots of the hash table", NULL},
+    {NULL}
+};
+
+static PyMethodDef NameIndex_methods[] = {
+    {
+        .ml_name = "lookup",
+        .ml_meth = (PyCFunction)NameIndex_lookup,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "lookup(first_name, last_name): return the rows with this name, in increasing order",
+    },
+    {
+        .ml_name = "get",
+        .ml_meth = (PyCFunction)NameIndex_get,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "get(first_name, last_name, default=None): return the first row with this name, or default",
+    },
+    {
+        .ml_name = "close",
+        .ml_meth = (PyCFunction)NameIndex_close,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Unmap the index",
+    },
+    {
+        .ml_name = "__enter__",
+        .ml_meth = (PyCFunction)NameIndex_enter,
+        .ml_flags = METH_NOARGS,
+    },
+    {
+        .ml_name = "__exit__",
+        .ml_meth = (PyCFunction)NameIndex_exit,
+        .ml_flags = METH_VARARGS,
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+static PyTypeObject NameIndexType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.NameIndex",
+    .tp_doc = "NameIndex(path)\n\nRead-only access to a name index written by write_name_index()",
+    .tp_basicsize = sizeof(struct NameIndex),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) NameIndex_init,
+    .tp_dealloc = (destructor) NameIndex_dealloc,
+    .tp_as_sequence = &NameIndex_as_sequence,
+    .tp_getset = NameIndex_getset,
+    .tp_methods = NameIndex_methods,
+};
+
+static PyMethodDef name_index_functions[] = {
+    {
+        .ml_name = "write_name_index",
+        .ml_meth = (PyCFunction)write_name_index,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "write_name_index(path, persons)\n\n"
+                  "Write a hash index from the names of a PersonColumns, or an iterable of Persons, "
+                  "to their row numbers. Return the number of rows.",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int name_index_module_init(PyObject *m)
+{
+    if(PyType_Ready(&NameIndexType) < 0){
+        return -1;
+    }
+
+    Py_INCREF(&NameIndexType);
+    if(PyModule_AddObject(m, "NameIndex", (PyObject *)&NameIndexType) < 0){
+        Py_DECREF(&NameIndexType);
+        return -1;
+    }
+    return PyModule_AddFunctions(m, name_index_functions);
+}
@@ -0,0 +1,142 @@
+#define _GNU_SOURCE
+#include <Python.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include "numa_placement.h"
+#include "tracked_alloc.h"
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+#ifndef HAVE_LIBNUMA
+static int sysfs_node_count(void)
+{
+    DIR *dir = opendir("/sys/devices/system/node");
+    if(dir == NULL){
+        return 1;
+    }
+    int count = 0;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL){
+        if(strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9'){
+            count++;
+        }
+    }
+    closedir(dir);
+    return count > 0 ? count : 1;
+}
+#endif
+
+int numa_placement_node_count(void)
+{
+    static int count = 0;
+    if(count == 0){
+#ifdef HAVE_LIBNUMA
+        count = numa_available() >= 0 ? numa_num_configured_nodes() : 1;
+        if(count < 1){
+            count = 1;
+        }
+#else
+        count = sysfs_node_count();
+#endif
+    }
+    return count;
+}
+
+#ifndef HAVE_LIBNUMA
+/*
+ * Parse a cpulist such as "0-3,8-11" as found in
+ * /sys/devices/system/node/node<N>/cpulist.
+ */
+static int parse_cpulist(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    int found = 0;
+    const char *p = list;
+    while(*p != '\0' && *p != '\n'){
+        char *end;
+        long first = strtol(p, &end, 10);
+        if(end == p){
+            return -1;
+        }
+        long last = first;
+        p = end;
+        if(*p == '-'){
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++){
+            CPU_SET((int)cpu, set);
+            found = 1;
+        }
+        if(*p == ','){
+            p++;
+        }
+    }
+    return found ? 0 : -1;
+}
+#endif
+
+int numa_placement_run_on(int node)
+{
+    if(numa_placement_node_count() <= 1){
+        return 0;
+    }
+#ifdef HAVE_LIBNUMA
+    return numa_run_on_node(node) == 0 ? 0 : -1;
+#else
+    char path[64];
+    char buf[1024];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if(f == NULL){
+        return -1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    cpu_set_t set;
+    if(parse_cpulist(buf, &set) < 0){
+        return -1;
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : -1;
+#endif
+}
+
+void *numa_placement_alloc(size_t size, int node)
+{
+    if(size == 0){
+        size = 1;
+    }
+#ifdef HAVE_LIBNUMA
+    if(numa_placement_node_count() > 1){
+        void *ptr = numa_alloc_onnode(size, node);
+        tracked_register(ptr, size);
+        return ptr;
+    }
+#endif
+    return tracked_malloc(size);
+}
+
+void numa_placement_release(void *ptr, size_t size)
+{
+    if(ptr == NULL){
+        return;
+    }
+    if(size == 0){
+        size = 1;
+    }
+#ifdef HAVE_LIBNUMA
+    if(numa_placement_node_count() > 1){
+        tracked_unregister(ptr);
+        numa_free(ptr, size);
+        return;
+    }
+#endif
+    tracked_free(ptr);
+}
@@ -0,0 +1,30 @@
+/*
+ * NUMA placement of bulk Person storage.
+ *
+ * When the module is built with libnuma (HAVE_LIBNUMA), memory is bound to a
+ * node with mbind() through numa_alloc_onnode().  Otherwise we rely on the
+ * kernel's first-touch policy: a partition is allocated and filled by a worker
+ * thread that runs on the CPUs of its home node, which places its pages there.
+ * On machines with a single node (or without /sys/devices/system/node) every
+ * function below degrades to a no-op.
+ */
+#ifndef MYMODULE_NUMA_PLACEMENT_H
+#define MYMODULE_NUMA_PLACEMENT_H
+
+#include <stddef.h>
+
+// Number of NUMA nodes, at least 1.
+int numa_placement_node_count(void);
+
+// Restrict the calling thread to the CPUs of `node`.  Returns 0 on success and
+// -1 if the node's CPUs are unknown; the thread then keeps its affinity.
+int numa_placement_run_on(int node);
+
+// Allocate `size` bytes whose pages live on `node`, tracked like
+// tracked_malloc().  Must be released with numa_placement_release() with the
+// same size.  Returns NULL on failure
+// without setting a Python exception: this is called from worker threads.
+void *numa_placement_alloc(size_t size, int node);
+void numa_placement_release(void *ptr, size_t size);
+
+#endif
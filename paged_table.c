@@ -0,0 +1,876 @@
+/*
+ * PagedTable: a disk-backed table of Persons that does not need to fit in
+ * memory.
+ *
+ * The file is a sequence of fixed-size pages.  Page 0 is the file header, all
+ * other pages are slotted data pages:
+ *
+ *      +-------------+-----------------------+-- ... --+---------------+
+ *      | page header | records growing up -> |   free   | <- slot array |
+ *      +-------------+-----------------------+-- ... --+---------------+
+ *
+ * A record is
+ *
+ *      uint16 first_len | uint16 last_len | int32 number | first | last
+ *
+ * and each slot is the uint16 offset of a record in the page.  The page header
+ * stores the row number of the first record of the page so that a point
+ * lookup is a binary search over pages followed by an O(1) slot access.
+ *
+ * Every page, and the file header, carries a CRC32C of its bytes.  It is set
+ * when the page is written back and checked when it is read into the pool.
+ *
+ * Pages are only ever accessed through a buffer pool of `pool_pages` frames.
+ * A page is pinned while its bytes are being read or written and unpinned
+ * right after.  Victims are chosen with the CLOCK algorithm.  Pages touched by
+ * sequential scans do not get their reference bit set so that a full scan does
+ * not flush the pages that point lookups keep hot, and the kernel is asked to
+ * read ahead `prefetch` pages with posix_fadvise().
+ *
+ * All I/O is done with the GIL held: the GIL is what serializes access to the
+ * pool.
+ *
+ * >>> t = mymodule.PagedTable("people.db", pool_pages=64)
+ * >>> t.append(mymodule.Person("Ada", "Lovelace", 1815))
+ * >>> t[0]
+ * >>> for p in t: ...
+ */
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "person.h"
+#include "crc32c.h"
+#include "encoding.h"
+#include "stats.h"
+#include "tracked_alloc.h"
+
+#define PT_MAGIC "MYPT"
+#define PT_VERSION 2
+
+#define PT_FILE_HEADER_SIZE 32
+#define PT_PAGE_HEADER_SIZE 16
+#define PT_RECORD_HEADER_SIZE 8
+#define PT_SLOT_SIZE 2
+
+/*
+ * File header (page 0)
+ *
+ *      char     magic[4]
+ *      uint32   version
+ *      uint32   page_size
+ *      uint32   crc        crc32c of the header with this field zero
+ *      uint64   n_rows
+ *      uint64   n_pages (including the header page)
+ *
+ * Data page header
+ *
+ *      uint64   first_row
+ *      uint16   count      number of records (and slots)
+ *      uint16   free_start offset of the end of the record area
+ *      uint32   crc        crc32c of the page with this field zero
+ */
+
+struct frame {
+    int64_t page_no;    // -1 if the frame is empty
+    int pin;
+    uint8_t ref;
+    uint8_t dirty;
+    char *data;
+};
+
+struct buffer_pool {
+    struct frame *frames;
+    char *memory;
+    Py_ssize_t n_frames;
+    Py_ssize_t hand;
+    // Open addressing page_no -> frame index, linear probing.  An entry of
+    // -1 is empty.
+    int32_t *table;
+    uint64_t table_mask;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writes;
+};
+
+struct PagedTable {
+    PyObject_HEAD
+    int fd;
+    PyObject *path;
+    uint32_t page_size;
+    uint32_t prefetch;
+    uint64_t n_rows;
+    uint64_t n_pages;
+    int header_dirty;
+    struct buffer_pool pool;
+};
+
+struct PagedTableIter {
+    PyObject_HEAD
+    struct PagedTable *table;
+    uint64_t row;
+    uint64_t page_no;
+    uint16_t slot;
+    uint64_t prefetched_until;
+};
+
+static PyTypeObject PagedTableType;
+static PyTypeObject PagedTableIterType;
+
+static int full_pread(int fd, char *buf, size_t size, off_t offset)
+{
+    while(size > 0){
+        ssize_t n = pread(fd, buf, size, offset);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        if(n == 0){
+            // Reading past the end of the file: the page was allocated but
+            // never written.
+            memset(buf, 0, size);
+            return 0;
+        }
+        buf += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int full_pwrite(int fd, const char *buf, size_t size, off_t offset)
+{
+    while(size > 0){
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+/*
+ * BUFFER POOL
+ */
+
+static inline uint64_t page_hash(int64_t page_no)
+{
+    return (uint64_t)page_no * 0x9E3779B97F4A7C15ull;
+}
+
+static int32_t *pool_slot(struct buffer_pool *pool, int64_t page_no)
+{
+    uint64_t i = page_hash(page_no) & pool->table_mask;
+    for(;;){
+        int32_t f = pool->table[i];
+        if(f < 0 || pool->frames[f].page_no == page_no){
+            return &pool->table[i];
+        }
+        i = (i + 1) & pool->table_mask;
+    }
+}
+
+// Backward shift deletion keeps linear probing chains intact without
+// tombstones.
+static void pool_table_remove(struct buffer_pool *pool, int64_t page_no)
+{
+    uint64_t i = (uint64_t)(pool_slot(pool, page_no) - pool->table);
+    pool->table[i] = -1;
+    uint64_t j = i;
+    for(;;){
+        j = (j + 1) & pool->table_mask;
+        int32_t f = pool->table[j];
+        if(f < 0){
+            return;
+        }
+        uint64_t home = page_hash(pool->frames[f].page_no) & pool->table_mask;
+        // Move the entry at j into the hole at i if its home is not in the
+        // cyclic range (i, j].
+        if((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))){
+            pool->table[i] = f;
+            pool->table[j] = -1;
+            i = j;
+        }
+    }
+}
+
+static int pool_init(struct buffer_pool *pool, Py_ssize_t n_frames, uint32_t page_size)
+{
+    memset(pool, 0, sizeof(*pool));
+    uint64_t table_size = 1;
+    while(table_size < (uint64_t)n_frames * 2){
+        table_size <<= 1;
+    }
+
+    pool->frames = tracked_calloc((size_t)n_frames, sizeof(struct frame));
+    pool->table = tracked_malloc(table_size * sizeof(int32_t));
+    pool->memory = tracked_malloc((size_t)n_frames * page_size);
+    if(pool->frames == NULL || pool->table == NULL || pool->memory == NULL){
+        tracked_free(pool->frames);
+        tracked_free(pool->table);
+        tracked_free(pool->memory);
+        memset(pool, 0, sizeof(*pool));
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    memset(pool->table, 0xff, table_size * sizeof(int32_t));
+    pool->table_mask = table_size - 1;
+    pool->n_frames = n_frames;
+    for(Py_ssize_t i = 0; i < n_frames; i++){
+        pool->frames[i].page_no = -1;
+        pool->frames[i].data = pool->memory + (size_t)i * page_size;
+    }
+    return 0;
+}
+
+static void pool_free(struct buffer_pool *pool)
+{
+    tracked_free(pool->frames);
+    tracked_free(pool->table);
+    tracked_free(pool->memory);
+    memset(pool, 0, sizeof(*pool));
+}
+
+// crc32c of `size` bytes, taking the uint32 at offset 12 as zero.
+static uint32_t page_crc(const char *page, size_t size)
+{
+    static const char zero[4] = {0};
+    uint32_t crc = crc32c(0, page, 12);
+    crc = crc32c(crc, zero, 4);
+    return crc32c(crc, page + 16, size - 16);
+}
+
+static int PagedTable_write_frame(struct PagedTable *self, struct frame *frame)
+{
+    put_u32(frame->data + 12, page_crc(frame->data, self->page_size));
+    if(full_pwrite(self->fd, frame->data, self->page_size, (off_t)frame->page_no * self->page_size) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->path);
+        return -1;
+    }
+    frame->dirty = 0;
+    self->pool.writes++;
+    return 0;
+}
+
+/*
+ * Pin a page in the pool, reading it from disk if needed.  `scan` is true for
+ * sequential access: the reference bit is left clear so the page is the first
+ * one to be evicted.
+ */
+static struct frame *PagedTable_pin(struct PagedTable *self, int64_t page_no, int scan)
+{
+    struct buffer_pool *pool = &self->pool;
+    int32_t *slot = pool_slot(pool, page_no);
+    if(*slot >= 0){
+        struct frame *frame = &pool->frames[*slot];
+        frame->pin++;
+        if(!scan){
+            frame->ref = 1;
+        }
+        pool->hits++;
+        STAT_INC(STAT_PAGE_HITS);
+        return frame;
+    }
+
+    pool->misses++;
+    STAT_INC(STAT_PAGE_MISSES);
+    Py_ssize_t victim = -1;
+    for(Py_ssize_t tries = 0; tries < 2 * pool->n_frames; tries++){
+        struct frame *frame = &pool->frames[pool->hand];
+        Py_ssize_t index = pool->hand;
+        pool->hand = (pool->hand + 1) % pool->n_frames;
+        if(frame->pin > 0){
+            continue;
+        }
+        if(frame->ref){
+            frame->ref = 0;
+            continue;
+        }
+        victim = index;
+        break;
+    }
+    if(victim < 0){
+        PyErr_SetString(PyExc_BufferError, "PagedTable: every page of the buffer pool is pinned");
+        return NULL;
+    }
+
+    struct frame *frame = &pool->frames[victim];
+    if(frame->page_no >= 0){
+        if(frame->dirty && PagedTable_write_frame(self, frame) < 0){
+            return NULL;
+        }
+        pool_table_remove(pool, frame->page_no);
+        frame->page_no = -1;
+        pool->evictions++;
+    }
+
+    if(full_pread(self->fd, frame->data, self->page_size, (off_t)page_no * self->page_size) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->path);
+        return NULL;
+    }
+    // A page past the end is being allocated and has not been written yet.
+    if(page_no < (int64_t)self->n_pages
+            && page_crc(frame->data, self->page_size) != get_u32(frame->data + 12)){
+        PyErr_Format(PyExc_ValueError, "%S: page %lld is corrupted (bad checksum)", self->path, (long long)page_no);
+        return NULL;
+    }
+
+    frame->page_no = page_no;
+    frame->pin = 1;
+    frame->ref = scan ? 0 : 1;
+    frame->dirty = 0;
+    *pool_slot(pool, page_no) = (int32_t)victim;
+    return frame;
+}
+
+static inline void PagedTable_unpin(struct frame *frame, int dirty)
+{
+    frame->pin--;
+    frame->dirty |= dirty;
+}
+
+/*
+ * TABLE
+ */
+
+static int PagedTable_check_open(struct PagedTable *self)
+{
+    if(self->fd < 0){
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed PagedTable");
+        return -1;
+    }
+    return 0;
+}
+
+static int PagedTable_write_header(struct PagedTable *self)
+{
+    char header[PT_FILE_HEADER_SIZE] = {0};
+    memcpy(header, PT_MAGIC, 4);
+    put_u32(header + 4, PT_VERSION);
+    put_u32(header + 8, self->page_size);
+    put_u64(header + 16, self->n_rows);
+    put_u64(header + 24, self->n_pages);
+    put_u32(header + 12, page_crc(header, sizeof(header)));
+    if(full_pwrite(self->fd, header, sizeof(header), 0) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->path);
+        return -1;
+    }
+    self->header_dirty = 0;
+    return 0;
+}
+
+static int PagedTable_flush_all(struct PagedTable *self)
+{
+    for(Py_ssize_t i = 0; i < self->pool.n_frames; i++){
+        struct frame *frame = &self->pool.frames[i];
+        if(frame->page_no >= 0 && frame->dirty && PagedTable_write_frame(self, frame) < 0){
+            return -1;
+        }
+    }
+    if(self->header_dirty && PagedTable_write_header(self) < 0){
+        return -1;
+    }
+    return 0;
+}
+
+static void PagedTable_dealloc(struct PagedTable *self)
+{
+    if(self->fd >= 0){
+        PyObject *exc_type, *exc_value, *exc_tb;
+        PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+        if(PagedTable_flush_all(self) < 0){
+            PyErr_WriteUnraisable((PyObject *)self);
+        }
+        PyErr_Restore(exc_type, exc_value, exc_tb);
+        close(self->fd);
+    }
+    pool_free(&self->pool);
+    Py_XDECREF(self->path);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *PagedTable_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    struct PagedTable *self = (struct PagedTable *) type->tp_alloc(type, 0);
+    if(self == NULL){
+        return NULL;
+    }
+    self->fd = -1;
+    return (PyObject *)self;
+}
+
+static int PagedTable_init(struct PagedTable *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *path = NULL;
+    Py_ssize_t pool_pages = 256;
+    unsigned int page_size = 4096;
+    unsigned int prefetch = 8;
+    static char *kwlist[] = {"path", "pool_pages", "page_size", "prefetch", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&|nII", kwlist,
+                PyUnicode_FSConverter, &path, &pool_pages, &page_size, &prefetch)){
+        return -1;
+    }
+
+    if(self->fd >= 0){
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_RuntimeError, "PagedTable is already open");
+        return -1;
+    }
+
+    if(pool_pages < 2 || pool_pages > INT32_MAX / 2){
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_ValueError, "pool_pages must be at least 2");
+        return -1;
+    }
+
+    int fd = open(PyBytes_AS_STRING(path), O_RDWR | O_CREAT, 0666);
+    if(fd < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return -1;
+    }
+
+    char header[PT_FILE_HEADER_SIZE];
+    struct stat st;
+    if(fstat(fd, &st) < 0 || full_pread(fd, header, sizeof(header), 0) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        goto fail;
+    }
+
+    if(st.st_size == 0){
+        // New file: the page size argument decides the layout.
+        if(page_size < 512 || page_size > 65536 || (page_size & (page_size - 1)) != 0){
+            PyErr_SetString(PyExc_ValueError, "page_size must be a power of two between 512 and 65536");
+            goto fail;
+        }
+        self->page_size = page_size;
+        self->n_rows = 0;
+        self->n_pages = 1;
+        self->header_dirty = 1;
+    } else {
+        // Existing file: the header decides the layout.
+        if(memcmp(header, PT_MAGIC, 4) != 0 || get_u32(header + 4) != PT_VERSION){
+            PyErr_Format(PyExc_ValueError, "%S is not a PagedTable file", path);
+            goto fail;
+        }
+        self->page_size = get_u32(header + 8);
+        self->n_rows = get_u64(header + 16);
+        self->n_pages = get_u64(header + 24);
+        if(page_crc(header, sizeof(header)) != get_u32(header + 12)
+                || self->page_size < 512 || self->page_size > 65536
+                || (self->page_size & (self->page_size - 1)) != 0 || self->n_pages == 0){
+            PyErr_Format(PyExc_ValueError, "%S has a corrupted PagedTable header", path);
+            goto fail;
+        }
+    }
+
+    if(pool_init(&self->pool, pool_pages, self->page_size) < 0){
+        goto fail;
+    }
+
+    self->fd = fd;
+    self->prefetch = prefetch;
+    // close() keeps the path of the previous file for error messages.
+    Py_XSETREF(self->path, path);
+    if(self->header_dirty && PagedTable_write_header(self) < 0){
+        return -1;
+    }
+    return 0;
+
+fail:
+    close(fd);
+    Py_DECREF(path);
+    return -1;
+}
+
+/*
+ * Encode one record at the end of the last page, starting a new page when it
+ * does not fit.
+ */
+static int PagedTable_append_one(struct PagedTable *self, PyObject *person)
+{
+    const char *first, *last;
+    Py_ssize_t first_len, last_len;
+    int number;
+    if(Person_AsUTF8(person, &first, &first_len, &last, &last_len, &number) < 0){
+        return -1;
+    }
+
+    size_t record_size = PT_RECORD_HEADER_SIZE + (size_t)first_len + (size_t)last_len;
+    if(first_len > UINT16_MAX || last_len > UINT16_MAX
+            || record_size + PT_SLOT_SIZE > self->page_size - PT_PAGE_HEADER_SIZE){
+        PyErr_Format(PyExc_ValueError, "Person record of %zu bytes does not fit in a %u byte page",
+                record_size, self->page_size);
+        return -1;
+    }
+
+    struct frame *frame = NULL;
+    if(self->n_pages > 1){
+        frame = PagedTable_pin(self, (int64_t)self->n_pages - 1, 0);
+        if(frame == NULL){
+            return -1;
+        }
+        uint16_t count = get_u16(frame->data + 8);
+        uint16_t free_start = get_u16(frame->data + 10);
+        size_t free_end = self->page_size - (size_t)(count + 1) * PT_SLOT_SIZE;
+        if(free_start + record_size > free_end){
+            PagedTable_unpin(frame, 0);
+            frame = NULL;
+        }
+    }
+
+    if(frame == NULL){
+        frame = PagedTable_pin(self, (int64_t)self->n_pages, 0);
+        if(frame == NULL){
+            return -1;
+        }
+        memset(frame->data, 0, self->page_size);
+        put_u64(frame->data, self->n_rows);
+        put_u16(frame->data + 8, 0);
+        put_u16(frame->data + 10, PT_PAGE_HEADER_SIZE);
+        self->n_pages++;
+    }
+
+    char *page = frame->data;
+    uint16_t count = get_u16(page + 8);
+    uint16_t offset = get_u16(page + 10);
+    char *record = page + offset;
+    put_u16(record, (uint16_t)first_len);
+    put_u16(record + 2, (uint16_t)last_len);
+    put_u32(record + 4, (uint32_t)number);
+    memcpy(record + PT_RECORD_HEADER_SIZE, first, (size_t)first_len);
+    memcpy(record + PT_RECORD_HEADER_SIZE + first_len, last, (size_t)last_len);
+    put_u16(page + self->page_size - (size_t)(count + 1) * PT_SLOT_SIZE, offset);
+    put_u16(page + 8, (uint16_t)(count + 1));
+    put_u16(page + 10, (uint16_t)(offset + record_size));
+    PagedTable_unpin(frame, 1);
+
+    self->n_rows++;
+    self->header_dirty = 1;
+    return 0;
+}
+
+static PyObject *PagedTable_decode(struct PagedTable *self, const char *page, uint16_t slot)
+{
+    uint16_t offset = get_u16(page + self->page_size - (size_t)(slot + 1) * PT_SLOT_SIZE);
+    const char *record = page + offset;
+    uint16_t first_len = get_u16(record);
+    uint16_t last_len = get_u16(record + 2);
+    int number = (int)get_u32(record + 4);
+    if((size_t)offset + PT_RECORD_HEADER_SIZE + first_len + last_len > self->page_size){
+        PyErr_Format(PyExc_ValueError, "%S: corrupted record", self->path);
+        return NULL;
+    }
+    return Person_FromUTF8(record + PT_RECORD_HEADER_SIZE, first_len,
+                           record + PT_RECORD_HEADER_SIZE + first_len, last_len, number);
+}
+
+static PyObject *PagedTable_append(struct PagedTable *self, PyObject *person)
+{
+    if(PagedTable_check_open(self) < 0 || PagedTable_append_one(self, person) < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PagedTable_extend(struct PagedTable *self, PyObject *iterable)
+{
+    if(PagedTable_check_open(self) < 0){
+        return NULL;
+    }
+    PyObject *iter = PyObject_GetIter(iterable);
+    if(iter == NULL){
+        return NULL;
+    }
+    PyObject *item;
+    while((item = PyIter_Next(iter)) != NULL){
+        int rc = PagedTable_append_one(self, item);
+        Py_DECREF(item);
+        if(rc < 0){
+            Py_DECREF(iter);
+            return NULL;
+        }
+    }
+    Py_DECREF(iter);
+    if(PyErr_Occurred()){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PagedTable_flush(struct PagedTable *self, PyObject *Py_UNUSED(ignored))
+{
+    if(PagedTable_check_open(self) < 0 || PagedTable_flush_all(self) < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PagedTable_close(struct PagedTable *self, PyObject *Py_UNUSED(ignored))
+{
+    if(self->fd < 0){
+        Py_RETURN_NONE;
+    }
+    int rc = PagedTable_flush_all(self);
+    close(self->fd);
+    self->fd = -1;
+    pool_free(&self->pool);
+    if(rc < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PagedTable_enter(struct PagedTable *self, PyObject *Py_UNUSED(ignored))
+{
+    if(PagedTable_check_open(self) < 0){
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *PagedTable_exit(struct PagedTable *self, PyObject *Py_UNUSED(args))
+{
+    return PagedTable_close(self, NULL);
+}
+
+static PyObject *PagedTable_pool_stats(struct PagedTable *self, PyObject *Py_UNUSED(ignored))
+{
+    return Py_BuildValue("{s:n,s:K,s:K,s:K,s:K}",
+            "pool_pages", self->pool.n_frames,
+            "hits", (unsigned long long)self->pool.hits,
+            "misses", (unsigned long long)self->pool.misses,
+            "evictions", (unsigned long long)self->pool.evictions,
+            "writes", (unsigned long long)self->pool.writes);
+}
+
+static Py_ssize_t PagedTable_length(struct PagedTable *self)
+{
+    return (Py_ssize_t)self->n_rows;
+}
+
+/*
+ * Point lookup: binary search for the last page whose first row is <= row.
+ * The pages visited by the search are regular (non scan) pins, so the top
+ * levels of the search stay in the pool.
+ */
+static PyObject *PagedTable_item(struct PagedTable *self, Py_ssize_t index)
+{
+    if(PagedTable_check_open(self) < 0){
+        return NULL;
+    }
+    if(index < 0 || (uint64_t)index >= self->n_rows){
+        PyErr_SetString(PyExc_IndexError, "PagedTable index out of range");
+        return NULL;
+    }
+    uint64_t row = (uint64_t)index;
+    uint64_t lo = 1, hi = self->n_pages - 1;
+    while(lo < hi){
+        uint64_t mid = lo + (hi - lo + 1) / 2;
+        struct frame *frame = PagedTable_pin(self, (int64_t)mid, 0);
+        if(frame == NULL){
+            return NULL;
+        }
+        uint64_t first_row = get_u64(frame->data);
+        PagedTable_unpin(frame, 0);
+        if(first_row <= row){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    struct frame *frame = PagedTable_pin(self, (int64_t)lo, 0);
+    if(frame == NULL){
+        return NULL;
+    }
+    uint64_t first_row = get_u64(frame->data);
+    uint16_t count = get_u16(frame->data + 8);
+    PyObject *result;
+    if(row < first_row || row - first_row >= count){
+        PyErr_Format(PyExc_ValueError, "%S: corrupted page directory", self->path);
+        result = NULL;
+    } else {
+        result = PagedTable_decode(self, frame->data, (uint16_t)(row - first_row));
+    }
+    PagedTable_unpin(frame, 0);
+    return result;
+}
+
+static PyObject *PagedTable_iter(struct PagedTable *self)
+{
+    if(PagedTable_check_open(self) < 0){
+        return NULL;
+    }
+    struct PagedTableIter *it = PyObject_New(struct PagedTableIter, &PagedTableIterType);
+    if(it == NULL){
+        return NULL;
+    }
+    Py_INCREF(self);
+    it->table = self;
+    it->row = 0;
+    it->page_no = 1;
+    it->slot = 0;
+    it->prefetched_until = 1;
+    return (PyObject *)it;
+}
+
+static void PagedTableIter_dealloc(struct PagedTableIter *self)
+{
+    Py_DECREF(self->table);
+    PyObject_Free(self);
+}
+
+static void PagedTable_prefetch(struct PagedTable *self, struct PagedTableIter *it)
+{
+#ifdef POSIX_FADV_WILLNEED
+    if(self->prefetch == 0 || it->page_no < it->prefetched_until){
+        return;
+    }
+    uint64_t start = it->page_no + 1;
+    uint64_t end = start + self->prefetch;
+    if(end > self->n_pages){
+        end = self->n_pages;
+    }
+    if(start < end){
+        posix_fadvise(self->fd, (off_t)start * self->page_size,
+                      (off_t)(end - start) * self->page_size, POSIX_FADV_WILLNEED);
+    }
+    it->prefetched_until = end;
+#endif
+}
+
+static PyObject *PagedTableIter_next(struct PagedTableIter *it)
+{
+    struct PagedTable *self = it->table;
+    if(PagedTable_check_open(self) < 0){
+        return NULL;
+    }
+    while(it->row < self->n_rows && it->page_no < self->n_pages){
+        if(it->slot == 0){
+            PagedTable_prefetch(self, it);
+        }
+        struct frame *frame = PagedTable_pin(self, (int64_t)it->page_no, 1);
+        if(frame == NULL){
+            return NULL;
+        }
+        uint16_t count = get_u16(frame->data + 8);
+        if(it->slot >= count){
+            PagedTable_unpin(frame, 0);
+            it->page_no++;
+            it->slot = 0;
+            continue;
+        }
+        PyObject *person = PagedTable_decode(self, frame->data, it->slot);
+        PagedTable_unpin(frame, 0);
+        it->slot++;
+        it->row++;
+        return person;
+    }
+    return NULL;
+}
+
+static PySequenceMethods PagedTable_as_sequence = {
+    .sq_length = (lenfunc) PagedTable_length,
+    .sq_item = (ssizeargfunc) PagedTable_item,
+};
+
+static PyMethodDef PagedTable_methods[] = {
+    {
+        .ml_name = "append",
+        .ml_meth = (PyCFunction)PagedTable_append,
+        .ml_flags = METH_O,
+        .ml_doc = "Append a Person at the end of the table",
+    },
+    {
+        .ml_name = "extend",
+        .ml_meth = (PyCFunction)PagedTable_extend,
+        .ml_flags = METH_O,
+        .ml_doc = "Append every Person of an iterable at the end of the table",
+    },
+    {
+        .ml_name = "flush",
+        .ml_meth = (PyCFunction)PagedTable_flush,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Write the dirty pages of the buffer pool and the header to disk",
+    },
+    {
+        .ml_name = "close",
+        .ml_meth = (PyCFunction)PagedTable_close,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Flush and close the table",
+    },
+    {
+        .ml_name = "pool_stats",
+        .ml_meth = (PyCFunction)PagedTable_pool_stats,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return a dict of buffer pool counters",
+    },
+    {
+        .ml_name = "__enter__",
+        .ml_meth = (PyCFunction)PagedTable_enter,
+        .ml_flags = METH_NOARGS,
+    },
+    {
+        .ml_name = "__exit__",
+        .ml_meth = (PyCFunction)PagedTable_exit,
+        .ml_flags = METH_VARARGS,
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+static PyTypeObject PagedTableType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.PagedTable",
+    .tp_doc = "PagedTable(path, pool_pages=256, page_size=4096, prefetch=8)\n\n"
+              "Disk-backed sequence of Persons accessed through a page buffer pool",
+    .tp_basicsize = sizeof(struct PagedTable),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PagedTable_new,
+    .tp_init = (initproc) PagedTable_init,
+    .tp_dealloc = (destructor) PagedTable_dealloc,
+    .tp_as_sequence = &PagedTable_as_sequence,
+    .tp_iter = (getiterfunc) PagedTable_iter,
+    .tp_methods = PagedTable_methods,
+};
+
+static PyTypeObject PagedTableIterType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.PagedTableIterator",
+    .tp_basicsize = sizeof(struct PagedTableIter),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) PagedTableIter_dealloc,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) PagedTableIter_next,
+};
+
+int paged_table_module_init(PyObject *m)
+{
+    if(PyType_Ready(&PagedTableType) < 0 || PyType_Ready(&PagedTableIterType) < 0){
+        return -1;
+    }
+
+    Py_INCREF(&PagedTableType);
+    if(PyModule_AddObject(m, "PagedTable", (PyObject *)&PagedTableType) < 0){
+        Py_DECREF(&PagedTableType);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,478 @@
+/*
+ * Sharding of Persons into Person files with consistent hashing.
+ *
+ * >>> mymodule.partition(persons, 8, key="name", out_dir="shards")
+ * {'version': 1, 'key': 'name', 'hash': 'jump', 'rows': 100000,
+ *  'shards': [{'path': 'part-00000.pf', 'rows': 12473}, ...]}
+ *
+ * Row i goes to shard jump_hash(hash of its key, n), so growing n from 8 to 9
+ * only moves about 1/9 of the rows, all of them to the new shard.  The hash of
+ * a key is name_hash() and does not depend on the host.  The shards are Person
+ * files (see person_file.c) named part-NNNNN.pf, and out_dir/manifest.json
+ * describes them; it is written last and atomically, so a directory with a
+ * manifest is complete.
+ *
+ * The shard of every row is computed in parallel, one thread per partition of
+ * the PersonColumns.  A counting sort then lists the rows of each shard in
+ * their original order.  Each writer thread owns a subset of the shards and
+ * writes them one after the other, so at most one Person file writer (and its
+ * block buffers) per thread is open at a time, whatever the number of shards.
+ */
+#include <Python.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "person.h"
+#include "person_columns.h"
+#include "person_file.h"
+#include "probes.h"
+#include "latency.h"
+#include "name_hash.h"
+#include "encoding.h"
+#include "tracked_alloc.h"
+
+#define PARTITION_MAX_SHARDS 100000
+#define PARTITION_MAX_WORKERS 64
+
+enum partition_key {
+    KEY_NAME,
+    KEY_FIRST_NAME,
+    KEY_LAST_NAME,
+    KEY_NUMBER,
+};
+
+static const char *key_names[] = {"name", "first_name", "last_name", "number"};
+
+// Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm".
+static int32_t jump_hash(uint64_t key, int32_t n)
+{
+    int64_t b = -1, j = 0;
+    while(j < n){
+        b = j;
+        key = key * 2862933555777941757ull + 1;
+        j = (int64_t)((double)(b + 1) * ((double)(1ll << 31) / (double)((key >> 33) + 1)));
+    }
+    return (int32_t)b;
+}
+
+struct partition_job {
+    struct PersonColumns *columns;
+    enum partition_key key;
+    int32_t n_shards;
+    int32_t **shard_of;             // shard of each row, per chunk
+    Py_ssize_t *shard_start;        // rows of shard s are order[shard_start[s]:shard_start[s + 1]]
+    Py_ssize_t *order;              // row numbers grouped by shard
+    const char *dir;
+    int block_rows;
+    struct person_file_writer **writers;    // open writer of each worker
+    uint64_t *rows;                 // rows of each shard, once closed
+    int n_workers;
+    int error;                      // first errno, 0 if none
+};
+
+static void set_error(struct partition_job *job, int error)
+{
+    int expected = 0;
+    __atomic_compare_exchange_n(&job->error, &expected, error, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static int get_error(struct partition_job *job)
+{
+    return __atomic_load_n(&job->error, __ATOMIC_RELAXED);
+}
+
+static void assign_shards(struct person_chunk *chunk, int index, void *arg)
+{
+    struct partition_job *job = arg;
+    int32_t *shard_of = job->shard_of[index];
+    for(Py_ssize_t i = 0; i < chunk->n; i++){
+        const char *first = chunk->first_data + chunk->first_offsets[i];
+        const char *last = chunk->last_data + chunk->last_offsets[i];
+        size_t first_len = (size_t)(chunk->first_offsets[i + 1] - chunk->first_offsets[i]);
+        size_t last_len = (size_t)(chunk->last_offsets[i + 1] - chunk->last_offsets[i]);
+        uint64_t h;
+        switch(job->key){
+        case KEY_FIRST_NAME:
+            h = name_hash(first, first_len, "", 0);
+            break;
+        case KEY_LAST_NAME:
+            h = name_hash("", 0, last, last_len);
+            break;
+        case KEY_NUMBER: {
+            char b[4];
+            put_u32(b, (uint32_t)chunk->number[i]);
+            h = name_hash(b, 4, "", 0);
+            break;
+        }
+        default:
+            h = name_hash(first, first_len, last, last_len);
+        }
+        shard_of[i] = jump_hash(h, job->n_shards);
+    }
+}
+
+struct partition_worker {
+    pthread_t thread;
+    struct partition_job *job;
+    int index;
+};
+
+static char *shard_path(const char *dir, int32_t s)
+{
+    size_t size = strlen(dir) + 32;
+    char *path = tracked_malloc(size);
+    if(path != NULL){
+        snprintf(path, size, "%s/part-%05d.pf", dir, (int)s);
+    }
+    return path;
+}
+
+// Write shard `s` from its rows in job->order.
+static int write_shard(struct partition_job *job, int w, int32_t s)
+{
+    const struct PersonColumns *columns = job->columns;
+    char *path = shard_path(job->dir, s);
+    struct person_file_writer *writer = path ? person_file_writer_open(path, job->block_rows, PERSON_FILE_CODEC_LZ,
+                                                                       PERSON_FILE_FILTER_DELTA | PERSON_FILE_FILTER_SHUFFLE) : NULL;
+    tracked_free(path);
+    if(writer == NULL){
+        return -1;
+    }
+    job->writers[w] = writer;
+
+    // Rows are in increasing order, so the chunk only moves forward.
+    int c = 0;
+    Py_ssize_t chunk_start = 0;
+    for(Py_ssize_t k = job->shard_start[s]; k < job->shard_start[s + 1]; k++){
+        Py_ssize_t row = job->order[k];
+        while(row >= chunk_start + columns->chunks[c].n){
+            chunk_start += columns->chunks[c].n;
+            c++;
+        }
+        const struct person_chunk *chunk = &columns->chunks[c];
+        Py_ssize_t i = row - chunk_start;
+        int32_t f0 = chunk->first_offsets[i], f1 = chunk->first_offsets[i + 1];
+        int32_t l0 = chunk->last_offsets[i], l1 = chunk->last_offsets[i + 1];
+        int full = person_file_writer_add(writer, chunk->first_data + f0, (uint32_t)(f1 - f0),
+                                          chunk->last_data + l0, (uint32_t)(l1 - l0), chunk->number[i]);
+        if(full < 0 || (full && person_file_writer_flush(writer) < 0)){
+            return -1;
+        }
+    }
+    job->rows[s] = person_file_writer_rows(writer);
+    job->writers[w] = NULL;
+    return person_file_writer_close(writer);
+}
+
+static void partition_worker_run(struct partition_job *job, int w)
+{
+    for(int32_t s = w; s < job->n_shards && get_error(job) == 0; s += job->n_workers){
+        if(write_shard(job, w, s) < 0){
+            set_error(job, errno ? errno : EIO);
+        }
+    }
+}
+
+static void *partition_worker_main(void *p)
+{
+    struct partition_worker *worker = p;
+    partition_worker_run(worker->job, worker->index);
+    return NULL;
+}
+
+static void run_workers(struct partition_job *job)
+{
+    struct partition_worker workers[PARTITION_MAX_WORKERS];
+    int started = 0;
+    for(; started < job->n_workers; started++){
+        workers[started].job = job;
+        workers[started].index = started;
+        if(pthread_create(&workers[started].thread, NULL, partition_worker_main, &workers[started]) != 0){
+            break;
+        }
+    }
+    for(int w = started; w < job->n_workers; w++){
+        partition_worker_run(job, w);
+    }
+    for(int w = 0; w < started; w++){
+        pthread_join(workers[w].thread, NULL);
+    }
+}
+
+static int write_manifest(const char *dir, const struct partition_job *job, uint64_t total)
+{
+    size_t dir_len = strlen(dir);
+    char *path = tracked_malloc(dir_len + 32);
+    char *tmp = tracked_malloc(dir_len + 32);
+    FILE *f = NULL;
+    int rc = -1;
+    if(path == NULL || tmp == NULL){
+        errno = ENOMEM;
+        goto done;
+    }
+    snprintf(path, dir_len + 32, "%s/manifest.json", dir);
+    snprintf(tmp, dir_len + 32, "%s/manifest.json.tmp", dir);
+    f = fopen(tmp, "w");
+    if(f == NULL){
+        goto done;
+    }
+    fprintf(f, "{\"version\": 1, \"format\": \"person_file\", \"key\": \"%s\", \"hash\": \"jump\", "
+               "\"rows\": %llu, \"shards\": [", key_names[job->key], (unsigned long long)total);
+    for(int32_t s = 0; s < job->n_shards; s++){
+        fprintf(f, "%s\n  {\"path\": \"part-%05d.pf\", \"rows\": %llu}", s ? "," : "",
+                (int)s, (unsigned long long)job->rows[s]);
+    }
+    fprintf(f, "\n]}\n");
+    if(fflush(f) != 0 || fsync(fileno(f)) < 0){
+        goto done;
+    }
+    int closed = fclose(f);
+    f = NULL;
+    if(closed != 0 || rename(tmp, path) < 0){
+        goto done;
+    }
+    rc = 0;
+
+done:
+    if(f != NULL){
+        int err = errno;
+        fclose(f);
+        errno = err;
+    }
+    if(rc < 0 && tmp != NULL){
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+    }
+    tracked_free(path);
+    tracked_free(tmp);
+    return rc;
+}
+
+// Counting sort of the rows by shard, stable so rows keep their order.
+static void group_rows(struct partition_job *job)
+{
+    const struct PersonColumns *columns = job->columns;
+    Py_ssize_t *next = job->shard_start + 1;
+    for(int c = 0; c < columns->n_chunks; c++){
+        for(Py_ssize_t i = 0; i < columns->chunks[c].n; i++){
+            next[job->shard_of[c][i]]++;
+        }
+    }
+    // shard_start[s + 1] becomes the start of shard s, then its end below.
+    Py_ssize_t total = 0;
+    for(int32_t s = 0; s < job->n_shards; s++){
+        Py_ssize_t count = next[s];
+        next[s] = total;
+        total += count;
+    }
+    Py_ssize_t row = 0;
+    for(int c = 0; c < columns->n_chunks; c++){
+        for(Py_ssize_t i = 0; i < columns->chunks[c].n; i++){
+            job->order[next[job->shard_of[c][i]]++] = row++;
+        }
+    }
+}
+
+// Does not touch Python state.
+static int partition_columns(struct partition_job *job)
+{
+    const char *dir = job->dir;
+    struct PersonColumns *columns = job->columns;
+    // A manifest left by an earlier run must not describe the new shards.
+    char *manifest = tracked_malloc(strlen(dir) + 32);
+    if(manifest == NULL){
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(manifest, strlen(dir) + 32, "%s/manifest.json", dir);
+    int rc = unlink(manifest);
+    tracked_free(manifest);
+    if(rc < 0 && errno != ENOENT){
+        return -1;
+    }
+
+    for(int c = 0; c < columns->n_chunks; c++){
+        job->shard_of[c] = tracked_malloc(((size_t)columns->chunks[c].n + 1) * sizeof(int32_t));
+        if(job->shard_of[c] == NULL){
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    person_chunks_parallel(columns->chunks, columns->n_chunks, assign_shards, job);
+    group_rows(job);
+    run_workers(job);
+    if(job->error != 0){
+        errno = job->error;
+        return -1;
+    }
+    return write_manifest(dir, job, (uint64_t)columns->n);
+}
+
+static void partition_cleanup(struct partition_job *job, const char *dir, int failed)
+{
+    for(int w = 0; w < job->n_workers; w++){
+        if(job->writers[w] != NULL){
+            person_file_writer_abort(job->writers[w]);
+        }
+    }
+    for(int32_t s = 0; s < job->n_shards; s++){
+        if(failed){
+            char *path = shard_path(dir, s);
+            if(path != NULL){
+                unlink(path);
+            }
+            tracked_free(path);
+        }
+    }
+    for(int c = 0; c < job->columns->n_chunks; c++){
+        tracked_free(job->shard_of[c]);
+    }
+}
+
+static PyObject *manifest_dict(const struct partition_job *job, Py_ssize_t total)
+{
+    PyObject *shards = PyList_New(job->n_shards);
+    if(shards == NULL){
+        return NULL;
+    }
+    for(int32_t s = 0; s < job->n_shards; s++){
+        char name[32];
+        snprintf(name, sizeof(name), "part-%05d.pf", (int)s);
+        PyObject *shard = Py_BuildValue("{s:s,s:K}", "path", name, "rows", (unsigned long long)job->rows[s]);
+        if(shard == NULL){
+            Py_DECREF(shards);
+            return NULL;
+        }
+        PyList_SET_ITEM(shards, s, shard);
+    }
+    return Py_BuildValue("{s:i,s:s,s:s,s:s,s:n,s:N}", "version", 1, "format", "person_file",
+                         "key", key_names[job->key], "hash", "jump", "rows", total, "shards", shards);
+}
+
+static PyObject *partition_impl(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *persons;
+    int n;
+    const char *key = "name";
+    PyObject *dir = NULL;
+    int block_rows = 4096;
+    static char *kwlist[] = {"persons", "n", "key", "out_dir", "block_rows", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "Oi|sO&i:partition", kwlist,
+                &persons, &n, &key, PyUnicode_FSConverter, &dir, &block_rows)){
+        return NULL;
+    }
+    if(dir == NULL){
+        PyErr_SetString(PyExc_TypeError, "partition() missing required argument 'out_dir'");
+        return NULL;
+    }
+    struct partition_job job = {0};
+    job.key = KEY_NAME;
+    while(job.key <= KEY_NUMBER && strcmp(key, key_names[job.key]) != 0){
+        job.key++;
+    }
+    if(job.key > KEY_NUMBER){
+        PyErr_Format(PyExc_ValueError, "unknown key '%s', expected 'name', 'first_name', 'last_name' or 'number'", key);
+        Py_DECREF(dir);
+        return NULL;
+    }
+    if(n < 1 || n > PARTITION_MAX_SHARDS || block_rows < 1 || block_rows > (1 << 24)){
+        PyErr_SetString(PyExc_ValueError, "n must be between 1 and 100000 and block_rows between 1 and 2**24");
+        Py_DECREF(dir);
+        return NULL;
+    }
+    if(mkdir(PyBytes_AS_STRING(dir), 0777) < 0 && errno != EEXIST){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, dir);
+        Py_DECREF(dir);
+        return NULL;
+    }
+
+    PyObject *columns;
+    if(PersonColumns_Check(persons)){
+        Py_INCREF(persons);
+        columns = persons;
+    } else {
+        columns = PyObject_CallFunction((PyObject *)&PersonColumnsType, "Oi", persons, 1);
+        if(columns == NULL){
+            Py_DECREF(dir);
+            return NULL;
+        }
+    }
+    job.columns = (struct PersonColumns *)columns;
+    job.n_shards = n;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    job.n_workers = n < cpus ? n : (int)(cpus > 0 ? cpus : 1);
+    if(job.n_workers > PARTITION_MAX_WORKERS){
+        job.n_workers = PARTITION_MAX_WORKERS;
+    }
+    job.dir = PyBytes_AS_STRING(dir);
+    job.block_rows = block_rows;
+    job.shard_of = tracked_calloc((size_t)job.columns->n_chunks, sizeof(int32_t *));
+    job.shard_start = tracked_calloc((size_t)n + 1, sizeof(Py_ssize_t));
+    job.order = tracked_malloc((size_t)(job.columns->n ? job.columns->n : 1) * sizeof(Py_ssize_t));
+    job.writers = tracked_calloc((size_t)job.n_workers, sizeof(struct person_file_writer *));
+    job.rows = tracked_calloc((size_t)n, sizeof(uint64_t));
+    PyObject *result = NULL;
+    if(job.shard_of == NULL || job.shard_start == NULL || job.order == NULL || job.writers == NULL || job.rows == NULL){
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    int rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = partition_columns(&job);
+    int saved = errno;
+    partition_cleanup(&job, PyBytes_AS_STRING(dir), rc < 0);
+    errno = saved;
+    Py_END_ALLOW_THREADS
+    if(rc < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, dir);
+        goto done;
+    }
+    result = manifest_dict(&job, job.columns->n);
+
+done:
+    tracked_free(job.shard_of);
+    tracked_free(job.shard_start);
+    tracked_free(job.order);
+    tracked_free(job.writers);
+    tracked_free(job.rows);
+    Py_DECREF(columns);
+    Py_DECREF(dir);
+    return result;
+}
+
+static PyObject *partition(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PROBE3(bulk_entry, "partition", args, -1L);
+    uint64_t started = latency_start();
+    PyObject *result = partition_impl(module, args, kwds);
+    PROBE3(bulk_return, "partition", args,
+           result == NULL ? -1L : PyLong_AsLong(PyDict_GetItemString(result, "rows")));
+    LATENCY_END(LAT_PARTITION, started);
+    return result;
+}
+
+static PyMethodDef partition_functions[] = {
+    {
+        .ml_name = "partition",
+        .ml_meth = (PyCFunction)(void(*)(void))partition,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "partition(persons, n, key='name', out_dir, block_rows=4096)\n\n"
+                  "Shard a PersonColumns, or an iterable of Persons, into n Person files in out_dir "
+                  "with jump consistent hashing of key ('name', 'first_name', 'last_name' or 'number'). "
+                  "Write out_dir/manifest.json and return its content.",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int partition_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, partition_functions);
+}
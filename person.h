@@ -0,0 +1,77 @@
+/*
+ * Declarations shared between mymodule.c, which defines the Person type, and
+ * the other translation units of the module that store or produce Persons.
+ *
+ * Only mymodule.c defines PyInit_mymodule().  Every other file exposes a
+ * `<name>_module_init(PyObject *m)` function that adds its types and functions
+ * to the module and returns 0 on success or -1 with an exception set.
+ */
+#ifndef MYMODULE_PERSON_H
+#define MYMODULE_PERSON_H
+
+#include <Python.h>
+
+struct Person {
+    PyObject_HEAD
+    PyObject *first_name;
+    PyObject *last_name;
+    int number;
+    char * x;
+};
+
+extern PyTypeObject PersonType;
+
+#define Person_Check(op) PyObject_TypeCheck(op, &PersonType)
+
+// FrozenPerson (frozen_person.c) is a Person whose fields never change.
+extern PyTypeObject FrozenPersonType;
+
+#define FrozenPerson_Check(op) PyObject_TypeCheck(op, &FrozenPersonType)
+
+/*
+ * Create a Person directly from UTF-8 buffers, bypassing Person_new() and
+ * Person_init().  This is what storage code uses to materialize records.
+ */
+PyObject *Person_FromUTF8(const char *first_name, Py_ssize_t first_len,
+                          const char *last_name, Py_ssize_t last_len,
+                          int number);
+
+/*
+ * Borrow the UTF-8 representation of the name fields of a Person.  Returns -1
+ * with TypeError set if the object is not a Person or if a name is not a str.
+ * The buffers are cached by the str objects and stay valid as long as the
+ * Person keeps a reference to them.
+ */
+int Person_AsUTF8(PyObject *person,
+                  const char **first_name, Py_ssize_t *first_len,
+                  const char **last_name, Py_ssize_t *last_len,
+                  int *number);
+
+/*
+ * Put a Person back in the state it has right after tp_alloc(): fields are
+ * cleared and anything derived from them is invalidated.  Used by PersonPool
+ * before handing an object out again.
+ */
+void Person_Reset(struct Person *self);
+
+int paged_table_module_init(PyObject *m);
+int person_columns_module_init(PyObject *m);
+int shared_store_module_init(PyObject *m);
+int person_pool_module_init(PyObject *m);
+int frozen_person_module_init(PyObject *m);
+int wal_module_init(PyObject *m);
+int lsm_module_init(PyObject *m);
+int person_file_module_init(PyObject *m);
+int delta_module_init(PyObject *m);
+int render_module_init(PyObject *m);
+int arrow_ipc_module_init(PyObject *m);
+int name_index_module_init(PyObject *m);
+int partition_module_init(PyObject *m);
+int stats_module_init(PyObject *m);
+int tracked_alloc_module_init(PyObject *m);
+int latency_module_init(PyObject *m);
+int metrics_export_module_init(PyObject *m);
+int trace_module_init(PyObject *m);
+int synth_module_init(PyObject *m);
+
+#endif
@@ -0,0 +1,653 @@
+/*
+ * PersonColumns: NUMA-partitioned columnar storage of Persons.
+ *
+ * >>> cols = mymodule.PersonColumns(persons)          # one partition per node
+ * >>> cols = mymodule.PersonColumns(persons, partitions=8)
+ * >>> cols.sum_number(), cols.count_range(0, 100), cols.select_range(0, 100)
+ *
+ * Construction happens in two steps.  With the GIL held, we take a reference
+ * to the name strings of every Person and borrow their UTF-8 buffers.  Then,
+ * with the GIL released, one worker per partition moves to the partition's
+ * home node, allocates the partition's arrays and fills them.  Without
+ * libnuma this first touch from the home node is what places the pages.
+ *
+ * Partition i lives on node i % numa_placement_node_count().
+ */
+#include <Python.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "person.h"
+#include "person_columns.h"
+#include "numa_placement.h"
+#include "probes.h"
+#include "latency.h"
+#include "trace.h"
+#include "tracked_alloc.h"
+
+int person_chunk_alloc(struct person_chunk *chunk, Py_ssize_t n,
+                       size_t first_size, size_t last_size, int node)
+{
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->n = n;
+    chunk->node = node;
+    chunk->first_size = first_size;
+    chunk->last_size = last_size;
+    chunk->number = numa_placement_alloc((size_t)n * sizeof(int32_t), node);
+    chunk->first_offsets = numa_placement_alloc((size_t)(n + 1) * sizeof(int32_t), node);
+    chunk->first_data = numa_placement_alloc(first_size, node);
+    chunk->last_offsets = numa_placement_alloc((size_t)(n + 1) * sizeof(int32_t), node);
+    chunk->last_data = numa_placement_alloc(last_size, node);
+    if(chunk->number == NULL || chunk->first_offsets == NULL || chunk->first_data == NULL
+            || chunk->last_offsets == NULL || chunk->last_data == NULL){
+        person_chunk_free(chunk);
+        return -1;
+    }
+    return 0;
+}
+
+void person_chunk_free(struct person_chunk *chunk)
+{
+    Py_ssize_t n = chunk->n;
+    numa_placement_release(chunk->number, (size_t)n * sizeof(int32_t));
+    numa_placement_release(chunk->first_offsets, (size_t)(n + 1) * sizeof(int32_t));
+    numa_placement_release(chunk->first_data, chunk->first_size);
+    numa_placement_release(chunk->last_offsets, (size_t)(n + 1) * sizeof(int32_t));
+    numa_placement_release(chunk->last_data, chunk->last_size);
+    memset(chunk, 0, sizeof(*chunk));
+}
+
+PyObject *person_chunk_get(const struct person_chunk *chunk, Py_ssize_t i)
+{
+    int32_t f0 = chunk->first_offsets[i], f1 = chunk->first_offsets[i + 1];
+    int32_t l0 = chunk->last_offsets[i], l1 = chunk->last_offsets[i + 1];
+    return Person_FromUTF8(chunk->first_data + f0, f1 - f0,
+                           chunk->last_data + l0, l1 - l0,
+                           chunk->number[i]);
+}
+
+struct chunk_thread {
+    pthread_t thread;
+    struct person_chunk *chunk;
+    int index;
+    person_chunk_func fn;
+    void *arg;
+};
+
+static void run_chunk(struct person_chunk *chunk, int index, person_chunk_func fn, void *arg)
+{
+    PROBE4(chunk_entry, chunk, index, chunk->node, (long)chunk->n);
+    uint64_t started = trace_start();
+    fn(chunk, index, arg);
+    TRACE_END("person_chunk", started, chunk->n);
+    PROBE4(chunk_return, chunk, index, chunk->node, (long)chunk->n);
+}
+
+static void *chunk_thread_main(void *p)
+{
+    struct chunk_thread *t = p;
+    numa_placement_run_on(t->chunk->node);
+    run_chunk(t->chunk, t->index, t->fn, t->arg);
+    return NULL;
+}
+
+#if defined(HAVE_SYS_SDT_H) || defined(MYMODULE_STATS)
+static long chunk_rows(const struct person_chunk *chunks, int n_chunks)
+{
+    long rows = 0;
+    for(int i = 0; i < n_chunks; i++){
+        rows += (long)chunks[i].n;
+    }
+    return rows;
+}
+#endif
+
+static void chunks_parallel(struct person_chunk *chunks, int n_chunks,
+                            person_chunk_func fn, void *arg)
+{
+    if(n_chunks == 1){
+        run_chunk(&chunks[0], 0, fn, arg);
+        return;
+    }
+
+    struct chunk_thread *threads = tracked_calloc((size_t)n_chunks, sizeof(struct chunk_thread));
+    int started = 0;
+    if(threads != NULL){
+        for(; started < n_chunks; started++){
+            struct chunk_thread *t = &threads[started];
+            t->chunk = &chunks[started];
+            t->index = started;
+            t->fn = fn;
+            t->arg = arg;
+            if(pthread_create(&t->thread, NULL, chunk_thread_main, t) != 0){
+                break;
+            }
+        }
+    }
+    for(int i = started; i < n_chunks; i++){
+        run_chunk(&chunks[i], i, fn, arg);
+    }
+    for(int i = 0; i < started; i++){
+        pthread_join(threads[i].thread, NULL);
+    }
+    tracked_free(threads);
+}
+
+void person_chunks_parallel(struct person_chunk *chunks, int n_chunks,
+                            person_chunk_func fn, void *arg)
+{
+    PROBE3(chunks_entry, chunks, n_chunks, chunk_rows(chunks, n_chunks));
+    uint64_t started = trace_start();
+    chunks_parallel(chunks, n_chunks, fn, arg);
+    TRACE_END("person_chunks_parallel", started, chunk_rows(chunks, n_chunks));
+    PROBE3(chunks_return, chunks, n_chunks, chunk_rows(chunks, n_chunks));
+}
+
+/*
+ * CONSTRUCTION
+ */
+
+struct row_ref {
+    PyObject *first_obj;
+    PyObject *last_obj;
+    const char *first;
+    const char *last;
+    Py_ssize_t first_len;
+    Py_ssize_t last_len;
+    int number;
+};
+
+struct build_args {
+    struct row_ref *rows;
+    Py_ssize_t *starts;
+    int failed;
+};
+
+static void build_chunk(struct person_chunk *chunk, int index, void *p)
+{
+    struct build_args *args = p;
+    Py_ssize_t start = args->starts[index];
+    Py_ssize_t n = args->starts[index + 1] - start;
+    struct row_ref *rows = args->rows + start;
+    int node = chunk->node;
+
+    size_t first_size = 0, last_size = 0;
+    for(Py_ssize_t i = 0; i < n; i++){
+        first_size += (size_t)rows[i].first_len;
+        last_size += (size_t)rows[i].last_len;
+    }
+    if(first_size > INT32_MAX || last_size > INT32_MAX
+            || person_chunk_alloc(chunk, n, first_size, last_size, node) < 0){
+        __atomic_store_n(&args->failed, 1, __ATOMIC_RELAXED);
+        chunk->n = 0;
+        chunk->node = node;
+        return;
+    }
+
+    int32_t f = 0, l = 0;
+    for(Py_ssize_t i = 0; i < n; i++){
+        chunk->number[i] = rows[i].number;
+        chunk->first_offsets[i] = f;
+        memcpy(chunk->first_data + f, rows[i].first, (size_t)rows[i].first_len);
+        f += (int32_t)rows[i].first_len;
+        chunk->last_offsets[i] = l;
+        memcpy(chunk->last_data + l, rows[i].last, (size_t)rows[i].last_len);
+        l += (int32_t)rows[i].last_len;
+    }
+    chunk->first_offsets[n] = f;
+    chunk->last_offsets[n] = l;
+}
+
+// Free an array of chunks, and their arrays unless they are borrowed.
+static void free_chunks(struct person_chunk *chunks, int n_chunks, PyObject *owner)
+{
+    if(owner == NULL){
+        for(int i = 0; i < n_chunks; i++){
+            person_chunk_free(&chunks[i]);
+        }
+    }
+    tracked_free(chunks);
+}
+
+static void PersonColumns_dealloc(struct PersonColumns *self)
+{
+    free_chunks(self->chunks, self->n_chunks, self->owner);
+    Py_XDECREF(self->owner);
+    tracked_free(self->starts);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// The arrays of a chunk are allocated by a worker thread without the GIL, so
+// they are registered with tracemalloc here, on behalf of the Python code that
+// created the PersonColumns.
+static void register_chunk(const struct person_chunk *chunk)
+{
+    Py_ssize_t n = chunk->n;
+    tracked_register(chunk->number, n > 0 ? (size_t)n * sizeof(int32_t) : 1);
+    tracked_register(chunk->first_offsets, (size_t)(n + 1) * sizeof(int32_t));
+    tracked_register(chunk->first_data, chunk->first_size > 0 ? chunk->first_size : 1);
+    tracked_register(chunk->last_offsets, (size_t)(n + 1) * sizeof(int32_t));
+    tracked_register(chunk->last_data, chunk->last_size > 0 ? chunk->last_size : 1);
+}
+
+static int PersonColumns_set_chunks(struct PersonColumns *self, struct person_chunk *chunks, int n_chunks)
+{
+    self->starts = tracked_malloc(((size_t)n_chunks + 1) * sizeof(Py_ssize_t));
+    if(self->starts == NULL){
+        free_chunks(chunks, n_chunks, self->owner);
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->chunks = chunks;
+    self->n_chunks = n_chunks;
+    self->n = 0;
+    for(int i = 0; i < n_chunks; i++){
+        self->starts[i] = self->n;
+        self->n += chunks[i].n;
+        if(self->owner == NULL){
+            register_chunk(&chunks[i]);
+        }
+    }
+    self->starts[n_chunks] = self->n;
+    return 0;
+}
+
+static PyObject *PersonColumns_create(struct person_chunk *chunks, int n_chunks, PyObject *owner)
+{
+    struct PersonColumns *self = (struct PersonColumns *) PersonColumnsType.tp_alloc(&PersonColumnsType, 0);
+    if(self == NULL){
+        free_chunks(chunks, n_chunks, owner);
+        return NULL;
+    }
+    Py_XINCREF(owner);
+    self->owner = owner;
+    if(PersonColumns_set_chunks(self, chunks, n_chunks) < 0){
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+PyObject *PersonColumns_FromChunks(struct person_chunk *chunks, int n_chunks)
+{
+    return PersonColumns_create(chunks, n_chunks, NULL);
+}
+
+PyObject *PersonColumns_FromBorrowedChunks(struct person_chunk *chunks, int n_chunks, PyObject *owner)
+{
+    return PersonColumns_create(chunks, n_chunks, owner);
+}
+
+static int PersonColumns_init(struct PersonColumns *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *persons = NULL;
+    int n_chunks = 0;
+    static char *kwlist[] = {"persons", "partitions", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &persons, &n_chunks)){
+        return -1;
+    }
+
+    if(self->chunks != NULL){
+        PyErr_SetString(PyExc_RuntimeError, "PersonColumns is already initialized");
+        return -1;
+    }
+
+    int nodes = numa_placement_node_count();
+    if(n_chunks <= 0){
+        n_chunks = nodes;
+    }
+
+    PyObject *seq = PySequence_Fast(persons, "persons must be an iterable of Person");
+    if(seq == NULL){
+        return -1;
+    }
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PROBE3(bulk_entry, "PersonColumns", persons, (long)n);
+    uint64_t started = latency_start();
+    if(n_chunks > n && n > 0){
+        n_chunks = (int)n;
+    }
+
+    struct row_ref *rows = tracked_calloc(n > 0 ? (size_t)n : 1, sizeof(struct row_ref));
+    Py_ssize_t *starts = tracked_malloc(((size_t)n_chunks + 1) * sizeof(Py_ssize_t));
+    struct person_chunk *chunks = tracked_calloc((size_t)n_chunks, sizeof(struct person_chunk));
+    Py_ssize_t referenced = 0;
+    int rc = -1;
+    if(rows == NULL || starts == NULL || chunks == NULL){
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    // Keep the name strings alive while the workers copy them without the GIL.
+    uint64_t extracting = trace_start();
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    for(; referenced < n; referenced++){
+        struct row_ref *row = &rows[referenced];
+        if(Person_AsUTF8(items[referenced], &row->first, &row->first_len,
+                         &row->last, &row->last_len, &row->number) < 0){
+            goto done;
+        }
+        row->first_obj = ((struct Person *)items[referenced])->first_name;
+        row->last_obj = ((struct Person *)items[referenced])->last_name;
+        Py_INCREF(row->first_obj);
+        Py_INCREF(row->last_obj);
+    }
+    TRACE_END("PersonColumns.extract", extracting, n);
+
+    for(int i = 0; i <= n_chunks; i++){
+        starts[i] = (Py_ssize_t)((int64_t)n * i / n_chunks);
+    }
+    for(int i = 0; i < n_chunks; i++){
+        chunks[i].node = i % nodes;
+    }
+
+    struct build_args build = {.rows = rows, .starts = starts, .failed = 0};
+    Py_BEGIN_ALLOW_THREADS
+    person_chunks_parallel(chunks, n_chunks, build_chunk, &build);
+    Py_END_ALLOW_THREADS
+
+    if(build.failed){
+        for(int i = 0; i < n_chunks; i++){
+            person_chunk_free(&chunks[i]);
+        }
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    rc = PersonColumns_set_chunks(self, chunks, n_chunks);
+    chunks = NULL;
+
+done:
+    for(Py_ssize_t i = 0; i < referenced; i++){
+        Py_DECREF(rows[i].first_obj);
+        Py_DECREF(rows[i].last_obj);
+    }
+    tracked_free(rows);
+    tracked_free(starts);
+    tracked_free(chunks);
+    Py_DECREF(seq);
+    PROBE3(bulk_return, "PersonColumns", persons, rc == 0 ? (long)n : -1L);
+    LATENCY_END(LAT_PERSON_COLUMNS, started);
+    return rc;
+}
+
+/*
+ * SEQUENCE PROTOCOL
+ */
+
+static Py_ssize_t PersonColumns_length(struct PersonColumns *self)
+{
+    return self->n;
+}
+
+static PyObject *PersonColumns_item(struct PersonColumns *self, Py_ssize_t index)
+{
+    if(index < 0 || index >= self->n){
+        PyErr_SetString(PyExc_IndexError, "PersonColumns index out of range");
+        return NULL;
+    }
+    int lo = 0, hi = self->n_chunks - 1;
+    while(lo < hi){
+        int mid = lo + (hi - lo + 1) / 2;
+        if(self->starts[mid] <= index){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return person_chunk_get(&self->chunks[lo], index - self->starts[lo]);
+}
+
+/*
+ * BULK OPERATIONS
+ *
+ * Each one fills a per-chunk result slot from a worker running on the chunk's
+ * home node, then combines the slots with the GIL held.
+ */
+
+struct range_args {
+    int lo;
+    int hi;
+    int64_t *results;
+    Py_ssize_t **selected;
+};
+
+static void sum_chunk(struct person_chunk *chunk, int index, void *p)
+{
+    struct range_args *args = p;
+    int64_t sum = 0;
+    for(Py_ssize_t i = 0; i < chunk->n; i++){
+        sum += chunk->number[i];
+    }
+    args->results[index] = sum;
+}
+
+static void count_chunk(struct person_chunk *chunk, int index, void *p)
+{
+    struct range_args *args = p;
+    int64_t count = 0;
+    for(Py_ssize_t i = 0; i < chunk->n; i++){
+        count += chunk->number[i] >= args->lo && chunk->number[i] < args->hi;
+    }
+    args->results[index] = count;
+}
+
+static void select_chunk(struct person_chunk *chunk, int index, void *p)
+{
+    struct range_args *args = p;
+    Py_ssize_t *selected = tracked_malloc((size_t)(chunk->n > 0 ? chunk->n : 1) * sizeof(Py_ssize_t));
+    int64_t count = 0;
+    if(selected == NULL){
+        args->results[index] = -1;
+        return;
+    }
+    for(Py_ssize_t i = 0; i < chunk->n; i++){
+        selected[count] = i;
+        count += chunk->number[i] >= args->lo && chunk->number[i] < args->hi;
+    }
+    args->selected[index] = selected;
+    args->results[index] = count;
+}
+
+static int PersonColumns_run(struct PersonColumns *self, person_chunk_func fn, struct range_args *args)
+{
+    args->results = tracked_calloc((size_t)self->n_chunks, sizeof(int64_t));
+    if(args->results == NULL){
+        PyErr_NoMemory();
+        return -1;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    person_chunks_parallel(self->chunks, self->n_chunks, fn, args);
+    Py_END_ALLOW_THREADS
+    return 0;
+}
+
+static PyObject *PersonColumns_sum_number(struct PersonColumns *self, PyObject *Py_UNUSED(ignored))
+{
+    struct range_args args = {0};
+    PROBE3(bulk_entry, "sum_number", self, (long)self->n);
+    uint64_t started = latency_start();
+    if(PersonColumns_run(self, sum_chunk, &args) < 0){
+        PROBE3(bulk_return, "sum_number", self, -1L);
+        LATENCY_END(LAT_SUM_NUMBER, started);
+        return NULL;
+    }
+    int64_t total = 0;
+    for(int i = 0; i < self->n_chunks; i++){
+        total += args.results[i];
+    }
+    tracked_free(args.results);
+    PROBE3(bulk_return, "sum_number", self, 1L);
+    LATENCY_END(LAT_SUM_NUMBER, started);
+    return PyLong_FromLongLong(total);
+}
+
+static PyObject *PersonColumns_count_range(struct PersonColumns *self, PyObject *args_tuple)
+{
+    struct range_args args = {0};
+    if(!PyArg_ParseTuple(args_tuple, "ii", &args.lo, &args.hi)){
+        return NULL;
+    }
+    PROBE3(bulk_entry, "count_range", self, (long)self->n);
+    uint64_t started = latency_start();
+    if(PersonColumns_run(self, count_chunk, &args) < 0){
+        PROBE3(bulk_return, "count_range", self, -1L);
+        LATENCY_END(LAT_COUNT_RANGE, started);
+        return NULL;
+    }
+    int64_t total = 0;
+    for(int i = 0; i < self->n_chunks; i++){
+        total += args.results[i];
+    }
+    tracked_free(args.results);
+    PROBE3(bulk_return, "count_range", self, 1L);
+    LATENCY_END(LAT_COUNT_RANGE, started);
+    return PyLong_FromLongLong(total);
+}
+
+static PyObject *PersonColumns_select_range(struct PersonColumns *self, PyObject *args_tuple)
+{
+    struct range_args args = {0};
+    if(!PyArg_ParseTuple(args_tuple, "ii", &args.lo, &args.hi)){
+        return NULL;
+    }
+    args.selected = tracked_calloc((size_t)self->n_chunks, sizeof(Py_ssize_t *));
+    if(args.selected == NULL){
+        return PyErr_NoMemory();
+    }
+    PROBE3(bulk_entry, "select_range", self, (long)self->n);
+    uint64_t started = latency_start();
+    if(PersonColumns_run(self, select_chunk, &args) < 0){
+        tracked_free(args.selected);
+        PROBE3(bulk_return, "select_range", self, -1L);
+        LATENCY_END(LAT_SELECT_RANGE, started);
+        return NULL;
+    }
+
+    uint64_t materializing = trace_start();
+    PyObject *result = PyList_New(0);
+    for(int c = 0; result != NULL && c < self->n_chunks; c++){
+        if(args.results[c] < 0){
+            Py_CLEAR(result);
+            PyErr_NoMemory();
+            break;
+        }
+        for(int64_t k = 0; k < args.results[c]; k++){
+            PyObject *person = person_chunk_get(&self->chunks[c], args.selected[c][k]);
+            if(person == NULL || PyList_Append(result, person) < 0){
+                Py_XDECREF(person);
+                Py_CLEAR(result);
+                break;
+            }
+            Py_DECREF(person);
+        }
+    }
+    TRACE_END("PersonColumns.select_range.materialize", materializing, result ? PyList_GET_SIZE(result) : -1);
+
+    for(int c = 0; c < self->n_chunks; c++){
+        tracked_free(args.selected[c]);
+    }
+    tracked_free(args.selected);
+    tracked_free(args.results);
+    PROBE3(bulk_return, "select_range", self, result ? (long)PyList_GET_SIZE(result) : -1L);
+    LATENCY_END(LAT_SELECT_RANGE, started);
+    return result;
+}
+
+static PyObject *PersonColumns_partitions(struct PersonColumns *self, PyObject *Py_UNUSED(ignored))
+{
+    PyObject *result = PyList_New(self->n_chunks);
+    if(result == NULL){
+        return NULL;
+    }
+    for(int i = 0; i < self->n_chunks; i++){
+        PyObject *item = Py_BuildValue("{s:n,s:n,s:i}",
+                "start", self->starts[i],
+                "length", self->chunks[i].n,
+                "node", self->chunks[i].node);
+        if(item == NULL){
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, i, item);
+    }
+    return result;
+}
+
+static PyObject *numa_nodes(PyObject *self, PyObject *Py_UNUSED(args))
+{
+    return PyLong_FromLong(numa_placement_node_count());
+}
+
+static PySequenceMethods PersonColumns_as_sequence = {
+    .sq_length = (lenfunc) PersonColumns_length,
+    .sq_item = (ssizeargfunc) PersonColumns_item,
+};
+
+static PyMethodDef PersonColumns_methods[] = {
+    {
+        .ml_name = "sum_number",
+        .ml_meth = (PyCFunction)PersonColumns_sum_number,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return the sum of the number field of every Person",
+    },
+    {
+        .ml_name = "count_range",
+        .ml_meth = (PyCFunction)PersonColumns_count_range,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "count_range(lo, hi): number of Persons with lo <= number < hi",
+    },
+    {
+        .ml_name = "select_range",
+        .ml_meth = (PyCFunction)PersonColumns_select_range,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "select_range(lo, hi): list of the Persons with lo <= number < hi",
+    },
+    {
+        .ml_name = "partitions",
+        .ml_meth = (PyCFunction)PersonColumns_partitions,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return the start, length and NUMA node of every partition",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+PyTypeObject PersonColumnsType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.PersonColumns",
+    .tp_doc = "PersonColumns(persons, partitions=<number of NUMA nodes>)\n\n"
+              "Columnar storage of Persons partitioned across NUMA nodes",
+    .tp_basicsize = sizeof(struct PersonColumns),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) PersonColumns_init,
+    .tp_dealloc = (destructor) PersonColumns_dealloc,
+    .tp_as_sequence = &PersonColumns_as_sequence,
+    .tp_methods = PersonColumns_methods,
+};
+
+static PyMethodDef person_columns_functions[] = {
+    {
+        .ml_name = "numa_nodes",
+        .ml_meth = (PyCFunction)numa_nodes,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return the number of NUMA nodes used to place PersonColumns partitions",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int person_columns_module_init(PyObject *m)
+{
+    if(PyType_Ready(&PersonColumnsType) < 0){
+        return -1;
+    }
+
+    Py_INCREF(&PersonColumnsType);
+    if(PyModule_AddObject(m, "PersonColumns", (PyObject *)&PersonColumnsType) < 0){
+        Py_DECREF(&PersonColumnsType);
+        return -1;
+    }
+    return PyModule_AddFunctions(m, person_columns_functions);
+}
@@ -0,0 +1,84 @@
+/*
+ * Columnar storage of Persons.
+ *
+ * A PersonColumns is split into partitions (chunks).  Each chunk stores its
+ * rows as a struct of arrays whose layout matches Arrow's utf8 and int32
+ * columns:
+ *
+ *      number[n]
+ *      first_offsets[n + 1]    first name of row i is
+ *      first_data[]            first_data[first_offsets[i]:first_offsets[i+1]]
+ *      last_offsets[n + 1]
+ *      last_data[]
+ *
+ * and lives on a single NUMA node (see numa_placement.h).  Bulk operations run
+ * one worker thread per chunk on the chunk's home node with the GIL released.
+ */
+#ifndef MYMODULE_PERSON_COLUMNS_H
+#define MYMODULE_PERSON_COLUMNS_H
+
+#include <Python.h>
+#include <stdint.h>
+
+struct person_chunk {
+    Py_ssize_t n;
+    int node;
+    int32_t *number;
+    int32_t *first_offsets;
+    char *first_data;
+    int32_t *last_offsets;
+    char *last_data;
+    size_t first_size;      // allocated bytes of first_data and last_data
+    size_t last_size;
+};
+
+struct PersonColumns {
+    PyObject_HEAD
+    Py_ssize_t n;
+    int n_chunks;
+    struct person_chunk *chunks;
+    Py_ssize_t *starts;     // row number of the first row of each chunk
+    PyObject *owner;        // owns the arrays of borrowed chunks, or NULL
+};
+
+extern PyTypeObject PersonColumnsType;
+
+#define PersonColumns_Check(op) PyObject_TypeCheck(op, &PersonColumnsType)
+
+/*
+ * Allocate the arrays of a chunk on `node`.  The offsets arrays are allocated
+ * but not filled.  These two functions never touch Python state and can be
+ * called without the GIL; person_chunk_alloc() returns -1 on failure without
+ * setting an exception.
+ */
+int person_chunk_alloc(struct person_chunk *chunk, Py_ssize_t n,
+                       size_t first_size, size_t last_size, int node);
+void person_chunk_free(struct person_chunk *chunk);
+
+// Materialize row `i` of a chunk as a Person.
+PyObject *person_chunk_get(const struct person_chunk *chunk, Py_ssize_t i);
+
+/*
+ * Run fn(chunk, index, arg) for every chunk, each in its own thread pinned to
+ * the chunk's home node.  Must be called without the GIL.  Falls back to
+ * running the remaining chunks in the calling thread if threads cannot be
+ * started.
+ */
+typedef void (*person_chunk_func)(struct person_chunk *chunk, int index, void *arg);
+void person_chunks_parallel(struct person_chunk *chunks, int n_chunks,
+                            person_chunk_func fn, void *arg);
+
+/*
+ * Create a PersonColumns that takes ownership of `chunks` (allocated with
+ * tracked_malloc) whether it succeeds or not.
+ */
+PyObject *PersonColumns_FromChunks(struct person_chunk *chunks, int n_chunks);
+
+/*
+ * Same, but the arrays of the chunks belong to `owner` (for instance a memory
+ * mapping) and are never modified or freed.  The PersonColumns keeps a
+ * reference to `owner`; only the `chunks` array itself is taken over.
+ */
+PyObject *PersonColumns_FromBorrowedChunks(struct person_chunk *chunks, int n_chunks, PyObject *owner);
+
+#endif
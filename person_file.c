@@ -0,0 +1,1433 @@
+/*
+ * Person files: bulk storage of Persons in compressed column blocks.
+ *
+ * >>> mymodule.write_person_file("people.pf", persons, block_rows=4096)
+ * >>> f = mymodule.PersonFile("people.pf")
+ * >>> f[12], len(f), f.read_block(0)
+ * >>> cols = f.to_columns()       # PersonColumns, decoded in parallel
+ * >>> f.scan(min_number=0, max_number=99, last_name_prefix="Lo")
+ *
+ * File format
+ *
+ *      char     magic[4] "MYPF"
+ *      uint32   version
+ *      block*
+ *      index entry[n_blocks]
+ *      footer
+ *
+ * block:   uint32 crc32c of everything after this field | uint32 n_rows
+ *          uint32 raw_size | uint32 stored_size
+ *          uint8 codec | uint8 filters | uint16 reserved | data[stored_size]
+ *
+ * index entry: uint64 offset | uint32 n_rows | uint32 first_size | uint32 last_size
+ *              int32 min_number | int32 max_number
+ *              char first_min[8] | char first_max[8] | char last_min[8] | char last_max[8]
+ *
+ * footer:  uint64 n_rows | uint64 index_offset | uint32 n_blocks
+ *          uint32 crc32c of the index | char magic[4]
+ *
+ * See person_file.h for the layout of a decoded block.  A block whose
+ * compressed form is not smaller than its raw form is stored raw.  The index
+ * records the name bytes of each block so that a reader can size the arrays of
+ * a PersonColumns partition before decoding any block.  The checksum of a
+ * block is verified every time the block is decoded, the checksum of the index
+ * when the file is opened.
+ *
+ * The index also holds a zone map of each block: the range of its numbers and
+ * of the first 8 bytes of its names (zero padded).  scan() tests its
+ * predicates against the zone maps and only decodes the blocks that may hold
+ * matching rows.
+ */
+#include <Python.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "person.h"
+#include "person_columns.h"
+#include "person_file.h"
+#include "numa_placement.h"
+#include "codec.h"
+#include "crc32c.h"
+#include "encoding.h"
+#include "stats.h"
+#include "probes.h"
+#include "latency.h"
+#include "trace.h"
+#include "tracked_alloc.h"
+
+#define PF_MAGIC "MYPF"
+#define PF_VERSION 3
+#define PF_HEADER_SIZE 8
+#define PF_BLOCK_HEADER_SIZE 20
+#define PF_INDEX_ENTRY_SIZE 60
+#define PF_FOOTER_SIZE 28
+#define PF_PREFIX_SIZE 8
+
+struct pf_block {
+    uint64_t offset;
+    uint32_t n_rows;
+    uint32_t first_size;
+    uint32_t last_size;
+    // zone map
+    int32_t min_number;
+    int32_t max_number;
+    uint64_t first_min;         // see name_prefix()
+    uint64_t first_max;
+    uint64_t last_min;
+    uint64_t last_max;
+};
+
+/*
+ * The first PF_PREFIX_SIZE bytes of a name, zero padded, as a big endian
+ * integer: comparing two prefixes as integers compares them as bytes, and the
+ * prefix of the smallest name of a block is the smallest prefix.
+ */
+static uint64_t name_prefix(const char *name, size_t len)
+{
+    uint64_t v = 0;
+    for(size_t i = 0; i < PF_PREFIX_SIZE; i++){
+        v = v << 8 | (i < len ? (unsigned char)name[i] : 0);
+    }
+    return v;
+}
+
+static void put_prefix(char *p, uint64_t v)
+{
+    for(int i = PF_PREFIX_SIZE - 1; i >= 0; i--){
+        p[i] = (char)v;
+        v >>= 8;
+    }
+}
+
+static uint64_t get_prefix(const char *p)
+{
+    return name_prefix(p, PF_PREFIX_SIZE);
+}
+
+// Size of the int32 part of a decoded block of n rows.
+static size_t pf_ints_count(size_t n)
+{
+    return 3 * n + 2;
+}
+
+/*
+ * WRITER
+ */
+
+struct person_file_writer {
+    FILE *file;
+    int block_rows;
+    int codec;
+    int filters;
+    uint64_t offset;            // of the next block
+    uint64_t n_rows;
+
+    // Rows of the current block, as one int32 array (number, first_offsets,
+    // last_offsets are filled at flush time) and two name buffers.
+    uint32_t n;
+    int32_t *ints;
+    uint32_t *first_lens;
+    uint32_t *last_lens;
+    char *first_data;
+    char *last_data;
+    size_t first_size, first_cap;
+    size_t last_size, last_cap;
+
+    char *raw;                  // encoded block before and after compression
+    char *stored;
+    size_t raw_cap, stored_cap;
+
+    struct pf_block *index;
+    size_t n_blocks, index_cap;
+};
+
+static int grow(char **buf, size_t *cap, size_t need)
+{
+    if(need <= *cap){
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : 4096;
+    while(new_cap < need){
+        new_cap *= 2;
+    }
+    char *p = tracked_realloc(*buf, new_cap);
+    if(p == NULL){
+        errno = ENOMEM;
+        return -1;
+    }
+    *buf = p;
+    *cap = new_cap;
+    return 0;
+}
+
+static void writer_free(struct person_file_writer *w)
+{
+    tracked_free(w->ints);
+    tracked_free(w->first_lens);
+    tracked_free(w->last_lens);
+    tracked_free(w->first_data);
+    tracked_free(w->last_data);
+    tracked_free(w->raw);
+    tracked_free(w->stored);
+    tracked_free(w->index);
+    tracked_free(w);
+}
+
+struct person_file_writer *person_file_writer_open(const char *path, int block_rows,
+                                                   int codec, int filters)
+{
+    if(block_rows < 1 || block_rows > (1 << 24)){
+        errno = EINVAL;
+        return NULL;
+    }
+    struct person_file_writer *w = tracked_calloc(1, sizeof(*w));
+    if(w == NULL){
+        errno = ENOMEM;
+        return NULL;
+    }
+    w->block_rows = block_rows;
+    w->codec = codec;
+    w->filters = filters;
+    w->ints = tracked_malloc(pf_ints_count((size_t)block_rows) * sizeof(int32_t));
+    w->first_lens = tracked_malloc((size_t)block_rows * sizeof(uint32_t));
+    w->last_lens = tracked_malloc((size_t)block_rows * sizeof(uint32_t));
+    if(w->ints == NULL || w->first_lens == NULL || w->last_lens == NULL){
+        writer_free(w);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    w->file = fopen(path, "wb");
+    if(w->file == NULL){
+        int saved = errno;
+        writer_free(w);
+        errno = saved;
+        return NULL;
+    }
+    char header[PF_HEADER_SIZE];
+    memcpy(header, PF_MAGIC, 4);
+    put_u32(header + 4, PF_VERSION);
+    if(fwrite(header, sizeof(header), 1, w->file) != 1){
+        person_file_writer_abort(w);
+        return NULL;
+    }
+    w->offset = PF_HEADER_SIZE;
+    return w;
+}
+
+int person_file_writer_add(struct person_file_writer *w,
+                           const char *first_name, uint32_t first_len,
+                           const char *last_name, uint32_t last_len,
+                           int32_t number)
+{
+    // Offsets are int32 within a block.
+    if(w->first_size + first_len > INT32_MAX || w->last_size + last_len > INT32_MAX){
+        errno = EFBIG;
+        return -1;
+    }
+    if(grow(&w->first_data, &w->first_cap, w->first_size + first_len) < 0
+            || grow(&w->last_data, &w->last_cap, w->last_size + last_len) < 0){
+        return -1;
+    }
+    memcpy(w->first_data + w->first_size, first_name, first_len);
+    w->first_size += first_len;
+    memcpy(w->last_data + w->last_size, last_name, last_len);
+    w->last_size += last_len;
+    w->ints[w->n] = number;
+    w->first_lens[w->n] = first_len;
+    w->last_lens[w->n] = last_len;
+    w->n++;
+    return w->n == (uint32_t)w->block_rows;
+}
+
+int person_file_writer_flush(struct person_file_writer *w)
+{
+    uint32_t n = w->n;
+    if(n == 0){
+        return 0;
+    }
+
+    // number[n] is already in place, add the offsets after it.
+    int32_t *first_offsets = w->ints + n;
+    int32_t *last_offsets = first_offsets + n + 1;
+    first_offsets[0] = last_offsets[0] = 0;
+    for(uint32_t i = 0; i < n; i++){
+        first_offsets[i + 1] = first_offsets[i] + (int32_t)w->first_lens[i];
+        last_offsets[i + 1] = last_offsets[i] + (int32_t)w->last_lens[i];
+    }
+
+    struct pf_block zone = {
+        .min_number = INT32_MAX,
+        .max_number = INT32_MIN,
+        .first_min = UINT64_MAX,
+        .last_min = UINT64_MAX,
+    };
+    for(uint32_t i = 0; i < n; i++){
+        int32_t number = w->ints[i];
+        uint64_t first = name_prefix(w->first_data + first_offsets[i], w->first_lens[i]);
+        uint64_t last = name_prefix(w->last_data + last_offsets[i], w->last_lens[i]);
+        zone.min_number = number < zone.min_number ? number : zone.min_number;
+        zone.max_number = number > zone.max_number ? number : zone.max_number;
+        zone.first_min = first < zone.first_min ? first : zone.first_min;
+        zone.first_max = first > zone.first_max ? first : zone.first_max;
+        zone.last_min = last < zone.last_min ? last : zone.last_min;
+        zone.last_max = last > zone.last_max ? last : zone.last_max;
+    }
+
+    size_t n_ints = pf_ints_count(n);
+    size_t ints_size = n_ints * 4;
+    size_t raw_size = ints_size + w->first_size + w->last_size;
+    if(raw_size > UINT32_MAX){
+        errno = EFBIG;
+        return -1;
+    }
+    // The shuffle needs the little endian bytes in a separate buffer: encode
+    // them at the end of `stored`, which is overwritten later.
+    size_t stored_need = PF_BLOCK_HEADER_SIZE + lz_compress_bound(raw_size);
+    if(grow(&w->raw, &w->raw_cap, raw_size) < 0
+            || grow(&w->stored, &w->stored_cap, stored_need + ints_size) < 0){
+        return -1;
+    }
+
+    if(w->filters & PERSON_FILE_FILTER_DELTA){
+        delta_encode_i32(w->ints, n_ints);
+    }
+    char *le = (w->filters & PERSON_FILE_FILTER_SHUFFLE) ? w->stored + stored_need : w->raw;
+    for(size_t i = 0; i < n_ints; i++){
+        put_u32(le + 4 * i, (uint32_t)w->ints[i]);
+    }
+    if(w->filters & PERSON_FILE_FILTER_SHUFFLE){
+        shuffle_i32(le, w->raw, n_ints);
+    }
+    memcpy(w->raw + ints_size, w->first_data, w->first_size);
+    memcpy(w->raw + ints_size + w->first_size, w->last_data, w->last_size);
+
+    char *data = w->stored + PF_BLOCK_HEADER_SIZE;
+    size_t stored_size = 0;
+    int codec = w->codec;
+    if(codec == PERSON_FILE_CODEC_LZ){
+        stored_size = lz_compress(w->raw, raw_size, data, raw_size - 1);
+    }
+    if(stored_size == 0){
+        codec = PERSON_FILE_CODEC_NONE;
+        stored_size = raw_size;
+        memcpy(data, w->raw, raw_size);
+    }
+
+    char *h = w->stored;
+    put_u32(h + 4, n);
+    put_u32(h + 8, (uint32_t)raw_size);
+    put_u32(h + 12, (uint32_t)stored_size);
+    h[16] = (char)codec;
+    h[17] = (char)w->filters;
+    put_u16(h + 18, 0);
+    put_u32(h, crc32c(0, h + 4, PF_BLOCK_HEADER_SIZE - 4 + stored_size));
+    if(fwrite(w->stored, PF_BLOCK_HEADER_SIZE + stored_size, 1, w->file) != 1){
+        return -1;
+    }
+
+    if(w->n_blocks == w->index_cap){
+        size_t cap = w->index_cap ? 2 * w->index_cap : 64;
+        struct pf_block *index = tracked_realloc(w->index, cap * sizeof(struct pf_block));
+        if(index == NULL){
+            errno = ENOMEM;
+            return -1;
+        }
+        w->index = index;
+        w->index_cap = cap;
+    }
+    zone.offset = w->offset;
+    zone.n_rows = n;
+    zone.first_size = (uint32_t)w->first_size;
+    zone.last_size = (uint32_t)w->last_size;
+    w->index[w->n_blocks++] = zone;
+    w->offset += PF_BLOCK_HEADER_SIZE + stored_size;
+    w->n_rows += n;
+    w->n = 0;
+    w->first_size = w->last_size = 0;
+    return 0;
+}
+
+int person_file_writer_close(struct person_file_writer *w)
+{
+    if(person_file_writer_flush(w) < 0){
+        person_file_writer_abort(w);
+        return -1;
+    }
+    uint32_t index_crc = 0;
+    for(size_t i = 0; i < w->n_blocks; i++){
+        char e[PF_INDEX_ENTRY_SIZE];
+        put_u64(e, w->index[i].offset);
+        put_u32(e + 8, w->index[i].n_rows);
+        put_u32(e + 12, w->index[i].first_size);
+        put_u32(e + 16, w->index[i].last_size);
+        put_u32(e + 20, (uint32_t)w->index[i].min_number);
+        put_u32(e + 24, (uint32_t)w->index[i].max_number);
+        put_prefix(e + 28, w->index[i].first_min);
+        put_prefix(e + 36, w->index[i].first_max);
+        put_prefix(e + 44, w->index[i].last_min);
+        put_prefix(e + 52, w->index[i].last_max);
+        index_crc = crc32c(index_crc, e, sizeof(e));
+        if(fwrite(e, sizeof(e), 1, w->file) != 1){
+            person_file_writer_abort(w);
+            return -1;
+        }
+    }
+    char footer[PF_FOOTER_SIZE];
+    put_u64(footer, w->n_rows);
+    put_u64(footer + 8, w->offset);
+    put_u32(footer + 16, (uint32_t)w->n_blocks);
+    put_u32(footer + 20, index_crc);
+    memcpy(footer + 24, PF_MAGIC, 4);
+    if(fwrite(footer, sizeof(footer), 1, w->file) != 1){
+        person_file_writer_abort(w);
+        return -1;
+    }
+    int rc = fclose(w->file);
+    int saved = errno;
+    writer_free(w);
+    errno = saved;
+    return rc == 0 ? 0 : -1;
+}
+
+void person_file_writer_abort(struct person_file_writer *w)
+{
+    int saved = errno;
+    fclose(w->file);
+    writer_free(w);
+    errno = saved;
+}
+
+uint64_t person_file_writer_rows(const struct person_file_writer *w)
+{
+    return w->n_rows + w->n;
+}
+
+/*
+ * DECODING
+ *
+ * Decode a block into `number`, `first_offsets`... at row `row` of a chunk
+ * whose name data already holds `first_base` and `last_base` bytes.  The
+ * offsets are rebased accordingly.  Returns -1 if the block is corrupt.  Does
+ * not touch Python state.
+ *
+ * The checksum covers the stored bytes, so it is checked before decompressing
+ * anything.
+ */
+
+static int pf_decode_block(const char *map, const struct pf_block *b, struct person_chunk *chunk,
+                           Py_ssize_t row, size_t first_base, size_t last_base)
+{
+    const char *h = map + b->offset;
+    uint32_t n = get_u32(h + 4);
+    uint32_t raw_size = get_u32(h + 8);
+    uint32_t stored_size = get_u32(h + 12);
+    int codec = (unsigned char)h[16];
+    int filters = (unsigned char)h[17];
+    size_t n_ints = pf_ints_count(n);
+    size_t ints_size = n_ints * 4;
+    const char *data = h + PF_BLOCK_HEADER_SIZE;
+
+    if(n != b->n_rows || raw_size != ints_size + b->first_size + b->last_size
+            || crc32c(0, h + 4, PF_BLOCK_HEADER_SIZE - 4 + (size_t)stored_size) != get_u32(h)){
+        return -1;
+    }
+
+    char *raw = NULL;
+    if(codec == PERSON_FILE_CODEC_LZ){
+        raw = tracked_malloc(raw_size);
+        if(raw == NULL || lz_decompress(data, stored_size, raw, raw_size) < 0){
+            tracked_free(raw);
+            return -1;
+        }
+        data = raw;
+    } else if(codec != PERSON_FILE_CODEC_NONE || stored_size != raw_size){
+        return -1;
+    }
+
+    int rc = -1;
+    char *le = NULL;
+    int32_t *ints = tracked_malloc(ints_size);
+    if(ints == NULL){
+        goto done;
+    }
+    const char *src = data;
+    if(filters & PERSON_FILE_FILTER_SHUFFLE){
+        le = tracked_malloc(ints_size);
+        if(le == NULL){
+            goto done;
+        }
+        unshuffle_i32(data, le, n_ints);
+        src = le;
+    }
+    for(size_t i = 0; i < n_ints; i++){
+        ints[i] = (int32_t)get_u32(src + 4 * i);
+    }
+    if(filters & PERSON_FILE_FILTER_DELTA){
+        delta_decode_i32(ints, n_ints);
+    }
+
+    const int32_t *first_offsets = ints + n;
+    const int32_t *last_offsets = first_offsets + n + 1;
+    if(first_offsets[0] != 0 || last_offsets[0] != 0
+            || first_offsets[n] != (int32_t)b->first_size || last_offsets[n] != (int32_t)b->last_size){
+        goto done;
+    }
+    for(uint32_t i = 0; i < n; i++){
+        if(first_offsets[i + 1] < first_offsets[i] || last_offsets[i + 1] < last_offsets[i]){
+            goto done;
+        }
+    }
+
+    memcpy(chunk->number + row, ints, (size_t)n * 4);
+    for(uint32_t i = 0; i <= n; i++){
+        chunk->first_offsets[row + i] = (int32_t)first_base + first_offsets[i];
+        chunk->last_offsets[row + i] = (int32_t)last_base + last_offsets[i];
+    }
+    memcpy(chunk->first_data + first_base, data + ints_size, b->first_size);
+    memcpy(chunk->last_data + last_base, data + ints_size + b->first_size, b->last_size);
+    rc = 0;
+
+done:
+    tracked_free(ints);
+    tracked_free(le);
+    tracked_free(raw);
+    return rc;
+}
+
+/*
+ * READER
+ */
+
+/*
+ * A decoded block.  Methods that create Persons from it hold a reference, so
+ * that another thread loading a different block while they run (the GIL can
+ * be released by any allocation that triggers a collection) does not free it
+ * under them.  The count is only touched with the GIL.
+ */
+struct pf_cached_block {
+    Py_ssize_t refs;
+    Py_ssize_t block;
+    struct person_chunk chunk;
+};
+
+static void cached_block_decref(struct pf_cached_block *c)
+{
+    if(c != NULL && --c->refs == 0){
+        person_chunk_free(&c->chunk);
+        tracked_free(c);
+    }
+}
+
+/*
+ * `map`, `blocks` and `starts` are read without the GIL by block decoding.
+ * Such work pins the file, and close() only marks a pinned file closed; the
+ * last unpin releases it.
+ */
+struct PersonFile {
+    PyObject_HEAD
+    char *map;
+    size_t size;
+    uint64_t n_rows;
+    uint32_t n_blocks;
+    struct pf_block *blocks;
+    Py_ssize_t *starts;         // row number of the first row of each block
+    struct pf_cached_block *cache;  // last decoded block, or NULL
+    int pins;
+    int close_pending;
+    unsigned long long blocks_scanned;
+    unsigned long long blocks_skipped;
+};
+
+static PyTypeObject PersonFileType;
+
+static void PersonFile_release(struct PersonFile *self)
+{
+    self->close_pending = 0;
+    if(self->map != NULL){
+        munmap(self->map, self->size);
+        self->map = NULL;
+    }
+    tracked_free(self->blocks);
+    self->blocks = NULL;
+    tracked_free(self->starts);
+    self->starts = NULL;
+    cached_block_decref(self->cache);
+    self->cache = NULL;
+}
+
+static void PersonFile_pin(struct PersonFile *self)
+{
+    self->pins++;
+}
+
+static void PersonFile_unpin(struct PersonFile *self)
+{
+    if(--self->pins == 0 && self->close_pending){
+        PersonFile_release(self);
+    }
+}
+
+static void PersonFile_close_file(struct PersonFile *self)
+{
+    if(self->pins > 0){
+        self->close_pending = 1;
+    } else {
+        PersonFile_release(self);
+    }
+}
+
+static void PersonFile_dealloc(struct PersonFile *self)
+{
+    PersonFile_release(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *PersonFile_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    struct PersonFile *self = (struct PersonFile *) type->tp_alloc(type, 0);
+    if(self == NULL){
+        return NULL;
+    }
+    return (PyObject *)self;
+}
+
+static int PersonFile_corrupt(struct PersonFile *self, const char *path)
+{
+    PersonFile_release(self);
+    PyErr_Format(PyExc_ValueError, "%s is not a valid Person file", path);
+    return -1;
+}
+
+static int PersonFile_init(struct PersonFile *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *path_obj = NULL;
+    static char *kwlist[] = {"path", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist, PyUnicode_FSConverter, &path_obj)){
+        return -1;
+    }
+    if(self->map != NULL){
+        Py_DECREF(path_obj);
+        PyErr_SetString(PyExc_RuntimeError, "PersonFile is already open");
+        return -1;
+    }
+    const char *path = PyBytes_AS_STRING(path_obj);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        if(fd >= 0){
+            close(fd);
+        }
+        Py_DECREF(path_obj);
+        return -1;
+    }
+    self->size = (size_t)st.st_size;
+    if(self->size < PF_HEADER_SIZE + PF_FOOTER_SIZE){
+        close(fd);
+        int rc = PersonFile_corrupt(self, path);
+        Py_DECREF(path_obj);
+        return rc;
+    }
+    self->map = mmap(NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(self->map == MAP_FAILED){
+        self->map = NULL;
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        Py_DECREF(path_obj);
+        return -1;
+    }
+
+    const char *footer = self->map + self->size - PF_FOOTER_SIZE;
+    uint64_t index_offset = get_u64(footer + 8);
+    self->n_rows = get_u64(footer);
+    self->n_blocks = get_u32(footer + 16);
+    if(memcmp(self->map, PF_MAGIC, 4) != 0 || get_u32(self->map + 4) != PF_VERSION
+            || memcmp(footer + 24, PF_MAGIC, 4) != 0 || index_offset < PF_HEADER_SIZE
+            || index_offset + (uint64_t)self->n_blocks * PF_INDEX_ENTRY_SIZE != self->size - PF_FOOTER_SIZE
+            || crc32c(0, self->map + index_offset, (size_t)self->n_blocks * PF_INDEX_ENTRY_SIZE) != get_u32(footer + 20)
+            || self->n_rows > PY_SSIZE_T_MAX){
+        int rc = PersonFile_corrupt(self, path);
+        Py_DECREF(path_obj);
+        return rc;
+    }
+
+    self->blocks = tracked_malloc(((size_t)self->n_blocks + 1) * sizeof(struct pf_block));
+    self->starts = tracked_malloc(((size_t)self->n_blocks + 1) * sizeof(Py_ssize_t));
+    if(self->blocks == NULL || self->starts == NULL){
+        PersonFile_release(self);
+        Py_DECREF(path_obj);
+        PyErr_NoMemory();
+        return -1;
+    }
+    uint64_t rows = 0;
+    for(uint32_t i = 0; i < self->n_blocks; i++){
+        const char *e = self->map + index_offset + (size_t)i * PF_INDEX_ENTRY_SIZE;
+        struct pf_block *b = &self->blocks[i];
+        b->offset = get_u64(e);
+        b->n_rows = get_u32(e + 8);
+        b->first_size = get_u32(e + 12);
+        b->last_size = get_u32(e + 16);
+        b->min_number = (int32_t)get_u32(e + 20);
+        b->max_number = (int32_t)get_u32(e + 24);
+        b->first_min = get_prefix(e + 28);
+        b->first_max = get_prefix(e + 36);
+        b->last_min = get_prefix(e + 44);
+        b->last_max = get_prefix(e + 52);
+        if(b->offset < PF_HEADER_SIZE || b->offset + PF_BLOCK_HEADER_SIZE > index_offset
+                || b->offset + PF_BLOCK_HEADER_SIZE + get_u32(self->map + b->offset + 12) > index_offset
+                || b->first_size > INT32_MAX || b->last_size > INT32_MAX){
+            int rc = PersonFile_corrupt(self, path);
+            Py_DECREF(path_obj);
+            return rc;
+        }
+        self->starts[i] = (Py_ssize_t)rows;
+        rows += b->n_rows;
+    }
+    self->starts[self->n_blocks] = (Py_ssize_t)rows;
+    if(rows != self->n_rows){
+        int rc = PersonFile_corrupt(self, path);
+        Py_DECREF(path_obj);
+        return rc;
+    }
+    Py_DECREF(path_obj);
+    return 0;
+}
+
+static int PersonFile_check_open(struct PersonFile *self)
+{
+    if(self->map == NULL || self->close_pending){
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed PersonFile");
+        return -1;
+    }
+    return 0;
+}
+
+static int PersonFile_check_block(struct PersonFile *self, Py_ssize_t block)
+{
+    if(PersonFile_check_open(self) < 0){
+        return -1;
+    }
+    if(block < 0 || block >= (Py_ssize_t)self->n_blocks){
+        PyErr_SetString(PyExc_IndexError, "block index out of range");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Return a new reference to `block` decoded, from the cache or decoded without
+ * the GIL into a fresh chunk that then replaces the cache.
+ */
+static struct pf_cached_block *PersonFile_load(struct PersonFile *self, Py_ssize_t block)
+{
+    if(self->cache != NULL && self->cache->block == block){
+        STAT_INC(STAT_BLOCK_CACHE_HITS);
+        self->cache->refs++;
+        return self->cache;
+    }
+    STAT_INC(STAT_BLOCK_CACHE_MISSES);
+    const struct pf_block *b = &self->blocks[block];
+    struct pf_cached_block *c = tracked_calloc(1, sizeof(struct pf_cached_block));
+    if(c == NULL || person_chunk_alloc(&c->chunk, b->n_rows, b->first_size, b->last_size, 0) < 0){
+        tracked_free(c);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    c->refs = 1;
+    c->block = block;
+    int rc;
+    PersonFile_pin(self);
+    Py_BEGIN_ALLOW_THREADS
+    rc = pf_decode_block(self->map, b, &c->chunk, 0, 0, 0);
+    Py_END_ALLOW_THREADS
+    PersonFile_unpin(self);
+    if(rc < 0){
+        cached_block_decref(c);
+        PyErr_Format(PyExc_ValueError, "block %zd of the Person file is corrupt (bad checksum or encoding)", block);
+        return NULL;
+    }
+    // The file may have been closed meanwhile; then the block is not cached.
+    if(self->map != NULL && !self->close_pending){
+        cached_block_decref(self->cache);
+        self->cache = c;
+        c->refs++;
+    }
+    return c;
+}
+
+/*
+ * SEQUENCE PROTOCOL
+ */
+
+static Py_ssize_t PersonFile_length(struct PersonFile *self)
+{
+    return (Py_ssize_t)self->n_rows;
+}
+
+static PyObject *PersonFile_item(struct PersonFile *self, Py_ssize_t index)
+{
+    if(PersonFile_check_open(self) < 0){
+        return NULL;
+    }
+    if(index < 0 || index >= (Py_ssize_t)self->n_rows){
+        PyErr_SetString(PyExc_IndexError, "PersonFile index out of range");
+        return NULL;
+    }
+    Py_ssize_t lo = 0, hi = (Py_ssize_t)self->n_blocks - 1;
+    while(lo < hi){
+        Py_ssize_t mid = (lo + hi + 1) / 2;
+        if(self->starts[mid] <= index){
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    Py_ssize_t row = index - self->starts[lo];
+    struct pf_cached_block *c = PersonFile_load(self, lo);
+    if(c == NULL){
+        return NULL;
+    }
+    PyObject *person = person_chunk_get(&c->chunk, row);
+    cached_block_decref(c);
+    return person;
+}
+
+/*
+ * METHODS
+ */
+
+static PyObject *PersonFile_read_block(struct PersonFile *self, PyObject *arg)
+{
+    Py_ssize_t block = PyLong_AsSsize_t(arg);
+    if((block == -1 && PyErr_Occurred()) || PersonFile_check_block(self, block) < 0){
+        return NULL;
+    }
+    struct pf_cached_block *c = PersonFile_load(self, block);
+    if(c == NULL){
+        return NULL;
+    }
+    PyObject *list = PyList_New(c->chunk.n);
+    for(Py_ssize_t i = 0; list != NULL && i < c->chunk.n; i++){
+        PyObject *p = person_chunk_get(&c->chunk, i);
+        if(p == NULL){
+            Py_CLEAR(list);
+            break;
+        }
+        PyList_SET_ITEM(list, i, p);
+    }
+    cached_block_decref(c);
+    return list;
+}
+
+struct decode_args {
+    const struct PersonFile *file;
+    const uint32_t *first_block;    // blocks [first_block[i], first_block[i+1]) go to chunk i
+    const size_t *first_sizes;
+    const size_t *last_sizes;
+    int failed;
+};
+
+// Worker of to_columns(): runs on the chunk's home node, so the chunk's pages
+// are first touched there.
+static void decode_chunk(struct person_chunk *chunk, int index, void *arg)
+{
+    struct decode_args *a = arg;
+    const struct PersonFile *f = a->file;
+    uint32_t b0 = a->first_block[index], b1 = a->first_block[index + 1];
+    Py_ssize_t n = f->starts[b1] - f->starts[b0];
+    if(person_chunk_alloc(chunk, n, a->first_sizes[index], a->last_sizes[index], chunk->node) < 0){
+        a->failed = 1;
+        return;
+    }
+    chunk->first_offsets[0] = chunk->last_offsets[0] = 0;
+    size_t first_base = 0, last_base = 0;
+    for(uint32_t b = b0; b < b1; b++){
+        const struct pf_block *block = &f->blocks[b];
+        if(pf_decode_block(f->map, block, chunk, f->starts[b] - f->starts[b0], first_base, last_base) < 0){
+            a->failed = 1;
+            return;
+        }
+        first_base += block->first_size;
+        last_base += block->last_size;
+    }
+}
+
+static PyObject *PersonFile_to_columns(struct PersonFile *self, PyObject *args, PyObject *kwds)
+{
+    int n_chunks = 0;
+    static char *kwlist[] = {"partitions", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|i:to_columns", kwlist, &n_chunks)
+            || PersonFile_check_open(self) < 0){
+        return NULL;
+    }
+    int nodes = numa_placement_node_count();
+    if(n_chunks <= 0){
+        n_chunks = nodes;
+    }
+    // A partition holds whole blocks.
+    if((uint32_t)n_chunks > self->n_blocks){
+        n_chunks = self->n_blocks > 0 ? (int)self->n_blocks : 1;
+    }
+
+    PROBE3(bulk_entry, "to_columns", self, (long)self->n_rows);
+    uint64_t started = latency_start();
+    struct person_chunk *chunks = tracked_calloc((size_t)n_chunks, sizeof(struct person_chunk));
+    uint32_t *first_block = tracked_malloc(((size_t)n_chunks + 1) * sizeof(uint32_t));
+    size_t *first_sizes = tracked_calloc((size_t)n_chunks, sizeof(size_t));
+    size_t *last_sizes = tracked_calloc((size_t)n_chunks, sizeof(size_t));
+    PyObject *result = NULL;
+    if(chunks == NULL || first_block == NULL || first_sizes == NULL || last_sizes == NULL){
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for(int i = 0; i <= n_chunks; i++){
+        first_block[i] = (uint32_t)((uint64_t)self->n_blocks * (uint64_t)i / (uint64_t)n_chunks);
+    }
+    for(int i = 0; i < n_chunks; i++){
+        chunks[i].node = i % nodes;
+        for(uint32_t b = first_block[i]; b < first_block[i + 1]; b++){
+            first_sizes[i] += self->blocks[b].first_size;
+            last_sizes[i] += self->blocks[b].last_size;
+        }
+        if(first_sizes[i] > INT32_MAX || last_sizes[i] > INT32_MAX){
+            PyErr_SetString(PyExc_OverflowError, "partition too large, use more partitions");
+            goto done;
+        }
+    }
+
+    struct decode_args decode = {
+        .file = self,
+        .first_block = first_block,
+        .first_sizes = first_sizes,
+        .last_sizes = last_sizes,
+        .failed = 0,
+    };
+    PersonFile_pin(self);
+    Py_BEGIN_ALLOW_THREADS
+    person_chunks_parallel(chunks, n_chunks, decode_chunk, &decode);
+    Py_END_ALLOW_THREADS
+    PersonFile_unpin(self);
+
+    if(decode.failed){
+        for(int i = 0; i < n_chunks; i++){
+            person_chunk_free(&chunks[i]);
+        }
+        PyErr_SetString(PyExc_ValueError, "cannot decode the Person file: corrupt block or out of memory");
+        goto done;
+    }
+    result = PersonColumns_FromChunks(chunks, n_chunks);
+    chunks = NULL;
+
+done:
+    tracked_free(chunks);
+    tracked_free(first_block);
+    tracked_free(first_sizes);
+    tracked_free(last_sizes);
+    PROBE3(bulk_return, "to_columns", self, result ? (long)self->n_rows : -1L);
+    LATENCY_END(LAT_TO_COLUMNS, started);
+    return result;
+}
+
+/*
+ * SCANS
+ */
+
+struct scan_predicate {
+    int32_t min_number;
+    int32_t max_number;
+    const char *first;          // prefixes, may be NULL
+    Py_ssize_t first_len;
+    const char *last;
+    Py_ssize_t last_len;
+};
+
+// Can a block whose name prefixes are in [min, max] hold a name starting with `prefix`?
+static int zone_prefix_may_match(uint64_t min, uint64_t max, const char *prefix, Py_ssize_t len)
+{
+    if(prefix == NULL || len == 0){
+        return 1;
+    }
+    size_t m = len < PF_PREFIX_SIZE ? (size_t)len : PF_PREFIX_SIZE;
+    uint64_t mask = m == PF_PREFIX_SIZE ? UINT64_MAX : ~(UINT64_MAX >> (8 * m));
+    uint64_t q = name_prefix(prefix, m);
+    return (min & mask) <= q && q <= (max & mask);
+}
+
+static int zone_may_match(const struct pf_block *b, const struct scan_predicate *p)
+{
+    return b->n_rows > 0
+        && b->max_number >= p->min_number && b->min_number <= p->max_number
+        && zone_prefix_may_match(b->first_min, b->first_max, p->first, p->first_len)
+        && zone_prefix_may_match(b->last_min, b->last_max, p->last, p->last_len);
+}
+
+static int has_prefix(const char *s, int32_t len, const char *prefix, Py_ssize_t prefix_len)
+{
+    return prefix == NULL || (len >= prefix_len && memcmp(s, prefix, (size_t)prefix_len) == 0);
+}
+
+static int parse_prefix(PyObject *obj, const char **prefix, Py_ssize_t *len)
+{
+    if(obj == Py_None){
+        *prefix = NULL;
+        *len = 0;
+        return 0;
+    }
+    if(!PyUnicode_Check(obj)){
+        PyErr_SetString(PyExc_TypeError, "name prefixes must be str or None");
+        return -1;
+    }
+    *prefix = PyUnicode_AsUTF8AndSize(obj, len);
+    return *prefix == NULL ? -1 : 0;
+}
+
+static PyObject *PersonFile_scan(struct PersonFile *self, PyObject *args, PyObject *kwds)
+{
+    struct scan_predicate p = {.min_number = INT32_MIN, .max_number = INT32_MAX};
+    PyObject *first_obj = Py_None, *last_obj = Py_None;
+    static char *kwlist[] = {"min_number", "max_number", "first_name_prefix", "last_name_prefix", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|iiOO:scan", kwlist,
+                &p.min_number, &p.max_number, &first_obj, &last_obj)
+            || parse_prefix(first_obj, &p.first, &p.first_len) < 0
+            || parse_prefix(last_obj, &p.last, &p.last_len) < 0
+            || PersonFile_check_open(self) < 0){
+        return NULL;
+    }
+
+    PyObject *result = PyList_New(0);
+    if(result == NULL){
+        return NULL;
+    }
+    PROBE3(bulk_entry, "scan", self, (long)self->n_rows);
+    uint64_t started = latency_start();
+    for(uint32_t b = 0; b < self->n_blocks; b++){
+        if(PersonFile_check_open(self) < 0){
+            Py_CLEAR(result);
+            goto done;
+        }
+        if(!zone_may_match(&self->blocks[b], &p)){
+            self->blocks_skipped++;
+            continue;
+        }
+        self->blocks_scanned++;
+        uint64_t loading = trace_start();
+        struct pf_cached_block *cached = PersonFile_load(self, b);
+        if(cached == NULL){
+            Py_CLEAR(result);
+            goto done;
+        }
+        const struct person_chunk *c = &cached->chunk;
+        TRACE_END("PersonFile.scan.load", loading, c->n);
+        for(Py_ssize_t i = 0; i < c->n; i++){
+            int32_t f0 = c->first_offsets[i], l0 = c->last_offsets[i];
+            if(c->number[i] < p.min_number || c->number[i] > p.max_number
+                    || !has_prefix(c->first_data + f0, c->first_offsets[i + 1] - f0, p.first, p.first_len)
+                    || !has_prefix(c->last_data + l0, c->last_offsets[i + 1] - l0, p.last, p.last_len)){
+                continue;
+            }
+            PyObject *person = person_chunk_get(c, i);
+            if(person == NULL || PyList_Append(result, person) < 0){
+                Py_XDECREF(person);
+                Py_CLEAR(result);
+                cached_block_decref(cached);
+                goto done;
+            }
+            Py_DECREF(person);
+        }
+        cached_block_decref(cached);
+    }
+
+done:
+    PROBE3(bulk_return, "scan", self, result ? (long)PyList_GET_SIZE(result) : -1L);
+    LATENCY_END(LAT_SCAN, started);
+    return result;
+}
+
+static PyObject *PersonFile_stats(struct PersonFile *self, PyObject *Py_UNUSED(ignored))
+{
+    if(PersonFile_check_open(self) < 0){
+        return NULL;
+    }
+    unsigned long long raw = 0, stored = 0, compressed = 0;
+    for(uint32_t i = 0; i < self->n_blocks; i++){
+        const char *h = self->map + self->blocks[i].offset;
+        raw += get_u32(h + 8);
+        stored += get_u32(h + 12);
+        compressed += h[16] != PERSON_FILE_CODEC_NONE;
+    }
+    return Py_BuildValue("{s:K,s:I,s:K,s:K,s:K,s:K,s:K}",
+                         "rows", (unsigned long long)self->n_rows,
+                         "blocks", (unsigned int)self->n_blocks,
+                         "compressed_blocks", compressed,
+                         "raw_bytes", raw,
+                         "stored_bytes", stored,
+                         "blocks_scanned", self->blocks_scanned,
+                         "blocks_skipped", self->blocks_skipped);
+}
+
+static PyObject *PersonFile_close(struct PersonFile *self, PyObject *Py_UNUSED(ignored))
+{
+    PersonFile_close_file(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PersonFile_enter(struct PersonFile *self, PyObject *Py_UNUSED(ignored))
+{
+    if(PersonFile_check_open(self) < 0){
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *PersonFile_exit(struct PersonFile *self, PyObject *Py_UNUSED(args))
+{
+    PersonFile_close_file(self);
+    Py_RETURN_FALSE;
+}
+
+static PyObject *PersonFile_get_n_blocks(struct PersonFile *self, void *Py_UNUSED(closure))
+{
+    return PyLong_FromUnsignedLong(self->n_blocks);
+}
+
+static PySequenceMethods PersonFile_as_sequence = {
+    .sq_length = (lenfunc)PersonFile_length,
+    .sq_item = (ssizeargfunc)PersonFile_item,
+};
+
+static PyGetSetDef PersonFile_getset[] = {
+    {"n_blocks", (getter)PersonFile_get_n_blocks, NULL, "Number of blocks of the file", NULL},
+    {NULL}
+};
+
+static PyMethodDef PersonFile_methods[] = {
+    {
+        .ml_name = "read_block",
+        .ml_meth = (PyCFunction)PersonFile_read_block,
+        .ml_flags = METH_O,
+        .ml_doc = "read_block(i): return the Persons of block i as a list",
+    },
+    {
+        .ml_name = "to_columns",
+        .ml_meth = (PyCFunction)(void(*)(void))PersonFile_to_columns,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "to_columns(partitions=0): decode the whole file into a PersonColumns, one thread per partition",
+    },
+    {
+        .ml_name = "scan",
+        .ml_meth = (PyCFunction)(void(*)(void))PersonFile_scan,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "scan(min_number=-2**31, max_number=2**31-1, first_name_prefix=None, last_name_prefix=None)\n\n"
+                  "Return the Persons whose number is in [min_number, max_number] and whose names start with "
+                  "the given prefixes. Blocks that cannot match according to their zone map are not decoded.",
+    },
+    {
+        .ml_name = "stats",
+        .ml_meth = (PyCFunction)PersonFile_stats,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return a dict with the number of rows and blocks, the raw and stored sizes and "
+                  "the number of blocks scanned and skipped by scan()",
+    },
+    {
+        .ml_name = "close",
+        .ml_meth = (PyCFunction)PersonFile_close,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Unmap the file",
+    },
+    {
+        .ml_name = "__enter__",
+        .ml_meth = (PyCFunction)PersonFile_enter,
+        .ml_flags = METH_NOARGS,
+    },
+    {
+        .ml_name = "__exit__",
+        .ml_meth = (PyCFunction)PersonFile_exit,
+        .ml_flags = METH_VARARGS,
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+static PyTypeObject PersonFileType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.PersonFile",
+    .tp_doc = "PersonFile(path)\n\nRead-only access to a Person file written by write_person_file()",
+    .tp_basicsize = sizeof(struct PersonFile),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PersonFile_new,
+    .tp_init = (initproc) PersonFile_init,
+    .tp_dealloc = (destructor) PersonFile_dealloc,
+    .tp_as_sequence = &PersonFile_as_sequence,
+    .tp_getset = PersonFile_getset,
+    .tp_methods = PersonFile_methods,
+};
+
+/*
+ * MODULE FUNCTIONS
+ */
+
+static int write_columns(struct person_file_writer *w, const struct PersonColumns *columns)
+{
+    for(int c = 0; c < columns->n_chunks; c++){
+        const struct person_chunk *chunk = &columns->chunks[c];
+        for(Py_ssize_t i = 0; i < chunk->n; i++){
+            int32_t f0 = chunk->first_offsets[i], f1 = chunk->first_offsets[i + 1];
+            int32_t l0 = chunk->last_offsets[i], l1 = chunk->last_offsets[i + 1];
+            int full = person_file_writer_add(w, chunk->first_data + f0, (uint32_t)(f1 - f0),
+                                              chunk->last_data + l0, (uint32_t)(l1 - l0),
+                                              chunk->number[i]);
+            if(full < 0 || (full && person_file_writer_flush(w) < 0)){
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int write_iterable(struct person_file_writer *w, PyObject *persons)
+{
+    PyObject *it = PyObject_GetIter(persons);
+    if(it == NULL){
+        return -1;
+    }
+    PyObject *item;
+    while((item = PyIter_Next(it)) != NULL){
+        const char *first, *last;
+        Py_ssize_t first_len, last_len;
+        int number;
+        if(Person_AsUTF8(item, &first, &first_len, &last, &last_len, &number) < 0){
+            Py_DECREF(item);
+            Py_DECREF(it);
+            return -1;
+        }
+        int full = person_file_writer_add(w, first, (uint32_t)first_len, last, (uint32_t)last_len, number);
+        Py_DECREF(item);
+        if(full > 0){
+            Py_BEGIN_ALLOW_THREADS
+            full = person_file_writer_flush(w);
+            Py_END_ALLOW_THREADS
+        }
+        if(full < 0){
+            Py_DECREF(it);
+            PyErr_SetFromErrno(PyExc_OSError);
+            return -1;
+        }
+    }
+    Py_DECREF(it);
+    return PyErr_Occurred() ? -1 : 0;
+}
+
+static PyObject *write_person_file(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *path_obj = NULL;
+    PyObject *persons;
+    int block_rows = 4096;
+    const char *compression = "lz";
+    int filters = 1;
+    static char *kwlist[] = {"path", "persons", "block_rows", "compression", "filters", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&O|izp:write_person_file", kwlist,
+                PyUnicode_FSConverter, &path_obj, &persons, &block_rows, &compression, &filters)){
+        return NULL;
+    }
+    int codec;
+    if(compression == NULL){
+        codec = PERSON_FILE_CODEC_NONE;
+    } else if(strcmp(compression, "lz") == 0){
+        codec = PERSON_FILE_CODEC_LZ;
+    } else {
+        Py_DECREF(path_obj);
+        PyErr_Format(PyExc_ValueError, "unknown compression '%s', expected 'lz' or None", compression);
+        return NULL;
+    }
+    if(block_rows < 1 || block_rows > (1 << 24)){
+        Py_DECREF(path_obj);
+        PyErr_SetString(PyExc_ValueError, "block_rows must be between 1 and 2**24");
+        return NULL;
+    }
+
+    const char *path = PyBytes_AS_STRING(path_obj);
+    PROBE3(bulk_entry, "write_person_file", persons,
+           PersonColumns_Check(persons) ? (long)((struct PersonColumns *)persons)->n : -1L);
+    uint64_t started = latency_start();
+    struct person_file_writer *w = person_file_writer_open(path, block_rows, codec,
+            filters ? PERSON_FILE_FILTER_DELTA | PERSON_FILE_FILTER_SHUFFLE : 0);
+    if(w == NULL){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        Py_DECREF(path_obj);
+        PROBE3(bulk_return, "write_person_file", persons, -1L);
+        LATENCY_END(LAT_WRITE_PERSON_FILE, started);
+        return NULL;
+    }
+
+    int rc;
+    uint64_t encoding = trace_start();
+    if(PersonColumns_Check(persons)){
+        Py_BEGIN_ALLOW_THREADS
+        rc = write_columns(w, (struct PersonColumns *)persons);
+        Py_END_ALLOW_THREADS
+        if(rc < 0){
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        }
+    } else {
+        rc = write_iterable(w, persons);
+    }
+    if(rc < 0){
+        person_file_writer_abort(w);
+        unlink(path);
+        Py_DECREF(path_obj);
+        PROBE3(bulk_return, "write_person_file", persons, -1L);
+        LATENCY_END(LAT_WRITE_PERSON_FILE, started);
+        return NULL;
+    }
+
+    uint64_t n = person_file_writer_rows(w);
+    TRACE_END("write_person_file.encode", encoding, (int64_t)n);
+    uint64_t closing = trace_start();
+    Py_BEGIN_ALLOW_THREADS
+    rc = person_file_writer_close(w);
+    Py_END_ALLOW_THREADS
+    TRACE_END("write_person_file.close", closing, (int64_t)n);
+    if(rc < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path_obj);
+        unlink(path);
+        Py_DECREF(path_obj);
+        PROBE3(bulk_return, "write_person_file", persons, -1L);
+        LATENCY_END(LAT_WRITE_PERSON_FILE, started);
+        return NULL;
+    }
+    Py_DECREF(path_obj);
+    PROBE3(bulk_return, "write_person_file", persons, (long)n);
+    LATENCY_END(LAT_WRITE_PERSON_FILE, started);
+    return PyLong_FromUnsignedLongLong(n);
+}
+
+static PyObject *lz_compress_py(PyObject *module, PyObject *arg)
+{
+    Py_buffer view;
+    if(PyObject_GetBuffer(arg, &view, PyBUF_SIMPLE) < 0){
+        return NULL;
+    }
+    size_t bound = lz_compress_bound((size_t)view.len);
+    PyObject *out = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)bound);
+    if(out == NULL){
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    size_t size;
+    Py_BEGIN_ALLOW_THREADS
+    size = lz_compress(view.buf, (size_t)view.len, PyBytes_AS_STRING(out), bound);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if(_PyBytes_Resize(&out, (Py_ssize_t)size) < 0){
+        return NULL;
+    }
+    return out;
+}
+
+static PyObject *lz_decompress_py(PyObject *module, PyObject *args)
+{
+    Py_buffer view;
+    Py_ssize_t size;
+    if(!PyArg_ParseTuple(args, "y*n:lz_decompress", &view, &size)){
+        return NULL;
+    }
+    if(size < 0){
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "size must not be negative");
+        return NULL;
+    }
+    PyObject *out = PyBytes_FromStringAndSize(NULL, size);
+    if(out == NULL){
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    int rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = lz_decompress(view.buf, (size_t)view.len, PyBytes_AS_STRING(out), (size_t)size);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    if(rc < 0){
+        Py_DECREF(out);
+        PyErr_SetString(PyExc_ValueError, "corrupt LZ data or wrong size");
+        return NULL;
+    }
+    return out;
+}
+
+static PyObject *crc32c_py(PyObject *module, PyObject *args)
+{
+    Py_buffer view;
+    unsigned int value = 0;
+    if(!PyArg_ParseTuple(args, "y*|I:crc32c", &view, &value)){
+        return NULL;
+    }
+    uint32_t crc;
+    // Not worth releasing the GIL for small buffers.
+    if(view.len >= 65536){
+        Py_BEGIN_ALLOW_THREADS
+        crc = crc32c(value, view.buf, (size_t)view.len);
+        Py_END_ALLOW_THREADS
+    } else {
+        crc = crc32c(value, view.buf, (size_t)view.len);
+    }
+    PyBuffer_Release(&view);
+    return PyLong_FromUnsignedLong(crc);
+}
+
+static PyMethodDef person_file_functions[] = {
+    {
+        .ml_name = "write_person_file",
+        .ml_meth = (PyCFunction)(void(*)(void))write_person_file,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "write_person_file(path, persons, block_rows=4096, compression='lz', filters=True)\n\n"
+                  "Write an iterable of Persons, or a PersonColumns, as a Person file. "
+                  "Return the number of rows written.",
+    },
+    {
+        .ml_name = "lz_compress",
+        .ml_meth = (PyCFunction)lz_compress_py,
+        .ml_flags = METH_O,
+        .ml_doc = "lz_compress(data): compress a bytes-like object with the block codec of Person files",
+    },
+    {
+        .ml_name = "lz_decompress",
+        .ml_meth = (PyCFunction)lz_decompress_py,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "lz_decompress(data, size): decompress data that decompresses to exactly size bytes",
+    },
+    {
+        .ml_name = "crc32c",
+        .ml_meth = (PyCFunction)crc32c_py,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "crc32c(data, value=0): CRC32C of a bytes-like object, starting from value",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int person_file_module_init(PyObject *m)
+{
+    if(PyType_Ready(&PersonFileType) < 0){
+        return -1;
+    }
+
+    Py_INCREF(&PersonFileType);
+    if(PyModule_AddObject(m, "PersonFile", (PyObject *)&PersonFileType) < 0){
+        Py_DECREF(&PersonFileType);
+        return -1;
+    }
+    return PyModule_AddFunctions(m, person_file_functions);
+}
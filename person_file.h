@@ -0,0 +1,60 @@
+/*
+ * Block-compressed Person files.
+ *
+ * A Person file stores rows in blocks of up to `block_rows` rows.  Each block
+ * holds its rows column by column, with the same layout as a person_chunk
+ * (see person_columns.h), so that a block decodes straight into a chunk:
+ *
+ *      int32    number[n]
+ *      int32    first_offsets[n + 1]
+ *      int32    last_offsets[n + 1]
+ *      char     first_data[first_offsets[n]]
+ *      char     last_data[last_offsets[n]]
+ *
+ * The int32 part is optionally filtered (delta, then byte shuffle: the delta
+ * of an offsets array is the array of name lengths) and the whole block is
+ * optionally compressed with the LZ codec of codec.h.
+ *
+ * The writer below never touches Python state and can be driven without the
+ * GIL.  Its functions return -1 with errno set on failure.
+ */
+#ifndef MYMODULE_PERSON_FILE_H
+#define MYMODULE_PERSON_FILE_H
+
+#include <stdint.h>
+
+#define PERSON_FILE_CODEC_NONE 0
+#define PERSON_FILE_CODEC_LZ 1
+
+#define PERSON_FILE_FILTER_DELTA 1
+#define PERSON_FILE_FILTER_SHUFFLE 2
+
+struct person_file_writer;
+
+// Returns NULL with errno set on failure.
+struct person_file_writer *person_file_writer_open(const char *path, int block_rows,
+                                                   int codec, int filters);
+
+/*
+ * Buffer one row.  Returns 1 when the current block is full: the caller must
+ * then call person_file_writer_flush() before adding more rows.  This split
+ * lets Python callers gather rows with the GIL and encode blocks without it.
+ */
+int person_file_writer_add(struct person_file_writer *w,
+                           const char *first_name, uint32_t first_len,
+                           const char *last_name, uint32_t last_len,
+                           int32_t number);
+
+// Encode and write the buffered rows as one block.
+int person_file_writer_flush(struct person_file_writer *w);
+
+// Flush, write the block index and close the file.  Frees `w` in any case.
+int person_file_writer_close(struct person_file_writer *w);
+
+// Close without completing the file.  Frees `w`.
+void person_file_writer_abort(struct person_file_writer *w);
+
+// Rows added so far, including those not flushed yet.
+uint64_t person_file_writer_rows(const struct person_file_writer *w);
+
+#endif
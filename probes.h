@@ -0,0 +1,108 @@
+/*
+ * USDT (SystemTap / bpftrace) static probes of the "mymodule" provider.
+ *
+ *      bpftrace -e 'usdt:./mymodule.so:mymodule:person_new { @[tid] = count(); }'
+ *
+ * With sys/sdt.h (systemtap-sdt-dev), detected by CMakeLists.txt, each probe
+ * is a nop instruction plus an ELF note, behind a test of the probe's
+ * semaphore.  bpftrace and SystemTap increment the semaphore while they are
+ * attached, so the arguments of a PROBEn() are only evaluated then and may
+ * call functions.  Code that prepares arguments outside of the macro tests
+ * MYMODULE_<PROBE>_ENABLED() first.  Without the header the macros expand to
+ * nothing and the tests are constant 0.  See bench/bpftrace/ for example
+ * scripts.
+ *
+ * Probe                        Arguments
+ * person_new                   object
+ * person_init_entry            object, positional argument count, keyword argument count
+ * person_init_return           object, 0 or -1
+ * person_dealloc               object
+ * person_str_entry             object
+ * person_str_return            object, length of the result or -1
+ * person_name_entry            object
+ * person_name_return           object, length of the result or -1
+ * bulk_entry                   operation name, input object, input rows or -1 if unknown
+ * bulk_return                  operation name, input object, result size or -1 on error
+ * chunks_entry                 chunk array, chunks, rows
+ * chunks_return                chunk array, chunks, rows
+ * chunk_entry                  chunk, index, NUMA node, rows
+ * chunk_return                 chunk, index, NUMA node, rows
+ *
+ * bulk_* wrap the Python-level bulk operations (PersonColumns(), sum_number(),
+ * write_person_file(), partition(), ...); the input object is the argument
+ * tuple when there are several inputs, and the result size is the number of
+ * rows, operations or bytes produced, or 1 for a scalar result.  chunks_* wrap person_chunks_parallel() and chunk_*
+ * each of its per-partition calls, in the worker thread that runs it.
+ */
+#ifndef MYMODULE_PROBES_H
+#define MYMODULE_PROBES_H
+
+// Every probe, for declaring and defining the semaphores.
+#define MYMODULE_PROBES(X) \
+    X(person_new) \
+    X(person_init_entry) \
+    X(person_init_return) \
+    X(person_dealloc) \
+    X(person_str_entry) \
+    X(person_str_return) \
+    X(person_name_entry) \
+    X(person_name_return) \
+    X(bulk_entry) \
+    X(bulk_return) \
+    X(chunks_entry) \
+    X(chunks_return) \
+    X(chunk_entry) \
+    X(chunk_return)
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// Defined in mymodule.c.
+#define PROBE_SEMAPHORE_DECLARE(name) \
+    extern unsigned short mymodule_##name##_semaphore __attribute__((visibility("hidden")));
+MYMODULE_PROBES(PROBE_SEMAPHORE_DECLARE)
+
+#define PROBE_ENABLED(name) __builtin_expect(mymodule_##name##_semaphore != 0, 0)
+
+#define PROBE1(name, a) do { \
+    if(PROBE_ENABLED(name)) DTRACE_PROBE1(mymodule, name, a); \
+} while(0)
+#define PROBE2(name, a, b) do { \
+    if(PROBE_ENABLED(name)) DTRACE_PROBE2(mymodule, name, a, b); \
+} while(0)
+#define PROBE3(name, a, b, c) do { \
+    if(PROBE_ENABLED(name)) DTRACE_PROBE3(mymodule, name, a, b, c); \
+} while(0)
+#define PROBE4(name, a, b, c, d) do { \
+    if(PROBE_ENABLED(name)) DTRACE_PROBE4(mymodule, name, a, b, c, d); \
+} while(0)
+
+#else
+
+#define PROBE_ENABLED(name) 0
+
+#define PROBE1(name, a) ((void)0)
+#define PROBE2(name, a, b) ((void)0)
+#define PROBE3(name, a, b, c) ((void)0)
+#define PROBE4(name, a, b, c, d) ((void)0)
+
+#endif
+
+#define MYMODULE_PERSON_NEW_ENABLED() PROBE_ENABLED(person_new)
+#define MYMODULE_PERSON_INIT_ENTRY_ENABLED() PROBE_ENABLED(person_init_entry)
+#define MYMODULE_PERSON_INIT_RETURN_ENABLED() PROBE_ENABLED(person_init_return)
+#define MYMODULE_PERSON_DEALLOC_ENABLED() PROBE_ENABLED(person_dealloc)
+#define MYMODULE_PERSON_STR_ENTRY_ENABLED() PROBE_ENABLED(person_str_entry)
+#define MYMODULE_PERSON_STR_RETURN_ENABLED() PROBE_ENABLED(person_str_return)
+#define MYMODULE_PERSON_NAME_ENTRY_ENABLED() PROBE_ENABLED(person_name_entry)
+#define MYMODULE_PERSON_NAME_RETURN_ENABLED() PROBE_ENABLED(person_name_return)
+#define MYMODULE_BULK_ENTRY_ENABLED() PROBE_ENABLED(bulk_entry)
+#define MYMODULE_BULK_RETURN_ENABLED() PROBE_ENABLED(bulk_return)
+#define MYMODULE_CHUNKS_ENTRY_ENABLED() PROBE_ENABLED(chunks_entry)
+#define MYMODULE_CHUNKS_RETURN_ENABLED() PROBE_ENABLED(chunks_return)
+#define MYMODULE_CHUNK_ENTRY_ENABLED() PROBE_ENABLED(chunk_entry)
+#define MYMODULE_CHUNK_RETURN_ENABLED() PROBE_ENABLED(chunk_return)
+
+#endif
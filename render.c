@@ -0,0 +1,543 @@
+/*
+ * Bulk rendering of Persons to a file descriptor.
+ *
+ * >>> mymodule.write_persons(sys.stdout, persons)
+ * >>> mymodule.write_persons(fd, persons, template="{last_name},{first_name},{number}\n")
+ *
+ * Without a template every Person is written as Person_str() formats it,
+ * "Person(first_name=..., last_name=..., number=...)", followed by a newline.
+ * The type's own str() is not called: subclasses are rendered the same way,
+ * including FrozenPerson whose str() says "FrozenPerson(...)".
+ * A template may contain the fields {first_name}, {last_name} and {number};
+ * "{{" and "}}" stand for literal braces.
+ *
+ * The Persons are taken from the iterable in batches.  For each batch the names
+ * are pinned (a reference is taken to the str objects) with the GIL held, then
+ * the batch is rendered without the GIL into a ring of large buffers.  A
+ * writer thread drains full buffers with writev(), several at a time, so
+ * rendering overlaps I/O and the GIL is never held during a write.
+ */
+#include <Python.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "person.h"
+#include "probes.h"
+#include "latency.h"
+#include "tracked_alloc.h"
+
+#define RENDER_BATCH 4096
+#define RENDER_BUFFERS 4
+#define RENDER_BUFFER_SIZE (256 * 1024)
+
+/*
+ * TEMPLATES
+ */
+
+enum segment_type {
+    SEGMENT_LITERAL,
+    SEGMENT_FIRST_NAME,
+    SEGMENT_LAST_NAME,
+    SEGMENT_NUMBER,
+};
+
+struct segment {
+    enum segment_type type;
+    const char *text;           // for SEGMENT_LITERAL
+    size_t len;
+};
+
+struct template {
+    struct segment *segments;
+    int n_segments;
+    char *text;                 // literals, unescaped
+    size_t literal_size;        // total size of the literals
+};
+
+// Same output as Person_str(), one per line, for every subclass as well.
+static const char default_template[] = "Person(first_name={first_name}, last_name={last_name}, number={number})\n";
+
+static void template_free(struct template *t)
+{
+    tracked_free(t->segments);
+    tracked_free(t->text);
+}
+
+static int template_compile(struct template *t, const char *src, Py_ssize_t size)
+{
+    static const struct {
+        const char *name;
+        enum segment_type type;
+    } fields[] = {
+        {"{first_name}", SEGMENT_FIRST_NAME},
+        {"{last_name}", SEGMENT_LAST_NAME},
+        {"{number}", SEGMENT_NUMBER},
+    };
+
+    memset(t, 0, sizeof(*t));
+    // At most one segment per character, plus one.
+    t->segments = tracked_malloc(((size_t)size + 1) * sizeof(struct segment));
+    t->text = tracked_malloc((size_t)size + 1);
+    if(t->segments == NULL || t->text == NULL){
+        template_free(t);
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    char *out = t->text;
+    struct segment *literal = NULL;
+    Py_ssize_t i = 0;
+    while(i < size){
+        if(src[i] == '{' && i + 1 < size && src[i + 1] != '{'){
+            size_t k;
+            for(k = 0; k < sizeof(fields) / sizeof(fields[0]); k++){
+                size_t len = strlen(fields[k].name);
+                if((size_t)(size - i) >= len && memcmp(src + i, fields[k].name, len) == 0){
+                    break;
+                }
+            }
+            if(k == sizeof(fields) / sizeof(fields[0])){
+                template_free(t);
+                PyErr_Format(PyExc_ValueError, "unknown field in template at position %zd, "
+                             "expected {first_name}, {last_name} or {number}", i);
+                return -1;
+            }
+            t->segments[t->n_segments++] = (struct segment){.type = fields[k].type};
+            literal = NULL;
+            i += (Py_ssize_t)strlen(fields[k].name);
+            continue;
+        }
+        if(src[i] == '}' && !(i + 1 < size && src[i + 1] == '}')){
+            template_free(t);
+            PyErr_Format(PyExc_ValueError, "single '}' in template at position %zd", i);
+            return -1;
+        }
+        if(src[i] == '{' && i + 1 == size){
+            template_free(t);
+            PyErr_SetString(PyExc_ValueError, "single '{' at the end of the template");
+            return -1;
+        }
+        // Literal character, "{{" and "}}" are one brace.
+        if(literal == NULL){
+            literal = &t->segments[t->n_segments++];
+            *literal = (struct segment){.type = SEGMENT_LITERAL, .text = out, .len = 0};
+        }
+        *out++ = src[i];
+        literal->len++;
+        t->literal_size++;
+        i += (src[i] == '{' || src[i] == '}') ? 2 : 1;
+    }
+    return 0;
+}
+
+// Write the decimal form of v at p, return the number of bytes (at most 11).
+static size_t format_int(char *p, int32_t v)
+{
+    static const char digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[12];
+    char *end = tmp + sizeof(tmp);
+    char *q = end;
+    uint32_t u = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    while(u >= 100){
+        uint32_t r = u % 100;
+        u /= 100;
+        q -= 2;
+        memcpy(q, digits + 2 * r, 2);
+    }
+    if(u >= 10){
+        q -= 2;
+        memcpy(q, digits + 2 * u, 2);
+    } else {
+        *--q = (char)('0' + u);
+    }
+    if(v < 0){
+        *--q = '-';
+    }
+    size_t len = (size_t)(end - q);
+    memcpy(p, q, len);
+    return len;
+}
+
+/*
+ * WRITER THREAD
+ */
+
+struct render_buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+    int full;                   // handed to the writer thread
+};
+
+struct render_writer {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct render_buffer buffers[RENDER_BUFFERS];
+    int head;                   // next buffer to write
+    int current;                // buffer being filled
+    int closing;
+    int error;                  // errno of the first failed write
+    unsigned long long written;
+};
+
+// Write all of `iov`, updating it as it goes.
+static int writev_all(int fd, struct iovec *iov, int n)
+{
+    while(n > 0){
+        ssize_t w = writev(fd, iov, n);
+        if(w < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        while(n > 0 && (size_t)w >= iov->iov_len){
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0){
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+    return 0;
+}
+
+static void *render_writer_main(void *arg)
+{
+    struct render_writer *w = arg;
+    pthread_mutex_lock(&w->mutex);
+    for(;;){
+        while(!w->buffers[w->head].full && !w->closing){
+            pthread_cond_wait(&w->cond, &w->mutex);
+        }
+        if(!w->buffers[w->head].full){
+            break;
+        }
+
+        // Take every full buffer in ring order.
+        struct iovec iov[RENDER_BUFFERS];
+        int n = 0;
+        size_t total = 0;
+        for(int i = w->head; n < RENDER_BUFFERS && w->buffers[i].full; i = (i + 1) % RENDER_BUFFERS){
+            iov[n].iov_base = w->buffers[i].data;
+            iov[n].iov_len = w->buffers[i].size;
+            total += w->buffers[i].size;
+            n++;
+        }
+        int error = w->error;
+        pthread_mutex_unlock(&w->mutex);
+
+        // After an error the remaining buffers are discarded.
+        if(error == 0 && writev_all(w->fd, iov, n) < 0){
+            error = errno;
+        }
+
+        pthread_mutex_lock(&w->mutex);
+        if(error != 0){
+            w->error = error;
+        } else {
+            w->written += total;
+        }
+        for(int i = 0; i < n; i++){
+            w->buffers[w->head].full = 0;
+            w->buffers[w->head].size = 0;
+            w->head = (w->head + 1) % RENDER_BUFFERS;
+        }
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+/*
+ * Hand the current buffer to the writer and wait until the next one is free.
+ * Called without the GIL.  Returns the writer's error, 0 if there is none.
+ */
+static int render_writer_submit(struct render_writer *w)
+{
+    pthread_mutex_lock(&w->mutex);
+    if(w->buffers[w->current].size > 0){
+        w->buffers[w->current].full = 1;
+        pthread_cond_broadcast(&w->cond);
+        w->current = (w->current + 1) % RENDER_BUFFERS;
+    }
+    while(w->buffers[w->current].full){
+        pthread_cond_wait(&w->cond, &w->mutex);
+    }
+    int error = w->error;
+    pthread_mutex_unlock(&w->mutex);
+    return error;
+}
+
+/*
+ * RENDERING
+ */
+
+struct render_row {
+    PyObject *first_obj;        // str, referenced
+    PyObject *last_obj;
+    const char *first;
+    const char *last;
+    Py_ssize_t first_len;
+    Py_ssize_t last_len;
+    int number;
+};
+
+// Pin the names of a Person.  Names that are not str are converted with str()
+// like Person_str() does.
+static int render_row_init(struct render_row *row, PyObject *item)
+{
+    if(!Person_Check(item)){
+        PyErr_Format(PyExc_TypeError, "expected a Person, got %.200s", Py_TYPE(item)->tp_name);
+        return -1;
+    }
+    struct Person *p = (struct Person *)item;
+    if(p->first_name == NULL || p->last_name == NULL){
+        PyErr_SetString(PyExc_AttributeError, p->first_name == NULL ? "first_name" : "last_name");
+        return -1;
+    }
+    row->first_obj = PyObject_Str(p->first_name);
+    if(row->first_obj == NULL){
+        return -1;
+    }
+    row->last_obj = PyObject_Str(p->last_name);
+    if(row->last_obj == NULL){
+        Py_DECREF(row->first_obj);
+        return -1;
+    }
+    row->first = PyUnicode_AsUTF8AndSize(row->first_obj, &row->first_len);
+    row->last = row->first ? PyUnicode_AsUTF8AndSize(row->last_obj, &row->last_len) : NULL;
+    if(row->last == NULL){
+        Py_DECREF(row->first_obj);
+        Py_DECREF(row->last_obj);
+        return -1;
+    }
+    row->number = p->number;
+    return 0;
+}
+
+// Render rows into the writer's buffers, without the GIL.  Returns -1 if a
+// buffer cannot grow or if the writer failed.
+static int render_rows(struct render_writer *w, const struct template *t,
+                       const struct render_row *rows, int n)
+{
+    for(int r = 0; r < n; r++){
+        const struct render_row *row = &rows[r];
+        size_t need = t->literal_size + (size_t)row->first_len + (size_t)row->last_len + 11 * (size_t)t->n_segments;
+        struct render_buffer *b = &w->buffers[w->current];
+        if(b->capacity - b->size < need){
+            if(render_writer_submit(w) != 0){
+                return -1;
+            }
+            b = &w->buffers[w->current];
+            // A single row larger than a buffer.
+            if(b->capacity < need){
+                char *data = tracked_realloc(b->data, need);
+                if(data == NULL){
+                    return -1;
+                }
+                b->data = data;
+                b->capacity = need;
+            }
+        }
+
+        char *p = b->data + b->size;
+        for(int s = 0; s < t->n_segments; s++){
+            const struct segment *seg = &t->segments[s];
+            switch(seg->type){
+            case SEGMENT_LITERAL:
+                memcpy(p, seg->text, seg->len);
+                p += seg->len;
+                break;
+            case SEGMENT_FIRST_NAME:
+                memcpy(p, row->first, (size_t)row->first_len);
+                p += row->first_len;
+                break;
+            case SEGMENT_LAST_NAME:
+                memcpy(p, row->last, (size_t)row->last_len);
+                p += row->last_len;
+                break;
+            case SEGMENT_NUMBER:
+                p += format_int(p, row->number);
+                break;
+            }
+        }
+        b->size = (size_t)(p - b->data);
+    }
+    return 0;
+}
+
+static PyObject *write_persons_impl(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PyObject *target, *persons;
+    PyObject *template_obj = Py_None;
+    static char *kwlist[] = {"file", "persons", "template", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "OO|O:write_persons", kwlist, &target, &persons, &template_obj)){
+        return NULL;
+    }
+
+    struct template t;
+    if(template_obj == Py_None){
+        if(template_compile(&t, default_template, (Py_ssize_t)strlen(default_template)) < 0){
+            return NULL;
+        }
+    } else {
+        Py_ssize_t size;
+        const char *src = PyUnicode_Check(template_obj) ? PyUnicode_AsUTF8AndSize(template_obj, &size) : NULL;
+        if(src == NULL){
+            if(!PyErr_Occurred()){
+                PyErr_SetString(PyExc_TypeError, "template must be a str or None");
+            }
+            return NULL;
+        }
+        if(template_compile(&t, src, size) < 0){
+            return NULL;
+        }
+    }
+
+    // Data buffered by a Python file object must go out first.
+    int fd = PyObject_AsFileDescriptor(target);
+    if(fd < 0){
+        template_free(&t);
+        return NULL;
+    }
+    if(!PyLong_Check(target) && PyObject_HasAttrString(target, "flush")){
+        PyObject *r = PyObject_CallMethod(target, "flush", NULL);
+        if(r == NULL){
+            template_free(&t);
+            return NULL;
+        }
+        Py_DECREF(r);
+    }
+
+    struct render_writer w;
+    memset(&w, 0, sizeof(w));
+    w.fd = fd;
+    struct render_row *rows = tracked_malloc(RENDER_BATCH * sizeof(struct render_row));
+    int ok = rows != NULL;
+    for(int i = 0; ok && i < RENDER_BUFFERS; i++){
+        w.buffers[i].data = tracked_malloc(RENDER_BUFFER_SIZE);
+        w.buffers[i].capacity = RENDER_BUFFER_SIZE;
+        ok = w.buffers[i].data != NULL;
+    }
+    if(!ok){
+        for(int i = 0; i < RENDER_BUFFERS; i++){
+            tracked_free(w.buffers[i].data);
+        }
+        tracked_free(rows);
+        template_free(&t);
+        return PyErr_NoMemory();
+    }
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.cond, NULL);
+
+    PyObject *it = NULL;
+    int started = pthread_create(&w.thread, NULL, render_writer_main, &w) == 0;
+    if(!started){
+        PyErr_SetString(PyExc_RuntimeError, "cannot start the writer thread");
+    } else {
+        it = PyObject_GetIter(persons);
+    }
+
+    int rc = 0;
+    while(it != NULL){
+        int n = 0;
+        PyObject *item = NULL;
+        while(n < RENDER_BATCH && (item = PyIter_Next(it)) != NULL){
+            int r = render_row_init(&rows[n], item);
+            Py_DECREF(item);
+            if(r < 0){
+                break;
+            }
+            n++;
+        }
+        int failed = PyErr_Occurred() != NULL;
+
+        if(n > 0){
+            Py_BEGIN_ALLOW_THREADS
+            rc = render_rows(&w, &t, rows, n);
+            Py_END_ALLOW_THREADS
+        }
+        for(int i = 0; i < n; i++){
+            Py_DECREF(rows[i].first_obj);
+            Py_DECREF(rows[i].last_obj);
+        }
+        if(failed || rc < 0 || n < RENDER_BATCH){
+            break;
+        }
+    }
+
+    if(started){
+        Py_BEGIN_ALLOW_THREADS
+        render_writer_submit(&w);
+        pthread_mutex_lock(&w.mutex);
+        w.closing = 1;
+        pthread_cond_broadcast(&w.cond);
+        pthread_mutex_unlock(&w.mutex);
+        pthread_join(w.thread, NULL);
+        Py_END_ALLOW_THREADS
+    }
+
+    // The writer thread is gone, its fields can be read without the mutex.
+    PyObject *result = NULL;
+    if(PyErr_Occurred()){
+        // from the iterator or a Person
+    } else if(w.error != 0){
+        errno = w.error;
+        PyErr_SetFromErrno(PyExc_OSError);
+    } else if(rc < 0){
+        PyErr_NoMemory();
+    } else {
+        result = PyLong_FromUnsignedLongLong(w.written);
+    }
+
+    Py_XDECREF(it);
+    pthread_mutex_destroy(&w.mutex);
+    pthread_cond_destroy(&w.cond);
+    for(int i = 0; i < RENDER_BUFFERS; i++){
+        tracked_free(w.buffers[i].data);
+    }
+    tracked_free(rows);
+    template_free(&t);
+    return result;
+}
+
+static PyObject *write_persons(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PROBE3(bulk_entry, "write_persons", args, -1L);
+    uint64_t started = latency_start();
+    PyObject *result = write_persons_impl(module, args, kwds);
+    PROBE3(bulk_return, "write_persons", args, result == NULL ? -1L : PyLong_AsLong(result));
+    LATENCY_END(LAT_WRITE_PERSONS, started);
+    return result;
+}
+
+static PyMethodDef render_functions[] = {
+    {
+        .ml_name = "write_persons",
+        .ml_meth = (PyCFunction)(void(*)(void))write_persons,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "write_persons(file, persons, template=None)\n\n"
+                  "Write every Person of an iterable to a file descriptor or a file object, as "
+                  "Person(first_name=..., last_name=..., number=...) and a newline, whatever the subclass, "
+                  "or following a template with {first_name}, {last_name} and {number}. "
+                  "Return the number of bytes written.",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int render_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, render_functions);
+}
@@ -0,0 +1,686 @@
+/*
+ * SharedPersonStore: a mutable Person dataset in POSIX shared memory that
+ * several processes attach to at the same time.
+ *
+ * >>> s = mymodule.SharedPersonStore("people", capacity=100000, create=True)
+ * >>> s.append(mymodule.Person("Ada", "Lovelace", 1815))
+ * 0
+ * # in another process
+ * >>> s = mymodule.SharedPersonStore("people")
+ * >>> v = s[0]                 # SharedPersonView, nothing is copied yet
+ * >>> v.number += 1            # visible to every process
+ *
+ * The segment is created with shm_open(), so it is the same object as
+ * multiprocessing.shared_memory.SharedMemory(name) and shows up under
+ * /dev/shm.  Each process maps it at a different address: the layout only
+ * contains offsets relative to the start of the segment.
+ *
+ *      +--------+--------+--------+-- ... --+
+ *      | header | slot 0 | slot 1 |          |
+ *      +--------+--------+--------+-- ... --+
+ *
+ * Every slot has room for `name_bytes` bytes of UTF-8 for both names.
+ *
+ * Writers (append and update) serialize on a process-shared robust mutex in
+ * the header.  If a process dies while holding it, the next one to lock it
+ * clears the slot that was being written, whose content cannot be trusted:
+ * its names become empty and its number 0.  Readers never
+ * lock: each slot has a sequence counter that writers make odd while they
+ * modify the slot (a seqlock), and readers retry when they observe an odd or
+ * changed counter.  A new slot is published by a release store of `count`.
+ */
+#include <Python.h>
+#include <structmember.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "person.h"
+
+#define SHM_MAGIC 0x4d595350u  // "MYSP"
+#define SHM_VERSION 1
+#define SHM_NO_WRITER UINT64_MAX
+
+struct shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t slots_offset;
+    uint32_t slot_size;
+    uint32_t name_bytes;
+    uint64_t count;         // published slots, accessed atomically
+    uint64_t writing;       // slot being written under the lock, or SHM_NO_WRITER
+    pthread_mutex_t lock;
+};
+
+struct shm_slot {
+    uint32_t seq;           // odd while a writer modifies the slot
+    int32_t number;
+    uint16_t first_len;
+    uint16_t last_len;
+    char names[];           // first name then last name
+};
+
+struct SharedPersonStore {
+    PyObject_HEAD
+    PyObject *name;
+    char *base;
+    size_t size;
+};
+
+struct SharedPersonView {
+    PyObject_HEAD
+    struct SharedPersonStore *store;
+    uint64_t index;
+};
+
+static PyTypeObject SharedPersonStoreType;
+static PyTypeObject SharedPersonViewType;
+
+static inline struct shm_header *store_header(struct SharedPersonStore *self)
+{
+    return (struct shm_header *)self->base;
+}
+
+static inline struct shm_slot *store_slot(struct SharedPersonStore *self, uint64_t index)
+{
+    struct shm_header *h = store_header(self);
+    return (struct shm_slot *)(self->base + h->slots_offset + index * h->slot_size);
+}
+
+static int store_check_open(struct SharedPersonStore *self)
+{
+    if(self->base == NULL){
+        PyErr_SetString(PyExc_ValueError, "SharedPersonStore is closed");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * LOCKING
+ */
+
+static int store_lock(struct SharedPersonStore *self)
+{
+    struct shm_header *h = store_header(self);
+    int rc;
+    Py_BEGIN_ALLOW_THREADS
+    rc = pthread_mutex_lock(&h->lock);
+    Py_END_ALLOW_THREADS
+    if(rc == EOWNERDEAD){
+        // The previous owner died in the middle of a write: the slot it was
+        // writing may be torn and has an odd sequence number that readers
+        // would spin on.  Clear it and publish it again.
+        if(h->writing != SHM_NO_WRITER && h->writing < h->capacity){
+            struct shm_slot *slot = store_slot(self, h->writing);
+            uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+            if(!(seq & 1)){
+                __atomic_store_n(&slot->seq, ++seq, __ATOMIC_RELAXED);
+                __atomic_thread_fence(__ATOMIC_RELEASE);
+            }
+            slot->number = 0;
+            slot->first_len = 0;
+            slot->last_len = 0;
+            __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+        }
+        h->writing = SHM_NO_WRITER;
+        pthread_mutex_consistent(&h->lock);
+        rc = 0;
+    }
+    if(rc != 0){
+        errno = rc;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    return 0;
+}
+
+static void store_unlock(struct SharedPersonStore *self)
+{
+    pthread_mutex_unlock(&store_header(self)->lock);
+}
+
+static void slot_write_begin(struct SharedPersonStore *self, uint64_t index, struct shm_slot *slot)
+{
+    store_header(self)->writing = index;
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void slot_write_end(struct SharedPersonStore *self, struct shm_slot *slot)
+{
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+    store_header(self)->writing = SHM_NO_WRITER;
+}
+
+/*
+ * Copy the name fields of a slot (not the whole slot) consistently.  `buf` must
+ * have room for name_bytes bytes.  Returns -1 with ValueError set if the slot
+ * holds lengths that do not fit, which a writer never stores.
+ */
+static int slot_read(struct SharedPersonStore *self, struct shm_slot *slot,
+                      char *buf, uint16_t *first_len, uint16_t *last_len, int *number)
+{
+    uint32_t name_bytes = store_header(self)->name_bytes;
+    for(;;){
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if(seq & 1){
+            sched_yield();
+            continue;
+        }
+        uint16_t f = __atomic_load_n(&slot->first_len, __ATOMIC_RELAXED);
+        uint16_t l = __atomic_load_n(&slot->last_len, __ATOMIC_RELAXED);
+        *number = __atomic_load_n(&slot->number, __ATOMIC_RELAXED);
+        if((uint32_t)f + l <= name_bytes){
+            memcpy(buf, slot->names, (size_t)f + l);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq){
+            if((uint32_t)f + l > name_bytes){
+                PyErr_Format(PyExc_ValueError, "corrupt SharedPersonStore slot: names of %u bytes in %u bytes",
+                             (unsigned)f + l, name_bytes);
+                return -1;
+            }
+            *first_len = f;
+            *last_len = l;
+            return 0;
+        }
+    }
+}
+
+/*
+ * STORE
+ */
+
+static int store_unmap(struct SharedPersonStore *self)
+{
+    if(self->base != NULL){
+        int rc = munmap(self->base, self->size);
+        self->base = NULL;
+        return rc;
+    }
+    return 0;
+}
+
+static void SharedPersonStore_dealloc(struct SharedPersonStore *self)
+{
+    store_unmap(self);
+    Py_XDECREF(self->name);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int SharedPersonStore_init(struct SharedPersonStore *self, PyObject *args, PyObject *kwds)
+{
+    const char *name;
+    unsigned long long capacity = 1024;
+    unsigned int name_bytes = 64;
+    int create = 0;
+    static char *kwlist[] = {"name", "capacity", "name_bytes", "create", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|KIp", kwlist, &name, &capacity, &name_bytes, &create)){
+        return -1;
+    }
+
+    if(self->base != NULL){
+        PyErr_SetString(PyExc_RuntimeError, "SharedPersonStore is already attached");
+        return -1;
+    }
+
+    // Same naming rule as multiprocessing.shared_memory.
+    PyObject *shm_name = name[0] == '/' ? PyUnicode_FromString(name) : PyUnicode_FromFormat("/%s", name);
+    if(shm_name == NULL){
+        return -1;
+    }
+    const char *path = PyUnicode_AsUTF8(shm_name);
+
+    int fd = shm_open(path, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if(fd < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, shm_name);
+        Py_DECREF(shm_name);
+        return -1;
+    }
+
+    size_t size;
+    if(create){
+        if(capacity == 0 || name_bytes == 0 || name_bytes > UINT16_MAX){
+            PyErr_SetString(PyExc_ValueError, "capacity must be positive and name_bytes between 1 and 65535");
+            goto fail_unlink;
+        }
+        size_t slot_size = (offsetof(struct shm_slot, names) + name_bytes + 7) & ~(size_t)7;
+        size_t slots_offset = (sizeof(struct shm_header) + 63) & ~(size_t)63;
+        if(capacity > (SIZE_MAX - slots_offset) / slot_size){
+            PyErr_SetString(PyExc_OverflowError, "SharedPersonStore capacity is too large");
+            goto fail_unlink;
+        }
+        size = slots_offset + (size_t)capacity * slot_size;
+        if(ftruncate(fd, (off_t)size) < 0){
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, shm_name);
+            goto fail_unlink;
+        }
+        self->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(self->base == MAP_FAILED){
+            self->base = NULL;
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, shm_name);
+            goto fail_unlink;
+        }
+        self->size = size;
+
+        struct shm_header *h = store_header(self);
+        h->version = SHM_VERSION;
+        h->capacity = capacity;
+        h->slots_offset = slots_offset;
+        h->slot_size = (uint32_t)slot_size;
+        h->name_bytes = name_bytes;
+        h->count = 0;
+        h->writing = SHM_NO_WRITER;
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        int rc = pthread_mutex_init(&h->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        if(rc != 0){
+            errno = rc;
+            PyErr_SetFromErrno(PyExc_OSError);
+            store_unmap(self);
+            goto fail_unlink;
+        }
+        // Attaching processes check the magic last.
+        __atomic_store_n(&h->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        struct stat st;
+        if(fstat(fd, &st) < 0){
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, shm_name);
+            goto fail;
+        }
+        size = (size_t)st.st_size;
+        if(size < sizeof(struct shm_header)){
+            PyErr_Format(PyExc_ValueError, "%S is not a SharedPersonStore", shm_name);
+            goto fail;
+        }
+        self->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(self->base == MAP_FAILED){
+            self->base = NULL;
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, shm_name);
+            goto fail;
+        }
+        self->size = size;
+        struct shm_header *h = store_header(self);
+        if(__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC || h->version != SHM_VERSION
+                || h->slot_size == 0 || h->slots_offset > size
+                || h->capacity > (size - h->slots_offset) / h->slot_size){
+            store_unmap(self);
+            PyErr_Format(PyExc_ValueError, "%S is not a SharedPersonStore", shm_name);
+            goto fail;
+        }
+    }
+
+    close(fd);
+    self->name = shm_name;
+    return 0;
+
+fail_unlink:
+    shm_unlink(path);
+fail:
+    close(fd);
+    Py_DECREF(shm_name);
+    return -1;
+}
+
+static Py_ssize_t SharedPersonStore_length(struct SharedPersonStore *self)
+{
+    if(store_check_open(self) < 0){
+        return -1;
+    }
+    return (Py_ssize_t)__atomic_load_n(&store_header(self)->count, __ATOMIC_ACQUIRE);
+}
+
+static int store_write_slot(struct SharedPersonStore *self, uint64_t index, PyObject *person)
+{
+    const char *first, *last;
+    Py_ssize_t first_len, last_len;
+    int number;
+    if(Person_AsUTF8(person, &first, &first_len, &last, &last_len, &number) < 0){
+        return -1;
+    }
+    if(first_len + last_len > store_header(self)->name_bytes){
+        PyErr_Format(PyExc_ValueError, "names of %zd bytes do not fit in %u bytes",
+                first_len + last_len, store_header(self)->name_bytes);
+        return -1;
+    }
+
+    struct shm_slot *slot = store_slot(self, index);
+    slot_write_begin(self, index, slot);
+    slot->number = number;
+    slot->first_len = (uint16_t)first_len;
+    slot->last_len = (uint16_t)last_len;
+    memcpy(slot->names, first, (size_t)first_len);
+    memcpy(slot->names + first_len, last, (size_t)last_len);
+    slot_write_end(self, slot);
+    return 0;
+}
+
+static PyObject *SharedPersonStore_append(struct SharedPersonStore *self, PyObject *person)
+{
+    if(store_check_open(self) < 0 || store_lock(self) < 0){
+        return NULL;
+    }
+    struct shm_header *h = store_header(self);
+    uint64_t index = h->count;
+    if(index >= h->capacity){
+        store_unlock(self);
+        PyErr_SetString(PyExc_MemoryError, "SharedPersonStore is full");
+        return NULL;
+    }
+    if(store_write_slot(self, index, person) < 0){
+        store_unlock(self);
+        return NULL;
+    }
+    __atomic_store_n(&h->count, index + 1, __ATOMIC_RELEASE);
+    store_unlock(self);
+    return PyLong_FromUnsignedLongLong(index);
+}
+
+static int store_check_index(struct SharedPersonStore *self, Py_ssize_t index)
+{
+    if(store_check_open(self) < 0){
+        return -1;
+    }
+    if(index < 0 || (uint64_t)index >= __atomic_load_n(&store_header(self)->count, __ATOMIC_ACQUIRE)){
+        PyErr_SetString(PyExc_IndexError, "SharedPersonStore index out of range");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *SharedPersonStore_item(struct SharedPersonStore *self, Py_ssize_t index)
+{
+    if(store_check_index(self, index) < 0){
+        return NULL;
+    }
+    struct SharedPersonView *view = PyObject_New(struct SharedPersonView, &SharedPersonViewType);
+    if(view == NULL){
+        return NULL;
+    }
+    Py_INCREF(self);
+    view->store = self;
+    view->index = (uint64_t)index;
+    return (PyObject *)view;
+}
+
+static int SharedPersonStore_ass_item(struct SharedPersonStore *self, Py_ssize_t index, PyObject *person)
+{
+    if(person == NULL){
+        PyErr_SetString(PyExc_TypeError, "SharedPersonStore does not support item deletion");
+        return -1;
+    }
+    if(store_check_index(self, index) < 0 || store_lock(self) < 0){
+        return -1;
+    }
+    int rc = store_write_slot(self, (uint64_t)index, person);
+    store_unlock(self);
+    return rc;
+}
+
+static PyObject *SharedPersonStore_close(struct SharedPersonStore *self, PyObject *Py_UNUSED(ignored))
+{
+    if(store_unmap(self) < 0){
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *SharedPersonStore_unlink(struct SharedPersonStore *self, PyObject *Py_UNUSED(ignored))
+{
+    if(shm_unlink(PyUnicode_AsUTF8(self->name)) < 0){
+        return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->name);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *SharedPersonStore_get_capacity(struct SharedPersonStore *self, void *Py_UNUSED(closure))
+{
+    if(store_check_open(self) < 0){
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(store_header(self)->capacity);
+}
+
+/*
+ * VIEWS
+ *
+ * A view is an index into the store.  Its attributes are read from and
+ * written to shared memory on every access.
+ */
+
+static void SharedPersonView_dealloc(struct SharedPersonView *self)
+{
+    Py_DECREF(self->store);
+    PyObject_Free(self);
+}
+
+static PyObject *view_field(struct SharedPersonView *self, int field)
+{
+    if(store_check_open(self->store) < 0){
+        return NULL;
+    }
+    uint16_t first_len, last_len;
+    int number;
+    char *buf = PyMem_Malloc(store_header(self->store)->name_bytes);
+    if(buf == NULL){
+        return PyErr_NoMemory();
+    }
+    if(slot_read(self->store, store_slot(self->store, self->index), buf, &first_len, &last_len, &number) < 0){
+        PyMem_Free(buf);
+        return NULL;
+    }
+    PyObject *result;
+    switch(field){
+        case 0: result = PyUnicode_DecodeUTF8(buf, first_len, NULL); break;
+        case 1: result = PyUnicode_DecodeUTF8(buf + first_len, last_len, NULL); break;
+        case 2: result = PyLong_FromLong(number); break;
+        default: result = Person_FromUTF8(buf, first_len, buf + first_len, last_len, number); break;
+    }
+    PyMem_Free(buf);
+    return result;
+}
+
+static PyObject *SharedPersonView_get(struct SharedPersonView *self, void *closure)
+{
+    return view_field(self, (int)(intptr_t)closure);
+}
+
+static int SharedPersonView_set(struct SharedPersonView *self, PyObject *value, void *closure)
+{
+    int field = (int)(intptr_t)closure;
+    if(value == NULL){
+        PyErr_SetString(PyExc_AttributeError, "cannot delete SharedPersonView attributes");
+        return -1;
+    }
+
+    // Read-modify-write under the lock so concurrent updates of different
+    // fields of the same slot do not lose each other.
+    PyObject *person = NULL;
+    if(store_check_open(self->store) < 0 || store_lock(self->store) < 0){
+        return -1;
+    }
+    person = view_field(self, 3);
+    if(person == NULL){
+        goto done;
+    }
+    struct Person *p = (struct Person *)person;
+    if(field == 2){
+        long number = PyLong_AsLong(value);
+        if(number == -1 && PyErr_Occurred()){
+            Py_CLEAR(person);
+            goto done;
+        }
+        if(number < INT_MIN || number > INT_MAX){
+            PyErr_SetString(PyExc_OverflowError, "number does not fit in a C int");
+            Py_CLEAR(person);
+            goto done;
+        }
+        p->number = (int)number;
+    } else {
+        if(!PyUnicode_Check(value)){
+            PyErr_SetString(PyExc_TypeError, "names must be str");
+            Py_CLEAR(person);
+            goto done;
+        }
+        PyObject **target = field == 0 ? &p->first_name : &p->last_name;
+        PyObject *tmp = *target;
+        Py_INCREF(value);
+        *target = value;
+        Py_XDECREF(tmp);
+    }
+    if(store_write_slot(self->store, self->index, person) < 0){
+        Py_CLEAR(person);
+    }
+
+done:
+    store_unlock(self->store);
+    if(person == NULL){
+        return -1;
+    }
+    Py_DECREF(person);
+    return 0;
+}
+
+static PyObject *SharedPersonView_to_person(struct SharedPersonView *self, PyObject *Py_UNUSED(ignored))
+{
+    return view_field(self, 3);
+}
+
+static PyObject *SharedPersonView_str(struct SharedPersonView *self)
+{
+    PyObject *person = view_field(self, 3);
+    if(person == NULL){
+        return NULL;
+    }
+    PyObject *result = PyObject_Str(person);
+    Py_DECREF(person);
+    return result;
+}
+
+static PyObject *SharedPersonView_get_index(struct SharedPersonView *self, void *Py_UNUSED(closure))
+{
+    return PyLong_FromUnsignedLongLong(self->index);
+}
+
+static PySequenceMethods SharedPersonStore_as_sequence = {
+    .sq_length = (lenfunc) SharedPersonStore_length,
+    .sq_item = (ssizeargfunc) SharedPersonStore_item,
+    .sq_ass_item = (ssizeobjargproc) SharedPersonStore_ass_item,
+};
+
+static PyMethodDef SharedPersonStore_methods[] = {
+    {
+        .ml_name = "append",
+        .ml_meth = (PyCFunction)SharedPersonStore_append,
+        .ml_flags = METH_O,
+        .ml_doc = "Append a Person and return its index",
+    },
+    {
+        .ml_name = "close",
+        .ml_meth = (PyCFunction)SharedPersonStore_close,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Detach from the shared memory segment",
+    },
+    {
+        .ml_name = "unlink",
+        .ml_meth = (PyCFunction)SharedPersonStore_unlink,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Remove the shared memory segment name, it is freed when every process has detached",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+static PyGetSetDef SharedPersonStore_getset[] = {
+    {"capacity", (getter)SharedPersonStore_get_capacity, NULL, "Maximum number of Persons", NULL},
+    {NULL}
+};
+
+static PyMemberDef SharedPersonStore_members[] = {
+    {
+        .name = "name",
+        .type = T_OBJECT_EX,
+        .offset = offsetof(struct SharedPersonStore, name),
+        .flags = READONLY,
+        .doc = "Name of the shared memory segment"
+    },
+    {NULL}
+};
+
+static PyMethodDef SharedPersonView_methods[] = {
+    {
+        .ml_name = "to_person",
+        .ml_meth = (PyCFunction)SharedPersonView_to_person,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return a Person copy of the current contents of the slot",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+static PyGetSetDef SharedPersonView_getset[] = {
+    {"first_name", (getter)SharedPersonView_get, (setter)SharedPersonView_set, "First name of the person", (void *)0},
+    {"last_name", (getter)SharedPersonView_get, (setter)SharedPersonView_set, "Last name of the person", (void *)1},
+    {"number", (getter)SharedPersonView_get, (setter)SharedPersonView_set, "Number of the person", (void *)2},
+    {"index", (getter)SharedPersonView_get_index, NULL, "Index of the slot in the store", NULL},
+    {NULL}
+};
+
+static PyTypeObject SharedPersonStoreType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.SharedPersonStore",
+    .tp_doc = "SharedPersonStore(name, capacity=1024, name_bytes=64, create=False)\n\n"
+              "Person dataset in POSIX shared memory shared between processes",
+    .tp_basicsize = sizeof(struct SharedPersonStore),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) SharedPersonStore_init,
+    .tp_dealloc = (destructor) SharedPersonStore_dealloc,
+    .tp_as_sequence = &SharedPersonStore_as_sequence,
+    .tp_methods = SharedPersonStore_methods,
+    .tp_members = SharedPersonStore_members,
+    .tp_getset = SharedPersonStore_getset,
+};
+
+static PyTypeObject SharedPersonViewType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.SharedPersonView",
+    .tp_doc = "Live view of one Person of a SharedPersonStore",
+    .tp_basicsize = sizeof(struct SharedPersonView),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) SharedPersonView_dealloc,
+    .tp_str = (reprfunc) SharedPersonView_str,
+    .tp_methods = SharedPersonView_methods,
+    .tp_getset = SharedPersonView_getset,
+};
+
+int shared_store_module_init(PyObject *m)
+{
+    if(PyType_Ready(&SharedPersonStoreType) < 0 || PyType_Ready(&SharedPersonViewType) < 0){
+        return -1;
+    }
+
+    Py_INCREF(&SharedPersonStoreType);
+    if(PyModule_AddObject(m, "SharedPersonStore", (PyObject *)&SharedPersonStoreType) < 0){
+        Py_DECREF(&SharedPersonStoreType);
+        return -1;
+    }
+    Py_INCREF(&SharedPersonViewType);
+    if(PyModule_AddObject(m, "SharedPersonView", (PyObject *)&SharedPersonViewType) < 0){
+        Py_DECREF(&SharedPersonViewType);
+        return -1;
+    }
+    return 0;
+}
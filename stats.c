@@ -0,0 +1,110 @@
+/*
+ * mymodule.stats() and mymodule.reset_stats(), see stats.h.
+ *
+ * >>> mymodule.stats()
+ * {'seconds': 12.5, 'persons_alive': 1000, 'person_alloc': 1204, ...}
+ *
+ * "seconds" is the time since the module was loaded or the counters were
+ * last reset, so that rates can be computed from a single call.  Counters are
+ * read one by one without stopping the threads that update them, so a dict
+ * taken while they run is not an exact snapshot.
+ */
+#include <Python.h>
+#include <time.h>
+#include "person.h"
+#include "stats.h"
+
+#ifdef MYMODULE_STATS
+
+struct mymodule_counter mymodule_stats[STAT_COUNT];
+int64_t mymodule_live_persons;
+
+static const char *stat_names[STAT_COUNT] = {
+    [STAT_PERSON_ALLOC] = "person_alloc",
+    [STAT_PERSON_DEALLOC] = "person_dealloc",
+    [STAT_PERSON_INIT] = "person_init",
+    [STAT_PERSON_INIT_POSITIONAL] = "person_init_positional",
+    [STAT_PERSON_INIT_KEYWORDS] = "person_init_keywords",
+    [STAT_PERSON_NAME] = "person_name",
+    [STAT_PERSON_STR] = "person_str",
+    [STAT_POOL_HITS] = "pool_hits",
+    [STAT_POOL_MISSES] = "pool_misses",
+    [STAT_PAGE_HITS] = "page_hits",
+    [STAT_PAGE_MISSES] = "page_misses",
+    [STAT_BLOCK_CACHE_HITS] = "block_cache_hits",
+    [STAT_BLOCK_CACHE_MISSES] = "block_cache_misses",
+};
+
+static double stats_since;
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static PyObject *stats(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    PyObject *result = Py_BuildValue("{s:d,s:L}", "seconds", monotonic_seconds() - stats_since,
+                                     "persons_alive",
+                                     (long long)__atomic_load_n(&mymodule_live_persons, __ATOMIC_RELAXED));
+    for(int i = 0; result != NULL && i < STAT_COUNT; i++){
+        PyObject *value = PyLong_FromUnsignedLongLong(__atomic_load_n(&mymodule_stats[i].value, __ATOMIC_RELAXED));
+        if(value == NULL || PyDict_SetItemString(result, stat_names[i], value) < 0){
+            Py_XDECREF(value);
+            Py_CLEAR(result);
+            break;
+        }
+        Py_DECREF(value);
+    }
+    return result;
+}
+
+static PyObject *reset_stats(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    for(int i = 0; i < STAT_COUNT; i++){
+        __atomic_store_n(&mymodule_stats[i].value, 0, __ATOMIC_RELAXED);
+    }
+    stats_since = monotonic_seconds();
+    Py_RETURN_NONE;
+}
+
+#else
+
+static PyObject *stats(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    return PyDict_New();
+}
+
+static PyObject *reset_stats(PyObject *module, PyObject *Py_UNUSED(ignored))
+{
+    Py_RETURN_NONE;
+}
+
+#endif
+
+static PyMethodDef stats_functions[] = {
+    {
+        .ml_name = "stats",
+        .ml_meth = (PyCFunction)stats,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return a dict of operation counters since the last reset_stats(), and the number of "
+                  "Persons alive. Empty if the module was built without MYMODULE_STATS.",
+    },
+    {
+        .ml_name = "reset_stats",
+        .ml_meth = (PyCFunction)reset_stats,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Set the counters of stats() back to zero",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int stats_module_init(PyObject *m)
+{
+#ifdef MYMODULE_STATS
+    stats_since = monotonic_seconds();
+#endif
+    return PyModule_AddFunctions(m, stats_functions);
+}
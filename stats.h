@@ -0,0 +1,56 @@
+/*
+ * Process-wide operation counters, read with mymodule.stats().
+ *
+ *      STAT_INC(STAT_PERSON_INIT);
+ *
+ * Counters are relaxed atomic increments, each on its own cache line so that
+ * threads counting different events do not contend.  When the module is
+ * built without MYMODULE_STATS (cmake -DMYMODULE_STATS=OFF) the macros expand
+ * to nothing and stats() returns an empty dict.
+ */
+#ifndef MYMODULE_STATS_H
+#define MYMODULE_STATS_H
+
+#include <stdint.h>
+
+enum mymodule_stat {
+    STAT_PERSON_ALLOC,
+    STAT_PERSON_DEALLOC,
+    STAT_PERSON_INIT,
+    STAT_PERSON_INIT_POSITIONAL,    // tp_init calls with positional arguments
+    STAT_PERSON_INIT_KEYWORDS,      // tp_init calls with keyword arguments
+    STAT_PERSON_NAME,
+    STAT_PERSON_STR,
+    STAT_POOL_HITS,                 // PersonPool.acquire()
+    STAT_POOL_MISSES,
+    STAT_PAGE_HITS,                 // PagedTable buffer pool
+    STAT_PAGE_MISSES,
+    STAT_BLOCK_CACHE_HITS,          // PersonFile decoded block
+    STAT_BLOCK_CACHE_MISSES,
+    STAT_COUNT
+};
+
+#ifdef MYMODULE_STATS
+
+struct mymodule_counter {
+    uint64_t value;
+} __attribute__((aligned(64)));
+
+extern struct mymodule_counter mymodule_stats[STAT_COUNT];
+extern int64_t mymodule_live_persons;  // not reset by reset_stats()
+
+#define STAT_INC(stat) __atomic_add_fetch(&mymodule_stats[stat].value, 1, __ATOMIC_RELAXED)
+#define STAT_PERSON_CREATED() (STAT_INC(STAT_PERSON_ALLOC), \
+                               __atomic_add_fetch(&mymodule_live_persons, 1, __ATOMIC_RELAXED))
+#define STAT_PERSON_DESTROYED() (STAT_INC(STAT_PERSON_DEALLOC), \
+                                 __atomic_sub_fetch(&mymodule_live_persons, 1, __ATOMIC_RELAXED))
+
+#else
+
+#define STAT_INC(stat) ((void)0)
+#define STAT_PERSON_CREATED() ((void)0)
+#define STAT_PERSON_DESTROYED() ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,492 @@
+/*
+ * Deterministic synthetic Persons for benchmarks and load tests.
+ *
+ * >>> cols = mymodule.synth(10_000_000, 42)                    # PersonColumns
+ * >>> people = mymodule.synth(1000, 42, profile="unicode", output="list")
+ * >>> mymodule.synth(10_000_000, 42, output="file", path="people.pf")
+ * 10000000
+ *
+ * A profile describes the data: how many distinct first and last names there
+ * are and whether they are drawn uniformly or with Zipf's law (s = 1, the
+ * shape of real surname frequencies), the scripts the names are written in,
+ * how often a last name is double-barrelled, and how `number` is distributed.
+ * Names are built from syllables, so their lengths vary, and only names of the
+ * "ascii" profile are guaranteed to be ASCII.
+ *
+ * The output only depends on (n, seed, profile): row i is made from values
+ * 4i to 4i + 3 of one splitmix64 stream, and the Zipf weights are integers, so
+ * neither the number of partitions nor the host's libm changes the result.
+ * The name tables are built with the GIL held; then one worker per partition
+ * of the resulting PersonColumns fills its rows with the GIL released, in two
+ * passes (sizes, then data) so that each chunk is allocated exactly once.
+ */
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "person.h"
+#include "person_columns.h"
+#include "numa_placement.h"
+#include "probes.h"
+#include "latency.h"
+#include "tracked_alloc.h"
+
+#define SYNTH_MIN_CHUNK_ROWS 65536
+#define SYNTH_MAX_WORKERS 64
+#define SYNTH_MAX_NAME 64           // bytes, more than 4 syllables of any script
+#define SYNTH_GOLDEN 0x9E3779B97F4A7C15ull
+
+/*
+ * NAMES
+ */
+
+enum synth_script {
+    SCRIPT_ASCII,
+    SCRIPT_LATIN,
+    SCRIPT_GREEK,
+    SCRIPT_CYRILLIC,
+    SCRIPT_CJK,
+    N_SCRIPTS
+};
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+static const char *const ascii_initial[] = {
+    "Al", "Ben", "Car", "Dan", "El", "Fer", "Gra", "Han", "Is", "Jo", "Kar", "Lu",
+    "Mar", "Ni", "Ol", "Pe", "Ro", "Sa", "Th", "Vi", "Wil", "Yu", "Zo",
+};
+static const char *const ascii_next[] = {
+    "a", "an", "bert", "da", "el", "en", "er", "ia", "ie", "in", "ka", "la", "lin",
+    "na", "ne", "o", "on", "ra", "ri", "son", "ta", "to", "ton", "us", "y",
+};
+static const char *const latin_initial[] = {
+    "Å", "Be", "Ça", "Đo", "É", "Fø", "Gö", "Hå", "Í", "Jó", "Ła", "Mü", "Ñu",
+    "Ø", "Pé", "Ré", "Śl", "Tö", "Úr", "Vä", "Ža",
+};
+static const char *const latin_next[] = {
+    "á", "ão", "ça", "dé", "ë", "ga", "ić", "kö", "ła", "ñe", "ø", "ra", "ré",
+    "ß", "še", "tå", "ü", "ya", "ž",
+};
+static const char *const greek_initial[] = {
+    "Αλ", "Βα", "Γι", "Δη", "Ελ", "Ζω", "Θε", "Ια", "Κω", "Λε", "Μα", "Νι",
+    "Ξε", "Ορ", "Πα", "Ρο", "Σο", "Τα", "Υπ", "Φω", "Χρ", "Ψα", "Ωρ",
+};
+static const char *const greek_next[] = {
+    "α", "ας", "η", "ης", "ι", "ιος", "κη", "λα", "νη", "ος", "ου", "πα", "ρα",
+    "ση", "τα", "ων",
+};
+static const char *const cyrillic_initial[] = {
+    "Ан", "Бо", "Ва", "Гр", "Дм", "Ев", "Жа", "Зо", "Ив", "Ка", "Ле", "Ми",
+    "На", "Ол", "Пе", "Ру", "Св", "Та", "Ул", "Фё", "Юр", "Яр",
+};
+static const char *const cyrillic_next[] = {
+    "а", "ан", "ев", "ий", "ин", "ка", "ла", "ль", "на", "ов", "ра", "сь", "та",
+    "я", "ёв",
+};
+static const char *const cjk_syllables[] = {
+    "王", "李", "张", "刘", "陈", "杨", "黄", "赵", "吴", "周", "伟", "芳", "娜",
+    "秀", "敏", "静", "丽", "强", "磊", "军", "佐", "藤", "鈴", "木", "高", "橋",
+    "田", "中", "渡", "辺",
+};
+
+static const struct {
+    const char *const *initial;
+    int n_initial;
+    const char *const *next;
+    int n_next;
+    int max_next;               // syllables after the initial one
+} scripts[N_SCRIPTS] = {
+    [SCRIPT_ASCII] = {ascii_initial, COUNT(ascii_initial), ascii_next, COUNT(ascii_next), 3},
+    [SCRIPT_LATIN] = {latin_initial, COUNT(latin_initial), latin_next, COUNT(latin_next), 3},
+    [SCRIPT_GREEK] = {greek_initial, COUNT(greek_initial), greek_next, COUNT(greek_next), 3},
+    [SCRIPT_CYRILLIC] = {cyrillic_initial, COUNT(cyrillic_initial), cyrillic_next, COUNT(cyrillic_next), 3},
+    [SCRIPT_CJK] = {cjk_syllables, COUNT(cjk_syllables), cjk_syllables, COUNT(cjk_syllables), 2},
+};
+
+/*
+ * PROFILES
+ */
+
+enum synth_number {
+    NUMBER_UNIFORM,             // [0, 1000000)
+    NUMBER_LOG,                 // 0 or [2**b, 2**(b+1)) with b uniform in [0, 30)
+    NUMBER_FULL,                // any int32
+};
+
+static const struct synth_profile {
+    const char *name;
+    int first_names;
+    int last_names;
+    int zipf;
+    int script_weights[N_SCRIPTS];      // percent
+    int double_barrel;                  // percent of last names
+    enum synth_number number;
+} profiles[] = {
+    {"realistic", 4096, 20000, 1, {85, 6, 2, 4, 3}, 3, NUMBER_LOG},
+    {"ascii", 1000, 1000, 0, {100, 0, 0, 0, 0}, 0, NUMBER_UNIFORM},
+    {"unicode", 4096, 20000, 1, {20, 20, 20, 20, 20}, 5, NUMBER_FULL},
+};
+
+/*
+ * RANDOM NUMBERS
+ */
+
+static inline uint64_t splitmix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Value `i` of the stream of `seed`.
+static inline uint64_t stream(uint64_t seed, uint64_t i)
+{
+    return splitmix64(seed + (i + 1) * SYNTH_GOLDEN);
+}
+
+// Uniform in [0, bound), without division.
+static inline uint64_t below(uint64_t r, uint64_t bound)
+{
+    return (uint64_t)(((__uint128_t)r * bound) >> 64);
+}
+
+/*
+ * NAME TABLES
+ */
+
+/*
+ * A name is drawn by inverting its cumulative weights: name i is picked for
+ * u = below(r, total) in [cumulative[i-1], cumulative[i]).  Since u grows with
+ * r, the top `guide_bits` bits of r tell where to start looking: guide[k] is
+ * the first name that can be picked in that range of r, and a few steps from
+ * there find the name, instead of a binary search that mispredicts at every
+ * level.
+ */
+struct name_table {
+    int count;
+    int guide_bits;
+    uint64_t *cumulative;       // cumulative integer weights of the names
+    uint32_t *guide;
+    uint32_t *offsets;          // name i is data[offsets[i]:offsets[i+1]]
+    char *data;
+};
+
+static void name_table_free(struct name_table *t)
+{
+    tracked_free(t->cumulative);
+    tracked_free(t->guide);
+    tracked_free(t->offsets);
+    tracked_free(t->data);
+}
+
+static int name_table_build(struct name_table *t, const struct synth_profile *profile, int count, uint64_t seed)
+{
+    t->count = count;
+    for(t->guide_bits = 2; (1 << (t->guide_bits - 2)) < count; t->guide_bits++){
+    }
+    t->cumulative = tracked_malloc((size_t)count * sizeof(uint64_t));
+    t->guide = tracked_malloc(((size_t)1 << t->guide_bits) * sizeof(uint32_t));
+    t->offsets = tracked_malloc(((size_t)count + 1) * sizeof(uint32_t));
+    t->data = tracked_malloc((size_t)count * SYNTH_MAX_NAME);
+    if(t->cumulative == NULL || t->guide == NULL || t->offsets == NULL || t->data == NULL){
+        name_table_free(t);
+        return -1;
+    }
+
+    uint64_t total = 0;
+    uint32_t size = 0;
+    for(int i = 0; i < count; i++){
+        // Zipf with s = 1: weight 2**32 / rank.
+        total += profile->zipf ? (UINT64_C(1) << 32) / (uint64_t)(i + 1) : 1;
+        t->cumulative[i] = total;
+
+        uint64_t r = stream(seed, (uint64_t)i);
+        int pick = (int)below(r, 100), script = 0;
+        while(pick >= profile->script_weights[script]){
+            pick -= profile->script_weights[script++];
+        }
+        r = splitmix64(r);
+        int syllables = (int)below(r, (uint64_t)scripts[script].max_next + 1);
+        const char *s = scripts[script].initial[below(splitmix64(r + 1), (uint64_t)scripts[script].n_initial)];
+        t->offsets[i] = size;
+        memcpy(t->data + size, s, strlen(s));
+        size += (uint32_t)strlen(s);
+        for(int k = 0; k < syllables; k++){
+            s = scripts[script].next[below(splitmix64(r + 2 + (uint64_t)k), (uint64_t)scripts[script].n_next)];
+            memcpy(t->data + size, s, strlen(s));
+            size += (uint32_t)strlen(s);
+        }
+    }
+    t->offsets[count] = size;
+
+    uint32_t i = 0;
+    for(uint64_t k = 0; k < (UINT64_C(1) << t->guide_bits); k++){
+        uint64_t lowest = below(k << (64 - t->guide_bits), total);
+        while(t->cumulative[i] <= lowest){
+            i++;
+        }
+        t->guide[k] = i;
+    }
+    return 0;
+}
+
+static inline int name_table_draw(const struct name_table *t, uint64_t r)
+{
+    uint64_t u = below(r, t->cumulative[t->count - 1]);
+    uint32_t i = t->guide[r >> (64 - t->guide_bits)];
+    while(t->cumulative[i] <= u){
+        i++;
+    }
+    return (int)i;
+}
+
+/*
+ * GENERATION
+ */
+
+struct synth_job {
+    const struct synth_profile *profile;
+    uint64_t seed;
+    struct name_table first;
+    struct name_table last;
+    Py_ssize_t *starts;
+    int failed;
+};
+
+struct synth_row {
+    int first;
+    int last;
+    int last2;                  // second part of a double-barrelled name, or -1
+    int32_t number;
+};
+
+static inline void synth_row(const struct synth_job *job, uint64_t row, struct synth_row *out)
+{
+    uint64_t r0 = stream(job->seed, 4 * row), r1 = stream(job->seed, 4 * row + 1);
+    uint64_t r2 = stream(job->seed, 4 * row + 2), r3 = stream(job->seed, 4 * row + 3);
+    out->first = name_table_draw(&job->first, r0);
+    out->last = name_table_draw(&job->last, r1);
+    out->last2 = below(r2, 100) < (uint64_t)job->profile->double_barrel
+                 ? name_table_draw(&job->last, splitmix64(r2)) : -1;
+    switch(job->profile->number){
+    case NUMBER_UNIFORM:
+        out->number = (int32_t)below(r3, 1000000);
+        break;
+    case NUMBER_LOG: {
+        int bits = (int)below(r3, 31);
+        out->number = bits == 0 ? 0 : (int32_t)((UINT32_C(1) << (bits - 1)) | ((uint32_t)r3 & ((UINT32_C(1) << (bits - 1)) - 1)));
+        break;
+    }
+    case NUMBER_FULL:
+        out->number = (int32_t)(uint32_t)r3;
+        break;
+    }
+}
+
+static inline uint32_t name_len(const struct name_table *t, int i)
+{
+    return t->offsets[i + 1] - t->offsets[i];
+}
+
+static inline int32_t copy_name(char *dst, const struct name_table *t, int i)
+{
+    memcpy(dst, t->data + t->offsets[i], name_len(t, i));
+    return (int32_t)name_len(t, i);
+}
+
+static void synth_chunk(struct person_chunk *chunk, int index, void *p)
+{
+    struct synth_job *job = p;
+    uint64_t start = (uint64_t)job->starts[index];
+    Py_ssize_t n = job->starts[index + 1] - job->starts[index];
+    int node = chunk->node;
+    struct synth_row row;
+
+    size_t first_size = 0, last_size = 0;
+    for(Py_ssize_t i = 0; i < n; i++){
+        synth_row(job, start + (uint64_t)i, &row);
+        first_size += name_len(&job->first, row.first);
+        last_size += name_len(&job->last, row.last);
+        if(row.last2 >= 0){
+            last_size += 1 + name_len(&job->last, row.last2);
+        }
+    }
+    if(first_size > INT32_MAX || last_size > INT32_MAX
+            || person_chunk_alloc(chunk, n, first_size, last_size, node) < 0){
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        chunk->n = 0;
+        chunk->node = node;
+        return;
+    }
+
+    int32_t f = 0, l = 0;
+    for(Py_ssize_t i = 0; i < n; i++){
+        synth_row(job, start + (uint64_t)i, &row);
+        chunk->number[i] = row.number;
+        chunk->first_offsets[i] = f;
+        f += copy_name(chunk->first_data + f, &job->first, row.first);
+        chunk->last_offsets[i] = l;
+        l += copy_name(chunk->last_data + l, &job->last, row.last);
+        if(row.last2 >= 0){
+            chunk->last_data[l++] = '-';
+            l += copy_name(chunk->last_data + l, &job->last, row.last2);
+        }
+    }
+    chunk->first_offsets[n] = f;
+    chunk->last_offsets[n] = l;
+}
+
+static PyObject *synth_columns(const struct synth_profile *profile, Py_ssize_t n, uint64_t seed, int n_chunks)
+{
+    if(n_chunks <= 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_chunks = cpus > 0 ? (int)(cpus < SYNTH_MAX_WORKERS ? cpus : SYNTH_MAX_WORKERS) : 1;
+        if(n / SYNTH_MIN_CHUNK_ROWS < n_chunks){
+            n_chunks = n / SYNTH_MIN_CHUNK_ROWS > 0 ? (int)(n / SYNTH_MIN_CHUNK_ROWS) : 1;
+        }
+    }
+    if(n_chunks > n && n > 0){
+        n_chunks = (int)n;
+    }
+
+    // The tables get their own streams, so that changing n keeps the names.
+    struct synth_job job = {.profile = profile, .seed = splitmix64(seed)};
+    struct person_chunk *chunks = tracked_calloc((size_t)n_chunks, sizeof(struct person_chunk));
+    job.starts = tracked_malloc(((size_t)n_chunks + 1) * sizeof(Py_ssize_t));
+    if(chunks == NULL || job.starts == NULL
+            || name_table_build(&job.first, profile, profile->first_names, splitmix64(seed + 1)) < 0){
+        tracked_free(chunks);
+        tracked_free(job.starts);
+        return PyErr_NoMemory();
+    }
+    if(name_table_build(&job.last, profile, profile->last_names, splitmix64(seed + 2)) < 0){
+        name_table_free(&job.first);
+        tracked_free(chunks);
+        tracked_free(job.starts);
+        return PyErr_NoMemory();
+    }
+
+    int nodes = numa_placement_node_count();
+    for(int i = 0; i <= n_chunks; i++){
+        job.starts[i] = (Py_ssize_t)((int64_t)n * i / n_chunks);
+    }
+    for(int i = 0; i < n_chunks; i++){
+        chunks[i].node = i % nodes;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    person_chunks_parallel(chunks, n_chunks, synth_chunk, &job);
+    Py_END_ALLOW_THREADS
+
+    name_table_free(&job.first);
+    name_table_free(&job.last);
+    tracked_free(job.starts);
+    if(job.failed){
+        for(int i = 0; i < n_chunks; i++){
+            person_chunk_free(&chunks[i]);
+        }
+        tracked_free(chunks);
+        return PyErr_NoMemory();
+    }
+    return PersonColumns_FromChunks(chunks, n_chunks);
+}
+
+static PyObject *columns_to_list(struct PersonColumns *columns)
+{
+    PyObject *list = PyList_New(columns->n);
+    if(list == NULL){
+        return NULL;
+    }
+    Py_ssize_t k = 0;
+    for(int c = 0; c < columns->n_chunks; c++){
+        for(Py_ssize_t i = 0; i < columns->chunks[c].n; i++){
+            PyObject *person = person_chunk_get(&columns->chunks[c], i);
+            if(person == NULL){
+                Py_DECREF(list);
+                return NULL;
+            }
+            PyList_SET_ITEM(list, k++, person);
+        }
+    }
+    return list;
+}
+
+static PyObject *synth_impl(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    Py_ssize_t n;
+    unsigned long long seed;
+    const char *profile_name = "realistic";
+    const char *output = "columns";
+    PyObject *path = Py_None;
+    int partitions = 0;
+    static char *kwlist[] = {"n", "seed", "profile", "output", "path", "partitions", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "nK|ssOi:synth", kwlist,
+                &n, &seed, &profile_name, &output, &path, &partitions)){
+        return NULL;
+    }
+    if(n < 0){
+        PyErr_SetString(PyExc_ValueError, "n must be non-negative");
+        return NULL;
+    }
+    const struct synth_profile *profile = NULL;
+    for(size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++){
+        if(strcmp(profiles[i].name, profile_name) == 0){
+            profile = &profiles[i];
+        }
+    }
+    if(profile == NULL){
+        PyErr_Format(PyExc_ValueError, "unknown profile '%s', expected 'realistic', 'ascii' or 'unicode'",
+                     profile_name);
+        return NULL;
+    }
+    int to_file = strcmp(output, "file") == 0;
+    if(!to_file && strcmp(output, "columns") != 0 && strcmp(output, "list") != 0){
+        PyErr_Format(PyExc_ValueError, "unknown output '%s', expected 'columns', 'list' or 'file'", output);
+        return NULL;
+    }
+    if(to_file != (path != Py_None)){
+        PyErr_SetString(PyExc_ValueError, "path is required with output='file' and only then");
+        return NULL;
+    }
+
+    PyObject *columns = synth_columns(profile, n, (uint64_t)seed, partitions);
+    if(columns == NULL || strcmp(output, "columns") == 0){
+        return columns;
+    }
+    PyObject *result = to_file
+        ? PyObject_CallMethod(module, "write_person_file", "OO", path, columns)
+        : columns_to_list((struct PersonColumns *)columns);
+    Py_DECREF(columns);
+    return result;
+}
+
+static PyObject *synth(PyObject *module, PyObject *args, PyObject *kwds)
+{
+    PROBE3(bulk_entry, "synth", args, -1L);
+    uint64_t started = latency_start();
+    PyObject *result = synth_impl(module, args, kwds);
+    PROBE3(bulk_return, "synth", args,
+           result == NULL ? -1L : PyLong_Check(result) ? PyLong_AsLong(result) : (long)PyObject_Length(result));
+    LATENCY_END(LAT_SYNTH, started);
+    return result;
+}
+
+static PyMethodDef synth_functions[] = {
+    {
+        .ml_name = "synth",
+        .ml_meth = (PyCFunction)(void(*)(void))synth,
+        .ml_flags = METH_VARARGS | METH_KEYWORDS,
+        .ml_doc = "synth(n, seed, profile='realistic', output='columns', path=None, partitions=0)\n\n"
+                  "Generate n synthetic Persons, the same ones for the same n, seed and profile "
+                  "('realistic', 'ascii' or 'unicode') on any machine. Return them as a PersonColumns "
+                  "with `partitions` partitions (default: one per CPU), as a list with output='list', "
+                  "or write them to the Person file `path` with output='file' and return n.",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int synth_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, synth_functions);
+}
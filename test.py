@@ -11,3 +11,490 @@ print(p)
 
 p = mymodule.Person(first_name="Johnny")
 print(p)
+
+import collections
+import json
+import os
+import tempfile
+import time
+
+tmpdir = tempfile.mkdtemp()
+
+t = mymodule.PagedTable(os.path.join(tmpdir, "people.db"), pool_pages=4, page_size=512)
+t.extend(mymodule.Person("First{}".format(i), "Last{}".format(i), i) for i in range(1000))
+print(len(t), t[0], t[-1])
+assert [p.number for p in t] == list(range(1000))
+print(t.pool_stats())
+t.close()
+
+people = [mymodule.Person("First{}".format(i), "Last{}".format(i), i) for i in range(1000)]
+cols = mymodule.PersonColumns(people, partitions=3)
+print(len(cols), cols[500], cols.partitions())
+assert cols.sum_number() == sum(range(1000))
+assert cols.count_range(100, 200) == 100
+assert [p.number for p in cols.select_range(990, 2000)] == list(range(990, 1000))
+
+store = mymodule.SharedPersonStore("mymodule-test-{}".format(os.getpid()), capacity=16, create=True)
+store.append(mymodule.Person("Grace", "Hopper", 1906))
+view = mymodule.SharedPersonStore(store.name)[0]
+view.number += 1
+print(len(store), store[0], view.index)
+assert store[0].number == 1907
+with open("/dev/shm/" + store.name, "r+b") as shm:
+    slots_offset = int.from_bytes(shm.read(24)[16:24], "little")
+    shm.seek(slots_offset + 8)
+    shm.write((0xFFFF).to_bytes(2, "little"))
+try:
+    store[0].first_name
+    assert False, "corrupt slot read"
+except ValueError as e:
+    print(e)
+with open("/dev/shm/" + store.name, "r+b") as shm:
+    slot_size = int.from_bytes(shm.read(28)[24:28], "little")
+    for field, value in ((8, (2**64 // slot_size + 1).to_bytes(8, "little")), (24, bytes(4))):
+        shm.seek(field)
+        shm.write(value)
+        shm.flush()
+        try:
+            mymodule.SharedPersonStore(store.name)
+            assert False, "corrupt header accepted"
+        except ValueError:
+            pass
+store.unlink()
+store.close()
+
+pool = mymodule.PersonPool(8)
+held = [None]
+for i in range(100):
+    held[0] = pool.acquire("Alan", "Turing", i)
+    assert pool.release(held, 0) and held[0] is None
+kept = [pool.acquire("Alan", "Turing", 1912)]
+alias = kept[0]
+assert not pool.release(kept, 0) and kept[0] is alias
+copies = list(kept)
+del alias
+assert not pool.release(kept, 0) and kept[0] is copies[0] and copies[0].number == 1912
+print(pool.stats())
+
+frozen = mymodule.FrozenPerson.intern("Ada", "Lovelace", 1815)
+assert frozen is mymodule.FrozenPerson.intern("Ada", "Lovelace", 1815)
+assert frozen == mymodule.FrozenPerson("Ada", "Lovelace", 1815)
+print(frozen, hash(frozen) == hash(mymodule.FrozenPerson("Ada", "Lovelace", 1815)))
+
+wal_path = os.path.join(tmpdir, "people.wal")
+with mymodule.WAL(wal_path, flush_interval=0.001) as wal:
+    for i in range(100):
+        wal.log_insert(mymodule.Person("First{}".format(i), "Last{}".format(i), i))
+    wal.wait(wal.log_update(7, "number", -7))
+    print(wal.stats())
+replayed = mymodule.wal_replay(wal_path)
+print(len(replayed), replayed[7])
+assert replayed[7].number == -7
+bad_update = (7).to_bytes(8, "little") + bytes([2]) + (5).to_bytes(4, "little") + b"junk"
+bad_record = len(bad_update).to_bytes(4, "little") + (10 ** 6).to_bytes(8, "little") + bytes([2]) + bad_update
+with open(wal_path, "ab") as f:
+    f.write(mymodule.crc32c(bad_record).to_bytes(4, "little") + bad_record)
+try:
+    mymodule.wal_replay(wal_path)
+    assert False, "oversized number update replayed"
+except ValueError:
+    pass
+
+import threading
+with mymodule.WAL(os.path.join(tmpdir, "threads.wal"), flush_interval=0.0005) as wal:
+    def log_some():
+        for i in range(500):
+            wal.log_insert(mymodule.Person("Ada", "Lovelace", i))
+            wal.stats()
+    threads = [threading.Thread(target=log_some) for _ in range(3)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    wal.commit()
+    assert wal.stats()["records"] == 1500
+
+closing_wal = mymodule.WAL(os.path.join(tmpdir, "closing.wal"), flush_interval=0.0005)
+def log_until_closed(lsns):
+    try:
+        while True:
+            lsns.append(closing_wal.log_insert(mymodule.Person("Ada", "Lovelace", len(lsns))))
+    except ValueError:
+        pass
+closing_lsns = [[] for _ in range(3)]
+threads = [threading.Thread(target=log_until_closed, args=(lsns,)) for lsns in closing_lsns]
+for t in threads:
+    t.start()
+time.sleep(0.05)
+closing_wal.close()
+for t in threads:
+    t.join()
+# Every LSN handed out is durable.
+assert len(mymodule.wal_replay(os.path.join(tmpdir, "closing.wal"))) == sum(map(len, closing_lsns))
+
+with mymodule.LSMStore(os.path.join(tmpdir, "people.lsm"), memtable_size=64, compaction_trigger=3) as db:
+    for i in range(1000):
+        db.put(mymodule.Person("First{}".format(i % 300), "Last", i))
+    db.wait_compaction()
+    print(db.stats(), db.get("First7", "Last"))
+    assert db.get("First7", "Last").number == 907
+    assert len(db.scan()) == 300
+    assert db.get("Nobody", "Last") is None
+
+data = b"Lovelace Ada " * 1000 + bytes(range(256))
+assert mymodule.lz_decompress(mymodule.lz_compress(data), len(data)) == data
+pf_path = os.path.join(tmpdir, "people.pf")
+people = [mymodule.Person("First{}".format(i % 50), "Łast{}".format(i % 7), i) for i in range(10000)]
+assert mymodule.write_person_file(pf_path, people, block_rows=1000) == 10000
+with mymodule.PersonFile(pf_path) as pf:
+    print(pf.stats(), pf[1234])
+    assert len(pf) == 10000 and pf.n_blocks == 10
+    assert pf[9999].number == 9999 and pf[1234].last_name == "Łast2"
+    cols = pf.to_columns(partitions=3)
+    assert len(cols) == 10000 and cols.sum_number() == sum(range(10000))
+mymodule.write_person_file(pf_path, cols, compression=None, filters=False)
+assert [p.number for p in mymodule.PersonFile(pf_path).read_block(0)][:3] == [0, 1, 2]
+
+assert mymodule.crc32c(b"123456789") == 0xE3069283
+assert mymodule.crc32c(b"56789", mymodule.crc32c(b"1234")) == 0xE3069283
+with open(pf_path, "r+b") as f:
+    f.seek(100)
+    byte = f.read(1)
+    f.seek(100)
+    f.write(bytes([byte[0] ^ 1]))
+try:
+    mymodule.PersonFile(pf_path)[0]
+    assert False, "corruption not detected"
+except ValueError as e:
+    print(e)
+
+old = [mymodule.Person("First{}".format(i), "Last", i) for i in range(1000)]
+new = [mymodule.Person(p.first_name, p.last_name, p.number + (p.number % 100 == 0)) for p in old[10:]]
+new.append(mymodule.Person("Grace", "Hopper", 1906))
+delta_path = os.path.join(tmpdir, "people.delta")
+counts = mymodule.write_delta(old, new, delta_path)
+print(counts, os.path.getsize(delta_path))
+assert counts == {"inserts": 1, "deletes": 10, "updates": 9}
+replica = list(old)
+assert mymodule.apply_delta(replica, delta_path) == counts
+assert sorted((p.first_name, p.number) for p in replica) == sorted((p.first_name, p.number) for p in new)
+try:
+    mymodule.apply_delta(replica, delta_path)
+    assert False, "delta applied twice"
+except ValueError as e:
+    print(e)
+
+out_path = os.path.join(tmpdir, "people.txt")
+with open(out_path, "w") as f:
+    f.write("header\n")
+    n = mymodule.write_persons(f, people[:3])
+with open(out_path) as f:
+    lines = f.read().splitlines()
+print(n, lines[1])
+assert lines[1:] == [str(p) for p in people[:3]]
+fd = os.open(out_path, os.O_WRONLY | os.O_TRUNC)
+mymodule.write_persons(fd, [mymodule.Person("Ada", "Lovelace", -1815)], template="{{{last_name}}},{first_name},{number}\n")
+os.close(fd)
+assert open(out_path).read() == "{Lovelace},Ada,-1815\n"
+class Emp(mymodule.Person):
+    pass
+with open(out_path, "w") as f:
+    mymodule.write_persons(f, [Emp("A", "B", 1), mymodule.FrozenPerson("C", "D", 2)])
+assert open(out_path).read().splitlines() == [str(Emp("A", "B", 1)), str(mymodule.Person("C", "D", 2))]
+
+mymodule.write_person_file(pf_path, people, block_rows=500)
+with mymodule.PersonFile(pf_path) as pf:
+    found = pf.scan(min_number=1200, max_number=1299, last_name_prefix="Łast3")
+    assert [p.number for p in found] == [i for i in range(1200, 1300) if i % 7 == 3]
+    assert len(pf.scan(first_name_prefix="First4", max_number=999)) == 220
+    print(pf.stats())
+    assert pf.stats()["blocks_skipped"] > 0
+
+arrow_path = os.path.join(tmpdir, "people.arrow")
+assert mymodule.write_arrow_file(arrow_path, mymodule.PersonColumns(people, 3)) == len(people)
+mapped = mymodule.read_arrow_file(arrow_path)
+print(len(mapped), mapped[7])
+assert [mapped[i].number for i in range(len(mapped))] == [p.number for p in people]
+assert mapped[len(mapped) - 1].last_name == people[-1].last_name
+del mapped
+
+nx_path = os.path.join(tmpdir, "people.nx")
+named = [mymodule.Person("First{}".format(i), "Last{}".format(i % 3), i) for i in range(1000)]
+assert mymodule.write_name_index(nx_path, named + named[:2]) == 1002
+with mymodule.NameIndex(nx_path) as index:
+    print(len(index), index.lookup("First1", "Last1"))
+    assert index.lookup("First1", "Last1") == [1, 1001]
+    assert index.get("First500", "Last2") == 500
+    assert index.get("First500", "Last0") is None
+
+shard_dir = os.path.join(tmpdir, "shards")
+manifest = mymodule.partition(named, 4, key="name", out_dir=shard_dir)
+print(manifest["rows"], [s["rows"] for s in manifest["shards"]])
+assert json.load(open(os.path.join(shard_dir, "manifest.json"))) == manifest
+shards = [mymodule.PersonFile(os.path.join(shard_dir, s["path"])) for s in manifest["shards"]]
+assert sorted(shard[i].number for shard in shards for i in range(len(shard))) == list(range(1000))
+
+mymodule.reset_stats()
+counted = [mymodule.Person("Ada", last_name="Lovelace") for _ in range(3)]
+stats = mymodule.stats()
+print(stats)
+if stats:   # empty when built with -DMYMODULE_STATS=OFF
+    assert stats["person_init"] == 3 and stats["person_init_keywords"] == 3 and stats["person_alloc"] >= 3
+    alive = stats["persons_alive"]
+    del counted
+    assert mymodule.stats()["persons_alive"] == alive - 3
+    frozen_batch = [mymodule.FrozenPerson("Ada", "Lovelace", i) for i in range(1000)]
+    del frozen_batch
+    assert mymodule.stats()["persons_alive"] == alive - 3
+
+import tracemalloc
+tracemalloc.start()
+traced_cols = mymodule.PersonColumns(people, partitions=2)
+native = tracemalloc.take_snapshot().filter_traces(
+    [tracemalloc.DomainFilter(True, mymodule.TRACEMALLOC_DOMAIN)])
+native_size = sum(stat.size for stat in native.statistics("filename"))
+print(native_size, native.statistics("lineno")[0])
+assert native_size > 0 and native.statistics("lineno")[0].traceback[0].filename == __file__
+del traced_cols
+native = tracemalloc.take_snapshot().filter_traces(
+    [tracemalloc.DomainFilter(True, mymodule.TRACEMALLOC_DOMAIN)])
+assert sum(stat.size for stat in native.statistics("filename")) < native_size
+tracemalloc.stop()
+
+try:
+    mymodule.enable_latency_tracking()
+except RuntimeError:    # built with -DMYMODULE_STATS=OFF
+    assert mymodule.percentiles() == {}
+else:
+    mymodule.reset_latency()
+    timed = [mymodule.Person("Ada", "Lovelace", i) for i in range(1000)]
+    names = [p.name() for p in timed]
+    mymodule.PersonColumns(timed).sum_number()
+    mymodule.disable_latency_tracking()
+    latency = mymodule.percentiles(percentiles=[50, 99, 100])
+    print(latency["Person.__init__"])
+    assert latency["Person.__init__"]["count"] == 1000 and latency["Person.name"]["count"] == 1000
+    assert latency["PersonColumns.sum_number"]["count"] == 1
+    init = latency["Person.__init__"]
+    assert init["min"] <= init["percentiles"][50.0] <= init["percentiles"][99.0] <= init["percentiles"][100.0] == init["max"]
+    exported = mymodule.export_latency()
+    mymodule.merge_latency(exported)
+    assert mymodule.percentiles()["Person.__init__"]["count"] == 2000
+    mymodule.reset_latency()
+    mymodule.merge_latency(exported)
+    assert mymodule.percentiles(percentiles=[50, 99, 100]) == latency
+    try:
+        mymodule.merge_latency(exported[:-1] + b"x")
+    except ValueError:
+        pass
+    else:
+        assert False, "corrupt export merged"
+    mymodule.reset_latency()
+
+prom_path = os.path.join(tmpdir, "mymodule.prom")
+try:
+    mymodule.start_metrics_export(prom_path, interval=0.05)
+except RuntimeError:    # built with -DMYMODULE_STATS=OFF
+    pass
+else:
+    mymodule.enable_latency_tracking()
+    exported_people = [mymodule.Person("Ada", "Lovelace", i) for i in range(100)]
+    mymodule.disable_latency_tracking()
+    time.sleep(0.2)
+    mymodule.stop_metrics_export()
+    metrics = open(prom_path).read()
+    print(metrics.splitlines()[2])
+    assert "mymodule_persons_alive" in metrics and 'mymodule_cache_hits_total{cache="person_pool"}' in metrics
+    assert 'mymodule_latency_seconds_count{op="Person.__init__"} 100' in metrics
+    assert not os.path.exists(prom_path + ".tmp")
+    mymodule.reset_latency()
+
+    native_threads = len(os.listdir("/proc/self/task"))
+    def restart_export():
+        for _ in range(50):
+            mymodule.start_metrics_export(prom_path, interval=0.05)
+    export_threads = [threading.Thread(target=restart_export) for _ in range(4)]
+    for t in export_threads:
+        t.start()
+    for t in export_threads:
+        t.join()
+    mymodule.stop_metrics_export()
+    assert len(os.listdir("/proc/self/task")) == native_threads
+
+trace_path = os.path.join(tmpdir, "trace.json")
+try:
+    mymodule.trace_to(trace_path)
+except RuntimeError:    # built with -DMYMODULE_STATS=OFF
+    pass
+else:
+    traced = mymodule.PersonColumns(people, partitions=3)
+    traced.select_range(0, 100)
+    spans = mymodule.trace_to(None)
+    trace = json.load(open(trace_path))
+    names = [e["name"] for e in trace["traceEvents"] if e["ph"] == "X"]
+    print(spans, sorted(set(names)))
+    assert spans == len(names) and names.count("person_chunk") == 6
+    assert {"PersonColumns", "PersonColumns.extract", "PersonColumns.select_range"} <= set(names)
+    assert trace["otherData"]["dropped_spans"] == 0
+    assert mymodule.trace_to(None) is None
+
+synthetic = mymodule.synth(20000, 42, partitions=3)
+assert len(synthetic) == 20000
+same = mymodule.synth(20000, 42, output="list", partitions=1)
+assert [str(p) for p in same] == [str(synthetic[i]) for i in range(20000)]
+print(same[0], same[1])
+last_names = collections.Counter(p.last_name for p in same)
+assert last_names.most_common(1)[0][1] > 20 * sorted(last_names.values())[len(last_names) // 2]
+unicode = mymodule.synth(1000, 42, profile="unicode", output="list")
+assert any(not p.first_name.isascii() for p in unicode) and len({p.number < 0 for p in unicode}) == 2
+assert all(p.last_name.isascii() for p in mymodule.synth(1000, 7, profile="ascii", output="list"))
+synth_path = os.path.join(tmpdir, "synth.pf")
+assert mymodule.synth(5000, 42, output="file", path=synth_path) == 5000
+assert str(mymodule.PersonFile(synth_path)[4999]) == str(synthetic[4999]) != str(mymodule.synth(5000, 43)[4999])
+
+eve = mymodule.FrozenPerson.intern("Ada", "Lovelace", 1)
+for mutate in (lambda: mymodule.Person.__init__(eve, "Eve", "X", 2),
+               lambda: mymodule.Person.number.__set__(eve, 2),
+               lambda: mymodule.Person.first_name.__delete__(eve)):
+    try:
+        mutate()
+        assert False, "FrozenPerson mutated"
+    except (TypeError, AttributeError):
+        pass
+assert mymodule.FrozenPerson.intern("Ada", "Lovelace", 1) is eve and eve.first_name == "Ada"
+assert str(eve) == "FrozenPerson(first_name=Ada, last_name=Lovelace, number=1)"
+class Employee(mymodule.Person):
+    pass
+assert str(Employee("Ada", "Lovelace", 1)) == "Person(first_name=Ada, last_name=Lovelace, number=1)"
+p = mymodule.Person("Ada", "Lovelace", 1)
+del p.first_name
+p.number = -5
+p.first_name = "Augusta"
+assert str(p) == "Person(first_name=Augusta, last_name=Lovelace, number=-5)"
+
+lsm = mymodule.LSMStore(os.path.join(tmpdir, "threads.lsm"), memtable_size=8)
+def lsm_puts(t):
+    for i in range(500):
+        lsm.put(mymodule.Person("T{}".format(t), "L{}".format(i), i))
+lsm_threads = [threading.Thread(target=lsm_puts, args=(t,)) for t in range(4)]
+for t in lsm_threads:
+    t.start()
+for t in lsm_threads:
+    t.join()
+assert len(lsm.scan()) == 2000 and lsm.get("T3", "L499").number == 499
+lsm.close()
+
+pf_threads_path = os.path.join(tmpdir, "threads.pf")
+mymodule.synth(50000, 1, output="file", path=pf_threads_path)
+pf = mymodule.PersonFile(pf_threads_path)
+expected = [str(p) for p in mymodule.synth(50000, 1, output="list")]
+pf_errors = []
+def pf_reads(k):
+    try:
+        for i in range(0, 50000, 97 + k):
+            if str(pf[i]) != expected[i]:
+                pf_errors.append(i)
+        pf.to_columns()
+    except ValueError as e:
+        if "closed" not in str(e):
+            pf_errors.append(e)
+pf_threads = [threading.Thread(target=pf_reads, args=(k,)) for k in range(4)]
+for t in pf_threads:
+    t.start()
+pf.close()
+for t in pf_threads:
+    t.join()
+assert pf_errors == []
+try:
+    pf[0]
+    assert False, "read from a closed PersonFile"
+except ValueError:
+    pass
+
+def flip_byte(path, offset):
+    with open(path, "r+b") as f:
+        f.seek(offset)
+        byte = f.read(1)
+        f.seek(offset)
+        f.write(bytes([byte[0] ^ 0x20]))
+
+crc_table_path = os.path.join(tmpdir, "people.db")
+assert mymodule.PagedTable(crc_table_path)[999].number == 999
+flip_byte(crc_table_path, 512 * 3 + 100)
+crc_table = mymodule.PagedTable(crc_table_path)
+assert crc_table[0].number == 0
+try:
+    list(crc_table)
+    assert False, "corrupt page not detected"
+except ValueError as e:
+    assert "checksum" in str(e)
+crc_table.close()
+crc_table.__init__(os.path.join(tmpdir, "people.db"))
+assert crc_table[0].number == 0
+crc_table.close()
+
+import struct
+
+def crc32c(data):
+    crc = 0xffffffff
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82f63b78 if crc & 1 else 0)
+    return crc ^ 0xffffffff
+
+odd_table_path = os.path.join(tmpdir, "odd_page.db")
+mymodule.PagedTable(odd_table_path, page_size=1024).close()
+with open(odd_table_path, "r+b") as f:
+    header = bytearray(f.read(32))
+    header[8:16] = struct.pack("<II", 1000, 0)
+    header[12:16] = struct.pack("<I", crc32c(header))
+    f.seek(0)
+    f.write(header)
+try:
+    mymodule.PagedTable(odd_table_path)
+    assert False, "non-power-of-two page size accepted"
+except ValueError as e:
+    assert "corrupted" in str(e)
+
+bad_nx_path = os.path.join(tmpdir, "bad_offset.nx")
+with open(nx_path, "rb") as f:
+    nx_bytes = bytearray(f.read())
+n_slots = struct.unpack_from("<Q", nx_bytes, 16)[0]
+struct.pack_into("<Q", nx_bytes, 24, 2**64 - n_slots * 16)
+struct.pack_into("<I", nx_bytes, 60, crc32c(nx_bytes[:60]))
+with open(bad_nx_path, "wb") as f:
+    f.write(nx_bytes)
+try:
+    mymodule.NameIndex(bad_nx_path)
+    assert False, "slots offset past the file accepted"
+except ValueError as e:
+    assert "not a valid name index" in str(e)
+
+crc_lsm_dir = os.path.join(tmpdir, "crc.lsm")
+with mymodule.LSMStore(crc_lsm_dir, memtable_size=1000) as db:
+    for i in range(1000):
+        db.put(mymodule.Person("First{:04}".format(i), "Last", i))
+crc_run = os.path.join(crc_lsm_dir, sorted(os.listdir(crc_lsm_dir))[0])
+flip_byte(crc_run, 8 + 12)
+with mymodule.LSMStore(crc_lsm_dir) as db:
+    assert db.get("First0999", "Last").number == 999
+    for bad in (lambda: db.get("First0000", "Last"), db.scan):
+        try:
+            bad()
+            assert False, "corrupt run not detected"
+        except ValueError as e:
+            assert "checksum" in str(e)
+
+import resource
+nofile = resource.getrlimit(resource.RLIMIT_NOFILE)
+resource.setrlimit(resource.RLIMIT_NOFILE, (256, nofile[1]))
+try:
+    many_dir = os.path.join(tmpdir, "many_shards")
+    many = mymodule.partition(named, 2000, key="number", out_dir=many_dir)
+finally:
+    resource.setrlimit(resource.RLIMIT_NOFILE, nofile)
+assert len(os.listdir(many_dir)) == 2001 and sum(s["rows"] for s in many["shards"]) == 1000
+for s in many["shards"][:50]:
+    numbers = [p.number for p in mymodule.PersonFile(os.path.join(many_dir, s["path"]))]
+    assert len(numbers) == s["rows"] and numbers == sorted(numbers)
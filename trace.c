@@ -0,0 +1,225 @@
+/*
+ * trace_to() and the per-thread span buffers, see trace.h.
+ *
+ * A buffer belongs to one thread at a time, which alone writes it: a span is
+ * written to events[n] and then published by a release store of n + 1.  A
+ * trace session has a number; a thread that finds its buffer tagged with an
+ * older session empties it first.  trace_to() ends a session by setting the
+ * current session to 0 and then reads the published events of the buffers of
+ * that session, so a span being written at that moment is just left out.
+ */
+#include <Python.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "person.h"
+#include "latency.h"
+#include "trace.h"
+#include "tracked_alloc.h"
+
+#ifdef MYMODULE_STATS
+
+#define TRACE_BUFFER_EVENTS 8192
+
+struct trace_event {
+    const char *name;       // static string
+    uint64_t start;         // latency_now() ns
+    uint64_t duration;
+    int64_t rows;
+    uint32_t tid;
+};
+
+struct trace_buffer {
+    struct trace_buffer *next;      // in all_buffers, never removed
+    int owned;                      // by a running thread
+    uint32_t session;
+    uint32_t n;
+    uint64_t dropped;
+    struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+static struct trace_buffer *all_buffers;
+static uint32_t trace_session;          // 0 when not tracing
+static uint32_t last_session;           // GIL
+static PyObject *trace_path;            // GIL, bytes
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+static __thread struct trace_buffer *thread_buffer;
+static __thread uint32_t thread_tid;
+
+static void release_buffer(void *buffer)
+{
+    __atomic_store_n(&((struct trace_buffer *)buffer)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void create_buffer_key(void)
+{
+    pthread_key_create(&buffer_key, release_buffer);
+}
+
+static struct trace_buffer *claim_buffer(void)
+{
+    pthread_once(&buffer_key_once, create_buffer_key);
+    struct trace_buffer *b;
+    for(b = __atomic_load_n(&all_buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next){
+        int expected = 0;
+        if(__atomic_compare_exchange_n(&b->owned, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            break;
+        }
+    }
+    if(b == NULL){
+        b = tracked_calloc(1, sizeof(*b));
+        if(b == NULL){
+            return NULL;
+        }
+        b->owned = 1;
+        b->next = __atomic_load_n(&all_buffers, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&all_buffers, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+        }
+    }
+    // Released when the thread exits, for the next thread that traces.
+    pthread_setspecific(buffer_key, b);
+    thread_tid = (uint32_t)syscall(SYS_gettid);
+    return b;
+}
+
+void trace_span(const char *name, uint64_t started, uint64_t ended, int64_t rows)
+{
+    uint32_t session = __atomic_load_n(&trace_session, __ATOMIC_ACQUIRE);
+    if(session == 0){
+        return;
+    }
+    struct trace_buffer *b = thread_buffer;
+    if(b == NULL){
+        b = thread_buffer = claim_buffer();
+        if(b == NULL){
+            return;
+        }
+    }
+    if(b->session != session){
+        __atomic_store_n(&b->n, 0, __ATOMIC_RELAXED);
+        b->dropped = 0;
+        __atomic_store_n(&b->session, session, __ATOMIC_RELEASE);
+    }
+    uint32_t n = b->n;
+    if(n == TRACE_BUFFER_EVENTS){
+        __atomic_store_n(&b->dropped, b->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    b->events[n] = (struct trace_event){
+        .name = name,
+        .start = started,
+        .duration = ended > started ? ended - started : 0,
+        .rows = rows,
+        .tid = thread_tid,
+    };
+    __atomic_store_n(&b->n, n + 1, __ATOMIC_RELEASE);
+}
+
+// Does not touch Python state.  Returns the number of spans, or -1.
+static Py_ssize_t write_trace(FILE *f, uint32_t session)
+{
+    Py_ssize_t written = 0;
+    uint64_t dropped = 0;
+    int pid = (int)getpid();
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n"
+               "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, "
+               "\"args\": {\"name\": \"mymodule\"}}", pid);
+    for(struct trace_buffer *b = __atomic_load_n(&all_buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next){
+        if(__atomic_load_n(&b->session, __ATOMIC_ACQUIRE) != session){
+            continue;
+        }
+        uint32_t n = __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+        dropped += __atomic_load_n(&b->dropped, __ATOMIC_RELAXED);
+        for(uint32_t i = 0; i < n; i++){
+            const struct trace_event *e = &b->events[i];
+            fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"mymodule\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                       "\"pid\": %d, \"tid\": %u",
+                    e->name, (double)e->start / 1e3, (double)e->duration / 1e3, pid, e->tid);
+            if(e->rows >= 0){
+                fprintf(f, ", \"args\": {\"rows\": %lld}", (long long)e->rows);
+            }
+            fputc('}', f);
+        }
+        written += n;
+    }
+    fprintf(f, "\n], \"otherData\": {\"dropped_spans\": %llu}}\n", (unsigned long long)dropped);
+    return ferror(f) ? -1 : written;
+}
+
+static PyObject *trace_to(PyObject *module, PyObject *arg)
+{
+    PyObject *path = NULL;
+    if(arg != Py_None && !PyUnicode_FSConverter(arg, &path)){
+        return NULL;
+    }
+
+    // End the current session, if any, and write its trace.
+    PyObject *result = Py_None;
+    Py_INCREF(result);
+    if(trace_path != NULL){
+        uint32_t session = __atomic_load_n(&trace_session, __ATOMIC_RELAXED);
+        __atomic_store_n(&trace_session, 0, __ATOMIC_RELEASE);
+        __atomic_and_fetch(&latency_flags, ~LATENCY_TRACE, __ATOMIC_RELAXED);
+        PyObject *previous = trace_path;
+        trace_path = NULL;
+
+        Py_ssize_t written = -1;
+        Py_BEGIN_ALLOW_THREADS
+        FILE *f = fopen(PyBytes_AS_STRING(previous), "w");
+        if(f != NULL){
+            written = write_trace(f, session);
+            if(fclose(f) != 0){
+                written = -1;
+            }
+        }
+        Py_END_ALLOW_THREADS
+        Py_DECREF(result);
+        result = written < 0 ? PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, previous)
+                             : PyLong_FromSsize_t(written);
+        Py_DECREF(previous);
+        if(result == NULL){
+            Py_XDECREF(path);
+            return NULL;
+        }
+    }
+
+    if(path != NULL){
+        trace_path = path;
+        last_session = last_session == UINT32_MAX ? 1 : last_session + 1;
+        __atomic_store_n(&trace_session, last_session, __ATOMIC_RELEASE);
+        __atomic_or_fetch(&latency_flags, LATENCY_TRACE, __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+#else
+
+static PyObject *trace_to(PyObject *module, PyObject *arg)
+{
+    PyErr_SetString(PyExc_RuntimeError, "mymodule was built without MYMODULE_STATS");
+    return NULL;
+}
+
+#endif
+
+static PyMethodDef trace_functions[] = {
+    {
+        .ml_name = "trace_to",
+        .ml_meth = (PyCFunction)trace_to,
+        .ml_flags = METH_O,
+        .ml_doc = "trace_to(path)\n\n"
+                  "Start recording spans of bulk operations, their stages and their worker threads, to be "
+                  "written to `path` as Chrome trace-event JSON.  The trace of the previous call is written "
+                  "when tracing starts again or stops with trace_to(None), which return its number of spans.",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int trace_module_init(PyObject *m)
+{
+    return PyModule_AddFunctions(m, trace_functions);
+}
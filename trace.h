@@ -0,0 +1,51 @@
+/*
+ * Chrome trace-event spans of bulk operations and of their stages.
+ *
+ * >>> mymodule.trace_to("trace.json")
+ * >>> cols = mymodule.PersonColumns(persons)
+ * >>> cols.select_range(0, 100)
+ * >>> mymodule.trace_to(None)     # writes trace.json, for ui.perfetto.dev
+ *
+ * Every bulk call of latency.h is a span; the code adds spans for its stages
+ * and worker threads add one per chunk:
+ *
+ *      uint64_t started = trace_start();
+ *      ...
+ *      TRACE_END("PersonColumns.extract", started, n);
+ *
+ * Each thread appends its spans to its own buffer without locks or atomic
+ * read-modify-writes.  Buffers are reused by later threads once their thread
+ * exits, so their number is bounded by the number of threads that trace at
+ * the same time.  A full buffer drops spans, counted in the trace's
+ * otherData.  Tracing is off by default and then costs a relaxed load per
+ * span.  Like the latency histograms it needs MYMODULE_STATS.
+ */
+#ifndef MYMODULE_TRACE_H
+#define MYMODULE_TRACE_H
+
+#include <stdint.h>
+#include "latency.h"
+
+#ifdef MYMODULE_STATS
+
+#define trace_start() latency_start_if(LATENCY_TRACE)
+
+// Record a span from `started` to `ended` (latency_now() values) in the
+// calling thread's buffer; `rows` is shown in its args unless negative.  Any
+// thread, with or without the GIL.
+void trace_span(const char *name, uint64_t started, uint64_t ended, int64_t rows);
+
+#define TRACE_END(name, started, rows) do { \
+        if(started){ \
+            trace_span(name, started, latency_now(), rows); \
+        } \
+    } while(0)
+
+#else
+
+#define trace_start() ((uint64_t)0)
+#define TRACE_END(name, started, rows) ((void)(started))
+
+#endif
+
+#endif
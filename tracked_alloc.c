@@ -0,0 +1,74 @@
+/*
+ * tracked_malloc() and friends, see tracked_alloc.h.
+ */
+#include <Python.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "person.h"
+#include "tracked_alloc.h"
+
+void tracked_register(void *ptr, size_t size)
+{
+    if(ptr != NULL && PyGILState_Check()){
+        // -2 when tracemalloc is not tracing; a failure to record the trace
+        // (-1) is not an allocation failure.
+        (void)PyTraceMalloc_Track(MYMODULE_TRACEMALLOC_DOMAIN, (uintptr_t)ptr, size);
+    }
+}
+
+// Does not need the GIL.
+void tracked_unregister(void *ptr)
+{
+    if(ptr != NULL){
+        (void)PyTraceMalloc_Untrack(MYMODULE_TRACEMALLOC_DOMAIN, (uintptr_t)ptr);
+    }
+}
+
+// Like PyMem_RawMalloc(), a request for 0 bytes returns a distinct pointer.
+void *tracked_malloc(size_t size)
+{
+    if(size == 0){
+        size = 1;
+    }
+    void *ptr = malloc(size);
+    tracked_register(ptr, size);
+    return ptr;
+}
+
+void *tracked_calloc(size_t n, size_t size)
+{
+    if(n == 0 || size == 0){
+        n = size = 1;
+    }
+    void *ptr = calloc(n, size);
+    tracked_register(ptr, n * size);
+    return ptr;
+}
+
+void *tracked_realloc(void *ptr, size_t size)
+{
+    if(size == 0){
+        size = 1;
+    }
+    uintptr_t old = (uintptr_t)ptr;    // ptr must not be used once realloc() succeeds
+    void *new_ptr = realloc(ptr, size);
+    if(new_ptr == NULL){
+        return NULL;        // ptr is untouched and still tracked
+    }
+    if(old != 0 && (uintptr_t)new_ptr != old){
+        (void)PyTraceMalloc_Untrack(MYMODULE_TRACEMALLOC_DOMAIN, old);
+    }
+    tracked_register(new_ptr, size);
+    return new_ptr;
+}
+
+void tracked_free(void *ptr)
+{
+    tracked_unregister(ptr);
+    free(ptr);
+}
+
+int tracked_alloc_module_init(PyObject *m)
+{
+    return PyModule_AddIntConstant(m, "TRACEMALLOC_DOMAIN", MYMODULE_TRACEMALLOC_DOMAIN);
+}
@@ -0,0 +1,47 @@
+/*
+ * Allocator of the module's native buffers, reported to tracemalloc.
+ *
+ * >>> tracemalloc.start(25)
+ * >>> cols = mymodule.PersonColumns(persons)
+ * >>> snapshot = tracemalloc.take_snapshot().filter_traces(
+ * ...     [tracemalloc.DomainFilter(True, mymodule.TRACEMALLOC_DOMAIN)])
+ * >>> snapshot.statistics("traceback")[0]
+ *
+ * Buffers that live outside Python objects (columnar storage, caches, write
+ * buffers, hash tables) are allocated with tracked_malloc() and friends
+ * rather than PyMem_RawMalloc(), and each block is registered with
+ * PyTraceMalloc_Track() in the domain TRACEMALLOC_DOMAIN.  Snapshots can then
+ * tell the module's native memory apart from Python objects (domain 0) and
+ * attribute it to the Python code that caused the allocation.
+ *
+ * Recording a trace needs the GIL, for the traceback, so blocks are only
+ * registered by threads that hold it.  Waiting for the GIL here could deadlock
+ * a worker that holds a lock the GIL holder waits for (the LSMStore compaction
+ * thread does), which is also why these functions do not use PyMem_RawMalloc(),
+ * whose tracemalloc hook takes the GIL.  Code that builds long-lived storage
+ * in worker threads registers it from the calling thread afterwards.  File
+ * mappings are not tracked: their pages belong to the page cache.
+ *
+ * Memory from these functions must be freed with tracked_free(), and never
+ * with free() or PyMem_RawFree().  They can be called with or without the GIL.
+ */
+#ifndef MYMODULE_TRACKED_ALLOC_H
+#define MYMODULE_TRACKED_ALLOC_H
+
+#include <stddef.h>
+
+// "mymd", far from the domains of CPython (0) and NumPy (389047).
+#define MYMODULE_TRACEMALLOC_DOMAIN 0x6d796d64u
+
+void *tracked_malloc(size_t size);
+void *tracked_calloc(size_t n, size_t size);
+void *tracked_realloc(void *ptr, size_t size);
+void tracked_free(void *ptr);
+
+// Register a block obtained from another allocator (libnuma), or a block
+// allocated without the GIL; registering a block again replaces its trace.
+// No-op unless the calling thread holds the GIL.
+void tracked_register(void *ptr, size_t size);
+void tracked_unregister(void *ptr);
+
+#endif
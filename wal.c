@@ -0,0 +1,848 @@
+/*
+ * WAL: write-ahead log with group commit for Person mutations.
+ *
+ * >>> wal = mymodule.WAL("people.wal", flush_interval=0.005, flush_bytes=1 << 20)
+ * >>> lsn = wal.log_insert(mymodule.Person("Ada", "Lovelace", 1815))
+ * >>> lsn = wal.log_update(0, "number", 1816)
+ * >>> wal.wait(lsn)            # returns once the record is on disk
+ * >>> people = mymodule.wal_replay("people.wal")
+ *
+ * Logging a record only appends it to an in-memory buffer.  A flusher thread
+ * writes and fdatasync()s the whole buffer at once (a group commit) when it
+ * holds `flush_bytes` bytes, when its oldest record is `flush_interval`
+ * seconds old, or when commit() asks for it.  Each log_* call returns the
+ * log sequence number (LSN) of its record, and wait(lsn) blocks, without the
+ * GIL, until that record is durable.  Many writers thus share one fsync.
+ *
+ * File format
+ *
+ *      char     magic[4] "MYWL"
+ *      uint32   version
+ *      record*
+ *
+ * record
+ *
+ *      uint32   crc32c of everything after this field
+ *      uint32   payload length
+ *      uint64   lsn
+ *      uint8    type
+ *      payload
+ *
+ * insert payload:  int32 number | uint32 first_len | uint32 last_len | first | last
+ * update payload:  uint64 row | uint8 field | int32 number          (field 2)
+ *                  uint64 row | uint8 field | uint32 len | utf8     (fields 0, 1)
+ *
+ * Replay stops at the first record that is truncated or fails its CRC: that
+ * is the torn tail of a crash.  Reopening a WAL for writing cuts that tail
+ * and continues the LSN sequence.
+ */
+#include <Python.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "person.h"
+#include "encoding.h"
+#include "crc32c.h"
+#include "tracked_alloc.h"
+
+#define WAL_MAGIC "MYWL"
+#define WAL_VERSION 1
+#define WAL_FILE_HEADER_SIZE 8
+#define WAL_RECORD_HEADER_SIZE 17
+
+enum wal_record_type { WAL_INSERT = 1, WAL_UPDATE = 2 };
+enum wal_field { WAL_FIRST_NAME = 0, WAL_LAST_NAME = 1, WAL_NUMBER = 2 };
+
+struct wal_record {
+    uint64_t lsn;
+    uint8_t type;
+    const char *payload;
+    uint32_t size;
+};
+
+/*
+ * Decode the record at *pos.  Returns 0 at the end of the valid part of the
+ * log (end of data, truncated record or CRC mismatch).
+ */
+static int wal_next(const char *data, size_t size, size_t *pos, struct wal_record *rec)
+{
+    if(size - *pos < WAL_RECORD_HEADER_SIZE){
+        return 0;
+    }
+    const char *p = data + *pos;
+    uint32_t crc = get_u32(p);
+    uint32_t payload_size = get_u32(p + 4);
+    if(payload_size > size - *pos - WAL_RECORD_HEADER_SIZE){
+        return 0;
+    }
+    if(crc32c(0, p + 4, WAL_RECORD_HEADER_SIZE - 4 + (size_t)payload_size) != crc){
+        return 0;
+    }
+    rec->size = payload_size;
+    rec->lsn = get_u64(p + 8);
+    rec->type = (uint8_t)p[16];
+    rec->payload = p + WAL_RECORD_HEADER_SIZE;
+    *pos += WAL_RECORD_HEADER_SIZE + (size_t)payload_size;
+    return 1;
+}
+
+struct wal_map {
+    char *data;
+    size_t size;
+};
+
+static int wal_map_file(int fd, PyObject *path, struct wal_map *map)
+{
+    struct stat st;
+    if(fstat(fd, &st) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        return -1;
+    }
+    map->size = (size_t)st.st_size;
+    map->data = NULL;
+    if(map->size == 0){
+        return 0;
+    }
+    map->data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map->data == MAP_FAILED){
+        map->data = NULL;
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        return -1;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(map->data, map->size, MADV_SEQUENTIAL);
+#endif
+    if(map->size < WAL_FILE_HEADER_SIZE || memcmp(map->data, WAL_MAGIC, 4) != 0
+            || get_u32(map->data + 4) != WAL_VERSION){
+        munmap(map->data, map->size);
+        map->data = NULL;
+        PyErr_Format(PyExc_ValueError, "%S is not a WAL file", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * WRITER
+ */
+
+struct WAL {
+    PyObject_HEAD
+    PyObject *path;
+    int fd;
+    double flush_interval;
+    size_t flush_bytes;
+
+    pthread_t flusher;
+    int flusher_started;
+    // A thread that holds the GIL never blocks on `mutex`: Python threads
+    // lock it with the GIL released (WAL_lock()), and may then take the GIL
+    // back while holding it, as WAL_begin_record() does.
+    pthread_mutex_t mutex;
+    pthread_cond_t work;        // signals the flusher
+    pthread_cond_t done;        // signals writers waiting for durability
+
+    // Everything below is protected by `mutex`.
+    char *buf;
+    size_t buf_len;
+    size_t buf_cap;
+    char *spare;                // buffer being written by the flusher
+    size_t spare_cap;
+    struct timespec batch_start;
+    uint64_t next_lsn;
+    uint64_t buffered_lsn;      // last LSN in buf
+    uint64_t durable_lsn;
+    int flush_now;
+    int stop;
+    int error;                  // errno of the last failed write, sticky
+    unsigned long long group_commits;
+    unsigned long long records;
+};
+
+static PyTypeObject WALType;
+
+static void timespec_add(struct timespec *ts, double seconds)
+{
+    long long ns = ts->tv_nsec + (long long)(seconds * 1e9);
+    ts->tv_sec += (time_t)(ns / 1000000000);
+    ts->tv_nsec = (long)(ns % 1000000000);
+}
+
+static int write_all(int fd, const char *buf, size_t size)
+{
+    while(size > 0){
+        ssize_t n = write(fd, buf, size);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+static void *wal_flusher_main(void *p)
+{
+    struct WAL *self = p;
+    pthread_mutex_lock(&self->mutex);
+    for(;;){
+        while(!self->stop && !self->flush_now && self->buf_len < self->flush_bytes){
+            if(self->buf_len == 0){
+                pthread_cond_wait(&self->work, &self->mutex);
+            } else {
+                struct timespec deadline = self->batch_start;
+                timespec_add(&deadline, self->flush_interval);
+                if(pthread_cond_timedwait(&self->work, &self->mutex, &deadline) == ETIMEDOUT){
+                    break;
+                }
+            }
+        }
+        if(self->buf_len == 0){
+            self->flush_now = 0;
+            if(self->stop){
+                break;
+            }
+            continue;
+        }
+
+        // Swap buffers so writers can keep appending during the fsync.
+        char *batch = self->buf;
+        size_t batch_len = self->buf_len;
+        size_t batch_cap = self->buf_cap;
+        uint64_t batch_lsn = self->buffered_lsn;
+        self->buf = self->spare;
+        self->buf_cap = self->spare_cap;
+        self->buf_len = 0;
+        self->spare = NULL;
+        self->flush_now = 0;
+        pthread_mutex_unlock(&self->mutex);
+
+        int rc = write_all(self->fd, batch, batch_len);
+        if(rc == 0){
+            rc = fdatasync(self->fd);
+        }
+        int err = rc < 0 ? errno : 0;
+
+        pthread_mutex_lock(&self->mutex);
+        self->spare = batch;
+        self->spare_cap = batch_cap;
+        if(err != 0){
+            self->error = err;
+        } else {
+            self->durable_lsn = batch_lsn;
+            self->group_commits++;
+        }
+        pthread_cond_broadcast(&self->done);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+}
+
+static int WAL_check_open(struct WAL *self)
+{
+    if(self->fd < 0){
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed WAL");
+        return -1;
+    }
+    return 0;
+}
+
+static void WAL_lock(struct WAL *self)
+{
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    Py_END_ALLOW_THREADS
+}
+
+// Called with the mutex held.
+static int WAL_check_error(struct WAL *self)
+{
+    if(self->error != 0){
+        errno = self->error;
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, self->path);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *WAL_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    struct WAL *self = (struct WAL *) type->tp_alloc(type, 0);
+    if(self == NULL){
+        return NULL;
+    }
+    self->fd = -1;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->work, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&self->done, NULL);
+    return (PyObject *)self;
+}
+
+static int WAL_init(struct WAL *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *path = NULL;
+    double flush_interval = 0.005;
+    Py_ssize_t flush_bytes = 1 << 20;
+    static char *kwlist[] = {"path", "flush_interval", "flush_bytes", NULL};
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&|dn", kwlist,
+                PyUnicode_FSConverter, &path, &flush_interval, &flush_bytes)){
+        return -1;
+    }
+    if(self->fd >= 0){
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_RuntimeError, "WAL is already open");
+        return -1;
+    }
+    if(flush_interval < 0 || flush_bytes <= 0){
+        Py_DECREF(path);
+        PyErr_SetString(PyExc_ValueError, "flush_interval must not be negative and flush_bytes must be positive");
+        return -1;
+    }
+
+    int fd = open(PyBytes_AS_STRING(path), O_RDWR | O_CREAT | O_APPEND, 0666);
+    if(fd < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return -1;
+    }
+
+    // Find the end of the valid records and the last LSN.
+    struct stat st;
+    if(fstat(fd, &st) < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        goto fail;
+    }
+    uint64_t last_lsn = 0;
+    if(st.st_size == 0){
+        char header[WAL_FILE_HEADER_SIZE];
+        memcpy(header, WAL_MAGIC, 4);
+        put_u32(header + 4, WAL_VERSION);
+        if(write_all(fd, header, sizeof(header)) < 0 || fdatasync(fd) < 0){
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+            goto fail;
+        }
+    } else {
+        struct wal_map map;
+        if(wal_map_file(fd, path, &map) < 0){
+            goto fail;
+        }
+        size_t pos = WAL_FILE_HEADER_SIZE;
+        struct wal_record rec;
+        while(wal_next(map.data, map.size, &pos, &rec)){
+            last_lsn = rec.lsn;
+        }
+        munmap(map.data, map.size);
+        if(pos < map.size && ftruncate(fd, (off_t)pos) < 0){
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+            goto fail;
+        }
+    }
+
+    self->buf_cap = (size_t)flush_bytes + 4096;
+    self->spare_cap = self->buf_cap;
+    self->buf = tracked_malloc(self->buf_cap);
+    self->spare = tracked_malloc(self->spare_cap);
+    if(self->buf == NULL || self->spare == NULL){
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    self->path = path;
+    self->fd = fd;
+    self->flush_interval = flush_interval;
+    self->flush_bytes = (size_t)flush_bytes;
+    self->next_lsn = last_lsn + 1;
+    self->buffered_lsn = last_lsn;
+    self->durable_lsn = last_lsn;
+
+    if(pthread_create(&self->flusher, NULL, wal_flusher_main, self) != 0){
+        PyErr_SetString(PyExc_RuntimeError, "cannot start the WAL flusher thread");
+        self->fd = -1;
+        self->path = NULL;
+        goto fail;
+    }
+    self->flusher_started = 1;
+    return 0;
+
+fail:
+    close(fd);
+    Py_DECREF(path);
+    return -1;
+}
+
+static void WAL_stop(struct WAL *self)
+{
+    if(self->flusher_started){
+        Py_BEGIN_ALLOW_THREADS
+        pthread_mutex_lock(&self->mutex);
+        self->stop = 1;
+        pthread_cond_signal(&self->work);
+        pthread_mutex_unlock(&self->mutex);
+        pthread_join(self->flusher, NULL);
+        Py_END_ALLOW_THREADS
+        self->flusher_started = 0;
+    }
+    if(self->fd >= 0){
+        close(self->fd);
+        self->fd = -1;
+    }
+}
+
+static void WAL_dealloc(struct WAL *self)
+{
+    WAL_stop(self);
+    tracked_free(self->buf);
+    tracked_free(self->spare);
+    pthread_mutex_destroy(&self->mutex);
+    pthread_cond_destroy(&self->work);
+    pthread_cond_destroy(&self->done);
+    Py_XDECREF(self->path);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/*
+ * Reserve room for a record of `payload_size` bytes and return a pointer to
+ * its payload.  On success the mutex is held and WAL_finish_record() must be
+ * called.  Applies backpressure when the flusher falls behind.
+ */
+static char *WAL_begin_record(struct WAL *self, uint8_t type, size_t payload_size)
+{
+    if(WAL_check_open(self) < 0){
+        return NULL;
+    }
+    size_t record_size = WAL_RECORD_HEADER_SIZE + payload_size;
+    if(payload_size > UINT32_MAX){
+        PyErr_SetString(PyExc_OverflowError, "WAL record is too large");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    while(self->error == 0 && !self->stop && self->buf_len >= 4 * self->flush_bytes){
+        pthread_cond_signal(&self->work);
+        pthread_cond_wait(&self->done, &self->mutex);
+    }
+    Py_END_ALLOW_THREADS
+
+    // close() may have stopped the flusher since the check above; nothing
+    // would ever write the record.
+    if(self->stop || self->fd < 0){
+        pthread_mutex_unlock(&self->mutex);
+        PyErr_SetString(PyExc_ValueError, "I/O operation on closed WAL");
+        return NULL;
+    }
+    if(WAL_check_error(self) < 0){
+        pthread_mutex_unlock(&self->mutex);
+        return NULL;
+    }
+    if(self->buf_len + record_size > self->buf_cap){
+        size_t cap = self->buf_cap * 2;
+        while(cap < self->buf_len + record_size){
+            cap *= 2;
+        }
+        char *buf = tracked_realloc(self->buf, cap);
+        if(buf == NULL){
+            pthread_mutex_unlock(&self->mutex);
+            PyErr_NoMemory();
+            return NULL;
+        }
+        self->buf = buf;
+        self->buf_cap = cap;
+    }
+    if(self->buf_len == 0){
+        clock_gettime(CLOCK_MONOTONIC, &self->batch_start);
+    }
+
+    char *record = self->buf + self->buf_len;
+    put_u32(record + 4, (uint32_t)payload_size);
+    put_u64(record + 8, self->next_lsn);
+    record[16] = (char)type;
+    return record + WAL_RECORD_HEADER_SIZE;
+}
+
+static uint64_t WAL_finish_record(struct WAL *self, char *payload)
+{
+    char *record = payload - WAL_RECORD_HEADER_SIZE;
+    uint32_t payload_size = get_u32(record + 4);
+    put_u32(record, crc32c(0, record + 4, WAL_RECORD_HEADER_SIZE - 4 + (size_t)payload_size));
+
+    uint64_t lsn = self->next_lsn++;
+    self->buf_len += WAL_RECORD_HEADER_SIZE + (size_t)payload_size;
+    self->buffered_lsn = lsn;
+    self->records++;
+    if(self->buf_len >= self->flush_bytes){
+        pthread_cond_signal(&self->work);
+    } else if(self->buf_len == WAL_RECORD_HEADER_SIZE + (size_t)payload_size){
+        // First record of a batch: start the flush_interval timer.
+        pthread_cond_signal(&self->work);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return lsn;
+}
+
+static PyObject *WAL_log_insert(struct WAL *self, PyObject *person)
+{
+    const char *first, *last;
+    Py_ssize_t first_len, last_len;
+    int number;
+    if(Person_AsUTF8(person, &first, &first_len, &last, &last_len, &number) < 0){
+        return NULL;
+    }
+
+    char *payload = WAL_begin_record(self, WAL_INSERT, 12 + (size_t)first_len + (size_t)last_len);
+    if(payload == NULL){
+        return NULL;
+    }
+    put_u32(payload, (uint32_t)number);
+    put_u32(payload + 4, (uint32_t)first_len);
+    put_u32(payload + 8, (uint32_t)last_len);
+    memcpy(payload + 12, first, (size_t)first_len);
+    memcpy(payload + 12 + first_len, last, (size_t)last_len);
+    return PyLong_FromUnsignedLongLong(WAL_finish_record(self, payload));
+}
+
+static int field_from_name(const char *name)
+{
+    if(strcmp(name, "first_name") == 0){
+        return WAL_FIRST_NAME;
+    }
+    if(strcmp(name, "last_name") == 0){
+        return WAL_LAST_NAME;
+    }
+    if(strcmp(name, "number") == 0){
+        return WAL_NUMBER;
+    }
+    PyErr_Format(PyExc_ValueError, "unknown Person field '%s'", name);
+    return -1;
+}
+
+static PyObject *WAL_log_update(struct WAL *self, PyObject *args)
+{
+    unsigned long long row;
+    const char *field_name;
+    PyObject *value;
+    if(!PyArg_ParseTuple(args, "KsO:log_update", &row, &field_name, &value)){
+        return NULL;
+    }
+    int field = field_from_name(field_name);
+    if(field < 0){
+        return NULL;
+    }
+
+    char *payload;
+    if(field == WAL_NUMBER){
+        long number = PyLong_AsLong(value);
+        if(number == -1 && PyErr_Occurred()){
+            return NULL;
+        }
+        if(number < INT_MIN || number > INT_MAX){
+            PyErr_SetString(PyExc_OverflowError, "number does not fit in a C int");
+            return NULL;
+        }
+        payload = WAL_begin_record(self, WAL_UPDATE, 13);
+        if(payload == NULL){
+            return NULL;
+        }
+        put_u64(payload, row);
+        payload[8] = (char)field;
+        put_u32(payload + 9, (uint32_t)number);
+    } else {
+        Py_ssize_t len;
+        const char *utf8 = PyUnicode_Check(value) ? PyUnicode_AsUTF8AndSize(value, &len) : NULL;
+        if(utf8 == NULL){
+            if(!PyErr_Occurred()){
+                PyErr_SetString(PyExc_TypeError, "names must be str");
+            }
+            return NULL;
+        }
+        payload = WAL_begin_record(self, WAL_UPDATE, 13 + (size_t)len);
+        if(payload == NULL){
+            return NULL;
+        }
+        put_u64(payload, row);
+        payload[8] = (char)field;
+        put_u32(payload + 9, (uint32_t)len);
+        memcpy(payload + 13, utf8, (size_t)len);
+    }
+    return PyLong_FromUnsignedLongLong(WAL_finish_record(self, payload));
+}
+
+static PyObject *WAL_wait_for(struct WAL *self, uint64_t lsn, int force)
+{
+    if(WAL_check_open(self) < 0){
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&self->mutex);
+    if(lsn > self->buffered_lsn){
+        lsn = self->buffered_lsn;
+    }
+    if(force && self->durable_lsn < lsn){
+        self->flush_now = 1;
+        pthread_cond_signal(&self->work);
+    }
+    while(self->error == 0 && self->durable_lsn < lsn){
+        pthread_cond_wait(&self->done, &self->mutex);
+    }
+    Py_END_ALLOW_THREADS
+    int rc = WAL_check_error(self);
+    pthread_mutex_unlock(&self->mutex);
+    if(rc < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *WAL_wait(struct WAL *self, PyObject *args)
+{
+    unsigned long long lsn = UINT64_MAX;
+    if(!PyArg_ParseTuple(args, "|K:wait", &lsn)){
+        return NULL;
+    }
+    return WAL_wait_for(self, lsn, 0);
+}
+
+static PyObject *WAL_commit(struct WAL *self, PyObject *Py_UNUSED(ignored))
+{
+    return WAL_wait_for(self, UINT64_MAX, 1);
+}
+
+static PyObject *WAL_close(struct WAL *self, PyObject *Py_UNUSED(ignored))
+{
+    if(self->fd < 0){
+        Py_RETURN_NONE;
+    }
+    // Stopping the flusher writes what is left in the buffer.
+    WAL_stop(self);
+    WAL_lock(self);
+    int rc = WAL_check_error(self);
+    pthread_mutex_unlock(&self->mutex);
+    if(rc < 0){
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *WAL_enter(struct WAL *self, PyObject *Py_UNUSED(ignored))
+{
+    if(WAL_check_open(self) < 0){
+        return NULL;
+    }
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *WAL_exit(struct WAL *self, PyObject *Py_UNUSED(args))
+{
+    return WAL_close(self, NULL);
+}
+
+static PyObject *WAL_stats(struct WAL *self, PyObject *Py_UNUSED(ignored))
+{
+    WAL_lock(self);
+    unsigned long long durable = self->durable_lsn, next = self->next_lsn;
+    unsigned long long commits = self->group_commits, records = self->records;
+    pthread_mutex_unlock(&self->mutex);
+    return Py_BuildValue("{s:K,s:K,s:K,s:K}",
+            "durable_lsn", durable,
+            "next_lsn", next,
+            "group_commits", commits,
+            "records", records);
+}
+
+/*
+ * REPLAY
+ */
+
+static int replay_update(PyObject *persons, const struct wal_record *rec)
+{
+    if(rec->size < 13){
+        return -2;
+    }
+    uint64_t row = get_u64(rec->payload);
+    int field = (uint8_t)rec->payload[8];
+    if(row >= (uint64_t)PyList_GET_SIZE(persons)){
+        return -2;
+    }
+    struct Person *p = (struct Person *)PyList_GET_ITEM(persons, (Py_ssize_t)row);
+    if(field == WAL_NUMBER){
+        if(rec->size != 13){
+            return -2;
+        }
+        p->number = (int)get_u32(rec->payload + 9);
+        return 0;
+    }
+    uint32_t len = get_u32(rec->payload + 9);
+    if(field > WAL_LAST_NAME || len != rec->size - 13){
+        return -2;
+    }
+    PyObject *value = PyUnicode_DecodeUTF8(rec->payload + 13, len, NULL);
+    if(value == NULL){
+        return -1;
+    }
+    PyObject **target = field == WAL_FIRST_NAME ? &p->first_name : &p->last_name;
+    PyObject *tmp = *target;
+    *target = value;
+    Py_XDECREF(tmp);
+    return 0;
+}
+
+static PyObject *wal_replay(PyObject *module, PyObject *args)
+{
+    PyObject *path;
+    if(!PyArg_ParseTuple(args, "O&:wal_replay", PyUnicode_FSConverter, &path)){
+        return NULL;
+    }
+    int fd = open(PyBytes_AS_STRING(path), O_RDONLY);
+    if(fd < 0){
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+        Py_DECREF(path);
+        return NULL;
+    }
+    struct wal_map map;
+    int rc = wal_map_file(fd, path, &map);
+    close(fd);
+    if(rc < 0){
+        Py_DECREF(path);
+        return NULL;
+    }
+
+    PyObject *persons = PyList_New(0);
+    size_t pos = WAL_FILE_HEADER_SIZE;
+    struct wal_record rec;
+    while(persons != NULL && map.data != NULL && wal_next(map.data, map.size, &pos, &rec)){
+        int status;
+        if(rec.type == WAL_INSERT && rec.size >= 12){
+            uint32_t first_len = get_u32(rec.payload + 4);
+            uint32_t last_len = get_u32(rec.payload + 8);
+            if((uint64_t)first_len + last_len != rec.size - 12){
+                status = -2;
+            } else {
+                PyObject *person = Person_FromUTF8(rec.payload + 12, first_len,
+                                                   rec.payload + 12 + first_len, last_len,
+                                                   (int)get_u32(rec.payload));
+                status = person == NULL || PyList_Append(persons, person) < 0 ? -1 : 0;
+                Py_XDECREF(person);
+            }
+        } else if(rec.type == WAL_UPDATE){
+            status = replay_update(persons, &rec);
+        } else {
+            status = -2;
+        }
+        if(status == -2){
+            PyErr_Format(PyExc_ValueError, "%S: invalid record with LSN %llu",
+                    path, (unsigned long long)rec.lsn);
+        }
+        if(status < 0){
+            Py_CLEAR(persons);
+        }
+    }
+
+    if(map.data != NULL){
+        munmap(map.data, map.size);
+    }
+    Py_DECREF(path);
+    return persons;
+}
+
+static PyMethodDef WAL_methods[] = {
+    {
+        .ml_name = "log_insert",
+        .ml_meth = (PyCFunction)WAL_log_insert,
+        .ml_flags = METH_O,
+        .ml_doc = "log_insert(person): log the insertion of a Person, return its LSN",
+    },
+    {
+        .ml_name = "log_update",
+        .ml_meth = (PyCFunction)WAL_log_update,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "log_update(row, field, value): log a field update of the Person at index row, return its LSN",
+    },
+    {
+        .ml_name = "wait",
+        .ml_meth = (PyCFunction)WAL_wait,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "wait(lsn=<last>): block until the record with this LSN is durable",
+    },
+    {
+        .ml_name = "commit",
+        .ml_meth = (PyCFunction)WAL_commit,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Flush the buffered records now and wait until they are durable",
+    },
+    {
+        .ml_name = "close",
+        .ml_meth = (PyCFunction)WAL_close,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Flush the buffered records and close the log",
+    },
+    {
+        .ml_name = "stats",
+        .ml_meth = (PyCFunction)WAL_stats,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "Return a dict of LSNs and group commit counters",
+    },
+    {
+        .ml_name = "__enter__",
+        .ml_meth = (PyCFunction)WAL_enter,
+        .ml_flags = METH_NOARGS,
+    },
+    {
+        .ml_name = "__exit__",
+        .ml_meth = (PyCFunction)WAL_exit,
+        .ml_flags = METH_VARARGS,
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+static PyTypeObject WALType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mymodule.WAL",
+    .tp_doc = "WAL(path, flush_interval=0.005, flush_bytes=1048576)\n\n"
+              "Write-ahead log of Person inserts and updates with group commit",
+    .tp_basicsize = sizeof(struct WAL),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = WAL_new,
+    .tp_init = (initproc) WAL_init,
+    .tp_dealloc = (destructor) WAL_dealloc,
+    .tp_methods = WAL_methods,
+};
+
+static PyMethodDef wal_functions[] = {
+    {
+        .ml_name = "wal_replay",
+        .ml_meth = (PyCFunction)wal_replay,
+        .ml_flags = METH_VARARGS,
+        .ml_doc = "wal_replay(path): rebuild the list of Persons described by a WAL",
+    },
+    {NULL, NULL, 0, NULL}        /* Sentinel */
+};
+
+int wal_module_init(PyObject *m)
+{
+    if(PyType_Ready(&WALType) < 0){
+        return -1;
+    }
+
+    Py_INCREF(&WALType);
+    if(PyModule_AddObject(m, "WAL", (PyObject *)&WALType) < 0){
+        Py_DECREF(&WALType);
+        return -1;
+    }
+    return PyModule_AddFunctions(m, wal_functions);
+}